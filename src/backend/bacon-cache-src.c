@@ -0,0 +1,925 @@
+/*
+ * HTTP source element backed by the stream cache
+ *
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+/**
+ * SECTION:bacon-cache-src
+ * @short_description: HTTP source serving from the stream cache
+ *
+ * #BaconCacheSrc replaces the HTTP source for playback. It drives a
+ * regular HTTP source element internally, stores everything it
+ * downloads in the #TotemStreamCache, and serves the byte ranges it
+ * already has from the cache, only going to the network for the gaps.
+ *
+ * The stream's ETag, or modification date, is checked on every open, so
+ * changed resources aren't served stale. Streams without either, or
+ * without a known length, such as live streams and internet radio, aren't
+ * cached, and upstream's buffers are passed on as they are. Upstream's
+ * caps, such as the application/x-icy ones of internet radio, are always
+ * passed on. Once a stream is completely cached, the download is stopped.
+ **/
+
+#include "config.h"
+
+#include <string.h>
+
+#include "totem-stream-cache.h"
+#include "bacon-cache-src.h"
+
+GST_DEBUG_CATEGORY_EXTERN (_totem_gst_debug_cat);
+#define GST_CAT_DEFAULT _totem_gst_debug_cat
+
+#define UPSTREAM_ELEMENT "souphttpsrc"
+#define MAX_QUEUED_BYTES (2 * 1024 * 1024)
+#define MAX_SKIP (1024 * 1024)             /* Read through gaps smaller than this, rather than seek */
+
+struct _BaconCacheSrc {
+  GstBaseSrc parent;
+
+  char *uri;
+  GstElement *upstream;
+  GstPad *sinkpad;             /* receives upstream's data, not part of the element */
+
+  /* Shared with upstream's streaming thread, protected by lock */
+  GMutex lock;
+  GCond cond;
+  GQueue queue;                /* of GstBuffers, with their offsets set */
+  gsize queued_bytes;
+  guint64 upstream_offset;     /* of the next buffer upstream will push */
+  gboolean upstream_running;
+  gboolean upstream_flushing;
+  gboolean upstream_eos;
+  GstMessage *upstream_error;
+  gboolean got_headers;
+  char *validator;
+  GstCaps *upstream_caps;
+  gboolean caps_changed;
+  gboolean flushing;
+
+  /* Only used by the streaming thread */
+  gboolean opened;
+  TotemStreamCacheEntry *entry;
+  guint64 length;
+  GstBuffer *current;          /* the latest upstream buffer, in case it couldn't be cached */
+};
+
+enum {
+  PROP_0,
+  PROP_LOCATION
+};
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static void bacon_cache_src_uri_handler_init (gpointer g_iface, gpointer iface_data);
+
+G_DEFINE_TYPE_WITH_CODE (BaconCacheSrc, bacon_cache_src, GST_TYPE_BASE_SRC,
+                         G_IMPLEMENT_INTERFACE (GST_TYPE_URI_HANDLER, bacon_cache_src_uri_handler_init))
+
+static void
+bacon_cache_src_clear_queue (BaconCacheSrc *src)
+{
+  g_queue_clear_full (&src->queue, (GDestroyNotify) gst_buffer_unref);
+  src->queued_bytes = 0;
+}
+
+static const char *
+get_header (const GstStructure *headers,
+            const char         *name)
+{
+  guint i, n_fields;
+
+  /* Header names are case-insensitive */
+  n_fields = gst_structure_n_fields (headers);
+  for (i = 0; i < n_fields; i++) {
+    const char *field = gst_structure_nth_field_name (headers, i);
+    const GValue *value;
+
+    if (g_ascii_strcasecmp (field, name) != 0)
+      continue;
+    value = gst_structure_get_value (headers, field);
+    if (G_VALUE_HOLDS_STRING (value))
+      return g_value_get_string (value);
+  }
+
+  return NULL;
+}
+
+static void
+bacon_cache_src_handle_headers (BaconCacheSrc      *src,
+                                const GstStructure *structure)
+{
+  const GstStructure *headers = NULL;
+  const GValue *value;
+  const char *validator;
+
+  value = gst_structure_get_value (structure, "response-headers");
+  if (value != NULL && GST_VALUE_HOLDS_STRUCTURE (value))
+    headers = gst_value_get_structure (value);
+
+  validator = headers ? get_header (headers, "ETag") : NULL;
+  if (validator == NULL && headers != NULL)
+    validator = get_header (headers, "Last-Modified");
+
+  g_mutex_lock (&src->lock);
+  if (!src->got_headers) {
+    src->validator = g_strdup (validator);
+    src->got_headers = TRUE;
+    g_cond_broadcast (&src->cond);
+  }
+  g_mutex_unlock (&src->lock);
+}
+
+static GstFlowReturn
+bacon_cache_src_upstream_chain (GstPad    *pad,
+                                GstObject *parent,
+                                GstBuffer *buffer)
+{
+  BaconCacheSrc *src = gst_pad_get_element_private (pad);
+  gsize size;
+
+  size = gst_buffer_get_size (buffer);
+
+  g_mutex_lock (&src->lock);
+  while (src->queued_bytes >= MAX_QUEUED_BYTES && !src->upstream_flushing)
+    g_cond_wait (&src->cond, &src->lock);
+
+  if (src->upstream_flushing) {
+    g_mutex_unlock (&src->lock);
+    gst_buffer_unref (buffer);
+    return GST_FLOW_FLUSHING;
+  }
+
+  buffer = gst_buffer_make_writable (buffer);
+  GST_BUFFER_OFFSET (buffer) = src->upstream_offset;
+  src->upstream_offset += size;
+  g_queue_push_tail (&src->queue, buffer);
+  src->queued_bytes += size;
+  g_cond_broadcast (&src->cond);
+  g_mutex_unlock (&src->lock);
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+bacon_cache_src_upstream_event (GstPad    *pad,
+                                GstObject *parent,
+                                GstEvent  *event)
+{
+  BaconCacheSrc *src = gst_pad_get_element_private (pad);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      g_mutex_lock (&src->lock);
+      src->upstream_flushing = TRUE;
+      g_cond_broadcast (&src->cond);
+      g_mutex_unlock (&src->lock);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      g_mutex_lock (&src->lock);
+      src->upstream_flushing = FALSE;
+      src->upstream_eos = FALSE;
+      bacon_cache_src_clear_queue (src);
+      g_mutex_unlock (&src->lock);
+      break;
+    case GST_EVENT_SEGMENT: {
+      const GstSegment *segment;
+
+      gst_event_parse_segment (event, &segment);
+      if (segment->format == GST_FORMAT_BYTES) {
+        g_mutex_lock (&src->lock);
+        src->upstream_offset = segment->start;
+        g_mutex_unlock (&src->lock);
+      }
+      break;
+    }
+    case GST_EVENT_EOS:
+      g_mutex_lock (&src->lock);
+      src->upstream_eos = TRUE;
+      g_cond_broadcast (&src->cond);
+      g_mutex_unlock (&src->lock);
+      break;
+    case GST_EVENT_CAPS: {
+      GstCaps *caps;
+
+      gst_event_parse_caps (event, &caps);
+      g_mutex_lock (&src->lock);
+      gst_caps_replace (&src->upstream_caps, caps);
+      src->caps_changed = TRUE;
+      g_mutex_unlock (&src->lock);
+      break;
+    }
+    case GST_EVENT_CUSTOM_DOWNSTREAM_STICKY:
+      if (gst_event_has_name (event, "http-headers"))
+        bacon_cache_src_handle_headers (src, gst_event_get_structure (event));
+      break;
+    default:
+      break;
+  }
+
+  gst_event_unref (event);
+  return TRUE;
+}
+
+static GstBusSyncReply
+bacon_cache_src_upstream_message (GstBus     *bus,
+                                  GstMessage *message,
+                                  gpointer    user_data)
+{
+  BaconCacheSrc *src = user_data;
+
+  switch (GST_MESSAGE_TYPE (message)) {
+    case GST_MESSAGE_ERROR:
+      /* Only reported if the data is actually needed, the cache
+       * might have it. The message is kept as is, as the HTTP status
+       * and the credential properties of the source are needed to
+       * handle authentication. */
+      g_mutex_lock (&src->lock);
+      if (src->upstream_error == NULL)
+        src->upstream_error = gst_message_ref (message);
+      g_cond_broadcast (&src->cond);
+      g_mutex_unlock (&src->lock);
+      break;
+    case GST_MESSAGE_WARNING: {
+      g_autoptr(GError) error = NULL;
+      g_autofree char *debug = NULL;
+
+      gst_message_parse_warning (message, &error, &debug);
+      gst_element_post_message (GST_ELEMENT (src),
+                                gst_message_new_warning (GST_OBJECT (src), error, debug));
+      break;
+    }
+    default:
+      break;
+  }
+
+  gst_message_unref (message);
+  return GST_BUS_DROP;
+}
+
+static gboolean
+bacon_cache_src_start_upstream (BaconCacheSrc *src)
+{
+  g_mutex_lock (&src->lock);
+  src->upstream_flushing = FALSE;
+  src->upstream_eos = FALSE;
+  src->upstream_offset = 0;
+  gst_clear_message (&src->upstream_error);
+  bacon_cache_src_clear_queue (src);
+  g_mutex_unlock (&src->lock);
+
+  gst_pad_set_active (src->sinkpad, TRUE);
+  if (gst_element_set_state (src->upstream, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+    GST_WARNING_OBJECT (src, "Could not start " UPSTREAM_ELEMENT);
+    return FALSE;
+  }
+
+  g_mutex_lock (&src->lock);
+  src->upstream_running = TRUE;
+  g_mutex_unlock (&src->lock);
+
+  return TRUE;
+}
+
+static void
+bacon_cache_src_stop_upstream (BaconCacheSrc *src)
+{
+  /* Unblock upstream's streaming thread first */
+  g_mutex_lock (&src->lock);
+  src->upstream_flushing = TRUE;
+  g_cond_broadcast (&src->cond);
+  g_mutex_unlock (&src->lock);
+
+  gst_element_set_state (src->upstream, GST_STATE_NULL);
+  gst_pad_set_active (src->sinkpad, FALSE);
+
+  g_mutex_lock (&src->lock);
+  src->upstream_running = FALSE;
+  bacon_cache_src_clear_queue (src);
+  g_mutex_unlock (&src->lock);
+}
+
+/* Waits for the first response, to know which version of the stream
+ * is getting served */
+static GstFlowReturn
+bacon_cache_src_open_entry (BaconCacheSrc *src)
+{
+  g_autofree char *validator = NULL;
+  GstPad *pad;
+  gint64 duration;
+
+  g_mutex_lock (&src->lock);
+  while (!src->got_headers && g_queue_is_empty (&src->queue) &&
+         !src->upstream_eos && src->upstream_error == NULL && !src->flushing)
+    g_cond_wait (&src->cond, &src->lock);
+  if (src->flushing) {
+    g_mutex_unlock (&src->lock);
+    return GST_FLOW_FLUSHING;
+  }
+  validator = g_strdup (src->validator);
+  g_mutex_unlock (&src->lock);
+
+  src->opened = TRUE;
+
+  pad = gst_element_get_static_pad (src->upstream, "src");
+  if (gst_pad_query_duration (pad, GST_FORMAT_BYTES, &duration) && duration > 0)
+    src->length = duration;
+  gst_object_unref (pad);
+
+  if (validator == NULL || src->length == 0) {
+    GST_DEBUG_OBJECT (src, "No ETag, modification date or length for '%s', not caching", src->uri);
+    return GST_FLOW_OK;
+  }
+
+  src->entry = totem_stream_cache_open (totem_stream_cache_get_default (),
+                                        src->uri, validator, src->length);
+  if (src->entry == NULL)
+    return GST_FLOW_OK;
+
+  if (totem_stream_cache_entry_is_complete (src->entry)) {
+    GST_DEBUG_OBJECT (src, "'%s' is fully cached, stopping the download", src->uri);
+    bacon_cache_src_stop_upstream (src);
+  }
+
+  return GST_FLOW_OK;
+}
+
+/* Gets the next upstream buffer, which covers @offset, or comes before it.
+ * Upstream gets moved if the data at @offset isn't coming soon. */
+static GstFlowReturn
+bacon_cache_src_pull_upstream (BaconCacheSrc *src,
+                               guint64        offset)
+{
+  GstBuffer *buffer;
+  GstMapInfo info;
+  guint64 next;
+  gboolean running;
+
+  g_mutex_lock (&src->lock);
+  running = src->upstream_running;
+  g_mutex_unlock (&src->lock);
+
+  if (!running && !bacon_cache_src_start_upstream (src)) {
+    GST_ELEMENT_ERROR (src, RESOURCE, OPEN_READ, (NULL),
+                       ("Could not start " UPSTREAM_ELEMENT));
+    return GST_FLOW_ERROR;
+  }
+
+  g_mutex_lock (&src->lock);
+  if (g_queue_is_empty (&src->queue))
+    next = src->upstream_offset;
+  else
+    next = GST_BUFFER_OFFSET (g_queue_peek_head (&src->queue));
+
+  if (offset < next || offset > next + MAX_SKIP) {
+    g_mutex_unlock (&src->lock);
+
+    GST_DEBUG_OBJECT (src, "Moving download from %" G_GUINT64_FORMAT " to %" G_GUINT64_FORMAT,
+                      next, offset);
+    if (!gst_element_seek_simple (src->upstream, GST_FORMAT_BYTES,
+                                  GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE, offset)) {
+      GST_ELEMENT_ERROR (src, RESOURCE, SEEK, (NULL),
+                         ("Could not seek to %" G_GUINT64_FORMAT, offset));
+      return GST_FLOW_ERROR;
+    }
+
+    g_mutex_lock (&src->lock);
+    bacon_cache_src_clear_queue (src);
+    src->upstream_offset = offset;
+  }
+
+  while (g_queue_is_empty (&src->queue) && !src->upstream_eos &&
+         src->upstream_error == NULL && !src->flushing)
+    g_cond_wait (&src->cond, &src->lock);
+
+  if (src->flushing) {
+    g_mutex_unlock (&src->lock);
+    return GST_FLOW_FLUSHING;
+  }
+
+  if (g_queue_is_empty (&src->queue)) {
+    if (src->upstream_error != NULL) {
+      gst_element_post_message (GST_ELEMENT (src), gst_message_ref (src->upstream_error));
+      g_mutex_unlock (&src->lock);
+      return GST_FLOW_ERROR;
+    }
+    g_mutex_unlock (&src->lock);
+    return GST_FLOW_EOS;
+  }
+
+  buffer = g_queue_pop_head (&src->queue);
+  src->queued_bytes -= gst_buffer_get_size (buffer);
+  g_cond_broadcast (&src->cond);
+  g_mutex_unlock (&src->lock);
+
+  if (src->entry != NULL && gst_buffer_map (buffer, &info, GST_MAP_READ)) {
+    totem_stream_cache_entry_write (src->entry, GST_BUFFER_OFFSET (buffer),
+                                    info.data, info.size);
+    gst_buffer_unmap (buffer, &info);
+  }
+
+  gst_clear_buffer (&src->current);
+  src->current = buffer;
+
+  return GST_FLOW_OK;
+}
+
+static GstBuffer *
+bacon_cache_src_read_cache (BaconCacheSrc *src,
+                            guint64        offset,
+                            guint          size)
+{
+  GstBuffer *buffer;
+  GstMapInfo info;
+  guint64 available;
+  gssize ret;
+
+  if (src->entry == NULL)
+    return NULL;
+
+  available = totem_stream_cache_entry_get_available (src->entry, offset);
+  if (available == 0)
+    return NULL;
+
+  size = MIN (size, available);
+  buffer = gst_buffer_new_allocate (NULL, size, NULL);
+  gst_buffer_map (buffer, &info, GST_MAP_WRITE);
+  ret = totem_stream_cache_entry_read (src->entry, offset, info.data, size);
+  gst_buffer_unmap (buffer, &info);
+
+  if (ret != (gssize) size) {
+    gst_buffer_unref (buffer);
+    return NULL;
+  }
+
+  return buffer;
+}
+
+/* Sets upstream's latest caps on our pad, from the streaming thread */
+static void
+bacon_cache_src_update_caps (BaconCacheSrc *src)
+{
+  g_autoptr(GstCaps) caps = NULL;
+
+  g_mutex_lock (&src->lock);
+  if (src->caps_changed && src->upstream_caps != NULL)
+    caps = gst_caps_ref (src->upstream_caps);
+  src->caps_changed = FALSE;
+  g_mutex_unlock (&src->lock);
+
+  if (caps != NULL && !gst_base_src_set_caps (GST_BASE_SRC (src), caps))
+    GST_WARNING_OBJECT (src, "Could not set caps %" GST_PTR_FORMAT, caps);
+}
+
+/* For streams that aren't cached, upstream's buffers are passed on
+ * without copies when possible */
+static GstFlowReturn
+bacon_cache_src_create_passthrough (BaconCacheSrc  *src,
+                                    guint64         offset,
+                                    guint           size,
+                                    GstBuffer     **buf)
+{
+  GstFlowReturn ret;
+
+  for (;;) {
+    if (src->current != NULL) {
+      guint64 start = GST_BUFFER_OFFSET (src->current);
+      gsize current_size = gst_buffer_get_size (src->current);
+
+      if (offset == start && current_size <= size) {
+        *buf = g_steal_pointer (&src->current);
+        return GST_FLOW_OK;
+      }
+      if (offset >= start && offset < start + current_size) {
+        *buf = gst_buffer_copy_region (src->current, GST_BUFFER_COPY_ALL,
+                                       offset - start,
+                                       MIN (size, start + current_size - offset));
+        GST_BUFFER_OFFSET (*buf) = offset;
+        GST_BUFFER_OFFSET_END (*buf) = offset + gst_buffer_get_size (*buf);
+        return GST_FLOW_OK;
+      }
+    }
+
+    ret = bacon_cache_src_pull_upstream (src, offset);
+    bacon_cache_src_update_caps (src);
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+}
+
+static GstFlowReturn
+bacon_cache_src_create (GstBaseSrc  *basesrc,
+                        guint64      offset,
+                        guint        size,
+                        GstBuffer  **buf)
+{
+  BaconCacheSrc *src = BACON_CACHE_SRC (basesrc);
+  GstFlowReturn ret;
+
+  if (!src->opened) {
+    ret = bacon_cache_src_open_entry (src);
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+  bacon_cache_src_update_caps (src);
+
+  if (src->length > 0 && offset >= src->length)
+    return GST_FLOW_EOS;
+
+  if (src->entry == NULL)
+    return bacon_cache_src_create_passthrough (src, offset, size, buf);
+
+  for (;;) {
+    GstBuffer *buffer;
+
+    buffer = bacon_cache_src_read_cache (src, offset, size);
+
+    /* Not cached, but just downloaded */
+    if (buffer == NULL && src->current != NULL) {
+      guint64 start = GST_BUFFER_OFFSET (src->current);
+      gsize current_size = gst_buffer_get_size (src->current);
+
+      if (offset >= start && offset < start + current_size) {
+        buffer = gst_buffer_copy_region (src->current, GST_BUFFER_COPY_ALL,
+                                         offset - start,
+                                         MIN (size, start + current_size - offset));
+      }
+    }
+
+    if (buffer != NULL) {
+      GST_BUFFER_OFFSET (buffer) = offset;
+      GST_BUFFER_OFFSET_END (buffer) = offset + gst_buffer_get_size (buffer);
+      *buf = buffer;
+      return GST_FLOW_OK;
+    }
+
+    ret = bacon_cache_src_pull_upstream (src, offset);
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+}
+
+static gboolean
+bacon_cache_src_get_size (GstBaseSrc *basesrc,
+                          guint64    *size)
+{
+  BaconCacheSrc *src = BACON_CACHE_SRC (basesrc);
+  GstPad *pad;
+  gint64 duration;
+  gboolean ret;
+
+  if (src->length > 0) {
+    *size = src->length;
+    return TRUE;
+  }
+
+  pad = gst_element_get_static_pad (src->upstream, "src");
+  ret = gst_pad_query_duration (pad, GST_FORMAT_BYTES, &duration) && duration > 0;
+  gst_object_unref (pad);
+  if (ret)
+    *size = duration;
+
+  return ret;
+}
+
+static gboolean
+bacon_cache_src_is_seekable (GstBaseSrc *basesrc)
+{
+  BaconCacheSrc *src = BACON_CACHE_SRC (basesrc);
+  g_autoptr(GstQuery) query = NULL;
+  GstPad *pad;
+  gboolean seekable = TRUE;
+
+  if (src->entry != NULL && totem_stream_cache_entry_is_complete (src->entry))
+    return TRUE;
+
+  query = gst_query_new_seeking (GST_FORMAT_BYTES);
+  pad = gst_element_get_static_pad (src->upstream, "src");
+  if (gst_pad_query (pad, query))
+    gst_query_parse_seeking (query, NULL, &seekable, NULL, NULL);
+  gst_object_unref (pad);
+
+  return seekable;
+}
+
+static gboolean
+bacon_cache_src_query (GstBaseSrc *basesrc,
+                       GstQuery   *query)
+{
+  BaconCacheSrc *src = BACON_CACHE_SRC (basesrc);
+  gboolean ret;
+
+  ret = GST_BASE_SRC_CLASS (bacon_cache_src_parent_class)->query (basesrc, query);
+
+  /* Like any network source, unless everything is local */
+  if (ret && GST_QUERY_TYPE (query) == GST_QUERY_SCHEDULING &&
+      (src->entry == NULL || !totem_stream_cache_entry_is_complete (src->entry))) {
+    GstSchedulingFlags flags;
+    gint minsize, maxsize, align;
+
+    gst_query_parse_scheduling (query, &flags, &minsize, &maxsize, &align);
+    gst_query_set_scheduling (query, flags | GST_SCHEDULING_FLAG_BANDWIDTH_LIMITED,
+                              minsize, maxsize, align);
+  }
+
+  return ret;
+}
+
+static gboolean
+bacon_cache_src_unlock (GstBaseSrc *basesrc)
+{
+  BaconCacheSrc *src = BACON_CACHE_SRC (basesrc);
+
+  g_mutex_lock (&src->lock);
+  src->flushing = TRUE;
+  g_cond_broadcast (&src->cond);
+  g_mutex_unlock (&src->lock);
+
+  return TRUE;
+}
+
+static gboolean
+bacon_cache_src_unlock_stop (GstBaseSrc *basesrc)
+{
+  BaconCacheSrc *src = BACON_CACHE_SRC (basesrc);
+
+  g_mutex_lock (&src->lock);
+  src->flushing = FALSE;
+  g_mutex_unlock (&src->lock);
+
+  return TRUE;
+}
+
+static gboolean
+bacon_cache_src_start (GstBaseSrc *basesrc)
+{
+  BaconCacheSrc *src = BACON_CACHE_SRC (basesrc);
+
+  if (src->uri == NULL) {
+    GST_ELEMENT_ERROR (src, RESOURCE, NOT_FOUND, (NULL), ("No URI set"));
+    return FALSE;
+  }
+
+  g_mutex_lock (&src->lock);
+  src->got_headers = FALSE;
+  g_clear_pointer (&src->validator, g_free);
+  gst_clear_caps (&src->upstream_caps);
+  src->caps_changed = FALSE;
+  src->flushing = FALSE;
+  g_mutex_unlock (&src->lock);
+
+  src->opened = FALSE;
+  src->length = 0;
+
+  /* Don't block the state change on the network, the first response
+   * is waited for in create() */
+  return bacon_cache_src_start_upstream (src);
+}
+
+static gboolean
+bacon_cache_src_stop (GstBaseSrc *basesrc)
+{
+  BaconCacheSrc *src = BACON_CACHE_SRC (basesrc);
+
+  bacon_cache_src_stop_upstream (src);
+
+  gst_clear_buffer (&src->current);
+  g_clear_pointer (&src->entry, totem_stream_cache_entry_close);
+  src->opened = FALSE;
+
+  return TRUE;
+}
+
+static gboolean
+bacon_cache_src_set_uri (BaconCacheSrc  *src,
+                         const char     *uri,
+                         GError        **error)
+{
+  GstState state;
+
+  GST_OBJECT_LOCK (src);
+  state = GST_STATE (src);
+  GST_OBJECT_UNLOCK (src);
+  if (state != GST_STATE_NULL && state != GST_STATE_READY) {
+    g_set_error_literal (error, GST_URI_ERROR, GST_URI_ERROR_BAD_STATE,
+                         "Changing the URI while playing is not supported");
+    return FALSE;
+  }
+
+  g_free (src->uri);
+  src->uri = g_strdup (uri);
+  g_object_set (src->upstream, "location", uri, NULL);
+
+  return TRUE;
+}
+
+static GstURIType
+bacon_cache_src_uri_get_type (GType type)
+{
+  return GST_URI_SRC;
+}
+
+static const char * const *
+bacon_cache_src_uri_get_protocols (GType type)
+{
+  static const char *protocols[] = { "http", "https", NULL };
+
+  return protocols;
+}
+
+static char *
+bacon_cache_src_uri_get_uri (GstURIHandler *handler)
+{
+  return g_strdup (BACON_CACHE_SRC (handler)->uri);
+}
+
+static gboolean
+bacon_cache_src_uri_set_uri (GstURIHandler  *handler,
+                             const char     *uri,
+                             GError        **error)
+{
+  return bacon_cache_src_set_uri (BACON_CACHE_SRC (handler), uri, error);
+}
+
+static void
+bacon_cache_src_uri_handler_init (gpointer g_iface,
+                                  gpointer iface_data)
+{
+  GstURIHandlerInterface *iface = g_iface;
+
+  iface->get_type = bacon_cache_src_uri_get_type;
+  iface->get_protocols = bacon_cache_src_uri_get_protocols;
+  iface->get_uri = bacon_cache_src_uri_get_uri;
+  iface->set_uri = bacon_cache_src_uri_set_uri;
+}
+
+/**
+ * bacon_cache_src_get_upstream:
+ * @src: a #BaconCacheSrc
+ *
+ * Gets the HTTP source that does the actual downloading, so that the
+ * user-agent, proxy and credentials can be set on it.
+ *
+ * Returns: (transfer none): the HTTP source element
+ */
+GstElement *
+bacon_cache_src_get_upstream (BaconCacheSrc *src)
+{
+  g_return_val_if_fail (BACON_IS_CACHE_SRC (src), NULL);
+
+  return src->upstream;
+}
+
+/**
+ * bacon_cache_src_register:
+ *
+ * Registers the "baconcachesrc" element, ranked just above the HTTP
+ * source it wraps, so that playbin picks it for HTTP streams.
+ *
+ * Returns: %TRUE if the element was registered
+ */
+gboolean
+bacon_cache_src_register (void)
+{
+  g_autoptr(GstElementFactory) factory = NULL;
+
+  factory = gst_element_factory_find (UPSTREAM_ELEMENT);
+  if (factory == NULL) {
+    GST_DEBUG ("No " UPSTREAM_ELEMENT ", HTTP streams won't be cached");
+    return FALSE;
+  }
+
+  return gst_element_register (NULL, "baconcachesrc",
+                               gst_plugin_feature_get_rank (GST_PLUGIN_FEATURE (factory)) + 1,
+                               BACON_TYPE_CACHE_SRC);
+}
+
+static void
+bacon_cache_src_set_property (GObject      *object,
+                              guint         property_id,
+                              const GValue *value,
+                              GParamSpec   *pspec)
+{
+  BaconCacheSrc *src = BACON_CACHE_SRC (object);
+
+  switch (property_id) {
+    case PROP_LOCATION:
+      bacon_cache_src_set_uri (src, g_value_get_string (value), NULL);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+bacon_cache_src_get_property (GObject    *object,
+                              guint       property_id,
+                              GValue     *value,
+                              GParamSpec *pspec)
+{
+  BaconCacheSrc *src = BACON_CACHE_SRC (object);
+
+  switch (property_id) {
+    case PROP_LOCATION:
+      g_value_set_string (value, src->uri);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+bacon_cache_src_finalize (GObject *object)
+{
+  BaconCacheSrc *src = BACON_CACHE_SRC (object);
+
+  gst_element_set_state (src->upstream, GST_STATE_NULL);
+  gst_object_unref (src->upstream);
+  gst_object_unref (src->sinkpad);
+  bacon_cache_src_clear_queue (src);
+  gst_clear_message (&src->upstream_error);
+  gst_clear_caps (&src->upstream_caps);
+  g_free (src->validator);
+  g_free (src->uri);
+  g_mutex_clear (&src->lock);
+  g_cond_clear (&src->cond);
+
+  G_OBJECT_CLASS (bacon_cache_src_parent_class)->finalize (object);
+}
+
+static void
+bacon_cache_src_class_init (BaconCacheSrcClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSrcClass *basesrc_class = GST_BASE_SRC_CLASS (klass);
+
+  object_class->set_property = bacon_cache_src_set_property;
+  object_class->get_property = bacon_cache_src_get_property;
+  object_class->finalize = bacon_cache_src_finalize;
+
+  g_object_class_install_property (object_class, PROP_LOCATION,
+                                   g_param_spec_string ("location", "Location",
+                                                        "The URI of the stream.", NULL,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+  gst_element_class_set_static_metadata (element_class,
+                                         "HTTP source with cache",
+                                         "Source/Network",
+                                         "Serves HTTP streams from Totem's stream cache",
+                                         "Totem");
+
+  basesrc_class->start = bacon_cache_src_start;
+  basesrc_class->stop = bacon_cache_src_stop;
+  basesrc_class->create = bacon_cache_src_create;
+  basesrc_class->get_size = bacon_cache_src_get_size;
+  basesrc_class->is_seekable = bacon_cache_src_is_seekable;
+  basesrc_class->query = bacon_cache_src_query;
+  basesrc_class->unlock = bacon_cache_src_unlock;
+  basesrc_class->unlock_stop = bacon_cache_src_unlock_stop;
+}
+
+static void
+bacon_cache_src_init (BaconCacheSrc *src)
+{
+  g_autoptr(GstBus) bus = NULL;
+  GstPad *pad;
+
+  g_mutex_init (&src->lock);
+  g_cond_init (&src->cond);
+  g_queue_init (&src->queue);
+
+  gst_base_src_set_format (GST_BASE_SRC (src), GST_FORMAT_BYTES);
+
+  src->upstream = gst_element_factory_make (UPSTREAM_ELEMENT, NULL);
+  g_assert (src->upstream != NULL);
+  gst_object_ref_sink (src->upstream);
+
+  bus = gst_bus_new ();
+  gst_bus_set_sync_handler (bus, bacon_cache_src_upstream_message, src, NULL);
+  gst_element_set_bus (src->upstream, bus);
+
+  src->sinkpad = gst_pad_new ("sink", GST_PAD_SINK);
+  gst_object_ref_sink (src->sinkpad);
+  gst_pad_set_element_private (src->sinkpad, src);
+  gst_pad_set_chain_function (src->sinkpad, bacon_cache_src_upstream_chain);
+  gst_pad_set_event_function (src->sinkpad, bacon_cache_src_upstream_event);
+
+  /* Not in the same bin, so skip the hierarchy checks */
+  pad = gst_element_get_static_pad (src->upstream, "src");
+  gst_pad_link_full (pad, src->sinkpad, GST_PAD_LINK_CHECK_NOTHING);
+  gst_object_unref (pad);
+}
+
+/*
+ * vim: sw=2 ts=8 cindent noai bs=2
+ */
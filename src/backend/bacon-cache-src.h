@@ -0,0 +1,16 @@
+/*
+ * HTTP source element backed by the stream cache
+ *
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+#pragma once
+
+#include <gst/base/gstbasesrc.h>
+
+#define BACON_TYPE_CACHE_SRC            (bacon_cache_src_get_type ())
+G_DECLARE_FINAL_TYPE(BaconCacheSrc, bacon_cache_src, BACON, CACHE_SRC, GstBaseSrc)
+
+gboolean    bacon_cache_src_register     (void);
+GstElement *bacon_cache_src_get_upstream (BaconCacheSrc *src);
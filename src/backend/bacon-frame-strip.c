@@ -0,0 +1,630 @@
+/*
+ * Seek bar preview frames
+ *
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+/**
+ * SECTION:bacon-frame-strip
+ * @short_description: preview frames for seek bars
+ *
+ * #BaconFrameStrip samples a small frame every few seconds of a local
+ * video file and packs them into a single atlas image. Decoding happens
+ * in a single worker thread shared by all the strips, with its own
+ * video-only pipeline, so that neither playback nor the main loop are
+ * ever blocked, and skipping through a playlist only ever decodes one
+ * file at a time.
+ *
+ * Finished atlases are cached on disk, keyed by the file's URI and
+ * modification time.
+ **/
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "totem-gst-helpers.h"
+#include "bacon-frame-strip.h"
+
+GST_DEBUG_CATEGORY_EXTERN (_totem_gst_debug_cat);
+#define GST_CAT_DEFAULT _totem_gst_debug_cat
+
+#define FRAME_HEIGHT 90                    /* In pixels */
+#define MIN_INTERVAL (2 * 1000)            /* In msecs */
+#define MAX_FRAMES 200
+#define ATLAS_COLUMNS 16
+#define MAX_FRAME_DISTANCE 8               /* In frames */
+#define MAX_GRAB_FAILURES 3
+#define PREROLL_TIMEOUT (10 * GST_SECOND)
+#define SEEK_TIMEOUT (5 * GST_SECOND)
+#define CANCEL_CHECK_INTERVAL (100 * GST_MSECOND)
+#define MAX_CACHED_STRIPS 100
+
+typedef struct {
+  gatomicrefcount  ref_count;
+  char            *uri;
+  GCancellable    *cancellable;
+
+  /* Written by the decoding thread, protected by lock */
+  GMutex           lock;
+  GdkPixbuf       *atlas;
+  gint64           interval;
+  guint            n_frames;
+  int              frame_width;
+  int              frame_height;
+  gboolean        *ready;
+} FrameStripJob;
+
+struct _BaconFrameStrip {
+  GObject parent;
+
+  FrameStripJob *job;
+};
+
+G_DEFINE_TYPE (BaconFrameStrip, bacon_frame_strip, G_TYPE_OBJECT)
+
+static FrameStripJob *
+frame_strip_job_new (const char *uri)
+{
+  FrameStripJob *job;
+
+  job = g_new0 (FrameStripJob, 1);
+  g_atomic_ref_count_init (&job->ref_count);
+  job->uri = g_strdup (uri);
+  job->cancellable = g_cancellable_new ();
+  g_mutex_init (&job->lock);
+
+  return job;
+}
+
+static FrameStripJob *
+frame_strip_job_ref (FrameStripJob *job)
+{
+  g_atomic_ref_count_inc (&job->ref_count);
+  return job;
+}
+
+static void
+frame_strip_job_unref (FrameStripJob *job)
+{
+  if (!g_atomic_ref_count_dec (&job->ref_count))
+    return;
+
+  g_free (job->uri);
+  g_object_unref (job->cancellable);
+  g_mutex_clear (&job->lock);
+  g_clear_object (&job->atlas);
+  g_free (job->ready);
+  g_free (job);
+}
+
+/* Must be called with the job lock held */
+static void
+frame_strip_job_set_atlas (FrameStripJob *job,
+                           GdkPixbuf     *atlas,
+                           gint64         interval,
+                           guint          n_frames,
+                           int            frame_width,
+                           int            frame_height,
+                           gboolean       ready)
+{
+  guint i;
+
+  job->atlas = atlas;
+  job->interval = interval;
+  job->n_frames = n_frames;
+  job->frame_width = frame_width;
+  job->frame_height = frame_height;
+  job->ready = g_new (gboolean, n_frames);
+  for (i = 0; i < n_frames; i++)
+    job->ready[i] = ready;
+}
+
+static char *
+frame_strip_get_cache_path (const char *uri)
+{
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GFileInfo) info = NULL;
+  g_autofree char *key = NULL;
+  g_autofree char *checksum = NULL;
+  g_autofree char *filename = NULL;
+
+  file = g_file_new_for_uri (uri);
+  info = g_file_query_info (file, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                            G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  if (info == NULL)
+    return NULL;
+
+  key = g_strdup_printf ("%s\n%" G_GUINT64_FORMAT, uri,
+                         g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED));
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, key, -1);
+  filename = g_strdup_printf ("%s.png", checksum);
+
+  return g_build_filename (g_get_user_cache_dir (), "totem", "frame-strips", filename, NULL);
+}
+
+static gboolean
+frame_strip_load_cache (FrameStripJob *job,
+                        const char    *cache_path)
+{
+  g_autoptr(GdkPixbuf) atlas = NULL;
+  const char *str;
+  gint64 interval, n_frames, frame_width, frame_height;
+
+  atlas = gdk_pixbuf_new_from_file (cache_path, NULL);
+  if (atlas == NULL)
+    return FALSE;
+
+  str = gdk_pixbuf_get_option (atlas, "tEXt::X-Totem-Interval");
+  interval = str ? g_ascii_strtoll (str, NULL, 10) : 0;
+  str = gdk_pixbuf_get_option (atlas, "tEXt::X-Totem-Frames");
+  n_frames = str ? g_ascii_strtoll (str, NULL, 10) : 0;
+  str = gdk_pixbuf_get_option (atlas, "tEXt::X-Totem-Frame-Width");
+  frame_width = str ? g_ascii_strtoll (str, NULL, 10) : 0;
+  str = gdk_pixbuf_get_option (atlas, "tEXt::X-Totem-Frame-Height");
+  frame_height = str ? g_ascii_strtoll (str, NULL, 10) : 0;
+
+  if (interval <= 0 ||
+      n_frames <= 0 || n_frames > MAX_FRAMES ||
+      frame_width <= 0 || frame_height <= 0 ||
+      gdk_pixbuf_get_n_channels (atlas) != 3 ||
+      gdk_pixbuf_get_width (atlas) < MIN (n_frames, ATLAS_COLUMNS) * frame_width ||
+      gdk_pixbuf_get_height (atlas) < ((n_frames + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS) * frame_height) {
+    GST_DEBUG ("Ignoring invalid frame strip cache '%s'", cache_path);
+    return FALSE;
+  }
+
+  g_mutex_lock (&job->lock);
+  frame_strip_job_set_atlas (job, g_steal_pointer (&atlas), interval, n_frames,
+                             frame_width, frame_height, TRUE);
+  g_mutex_unlock (&job->lock);
+
+  return TRUE;
+}
+
+static int
+compare_mtime (gconstpointer a,
+               gconstpointer b)
+{
+  const GStatBuf *sa = g_object_get_data (*(GObject **) a, "stat");
+  const GStatBuf *sb = g_object_get_data (*(GObject **) b, "stat");
+
+  return (sa->st_mtime > sb->st_mtime) - (sa->st_mtime < sb->st_mtime);
+}
+
+/* Keep the cache directory from growing unbounded, by removing the
+ * least recently written strips */
+static void
+frame_strip_prune_cache (const char *dir_path)
+{
+  g_autoptr(GPtrArray) files = NULL;
+  GDir *dir;
+  const char *name;
+  guint i;
+
+  dir = g_dir_open (dir_path, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  files = g_ptr_array_new_with_free_func (g_object_unref);
+  while ((name = g_dir_read_name (dir)) != NULL) {
+    g_autofree char *path = NULL;
+    GStatBuf *buf;
+    GFile *file;
+
+    if (!g_str_has_suffix (name, ".png"))
+      continue;
+    path = g_build_filename (dir_path, name, NULL);
+    buf = g_new0 (GStatBuf, 1);
+    if (g_stat (path, buf) < 0) {
+      g_free (buf);
+      continue;
+    }
+    file = g_file_new_for_path (path);
+    g_object_set_data_full (G_OBJECT (file), "stat", buf, g_free);
+    g_ptr_array_add (files, file);
+  }
+  g_dir_close (dir);
+
+  if (files->len < MAX_CACHED_STRIPS)
+    return;
+
+  g_ptr_array_sort (files, compare_mtime);
+  for (i = 0; i <= files->len - MAX_CACHED_STRIPS; i++) {
+    GFile *file = g_ptr_array_index (files, i);
+
+    GST_DEBUG ("Pruning frame strip cache file '%s'", g_file_peek_path (file));
+    g_file_delete (file, NULL, NULL);
+  }
+}
+
+static void
+frame_strip_save_cache (FrameStripJob *job,
+                        const char    *cache_path)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree char *dir = NULL;
+  g_autofree char *tmp_path = NULL;
+  char interval[32], n_frames[16], frame_width[16], frame_height[16];
+
+  dir = g_path_get_dirname (cache_path);
+  if (g_mkdir_with_parents (dir, 0700) < 0) {
+    GST_DEBUG ("Could not create frame strip cache directory '%s': %s",
+               dir, g_strerror (errno));
+    return;
+  }
+  frame_strip_prune_cache (dir);
+
+  g_snprintf (interval, sizeof (interval), "%" G_GINT64_FORMAT, job->interval);
+  g_snprintf (n_frames, sizeof (n_frames), "%u", job->n_frames);
+  g_snprintf (frame_width, sizeof (frame_width), "%d", job->frame_width);
+  g_snprintf (frame_height, sizeof (frame_height), "%d", job->frame_height);
+
+  /* Write to a temporary file first so readers never see a partial atlas */
+  tmp_path = g_strdup_printf ("%s.tmp", cache_path);
+  if (!gdk_pixbuf_save (job->atlas, tmp_path, "png", &error,
+                        "tEXt::X-Totem-Interval", interval,
+                        "tEXt::X-Totem-Frames", n_frames,
+                        "tEXt::X-Totem-Frame-Width", frame_width,
+                        "tEXt::X-Totem-Frame-Height", frame_height,
+                        NULL)) {
+    GST_DEBUG ("Could not save frame strip cache '%s': %s", tmp_path, error->message);
+    g_unlink (tmp_path);
+    return;
+  }
+
+  if (g_rename (tmp_path, cache_path) < 0) {
+    GST_DEBUG ("Could not rename frame strip cache '%s': %s", tmp_path, g_strerror (errno));
+    g_unlink (tmp_path);
+  }
+}
+
+/* Gives up early if the job gets cancelled, so that the worker moves
+ * on to the next video without waiting for the whole timeout */
+static gboolean
+frame_strip_wait_async_done (FrameStripJob *job,
+                             GstElement    *play,
+                             GstClockTime   timeout)
+{
+  g_autoptr(GstBus) bus = NULL;
+  GstClockTime waited;
+
+  bus = gst_element_get_bus (play);
+  for (waited = 0; waited < timeout; waited += CANCEL_CHECK_INTERVAL) {
+    g_autoptr(GstMessage) msg = NULL;
+
+    if (g_cancellable_is_cancelled (job->cancellable))
+      return FALSE;
+
+    msg = gst_bus_timed_pop_filtered (bus, MIN (CANCEL_CHECK_INTERVAL, timeout - waited),
+                                      GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR);
+    if (msg != NULL)
+      return GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ASYNC_DONE;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+frame_strip_grab_frame (FrameStripJob *job,
+                        GstElement    *play,
+                        GstCaps       *to_caps,
+                        guint          index)
+{
+  g_autoptr(GstSample) sample = NULL;
+  GstVideoInfo info;
+  GstMapInfo map;
+  GstBuffer *buffer;
+  guint8 *dest;
+  int dest_stride, src_stride, y;
+
+  if (!gst_element_seek_simple (play, GST_FORMAT_TIME,
+                                GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_NEAREST,
+                                index * job->interval * GST_MSECOND))
+    return FALSE;
+  if (!frame_strip_wait_async_done (job, play, SEEK_TIMEOUT))
+    return FALSE;
+
+  /* The sink gets full-sized frames, convert-sample converts the last
+   * one to RGB and scales it down to the atlas' frame size itself */
+  g_signal_emit_by_name (play, "convert-sample", to_caps, &sample);
+  if (sample == NULL)
+    return FALSE;
+
+  if (!gst_video_info_from_caps (&info, gst_sample_get_caps (sample)) ||
+      GST_VIDEO_INFO_WIDTH (&info) != job->frame_width ||
+      GST_VIDEO_INFO_HEIGHT (&info) != job->frame_height)
+    return FALSE;
+
+  buffer = gst_sample_get_buffer (sample);
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return FALSE;
+
+  /* Only this thread writes to the atlas, and each frame's region is only
+   * read once it's marked as ready */
+  src_stride = GST_VIDEO_INFO_PLANE_STRIDE (&info, 0);
+  dest_stride = gdk_pixbuf_get_rowstride (job->atlas);
+  dest = gdk_pixbuf_get_pixels (job->atlas) +
+    (index / ATLAS_COLUMNS) * job->frame_height * dest_stride +
+    (index % ATLAS_COLUMNS) * job->frame_width * 3;
+  for (y = 0; y < job->frame_height; y++)
+    memcpy (dest + y * dest_stride, map.data + y * src_stride, job->frame_width * 3);
+
+  gst_buffer_unmap (buffer, &map);
+
+  return TRUE;
+}
+
+static gboolean
+frame_strip_get_frame_size (GstElement *play,
+                            int        *width,
+                            int        *height)
+{
+  g_autoptr(GstPad) pad = NULL;
+  g_autoptr(GstCaps) caps = NULL;
+  GstVideoInfo info;
+  gint64 num, den;
+
+  g_signal_emit_by_name (play, "get-video-pad", 0, &pad);
+  if (pad == NULL)
+    return FALSE;
+  caps = gst_pad_get_current_caps (pad);
+  if (caps == NULL || !gst_video_info_from_caps (&info, caps))
+    return FALSE;
+
+  num = (gint64) GST_VIDEO_INFO_WIDTH (&info) * GST_VIDEO_INFO_PAR_N (&info);
+  den = (gint64) GST_VIDEO_INFO_HEIGHT (&info) * GST_VIDEO_INFO_PAR_D (&info);
+  if (num <= 0 || den <= 0)
+    return FALSE;
+
+  *height = FRAME_HEIGHT;
+  *width = MAX (2, GST_ROUND_UP_2 (FRAME_HEIGHT * num / den));
+
+  return TRUE;
+}
+
+static void
+frame_strip_run (gpointer data,
+                 gpointer user_data)
+{
+  FrameStripJob *job = data;
+  g_autofree char *cache_path = NULL;
+  g_autoptr(GstCaps) to_caps = NULL;
+  GstElement *play = NULL;
+  gint64 duration, duration_msecs, interval;
+  guint n_frames, n_rows, n_failures, step, i;
+  int n_video, width, height;
+  GdkPixbuf *atlas;
+
+  /* Replaced by another video while queued */
+  if (g_cancellable_is_cancelled (job->cancellable))
+    goto out;
+
+  if (job->uri != NULL && g_str_has_prefix (job->uri, "file://"))
+    cache_path = frame_strip_get_cache_path (job->uri);
+  if (cache_path != NULL && frame_strip_load_cache (job, cache_path)) {
+    GST_DEBUG ("Loaded frame strip for '%s' from '%s'", job->uri, cache_path);
+    goto out;
+  }
+
+  play = gst_element_factory_make ("playbin", "frame-strip");
+  if (play == NULL)
+    goto out;
+  g_object_ref_sink (play);
+  g_object_set (play,
+                "uri", job->uri,
+                "flags", GST_PLAY_FLAG_VIDEO,
+                "audio-sink", gst_element_factory_make ("fakesink", NULL),
+                "video-sink", gst_element_factory_make ("fakesink", NULL),
+                NULL);
+
+  gst_element_set_state (play, GST_STATE_PAUSED);
+  if (!frame_strip_wait_async_done (job, play, PREROLL_TIMEOUT)) {
+    GST_DEBUG ("Could not preroll '%s' for frame strip", job->uri);
+    goto out;
+  }
+
+  g_object_get (play, "n-video", &n_video, NULL);
+  if (n_video == 0 ||
+      !gst_element_query_duration (play, GST_FORMAT_TIME, &duration) ||
+      duration <= 0 ||
+      !frame_strip_get_frame_size (play, &width, &height))
+    goto out;
+
+  duration_msecs = duration / GST_MSECOND;
+  interval = MAX (MIN_INTERVAL, duration_msecs / MAX_FRAMES);
+  n_frames = CLAMP (duration_msecs / interval, 1, MAX_FRAMES);
+  n_rows = (n_frames + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS;
+
+  atlas = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
+                          MIN (n_frames, ATLAS_COLUMNS) * width, n_rows * height);
+  if (atlas == NULL)
+    goto out;
+  gdk_pixbuf_fill (atlas, 0x000000ff);
+
+  g_mutex_lock (&job->lock);
+  frame_strip_job_set_atlas (job, atlas, interval, n_frames, width, height, FALSE);
+  g_mutex_unlock (&job->lock);
+
+  GST_DEBUG ("Sampling %u %dx%d frames every %" G_GINT64_FORMAT " msecs for '%s'",
+             n_frames, width, height, interval, job->uri);
+
+  to_caps = gst_caps_new_simple ("video/x-raw",
+                                 "format", G_TYPE_STRING, "RGB",
+                                 "width", G_TYPE_INT, width,
+                                 "height", G_TYPE_INT, height,
+                                 "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+                                 NULL);
+
+  /* Sample coarse to fine, so the whole seek bar gets previews early */
+  n_failures = 0;
+  for (step = MAX_FRAME_DISTANCE; step > 0; step /= 2) {
+    for (i = 0; i < n_frames; i += step) {
+      if (g_cancellable_is_cancelled (job->cancellable))
+        goto out;
+      if (job->ready[i])
+        continue;
+
+      if (!frame_strip_grab_frame (job, play, to_caps, i)) {
+        GST_DEBUG ("Could not grab frame strip frame %u for '%s'", i, job->uri);
+        if (++n_failures >= MAX_GRAB_FAILURES)
+          goto out;
+        continue;
+      }
+
+      g_mutex_lock (&job->lock);
+      job->ready[i] = TRUE;
+      g_mutex_unlock (&job->lock);
+    }
+  }
+
+  if (cache_path != NULL && n_failures == 0)
+    frame_strip_save_cache (job, cache_path);
+
+out:
+  if (play != NULL) {
+    gst_element_set_state (play, GST_STATE_NULL);
+    gst_object_unref (play);
+  }
+  frame_strip_job_unref (job);
+}
+
+static GThreadPool *
+frame_strip_get_pool (void)
+{
+  static GThreadPool *pool = NULL;
+
+  if (g_once_init_enter (&pool))
+    g_once_init_leave (&pool, g_thread_pool_new (frame_strip_run, NULL, 1, FALSE, NULL));
+
+  return pool;
+}
+
+/**
+ * bacon_frame_strip_set_uri:
+ * @strip: a #BaconFrameStrip
+ * @uri: (nullable): the URI of the video to sample, or %NULL
+ *
+ * Cancels any sampling in progress and, if @uri is a local file,
+ * starts sampling preview frames for it in the background.
+ **/
+void
+bacon_frame_strip_set_uri (BaconFrameStrip *strip,
+                           const char      *uri)
+{
+  FrameStripJob *job;
+
+  g_return_if_fail (BACON_IS_FRAME_STRIP (strip));
+
+  if (strip->job != NULL) {
+    if (g_strcmp0 (strip->job->uri, uri) == 0)
+      return;
+    g_cancellable_cancel (strip->job->cancellable);
+    g_clear_pointer (&strip->job, frame_strip_job_unref);
+  }
+
+  /* Decoding the stream a second time is only cheap for local files */
+  if (uri == NULL || !g_str_has_prefix (uri, "file://"))
+    return;
+
+  job = frame_strip_job_new (uri);
+  strip->job = frame_strip_job_ref (job);
+  g_thread_pool_push (frame_strip_get_pool (), job, NULL);
+}
+
+/**
+ * bacon_frame_strip_get_frame:
+ * @strip: a #BaconFrameStrip
+ * @time_msecs: the stream position, in milliseconds
+ *
+ * Returns the preview frame closest to @time_msecs, out of the
+ * ones sampled so far. This never blocks.
+ *
+ * Returns: (transfer full) (nullable): a #GdkPixbuf, or %NULL if no
+ * nearby frame is available yet
+ **/
+GdkPixbuf *
+bacon_frame_strip_get_frame (BaconFrameStrip *strip,
+                             gint64           time_msecs)
+{
+  FrameStripJob *job;
+  GdkPixbuf *frame = NULL;
+  int index, offset, found = -1;
+
+  g_return_val_if_fail (BACON_IS_FRAME_STRIP (strip), NULL);
+
+  job = strip->job;
+  if (job == NULL)
+    return NULL;
+
+  g_mutex_lock (&job->lock);
+  if (job->atlas == NULL)
+    goto out;
+
+  index = CLAMP ((time_msecs + job->interval / 2) / job->interval, 0, (gint64) job->n_frames - 1);
+  for (offset = 0; offset <= MAX_FRAME_DISTANCE; offset++) {
+    if (index - offset >= 0 && job->ready[index - offset]) {
+      found = index - offset;
+      break;
+    }
+    if (index + offset < (int) job->n_frames && job->ready[index + offset]) {
+      found = index + offset;
+      break;
+    }
+  }
+
+  if (found >= 0)
+    frame = gdk_pixbuf_new_subpixbuf (job->atlas,
+                                      (found % ATLAS_COLUMNS) * job->frame_width,
+                                      (found / ATLAS_COLUMNS) * job->frame_height,
+                                      job->frame_width, job->frame_height);
+
+out:
+  g_mutex_unlock (&job->lock);
+  return frame;
+}
+
+/**
+ * bacon_frame_strip_new:
+ *
+ * Creates a new #BaconFrameStrip.
+ *
+ * Returns: (transfer full): a new #BaconFrameStrip
+ **/
+BaconFrameStrip *
+bacon_frame_strip_new (void)
+{
+  return g_object_new (BACON_TYPE_FRAME_STRIP, NULL);
+}
+
+static void
+bacon_frame_strip_dispose (GObject *object)
+{
+  BaconFrameStrip *strip = BACON_FRAME_STRIP (object);
+
+  if (strip->job != NULL) {
+    g_cancellable_cancel (strip->job->cancellable);
+    g_clear_pointer (&strip->job, frame_strip_job_unref);
+  }
+
+  G_OBJECT_CLASS (bacon_frame_strip_parent_class)->dispose (object);
+}
+
+static void
+bacon_frame_strip_class_init (BaconFrameStripClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = bacon_frame_strip_dispose;
+}
+
+static void
+bacon_frame_strip_init (BaconFrameStrip *strip)
+{
+}
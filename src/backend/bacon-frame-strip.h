@@ -0,0 +1,19 @@
+/*
+ * Seek bar preview frames
+ *
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+#pragma once
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#define BACON_TYPE_FRAME_STRIP            (bacon_frame_strip_get_type ())
+G_DECLARE_FINAL_TYPE(BaconFrameStrip, bacon_frame_strip, BACON, FRAME_STRIP, GObject)
+
+BaconFrameStrip *bacon_frame_strip_new          (void);
+void             bacon_frame_strip_set_uri      (BaconFrameStrip *strip,
+                                                 const char      *uri);
+GdkPixbuf       *bacon_frame_strip_get_frame    (BaconFrameStrip *strip,
+                                                 gint64           time_msecs);
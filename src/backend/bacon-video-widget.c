@@ -27,6 +27,7 @@
 #define GST_USE_UNSTABLE_API 1
 
 #include <gst/gst.h>
+#include <gst/base/gstbasesink.h>
 
 /* GStreamer Interfaces */
 #include <gst/video/navigation.h>
@@ -56,8 +57,10 @@
 #include <gio/gio.h>
 #include <gdesktop-enums.h>
 
+#include "totem-decoder-policy.h"
 #include "totem-gst-helpers.h"
 #include "totem-gst-pixbuf-helpers.h"
+#include "bacon-cache-src.h"
 #include "bacon-video-widget.h"
 #include "bacon-video-widget-enums.h"
 #include "bacon-video-widget-resources.h"
@@ -73,7 +76,17 @@
 
 /* Helper constants */
 #define NANOSECS_IN_SEC 1000000000
-#define SEEK_TIMEOUT NANOSECS_IN_SEC / 10
+/* How long to wait for a seek to finish before issuing the next one anyway */
+#define SEEK_TIMEOUT (2 * GST_SECOND)
+#define SCRUB_SEEK_FLAGS (GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_NEAREST | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS)
+/* Direct seeking is enabled for any stream whose seeks are fast enough */
+#define DIRECT_SEEK_MAX_LATENCY (250 * GST_MSECOND)
+#define DIRECT_SEEK_MIN_SAMPLES 3
+#define TICK_INTERVAL 200                      /* In msecs, when the video is shown */
+#define TICK_INTERVAL_AUDIO 500                /* In msecs, for audio-only streams */
+#define TICK_INTERVAL_HIDDEN 2000              /* In msecs, when nothing is shown */
+#define TICK_INTERVAL_FALLBACK 1000            /* In msecs, if the frame clock stalls */
+
 #define FORWARD_RATE 1.0
 #define REVERSE_RATE -1.0
 #define DIRECTION_STR (forward == FALSE ? "reverse" : "forward")
@@ -87,6 +100,35 @@
 
 #define I_(string) (g_intern_static_string (string))
 
+/* How position ticks are scheduled, see bvw_update_tick_mode() */
+typedef enum {
+  BVW_TICK_STOPPED,
+  BVW_TICK_FRAME_CLOCK,
+  BVW_TICK_AUDIO,
+  BVW_TICK_HIDDEN
+} BvwTickMode;
+
+static const char *tick_mode_names[] = {
+  "stopped",
+  "frame clock",
+  "audio",
+  "hidden"
+};
+
+/* Stream types with their own tag caches and pending tags */
+typedef enum {
+  BVW_TAGS_VIDEO,
+  BVW_TAGS_AUDIO,
+  BVW_TAGS_TEXT,
+  BVW_TAGS_N_TYPES
+} BvwTagsType;
+
+static const char *tags_type_names[] = {
+  "video",
+  "audio",
+  "text"
+};
+
 /* Signals */
 enum
 {
@@ -102,6 +144,7 @@ enum
   SIGNAL_PLAY_STARTING,
   SIGNAL_SUBTITLES_CHANGED,
   SIGNAL_LANGUAGES_CHANGED,
+  SIGNAL_STREAM_SWITCHED,
   LAST_SIGNAL
 };
 
@@ -126,6 +169,8 @@ enum
   PROP_AUDIO_OUTPUT_TYPE,
   PROP_AV_OFFSET,
   PROP_SHOW_CURSOR,
+  PROP_STATS,
+  PROP_USE_PLAYBIN3,
 };
 
 static const gchar *video_props_str[4] = {
@@ -163,6 +208,13 @@ struct _BaconVideoWidget
   guint                        update_id;
   guint                        fill_id;
 
+  BvwTickMode                  tick_mode;
+  gboolean                     tick_playing;
+  GdkFrameClock               *tick_clock;
+  gulong                       tick_clock_id;
+  gint64                       last_tick_time;
+  GdkWindowState               toplevel_state;
+
   gboolean                     media_has_video;
   gboolean                     media_has_unsupported_video;
   gboolean                     media_has_audio;
@@ -176,8 +228,11 @@ struct _BaconVideoWidget
   GstTagList                  *audiotags;
   GstTagList                  *videotags;
 
-  GAsyncQueue                 *tag_update_queue;
-  guint                        tag_update_id;
+  /* Tags from the streaming threads, see bvw_update_tags_delayed() */
+  GSource                     *tag_update_source;
+  gint                         tag_update_pending;
+  GstTagList                  *pending_tags[BVW_TAGS_N_TYPES];
+  GstTagList                  *last_tags[BVW_TAGS_N_TYPES];
 
   gboolean                     got_redirect;
 
@@ -214,11 +269,32 @@ struct _BaconVideoWidget
   gint                         eos_id;
 
   /* When seeking, queue up the seeks if they happen before
-   * the previous one finished */
+   * the previous one finished, only the newest one is kept */
   GMutex                       seek_mutex;
   GstClock                    *clock;
   GstClockTime                 seek_req_time;
+  gboolean                     seek_in_flight;
   gint64                       seek_time;
+  GstSeekFlags                 seek_flags;
+  /* while the seek bar is being dragged */
+  gboolean                     scrubbing;
+  gint64                       scrub_time;
+  /* running average of the time between a seek and its ASYNC_DONE */
+  GstClockTime                 seek_latency;
+  guint                        n_seek_latencies;
+
+  /* playback quality, see bacon_video_widget_get_stats() */
+  BvwStats                     stats;
+  guint64                      sink_rendered; /* the sink's own counters, */
+  guint64                      sink_dropped;  /* which a flush resets */
+  guint64                      decoder_rendered; /* only at normal rate, */
+  guint64                      decoder_dropped;  /* outside of seeks */
+  gint64                       buffering_start; /* monotonic, in µs */
+  gint64                       step_start;
+  gint64                       state_change_start;
+  GstState                     state_change_target;
+  gboolean                     decoder_playback_recorded;
+
   /* state we want to be in, as opposed to actual pipeline state
    * which may change asynchronously or during buffering */
   GstState                     target_state;
@@ -244,6 +320,24 @@ struct _BaconVideoWidget
 
   /* for stepping */
   float                        rate;
+
+  /* for gapless playback, the next MRL is handed to playbin
+   * from the streaming thread in about-to-finish */
+  GMutex                       gapless_mutex;
+  char                        *next_mrl;
+  char                        *next_subtitle_uri;
+  gboolean                     gapless_pending;
+  gint64                       gapless_end_time; /* monotonic, in µs */
+  /* monotonic time of the last non-gapless open, in µs */
+  gint64                       switch_start_time;
+
+  /* playbin3 stream selection */
+  gboolean                     use_playbin3;
+  GstStreamCollection         *collection;
+  char                        *selected_video_id;
+  char                        *selected_audio_id;
+  char                        *selected_text_id;
+  gint64                       select_time; /* monotonic, in µs */
 };
 
 G_DEFINE_TYPE (BaconVideoWidget, bacon_video_widget, GTK_TYPE_BIN)
@@ -257,9 +351,12 @@ static void bacon_video_widget_get_property (GObject * object,
                                              GValue * value,
                                              GParamSpec * pspec);
 
+static void bacon_video_widget_constructed (GObject * object);
 static void bacon_video_widget_finalize (GObject * object);
 
 static void bvw_reconfigure_fill_timeout (BaconVideoWidget *bvw, guint msecs);
+static void bvw_update_tick_mode (BaconVideoWidget *bvw);
+static GVariant *bvw_stats_to_variant (BaconVideoWidget *bvw);
 static void bvw_stop_play_pipeline (BaconVideoWidget * bvw);
 static GError* bvw_error_from_gst_error (BaconVideoWidget *bvw, GstMessage *m);
 static gboolean bvw_set_playback_direction (BaconVideoWidget *bvw, gboolean forward);
@@ -270,12 +367,6 @@ static gboolean bacon_video_widget_seek_time_no_lock (BaconVideoWidget *bvw,
 static gboolean update_subtitles_tracks (BaconVideoWidget *bvw);
 static gboolean update_languages_tracks (BaconVideoWidget *bvw);
 
-typedef struct {
-  GstTagList *tags;
-  const gchar *type;
-} UpdateTagsDelayedData;
-
-static void update_tags_delayed_data_destroy (UpdateTagsDelayedData *data);
 
 static GtkWidgetClass *parent_class = NULL;
 
@@ -394,6 +485,17 @@ update_cursor (BaconVideoWidget *bvw)
     gdk_window_set_cursor (window, bvw->blank_cursor);
 }
 
+static gboolean
+bvw_toplevel_window_state_cb (GtkWidget           *toplevel,
+                              GdkEventWindowState *event,
+                              BaconVideoWidget    *bvw)
+{
+  bvw->toplevel_state = event->new_window_state;
+  bvw_update_tick_mode (bvw);
+
+  return GDK_EVENT_PROPAGATE;
+}
+
 static void
 bacon_video_widget_realize (GtkWidget * widget)
 {
@@ -411,6 +513,8 @@ bacon_video_widget_realize (GtkWidget * widget)
   bvw->parent_toplevel = GTK_WINDOW (gtk_widget_get_toplevel (GTK_WIDGET (bvw)));
   g_signal_connect_swapped (G_OBJECT (bvw->parent_toplevel), "notify::is-active",
 			    G_CALLBACK (update_cursor), bvw);
+  g_signal_connect (G_OBJECT (bvw->parent_toplevel), "window-state-event",
+		    G_CALLBACK (bvw_toplevel_window_state_cb), bvw);
 }
 
 static void
@@ -422,10 +526,29 @@ bacon_video_widget_unrealize (GtkWidget *widget)
 
   if (bvw->parent_toplevel != NULL) {
     g_signal_handlers_disconnect_by_func (bvw->parent_toplevel, update_cursor, bvw);
+    g_signal_handlers_disconnect_by_func (bvw->parent_toplevel, bvw_toplevel_window_state_cb, bvw);
     bvw->parent_toplevel = NULL;
   }
+  bvw->toplevel_state = 0;
   g_clear_object (&bvw->blank_cursor);
   g_clear_object (&bvw->hand_cursor);
+
+  /* The frame clock is gone */
+  bvw_update_tick_mode (bvw);
+}
+
+static void
+bacon_video_widget_map (GtkWidget *widget)
+{
+  GTK_WIDGET_CLASS (parent_class)->map (widget);
+  bvw_update_tick_mode (BACON_VIDEO_WIDGET (widget));
+}
+
+static void
+bacon_video_widget_unmap (GtkWidget *widget)
+{
+  GTK_WIDGET_CLASS (parent_class)->unmap (widget);
+  bvw_update_tick_mode (BACON_VIDEO_WIDGET (widget));
 }
 
 static void
@@ -572,6 +695,8 @@ bacon_video_widget_class_init (BaconVideoWidgetClass * klass)
   widget_class->get_preferred_height = bacon_video_widget_get_preferred_height;
   widget_class->realize = bacon_video_widget_realize;
   widget_class->unrealize = bacon_video_widget_unrealize;
+  widget_class->map = bacon_video_widget_map;
+  widget_class->unmap = bacon_video_widget_unmap;
 
   widget_class->motion_notify_event = bacon_video_widget_motion_notify;
   widget_class->button_press_event = bacon_video_widget_button_press_or_release;
@@ -580,6 +705,7 @@ bacon_video_widget_class_init (BaconVideoWidgetClass * klass)
   /* GObject */
   object_class->set_property = bacon_video_widget_set_property;
   object_class->get_property = bacon_video_widget_get_property;
+  object_class->constructed = bacon_video_widget_constructed;
   object_class->finalize = bacon_video_widget_finalize;
 
   /* Properties */
@@ -763,6 +889,36 @@ bacon_video_widget_class_init (BaconVideoWidgetClass * klass)
                                                          G_PARAM_READWRITE |
                                                          G_PARAM_STATIC_STRINGS));
 
+  /**
+   * BaconVideoWidget:stats:
+   *
+   * The playback quality statistics for the current stream, as a
+   * <code class="literal">a{sv}</code> #GVariant with the same fields as
+   * #BvwStats, using dashes instead of underscores. This property changes
+   * continuously and isn't notified, poll it instead.
+   **/
+  g_object_class_install_property (object_class, PROP_STATS,
+                                   g_param_spec_variant ("stats", "Stats",
+                                                         "Playback quality statistics.",
+                                                         G_VARIANT_TYPE_VARDICT, NULL,
+                                                         G_PARAM_READABLE |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  /**
+   * BaconVideoWidget:use-playbin3:
+   *
+   * Whether to play with playbin3 instead of playbin. Setting
+   * <code class="literal">TOTEM_PLAYBIN3=1</code> in the environment
+   * forces it on, for testing.
+   **/
+  g_object_class_install_property (object_class, PROP_USE_PLAYBIN3,
+                                   g_param_spec_boolean ("use-playbin3", "Use playbin3",
+                                                         "Whether to play with playbin3.",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT_ONLY |
+                                                         G_PARAM_STATIC_STRINGS));
+
   /* Signals */
   /**
    * BaconVideoWidget::error:
@@ -965,6 +1121,29 @@ bacon_video_widget_class_init (BaconVideoWidgetClass * klass)
                   NULL, NULL,
                   g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
 
+  /**
+   * BaconVideoWidget::stream-switched:
+   * @bvw: the #BaconVideoWidget which received the signal
+   * @mrl: the MRL now playing
+   * @latency: the switch latency, in microseconds
+   * @gapless: whether the switch happened without tearing down the pipeline
+   *
+   * Emitted when playback of a new MRL has started.
+   *
+   * For gapless switches (see bacon_video_widget_set_next_mrl()), @latency is
+   * the time between the expected end of the previous stream and the start of
+   * the new one. Otherwise it is the time between the call to
+   * bacon_video_widget_open() and the pipeline reaching the playing state.
+   **/
+  bvw_signals[SIGNAL_STREAM_SWITCHED] =
+    g_signal_new ("stream-switched",
+                  G_TYPE_FROM_CLASS (object_class),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL,
+                  g_cclosure_marshal_generic,
+                  G_TYPE_NONE, 3, G_TYPE_STRING, G_TYPE_INT64, G_TYPE_BOOLEAN);
+
   g_resources_register (_bvw_get_resource ());
 
   default_theme = gtk_icon_theme_get_default ();
@@ -977,8 +1156,11 @@ bacon_video_widget_class_init (BaconVideoWidgetClass * klass)
 }
 
 static gboolean bvw_query_timeout (BaconVideoWidget *bvw);
+static void bvw_tick (BaconVideoWidget *bvw);
 static gboolean bvw_query_buffering_timeout (BaconVideoWidget *bvw);
 static void parse_stream_info (BaconVideoWidget *bvw);
+static gint bvw_get_current_stream_num (BaconVideoWidget *bvw, const gchar *stream_type);
+static GstTagList *bvw_get_tags_of_current_stream (BaconVideoWidget *bvw, const gchar *stream_type);
 
 static void
 bvw_update_stream_info (BaconVideoWidget *bvw)
@@ -1271,6 +1453,102 @@ bvw_reconfigure_tick_timeout (BaconVideoWidget *bvw, guint msecs)
   }
 }
 
+static void
+bvw_frame_clock_after_paint (GdkFrameClock    *clock,
+                             BaconVideoWidget *bvw)
+{
+  /* Piggy-back on video frames being painted, instead of waking up
+   * on our own */
+  if (gdk_frame_clock_get_frame_time (clock) - bvw->last_tick_time < TICK_INTERVAL * G_TIME_SPAN_MILLISECOND)
+    return;
+  bvw_tick (bvw);
+}
+
+static void
+bvw_disconnect_frame_clock (BaconVideoWidget *bvw)
+{
+  if (bvw->tick_clock == NULL)
+    return;
+  g_clear_signal_handler (&bvw->tick_clock_id, bvw->tick_clock);
+  g_clear_object (&bvw->tick_clock);
+}
+
+static gboolean
+bvw_is_shown (BaconVideoWidget *bvw)
+{
+  if (!gtk_widget_get_mapped (GTK_WIDGET (bvw)))
+    return FALSE;
+  return (bvw->toplevel_state & (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN)) == 0;
+}
+
+/* Position ticks follow the frame clock while video is shown, so that
+ * the seek bar and time labels update in step with painting, with a
+ * slow timeout in case no frames get painted. Audio-only streams use a
+ * plain timeout, and ticks slow right down when nothing is shown, the
+ * getters then query the position themselves. */
+static void
+bvw_update_tick_mode (BaconVideoWidget *bvw)
+{
+  BvwTickMode mode;
+  BvwTickMode old_mode;
+  GdkFrameClock *clock;
+  guint interval = 0;
+
+  clock = gtk_widget_get_realized (GTK_WIDGET (bvw)) ?
+    gtk_widget_get_frame_clock (GTK_WIDGET (bvw)) : NULL;
+
+  if (!bvw->tick_playing)
+    mode = BVW_TICK_STOPPED;
+  else if (!bvw_is_shown (bvw))
+    mode = BVW_TICK_HIDDEN;
+  else if (bvw->media_has_video && clock != NULL)
+    mode = BVW_TICK_FRAME_CLOCK;
+  else
+    mode = BVW_TICK_AUDIO;
+
+  if (mode == bvw->tick_mode &&
+      (mode != BVW_TICK_FRAME_CLOCK || clock == bvw->tick_clock))
+    return;
+
+  GST_DEBUG ("Switching tick mode from %s to %s",
+             tick_mode_names[bvw->tick_mode], tick_mode_names[mode]);
+
+  old_mode = bvw->tick_mode;
+  bvw->tick_mode = mode;
+
+  bvw_disconnect_frame_clock (bvw);
+  switch (mode) {
+    case BVW_TICK_FRAME_CLOCK:
+      bvw->tick_clock = g_object_ref (clock);
+      bvw->tick_clock_id = g_signal_connect (G_OBJECT (clock), "after-paint",
+                                             G_CALLBACK (bvw_frame_clock_after_paint), bvw);
+      interval = TICK_INTERVAL_FALLBACK;
+      break;
+    case BVW_TICK_AUDIO:
+      interval = TICK_INTERVAL_AUDIO;
+      break;
+    case BVW_TICK_HIDDEN:
+      interval = TICK_INTERVAL_HIDDEN;
+      break;
+    case BVW_TICK_STOPPED:
+    default:
+      break;
+  }
+  bvw_reconfigure_tick_timeout (bvw, interval);
+
+  /* Catch up straight away when shown again */
+  if (old_mode == BVW_TICK_HIDDEN && mode != BVW_TICK_STOPPED)
+    bvw_tick (bvw);
+}
+
+static void
+bvw_set_tick_playing (BaconVideoWidget *bvw,
+                      gboolean          playing)
+{
+  bvw->tick_playing = playing;
+  bvw_update_tick_mode (bvw);
+}
+
 static void
 bvw_reconfigure_fill_timeout (BaconVideoWidget *bvw, guint msecs)
 {
@@ -1429,6 +1707,179 @@ bvw_check_missing_plugins_error (BaconVideoWidget * bvw, GstMessage * err_msg)
   return FALSE;
 }
 
+static gint
+find_hardware_video_decoder (gconstpointer a,
+                             gconstpointer b)
+{
+  GstElement *element = g_value_get_object (a);
+  GstElementFactory *factory;
+
+  factory = gst_element_get_factory (element);
+  if (factory != NULL && totem_decoder_policy_is_hardware_video_decoder (factory))
+    return 0;
+  return 1;
+}
+
+static GstElement *
+bvw_find_hardware_video_decoder (BaconVideoWidget *bvw)
+{
+  GstIterator *it;
+  GValue item = G_VALUE_INIT;
+  GstElement *decoder = NULL;
+
+  it = gst_bin_iterate_recurse (GST_BIN (bvw->play));
+  if (gst_iterator_find_custom (it, find_hardware_video_decoder, &item, NULL)) {
+    decoder = g_value_dup_object (&item);
+    g_value_unset (&item);
+  }
+  gst_iterator_free (it);
+
+  return decoder;
+}
+
+static char *
+bvw_get_decoder_codec (GstElement *decoder)
+{
+  g_autoptr(GstPad) pad = NULL;
+  g_autoptr(GstCaps) caps = NULL;
+
+  pad = gst_element_get_static_pad (decoder, "sink");
+  if (pad == NULL)
+    return NULL;
+  caps = gst_pad_get_current_caps (pad);
+  if (caps == NULL || gst_caps_get_size (caps) == 0)
+    return NULL;
+
+  return g_strdup (gst_structure_get_name (gst_caps_get_structure (caps, 0)));
+}
+
+/* Demote hardware decoders that error out, so that the next playback
+ * picks another decoder */
+static void
+bvw_check_decoder_error (BaconVideoWidget *bvw, GstMessage *err_msg)
+{
+  GstElementFactory *factory;
+  g_autofree char *codec = NULL;
+
+  if (!GST_IS_ELEMENT (GST_MESSAGE_SRC (err_msg)))
+    return;
+
+  factory = gst_element_get_factory (GST_ELEMENT (GST_MESSAGE_SRC (err_msg)));
+  if (factory == NULL || !totem_decoder_policy_is_hardware_video_decoder (factory))
+    return;
+
+  codec = bvw_get_decoder_codec (GST_ELEMENT (GST_MESSAGE_SRC (err_msg)));
+  if (codec == NULL)
+    return;
+
+  totem_decoder_policy_record_failure (totem_decoder_policy_get_default (),
+                                       gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory)),
+                                       codec, bvw->video_width, bvw->video_height);
+}
+
+/* Accumulate the video sink's frame counters, which get reset on every
+ * flush, so this needs calling before seeking or changing the rate, as
+ * well as regularly. Frames shown while seeking, scrubbing or not at
+ * the normal rate say nothing about how well the decoder copes, so
+ * they aren't counted towards the decoder policy. */
+static void
+bvw_update_frame_stats (BaconVideoWidget *bvw)
+{
+  g_autoptr(GstStructure) sink_stats = NULL;
+  guint64 rendered = 0, dropped = 0;
+
+  if (bvw->video_sink == NULL || !GST_IS_BASE_SINK (bvw->video_sink))
+    return;
+
+  g_object_get (bvw->video_sink, "stats", &sink_stats, NULL);
+  if (sink_stats == NULL)
+    return;
+  gst_structure_get_uint64 (sink_stats, "rendered", &rendered);
+  gst_structure_get_uint64 (sink_stats, "dropped", &dropped);
+
+  if (rendered < bvw->sink_rendered || dropped < bvw->sink_dropped)
+    bvw->sink_rendered = bvw->sink_dropped = 0;
+
+  bvw->stats.frames_rendered += rendered - bvw->sink_rendered;
+  bvw->stats.frames_dropped += dropped - bvw->sink_dropped;
+  if (bvw->rate == FORWARD_RATE && !bvw->seek_in_flight && !bvw->scrubbing) {
+    bvw->decoder_rendered += rendered - bvw->sink_rendered;
+    bvw->decoder_dropped += dropped - bvw->sink_dropped;
+  }
+  bvw->sink_rendered = rendered;
+  bvw->sink_dropped = dropped;
+}
+
+static void
+bvw_handle_qos (BaconVideoWidget *bvw, GstMessage *message)
+{
+  gint64 jitter;
+
+  /* Only the video sink's stats tell how well the video decoder copes */
+  if (bvw->video_sink == NULL ||
+      (GST_MESSAGE_SRC (message) != GST_OBJECT (bvw->video_sink) &&
+       !gst_object_has_as_ancestor (GST_MESSAGE_SRC (message), GST_OBJECT (bvw->video_sink))))
+    return;
+
+  gst_message_parse_qos_values (message, &jitter, NULL, NULL);
+  bvw->stats.max_lateness = MAX (bvw->stats.max_lateness, jitter / GST_USECOND);
+
+  bvw_update_frame_stats (bvw);
+}
+
+static void
+bvw_handle_latency (BaconVideoWidget *bvw)
+{
+  g_autoptr(GstQuery) query = NULL;
+  GstClockTime min_latency;
+
+  query = gst_query_new_latency ();
+  if (!gst_element_query (bvw->play, query))
+    return;
+
+  gst_query_parse_latency (query, NULL, &min_latency, NULL);
+  if (GST_CLOCK_TIME_IS_VALID (min_latency))
+    bvw->stats.latency = min_latency / GST_USECOND;
+  GST_DEBUG ("Pipeline latency now %" GST_TIME_FORMAT, GST_TIME_ARGS (min_latency));
+}
+
+static void
+bvw_start_state_change (BaconVideoWidget *bvw, GstState state)
+{
+  bvw->state_change_start = g_get_monotonic_time ();
+  bvw->state_change_target = state;
+}
+
+static void
+bvw_record_decoder_playback (BaconVideoWidget *bvw)
+{
+  g_autoptr(GstElement) decoder = NULL;
+  g_autofree char *codec = NULL;
+  guint64 processed, dropped;
+
+  if (bvw->decoder_playback_recorded || bvw->play == NULL)
+    return;
+
+  bvw_update_frame_stats (bvw);
+  processed = bvw->decoder_rendered;
+  dropped = bvw->decoder_dropped;
+  if (processed + dropped == 0)
+    return;
+  bvw->decoder_playback_recorded = TRUE;
+
+  decoder = bvw_find_hardware_video_decoder (bvw);
+  if (decoder == NULL)
+    return;
+  codec = bvw_get_decoder_codec (decoder);
+  if (codec == NULL)
+    return;
+
+  totem_decoder_policy_record_playback (totem_decoder_policy_get_default (),
+                                        gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (gst_element_get_factory (decoder))),
+                                        codec, bvw->video_width, bvw->video_height,
+                                        processed, dropped);
+}
+
 static gboolean
 bvw_check_mpeg_eos (BaconVideoWidget *bvw, GstMessage *err_msg)
 {
@@ -1458,11 +1909,50 @@ bvw_check_mpeg_eos (BaconVideoWidget *bvw, GstMessage *err_msg)
   return ret;
 }
 
+static int
+bvw_tags_type_from_name (const char *type)
+{
+  guint i;
+
+  for (i = 0; i < BVW_TAGS_N_TYPES; i++) {
+    if (g_str_equal (type, tags_type_names[i]))
+      return i;
+  }
+  return -1;
+}
+
+static void
+bvw_clear_tags (BaconVideoWidget *bvw)
+{
+  guint i;
+
+  g_clear_pointer (&bvw->tagcache, gst_tag_list_unref);
+  g_clear_pointer (&bvw->audiotags, gst_tag_list_unref);
+  g_clear_pointer (&bvw->videotags, gst_tag_list_unref);
+  for (i = 0; i < BVW_TAGS_N_TYPES; i++)
+    g_clear_pointer (&bvw->last_tags[i], gst_tag_list_unref);
+}
+
 static void
 bvw_update_tags (BaconVideoWidget * bvw, GstTagList *tag_list, const gchar *type)
 {
   GstTagList **cache = NULL;
   GstTagList *result;
+  int type_idx;
+
+  /* Streams resend their whole tag list whenever any tag changes, so
+   * check the (small) list against the last one for this stream type
+   * before merging it into the (large) cache */
+  type_idx = bvw_tags_type_from_name (type);
+  if (type_idx >= 0 && tag_list != NULL) {
+    if (bvw->last_tags[type_idx] != NULL &&
+        gst_tag_list_is_equal (bvw->last_tags[type_idx], tag_list)) {
+      GST_LOG ("Skipping unchanged %s tags", type);
+      gst_tag_list_unref (tag_list);
+      return;
+    }
+    gst_tag_list_replace (&bvw->last_tags[type_idx], tag_list);
+  }
 
   /* all tags (replace previous tags, title/artist/etc. might change
    * in the middle of a stream, e.g. with radio streams) */
@@ -1472,6 +1962,7 @@ bvw_update_tags (BaconVideoWidget * bvw, GstTagList *tag_list, const gchar *type
       result &&
       gst_tag_list_is_equal (result, bvw->tagcache)) {
     gst_tag_list_unref (result);
+    gst_tag_list_unref (tag_list);
     GST_WARNING ("Pipeline sent %s tags update with no changes", type);
     return;
   }
@@ -1502,49 +1993,75 @@ bvw_update_tags (BaconVideoWidget * bvw, GstTagList *tag_list, const gchar *type
   set_current_actor (bvw);
 }
 
-static void
-update_tags_delayed_data_destroy (UpdateTagsDelayedData *data)
+static GstTagList *
+bvw_exchange_pending_tags (GstTagList **slot, GstTagList *tags)
 {
-  g_slice_free (UpdateTagsDelayedData, data);
+  GstTagList *old;
+
+  do {
+    old = g_atomic_pointer_get (slot);
+  } while (!g_atomic_pointer_compare_and_exchange (slot, old, tags));
+
+  return old;
 }
 
 static gboolean
 bvw_update_tags_dispatcher (BaconVideoWidget *bvw)
 {
-  UpdateTagsDelayedData *data;
+  guint i;
+
+  /* Cleared first, so tags arriving while we dispatch schedule
+   * another run */
+  g_atomic_int_set (&bvw->tag_update_pending, 0);
 
-  /* If we take the queue's lock for the entire function call, we can use it to protect tag_update_id too */
-  g_async_queue_lock (bvw->tag_update_queue);
+  for (i = 0; i < BVW_TAGS_N_TYPES; i++) {
+    GstTagList *tags;
 
-  while ((data = g_async_queue_try_pop_unlocked (bvw->tag_update_queue)) != NULL) {
-    bvw_update_tags (bvw, data->tags, data->type);
-    update_tags_delayed_data_destroy (data);
+    tags = bvw_exchange_pending_tags (&bvw->pending_tags[i], NULL);
+    if (tags)
+      bvw_update_tags (bvw, tags, tags_type_names[i]);
   }
 
-  bvw->tag_update_id = 0;
-  g_async_queue_unlock (bvw->tag_update_queue);
+  return G_SOURCE_CONTINUE;
+}
 
-  return FALSE;
+static gboolean
+bvw_tag_source_dispatch (GSource     *source,
+                         GSourceFunc  callback,
+                         gpointer     user_data)
+{
+  g_source_set_ready_time (source, -1);
+  return callback (user_data);
 }
 
+static GSourceFuncs bvw_tag_source_funcs = {
+  NULL,
+  NULL,
+  bvw_tag_source_dispatch,
+  NULL,
+};
+
 /* Marshal the changed tags to the main thread for updating the GUI
- * and sending the BVW signals */
+ * and sending the BVW signals.
+ *
+ * tags-changed is emitted from the streaming threads, and each time
+ * with the stream's full tag list, so there's one slot per stream
+ * type: a newer list replaces one that wasn't dispatched yet, without
+ * taking any lock, and the main thread merges at most one list per
+ * stream type each time it dispatches. */
 static void
-bvw_update_tags_delayed (BaconVideoWidget *bvw, GstTagList *tags, const gchar *type) {
-  UpdateTagsDelayedData *data = g_slice_new0 (UpdateTagsDelayedData);
-
-  data->tags = tags;
-  data->type = type;
-
-  g_async_queue_lock (bvw->tag_update_queue);
-  g_async_queue_push_unlocked (bvw->tag_update_queue, data);
+bvw_update_tags_delayed (BaconVideoWidget *bvw, GstTagList *tags, BvwTagsType type)
+{
+  GstTagList *old;
 
-  if (bvw->tag_update_id == 0) {
-    bvw->tag_update_id = g_idle_add ((GSourceFunc) bvw_update_tags_dispatcher, bvw);
-    g_source_set_name_by_id (bvw->tag_update_id, "[totem] bvw_update_tags_dispatcher");
+  old = bvw_exchange_pending_tags (&bvw->pending_tags[type], tags);
+  if (old) {
+    GST_LOG ("Replacing undispatched %s tags", tags_type_names[type]);
+    gst_tag_list_unref (old);
   }
 
-  g_async_queue_unlock (bvw->tag_update_queue);
+  if (g_atomic_int_compare_and_exchange (&bvw->tag_update_pending, 0, 1))
+    g_source_set_ready_time (bvw->tag_update_source, 0);
 }
 
 static void
@@ -1563,7 +2080,7 @@ video_tags_changed_cb (GstElement *playbin2, gint stream_id, gpointer user_data)
   g_signal_emit_by_name (G_OBJECT (bvw->play), "get-video-tags", stream_id, &tags);
 
   if (tags)
-    bvw_update_tags_delayed (bvw, tags, "video");
+    bvw_update_tags_delayed (bvw, tags, BVW_TAGS_VIDEO);
 }
 
 static void
@@ -1582,7 +2099,7 @@ audio_tags_changed_cb (GstElement *playbin2, gint stream_id, gpointer user_data)
   g_signal_emit_by_name (G_OBJECT (bvw->play), "get-audio-tags", stream_id, &tags);
 
   if (tags)
-    bvw_update_tags_delayed (bvw, tags, "audio");
+    bvw_update_tags_delayed (bvw, tags, BVW_TAGS_AUDIO);
 }
 
 static void
@@ -1601,7 +2118,7 @@ text_tags_changed_cb (GstElement *playbin2, gint stream_id, gpointer user_data)
   g_signal_emit_by_name (G_OBJECT (bvw->play), "get-text-tags", stream_id, &tags);
 
   if (tags)
-    bvw_update_tags_delayed (bvw, tags, "text");
+    bvw_update_tags_delayed (bvw, tags, BVW_TAGS_TEXT);
 }
 
 static gboolean
@@ -1666,6 +2183,10 @@ bvw_handle_buffering_message (GstMessage * message, BaconVideoWidget *bvw)
   if (percent >= 100) {
     /* a 100% message means buffering is done */
     bvw->buffering = FALSE;
+    if (bvw->buffering_start != 0) {
+      bvw->stats.buffering_time += g_get_monotonic_time () - bvw->buffering_start;
+      bvw->buffering_start = 0;
+    }
     /* if the desired state is playing, go back */
     if (bvw->target_state == GST_STATE_PLAYING) {
       GST_DEBUG ("Buffering done, setting pipeline back to PLAYING");
@@ -1676,10 +2197,14 @@ bvw_handle_buffering_message (GstMessage * message, BaconVideoWidget *bvw)
   } else if (bvw->target_state == GST_STATE_PLAYING) {
     GstState cur_state;
 
+    if (bvw->buffering_start == 0)
+      bvw->buffering_start = g_get_monotonic_time ();
+
     gst_element_get_state (bvw->play, &cur_state, NULL, 0);
     if (cur_state != GST_STATE_PAUSED) {
       GST_DEBUG ("Buffering ... temporarily pausing playback %d%%", percent);
       gst_element_set_state (bvw->play, GST_STATE_PAUSED);
+      bvw->stats.buffering_stalls++;
     } else {
       GST_LOG ("Buffering (already paused) ... %d%%", percent);
     }
@@ -1749,6 +2274,217 @@ out:
   gst_toc_unref (toc);
 }
 
+static void
+bvw_refresh_tags (BaconVideoWidget *bvw)
+{
+  const char *types[] = { "video", "audio", "text" };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (types); i++) {
+    GstTagList *tags;
+
+    tags = bvw_get_tags_of_current_stream (bvw, types[i]);
+    if (tags)
+      bvw_update_tags (bvw, tags, types[i]);
+  }
+}
+
+/* The type of the stream going into @object, from the stream-start
+ * event on its sink pad */
+static GstStreamType
+bvw_get_stream_type_of_object (GstObject *object)
+{
+  GstStreamType type = GST_STREAM_TYPE_UNKNOWN;
+  GstStream *stream = NULL;
+  GstEvent *event;
+  GstPad *pad;
+
+  if (!GST_IS_ELEMENT (object))
+    return type;
+
+  pad = gst_element_get_static_pad (GST_ELEMENT (object), "sink");
+  if (pad == NULL)
+    return type;
+
+  event = gst_pad_get_sticky_event (pad, GST_EVENT_STREAM_START, 0);
+  if (event != NULL) {
+    gst_event_parse_stream (event, &stream);
+    if (stream != NULL) {
+      type = gst_stream_get_stream_type (stream);
+      gst_object_unref (stream);
+    }
+    gst_event_unref (event);
+  }
+  gst_object_unref (pad);
+
+  return type;
+}
+
+static void
+bvw_handle_tag_message (BaconVideoWidget *bvw, GstMessage *message)
+{
+  GstTagList *tags = NULL;
+  GstStreamType stream_type;
+  const char *type;
+
+  gst_message_parse_tag (message, &tags);
+
+  /* Only sinks post tags with playbin3, and only for the
+   * selected streams */
+  stream_type = bvw_get_stream_type_of_object (GST_MESSAGE_SRC (message));
+  if (gst_object_has_as_ancestor (GST_MESSAGE_SRC (message),
+                                  GST_OBJECT (bvw->video_sink)) ||
+      (stream_type & GST_STREAM_TYPE_VIDEO))
+    type = "video";
+  else if (stream_type & GST_STREAM_TYPE_TEXT)
+    type = "text";
+  else
+    type = "audio";
+
+  bvw_update_tags (bvw, tags, type);
+}
+
+static char **
+bvw_get_selected_stream_id_ptr (BaconVideoWidget *bvw, GstStreamType type)
+{
+  if (type & GST_STREAM_TYPE_VIDEO)
+    return &bvw->selected_video_id;
+  if (type & GST_STREAM_TYPE_AUDIO)
+    return &bvw->selected_audio_id;
+  if (type & GST_STREAM_TYPE_TEXT)
+    return &bvw->selected_text_id;
+  return NULL;
+}
+
+static void
+bvw_clear_stream_selection (BaconVideoWidget *bvw)
+{
+  g_clear_pointer (&bvw->selected_video_id, g_free);
+  g_clear_pointer (&bvw->selected_audio_id, g_free);
+  g_clear_pointer (&bvw->selected_text_id, g_free);
+  bvw->select_time = 0;
+}
+
+static void
+bvw_handle_stream_collection (BaconVideoWidget *bvw, GstMessage *message)
+{
+  GstStreamCollection *collection = NULL;
+
+  gst_message_parse_stream_collection (message, &collection);
+  if (collection == NULL)
+    return;
+
+  GST_DEBUG ("Got stream collection with %u streams",
+             gst_stream_collection_get_size (collection));
+
+  gst_clear_object (&bvw->collection);
+  bvw->collection = collection;
+
+  bvw_update_stream_info (bvw);
+}
+
+static void
+bvw_handle_streams_selected (BaconVideoWidget *bvw, GstMessage *message)
+{
+  guint i, n;
+
+  if (bvw->select_time != 0) {
+    GST_DEBUG ("Stream selection took %" G_GINT64_FORMAT " µs",
+               g_get_monotonic_time () - bvw->select_time);
+  }
+
+  bvw_clear_stream_selection (bvw);
+
+  n = gst_message_streams_selected_get_size (message);
+  for (i = 0; i < n; i++) {
+    g_autoptr(GstStream) stream = NULL;
+    char **id;
+
+    stream = gst_message_streams_selected_get_stream (message, i);
+    id = bvw_get_selected_stream_id_ptr (bvw, gst_stream_get_stream_type (stream));
+    if (id == NULL)
+      continue;
+
+    g_free (*id);
+    *id = g_strdup (gst_stream_get_stream_id (stream));
+  }
+
+  GST_DEBUG ("Selected streams: video '%s', audio '%s', text '%s'",
+             GST_STR_NULL (bvw->selected_video_id),
+             GST_STR_NULL (bvw->selected_audio_id),
+             GST_STR_NULL (bvw->selected_text_id));
+
+  bvw_update_stream_info (bvw);
+  bvw_refresh_tags (bvw);
+}
+
+static void
+bvw_handle_stream_start (BaconVideoWidget *bvw)
+{
+  char *mrl, *subtitle_uri;
+  gint64 latency;
+
+  g_mutex_lock (&bvw->gapless_mutex);
+  if (!bvw->gapless_pending) {
+    g_mutex_unlock (&bvw->gapless_mutex);
+    return;
+  }
+  mrl = g_steal_pointer (&bvw->next_mrl);
+  subtitle_uri = g_steal_pointer (&bvw->next_subtitle_uri);
+  latency = MAX (0, g_get_monotonic_time () - bvw->gapless_end_time);
+  bvw->gapless_pending = FALSE;
+  g_mutex_unlock (&bvw->gapless_mutex);
+
+  GST_DEBUG ("Gapless switch to '%s', latency %" G_GINT64_FORMAT " µs",
+             GST_STR_NULL (mrl), latency);
+
+  g_free (bvw->mrl);
+  bvw->mrl = mrl;
+  g_free (bvw->subtitle_uri);
+  bvw->subtitle_uri = subtitle_uri;
+
+  /* The pipeline kept running, so reset everything that
+   * bacon_video_widget_close() would have */
+  bvw->seekable = -1;
+  bvw->stream_length = 0;
+  bvw->current_time = 0;
+  bvw->is_menu = FALSE;
+  bvw->has_angles = FALSE;
+  bvw->got_redirect = FALSE;
+
+  if (bvw->chapters) {
+    g_list_free_full (bvw->chapters, (GDestroyNotify) gst_mini_object_unref);
+    bvw->chapters = NULL;
+  }
+
+  /* The next stream's tags might have arrived while the previous
+   * one was still playing, so fetch them again */
+  bvw_clear_tags (bvw);
+  bvw_refresh_tags (bvw);
+
+  bacon_video_widget_get_stream_length (bvw);
+  bvw_update_stream_info (bvw);
+  g_object_notify (G_OBJECT (bvw), "seekable");
+
+  g_signal_emit (bvw, bvw_signals[SIGNAL_STREAM_SWITCHED], 0,
+                 bvw->mrl, latency, TRUE);
+}
+
+static void
+bvw_add_seek_latency (BaconVideoWidget *bvw, GstClockTime latency)
+{
+  if (bvw->n_seek_latencies == 0)
+    bvw->seek_latency = latency;
+  else
+    bvw->seek_latency = (3 * bvw->seek_latency + latency) / 4;
+  bvw->n_seek_latencies++;
+  bvw->stats.max_seek_latency = MAX (bvw->stats.max_seek_latency,
+                                     (gint64) (latency / GST_USECOND));
+
+  GST_DEBUG ("Seek took %" GST_TIME_FORMAT ", average %" GST_TIME_FORMAT,
+             GST_TIME_ARGS (latency), GST_TIME_ARGS (bvw->seek_latency));
+}
+
 static void
 bvw_bus_message_cb (GstBus * bus, GstMessage * message, BaconVideoWidget *bvw)
 {
@@ -1768,6 +2504,7 @@ bvw_bus_message_cb (GstBus * bus, GstMessage * message, BaconVideoWidget *bvw)
   switch (msg_type) {
     case GST_MESSAGE_ERROR: {
       totem_gst_message_print (message, bvw->play, "totem-error");
+      bvw_check_decoder_error (bvw, message);
 
       if (!bvw_check_missing_plugins_error (bvw, message) &&
 	  !bvw_check_missing_auth (bvw, message) &&
@@ -1794,14 +2531,26 @@ bvw_bus_message_cb (GstBus * bus, GstMessage * message, BaconVideoWidget *bvw)
       break;
     }
     case GST_MESSAGE_TAG: 
-      /* Ignore TAG messages, we get updated tags from the
-       * {audio,video,text}-tags-changed signals of playbin2
+      /* Ignore TAG messages with playbin, we get updated tags from the
+       * {audio,video,text}-tags-changed signals instead
        */
+      if (bvw->use_playbin3)
+        bvw_handle_tag_message (bvw, message);
+      break;
+    case GST_MESSAGE_STREAM_COLLECTION:
+      bvw_handle_stream_collection (bvw, message);
+      break;
+    case GST_MESSAGE_STREAMS_SELECTED:
+      bvw_handle_streams_selected (bvw, message);
+      break;
+    case GST_MESSAGE_QOS:
+      bvw_handle_qos (bvw, message);
       break;
     case GST_MESSAGE_EOS:
       GST_DEBUG ("EOS message");
       /* update slider one last time */
-      bvw_query_timeout (bvw);
+      bvw_tick (bvw);
+      bvw_record_decoder_playback (bvw);
       if (bvw->eos_id == 0) {
         bvw->eos_id = g_idle_add (bvw_signal_eos_delayed, bvw);
         g_source_set_name_by_id (bvw->eos_id, "[totem] bvw_signal_eos_delayed");
@@ -1840,10 +2589,34 @@ bvw_bus_message_cb (GstBus * bus, GstMessage * message, BaconVideoWidget *bvw)
 
       /* now do stuff */
       if (new_state <= GST_STATE_PAUSED) {
-        bvw_query_timeout (bvw);
-        bvw_reconfigure_tick_timeout (bvw, 0);
+        bvw_tick (bvw);
+        bvw_set_tick_playing (bvw, FALSE);
       } else if (new_state > GST_STATE_PAUSED) {
-        bvw_reconfigure_tick_timeout (bvw, 200);
+        bvw_set_tick_playing (bvw, TRUE);
+      }
+
+      if (new_state == bvw->state_change_target && bvw->state_change_start != 0) {
+        gint64 duration;
+
+        duration = g_get_monotonic_time () - bvw->state_change_start;
+        bvw->state_change_start = 0;
+        if (new_state == GST_STATE_PAUSED)
+          bvw->stats.preroll_time = duration;
+        else
+          bvw->stats.resume_time = duration;
+        GST_DEBUG ("Getting to %s took %" G_GINT64_FORMAT " µs",
+                   gst_element_state_get_name (new_state), duration);
+      }
+
+      if (new_state == GST_STATE_PLAYING && bvw->switch_start_time != 0) {
+        gint64 latency;
+
+        latency = g_get_monotonic_time () - bvw->switch_start_time;
+        bvw->switch_start_time = 0;
+        GST_DEBUG ("Switch to '%s', latency %" G_GINT64_FORMAT " µs",
+                   GST_STR_NULL (bvw->mrl), latency);
+        g_signal_emit (bvw, bvw_signals[SIGNAL_STREAM_SWITCHED], 0,
+                       bvw->mrl, latency, FALSE);
       }
 
       if (old_state == GST_STATE_READY && new_state == GST_STATE_PAUSED) {
@@ -1856,17 +2629,18 @@ bvw_bus_message_cb (GstBus * bus, GstMessage * message, BaconVideoWidget *bvw)
         bvw_show_error_if_video_decoder_is_missing (bvw);
 	/* Now that we have the length, check whether we wanted
 	 * to pause or to stop the pipeline */
-        if (bvw->target_state == GST_STATE_PAUSED)
+        if (bvw->target_state == GST_STATE_PAUSED) {
+	  /* Not a switch we can measure */
+	  bvw->switch_start_time = 0;
 	  bacon_video_widget_pause (bvw);
+	}
       } else if (old_state == GST_STATE_PAUSED && new_state == GST_STATE_READY) {
         bvw->media_has_video = FALSE;
         bvw->media_has_audio = FALSE;
 	bvw->media_has_unsupported_video = FALSE;
 
         /* clean metadata cache */
-	g_clear_pointer (&bvw->tagcache, gst_tag_list_unref);
-	g_clear_pointer (&bvw->audiotags, gst_tag_list_unref);
-	g_clear_pointer (&bvw->videotags, gst_tag_list_unref);
+	bvw_clear_tags (bvw);
 
         bvw->video_width = 0;
         bvw->video_height = 0;
@@ -1889,18 +2663,32 @@ bvw_bus_message_cb (GstBus * bus, GstMessage * message, BaconVideoWidget *bvw)
 
     case GST_MESSAGE_ASYNC_DONE: {
 	gint64 _time;
+	GstSeekFlags flags;
+	GstClockTime now;
+	/* Frames shown while seeking don't count towards the decoder's */
+	bvw_update_frame_stats (bvw);
 	/* When a seek has finished, set the playing state again */
 	g_mutex_lock (&bvw->seek_mutex);
 
-	bvw->seek_req_time = gst_clock_get_internal_time (bvw->clock);
+	now = gst_clock_get_internal_time (bvw->clock);
+	if (bvw->seek_in_flight)
+	  bvw_add_seek_latency (bvw, now - bvw->seek_req_time);
+	bvw->seek_in_flight = FALSE;
 	_time = bvw->seek_time;
+	flags = bvw->seek_flags;
 	bvw->seek_time = -1;
+	if (_time >= 0) {
+	  bvw->seek_req_time = now;
+	  bvw->seek_in_flight = TRUE;
+	}
 
 	g_mutex_unlock (&bvw->seek_mutex);
 
 	if (_time >= 0) {
 	  GST_DEBUG ("Have an old seek to schedule, doing it now");
-	  bacon_video_widget_seek_time_no_lock (bvw, _time, 0, NULL);
+	  bacon_video_widget_seek_time_no_lock (bvw, _time, flags, NULL);
+	} else if (bvw->scrubbing) {
+	  GST_DEBUG ("Staying paused while scrubbing");
 	} else if (bvw->target_state == GST_STATE_PLAYING) {
 	  GST_DEBUG ("Maybe starting deferred playback after seek");
 	  bacon_video_widget_play (bvw, NULL);
@@ -1916,6 +2704,22 @@ bvw_bus_message_cb (GstBus * bus, GstMessage * message, BaconVideoWidget *bvw)
 	break;
     }
 
+    case GST_MESSAGE_STREAM_START: {
+	bvw_handle_stream_start (bvw);
+	break;
+    }
+
+    case GST_MESSAGE_LATENCY:
+      bvw_handle_latency (bvw);
+      break;
+
+    case GST_MESSAGE_STEP_DONE:
+      if (bvw->step_start != 0) {
+        bvw->stats.step_latency = g_get_monotonic_time () - bvw->step_start;
+        bvw->step_start = 0;
+      }
+      break;
+
     /* FIXME: at some point we might want to handle CLOCK_LOST and set the
      * pipeline back to PAUSED and then PLAYING again to select a different
      * clock (this seems to trip up rtspsrc though so has to wait until
@@ -1929,19 +2733,15 @@ bvw_bus_message_cb (GstBus * bus, GstMessage * message, BaconVideoWidget *bvw)
 
     case GST_MESSAGE_UNKNOWN:
     case GST_MESSAGE_INFO:
-    case GST_MESSAGE_STEP_DONE:
     case GST_MESSAGE_STRUCTURE_CHANGE:
     case GST_MESSAGE_SEGMENT_START:
     case GST_MESSAGE_SEGMENT_DONE:
-    case GST_MESSAGE_LATENCY:
     case GST_MESSAGE_ASYNC_START:
     case GST_MESSAGE_REQUEST_STATE:
     case GST_MESSAGE_STEP_START:
-    case GST_MESSAGE_QOS:
     case GST_MESSAGE_PROGRESS:
     case GST_MESSAGE_ANY:
     case GST_MESSAGE_RESET_TIME:
-    case GST_MESSAGE_STREAM_START:
     case GST_MESSAGE_NEED_CONTEXT:
     case GST_MESSAGE_HAVE_CONTEXT:
     default:
@@ -1951,10 +2751,8 @@ bvw_bus_message_cb (GstBus * bus, GstMessage * message, BaconVideoWidget *bvw)
 }
 
 static void
-got_time_tick (GstElement * play, gint64 time_nanos, BaconVideoWidget * bvw)
+bvw_set_position (BaconVideoWidget *bvw, gint64 time_nanos)
 {
-  gboolean seekable;
-
   bvw->current_time = (gint64) time_nanos / GST_MSECOND;
 
   if (bvw->stream_length == 0) {
@@ -1964,6 +2762,35 @@ got_time_tick (GstElement * play, gint64 time_nanos, BaconVideoWidget * bvw)
       (gdouble) bvw->current_time / bvw->stream_length;
   }
 
+  bvw->last_tick_time = g_get_monotonic_time ();
+}
+
+/* Ticks are sparse unless video is being shown, so refresh the position
+ * when it's asked for. One query then serves every caller until the next
+ * tick is due. */
+static void
+bvw_refresh_position (BaconVideoWidget *bvw)
+{
+  gint64 pos = -1;
+
+  if (bvw->play == NULL)
+    return;
+  if (bvw->tick_mode != BVW_TICK_AUDIO && bvw->tick_mode != BVW_TICK_HIDDEN)
+    return;
+  if (g_get_monotonic_time () - bvw->last_tick_time < TICK_INTERVAL * G_TIME_SPAN_MILLISECOND)
+    return;
+
+  if (gst_element_query_position (bvw->play, GST_FORMAT_TIME, &pos) && pos != -1)
+    bvw_set_position (bvw, pos);
+}
+
+static void
+got_time_tick (GstElement * play, gint64 time_nanos, BaconVideoWidget * bvw)
+{
+  gboolean seekable;
+
+  bvw_set_position (bvw, time_nanos);
+
   if (bvw->stream_length == 0) {
     seekable = bacon_video_widget_is_seekable (bvw);
   } else {
@@ -2134,6 +2961,8 @@ playbin_source_setup_cb (GstElement       *playbin,
 			 BaconVideoWidget *bvw)
 {
   GST_DEBUG ("Got source of type '%s'", G_OBJECT_TYPE_NAME (source));
+  if (BACON_IS_CACHE_SRC (source))
+    source = bacon_cache_src_get_upstream (BACON_CACHE_SRC (source));
   if (g_strcmp0 (G_OBJECT_TYPE_NAME (source), "GstCurlHttpSrc") == 0)
     g_warning ("Download buffering not supported with GstCurlHttpSrc, see https://gitlab.freedesktop.org/gstreamer/gst-plugins-base/issues/551");
   bvw_set_user_agent_on_element (bvw, source);
@@ -2142,13 +2971,64 @@ playbin_source_setup_cb (GstElement       *playbin,
   bvw_set_proxy_on_element (bvw, source);
 }
 
+/* Put the hardware decoders that failed with this codec and size
+ * last, so that decodebin tries the other decoders first */
+static GValueArray *
+uridecodebin_autoplug_sort_cb (GstElement  *bin,
+			       GstPad      *pad,
+			       GstCaps     *caps,
+			       GValueArray *factories,
+			       gpointer     user_data)
+{
+  GList *list = NULL, *ranked, *l, *m;
+  GValueArray *result = NULL;
+  guint i;
+
+  G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+  for (i = factories->n_values; i > 0; i--)
+    list = g_list_prepend (list, g_value_get_object (g_value_array_get_nth (factories, i - 1)));
+
+  ranked = totem_decoder_policy_rank_factories (totem_decoder_policy_get_default (), list, caps);
+
+  /* Let decodebin use its own list if nothing moved */
+  for (l = list, m = ranked; l != NULL && l->data == m->data; l = l->next, m = m->next)
+    ;
+  if (l != NULL) {
+    result = g_value_array_new (factories->n_values);
+    for (m = ranked; m != NULL; m = m->next) {
+      GValue value = G_VALUE_INIT;
+
+      g_value_init (&value, GST_TYPE_ELEMENT_FACTORY);
+      g_value_set_object (&value, m->data);
+      g_value_array_append (result, &value);
+      g_value_unset (&value);
+    }
+    GST_DEBUG ("Reordered decoders for %" GST_PTR_FORMAT, caps);
+  }
+  G_GNUC_END_IGNORE_DEPRECATIONS
+
+  gst_plugin_feature_list_free (ranked);
+  g_list_free (list);
+
+  return result;
+}
+
 static void
 playbin_element_setup_cb (GstElement *playbin,
 			  GstElement *element,
 			  BaconVideoWidget *bvw)
 {
+  GstElementFactory *factory;
   char *template;
 
+  factory = gst_element_get_factory (element);
+  if (factory != NULL &&
+      g_str_equal (gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory)), "uridecodebin")) {
+    g_signal_connect (element, "autoplug-sort",
+		      G_CALLBACK (uridecodebin_autoplug_sort_cb), NULL);
+    return;
+  }
+
   if (g_strcmp0 (G_OBJECT_TYPE_NAME (element), "GstDownloadBuffer") != 0)
     return;
 
@@ -2174,8 +3054,8 @@ playbin_deep_notify_cb (GstObject  *gstobject,
 		NULL);
 }
 
-static gboolean
-bvw_query_timeout (BaconVideoWidget *bvw)
+static void
+bvw_tick (BaconVideoWidget *bvw)
 {
   gint64 pos = -1;
 
@@ -2188,7 +3068,20 @@ bvw_query_timeout (BaconVideoWidget *bvw)
     GST_DEBUG ("could not get position");
   }
 
-  return TRUE;
+  bvw_update_frame_stats (bvw);
+}
+
+static gboolean
+bvw_query_timeout (BaconVideoWidget *bvw)
+{
+  /* Only a fallback when the frame clock drives the ticks */
+  if (bvw->tick_mode == BVW_TICK_FRAME_CLOCK &&
+      g_get_monotonic_time () - bvw->last_tick_time < TICK_INTERVAL_FALLBACK * G_TIME_SPAN_MILLISECOND)
+    return G_SOURCE_CONTINUE;
+
+  bvw_tick (bvw);
+
+  return G_SOURCE_CONTINUE;
 }
 
 static gboolean
@@ -2253,34 +3146,218 @@ bvw_query_buffering_timeout (BaconVideoWidget *bvw)
   } else {
     g_debug ("Failed to query the source element for buffering info in percent");
   }
-  gst_query_unref (query);
+  gst_query_unref (query);
+
+  return TRUE;
+}
+
+static void
+caps_set (GObject * obj,
+    GParamSpec * pspec, BaconVideoWidget * bvw)
+{
+  GstPad *pad = GST_PAD (obj);
+  GstStructure *s;
+  GstCaps *caps;
+
+  if (!(caps = gst_pad_get_current_caps (pad)))
+    return;
+
+  /* Get video decoder caps */
+  s = gst_caps_get_structure (caps, 0);
+  if (s) {
+    /* We need at least width/height and framerate */
+    if (!(gst_structure_get_fraction (s, "framerate", &bvw->video_fps_n,
+          &bvw->video_fps_d) &&
+          gst_structure_get_int (s, "width", &bvw->video_width) &&
+          gst_structure_get_int (s, "height", &bvw->video_height)))
+      return;
+  }
+
+  gst_caps_unref (caps);
+}
+
+static GstStreamType
+bvw_stream_type_from_name (const gchar *stream_type)
+{
+  if (g_ascii_strcasecmp (stream_type, "video") == 0)
+    return GST_STREAM_TYPE_VIDEO;
+  if (g_ascii_strcasecmp (stream_type, "audio") == 0)
+    return GST_STREAM_TYPE_AUDIO;
+  if (g_ascii_strcasecmp (stream_type, "text") == 0)
+    return GST_STREAM_TYPE_TEXT;
+  return GST_STREAM_TYPE_UNKNOWN;
+}
+
+/* Returns a new reference to the @index-th stream of @type
+ * in the playbin3 stream collection */
+static GstStream *
+bvw_get_nth_stream (BaconVideoWidget *bvw,
+                    GstStreamType     type,
+                    gint              index)
+{
+  guint i, n;
+
+  if (bvw->collection == NULL || index < 0)
+    return NULL;
+
+  n = gst_stream_collection_get_size (bvw->collection);
+  for (i = 0; i < n; i++) {
+    GstStream *stream;
+
+    stream = gst_stream_collection_get_stream (bvw->collection, i);
+    if ((gst_stream_get_stream_type (stream) & type) == 0)
+      continue;
+    if (index-- == 0)
+      return gst_object_ref (stream);
+  }
+
+  return NULL;
+}
+
+static gint
+bvw_get_stream_index (BaconVideoWidget *bvw,
+                      GstStreamType     type,
+                      const char       *stream_id)
+{
+  guint i, n;
+  gint index = 0;
+
+  if (bvw->collection == NULL || stream_id == NULL)
+    return -1;
+
+  n = gst_stream_collection_get_size (bvw->collection);
+  for (i = 0; i < n; i++) {
+    GstStream *stream;
+
+    stream = gst_stream_collection_get_stream (bvw->collection, i);
+    if ((gst_stream_get_stream_type (stream) & type) == 0)
+      continue;
+    if (g_strcmp0 (gst_stream_get_stream_id (stream), stream_id) == 0)
+      return index;
+    index++;
+  }
+
+  return -1;
+}
+
+static gint
+bvw_get_n_streams (BaconVideoWidget *bvw,
+                   GstStreamType     type)
+{
+  gint n = 0;
+
+  if (bvw->use_playbin3) {
+    guint i, size;
+
+    if (bvw->collection == NULL)
+      return 0;
+
+    size = gst_stream_collection_get_size (bvw->collection);
+    for (i = 0; i < size; i++) {
+      GstStream *stream;
+
+      stream = gst_stream_collection_get_stream (bvw->collection, i);
+      if (gst_stream_get_stream_type (stream) & type)
+        n++;
+    }
+    return n;
+  }
+
+  switch (type) {
+    case GST_STREAM_TYPE_VIDEO:
+      g_object_get (G_OBJECT (bvw->play), "n-video", &n, NULL);
+      break;
+    case GST_STREAM_TYPE_AUDIO:
+      g_object_get (G_OBJECT (bvw->play), "n-audio", &n, NULL);
+      break;
+    case GST_STREAM_TYPE_TEXT:
+      g_object_get (G_OBJECT (bvw->play), "n-text", &n, NULL);
+      break;
+    case GST_STREAM_TYPE_UNKNOWN:
+    case GST_STREAM_TYPE_CONTAINER:
+    default:
+      break;
+  }
+
+  return n;
+}
+
+static GstTagList *
+bvw_get_stream_tags (BaconVideoWidget *bvw,
+                     GstStreamType     type,
+                     gint              index)
+{
+  GstTagList *tags = NULL;
+
+  if (bvw->use_playbin3) {
+    g_autoptr(GstStream) stream = NULL;
+
+    stream = bvw_get_nth_stream (bvw, type, index);
+    if (stream)
+      tags = gst_stream_get_tags (stream);
+    return tags;
+  }
+
+  switch (type) {
+    case GST_STREAM_TYPE_VIDEO:
+      g_signal_emit_by_name (G_OBJECT (bvw->play), "get-video-tags", index, &tags);
+      break;
+    case GST_STREAM_TYPE_AUDIO:
+      g_signal_emit_by_name (G_OBJECT (bvw->play), "get-audio-tags", index, &tags);
+      break;
+    case GST_STREAM_TYPE_TEXT:
+      g_signal_emit_by_name (G_OBJECT (bvw->play), "get-text-tags", index, &tags);
+      break;
+    case GST_STREAM_TYPE_UNKNOWN:
+    case GST_STREAM_TYPE_CONTAINER:
+    default:
+      break;
+  }
 
-  return TRUE;
+  return tags;
 }
 
+/* Selects the @index-th stream of @type, or none if @index is negative,
+ * keeping the current selection for the other stream types. Unselected
+ * streams are not decoded at all by playbin3. */
 static void
-caps_set (GObject * obj,
-    GParamSpec * pspec, BaconVideoWidget * bvw)
-{
-  GstPad *pad = GST_PAD (obj);
-  GstStructure *s;
-  GstCaps *caps;
+bvw_select_stream (BaconVideoWidget *bvw,
+                   GstStreamType     type,
+                   gint              index)
+{
+  const GstStreamType types[] = {
+    GST_STREAM_TYPE_VIDEO,
+    GST_STREAM_TYPE_AUDIO,
+    GST_STREAM_TYPE_TEXT
+  };
+  GList *streams = NULL;
+  GstPlayFlags flags;
+  guint i;
 
-  if (!(caps = gst_pad_get_current_caps (pad)))
-    return;
+  g_object_get (bvw->play, "flags", &flags, NULL);
 
-  /* Get video decoder caps */
-  s = gst_caps_get_structure (caps, 0);
-  if (s) {
-    /* We need at least width/height and framerate */
-    if (!(gst_structure_get_fraction (s, "framerate", &bvw->video_fps_n,
-          &bvw->video_fps_d) &&
-          gst_structure_get_int (s, "width", &bvw->video_width) &&
-          gst_structure_get_int (s, "height", &bvw->video_height)))
-      return;
+  for (i = 0; i < G_N_ELEMENTS (types); i++) {
+    g_autoptr(GstStream) stream = NULL;
+    const char *id;
+
+    if (types[i] == GST_STREAM_TYPE_TEXT && (flags & GST_PLAY_FLAG_TEXT) == 0)
+      continue;
+
+    if (types[i] == type) {
+      stream = bvw_get_nth_stream (bvw, type, index);
+      id = stream ? gst_stream_get_stream_id (stream) : NULL;
+    } else {
+      id = *bvw_get_selected_stream_id_ptr (bvw, types[i]);
+    }
+
+    if (id != NULL)
+      streams = g_list_append (streams, g_strdup (id));
   }
 
-  gst_caps_unref (caps);
+  GST_DEBUG ("Selecting %u streams", g_list_length (streams));
+  bvw->select_time = g_get_monotonic_time ();
+  gst_element_send_event (bvw->play, gst_event_new_select_streams (streams));
+  g_list_free_full (streams, g_free);
 }
 
 static void
@@ -2289,8 +3366,8 @@ parse_stream_info (BaconVideoWidget *bvw)
   GstPad *videopad = NULL;
   gint n_audio, n_video;
 
-  g_object_get (G_OBJECT (bvw->play), "n-audio", &n_audio,
-      "n-video", &n_video, NULL);
+  n_audio = bvw_get_n_streams (bvw, GST_STREAM_TYPE_AUDIO);
+  n_video = bvw_get_n_streams (bvw, GST_STREAM_TYPE_VIDEO);
 
   bvw->media_has_video = FALSE;
   bvw->media_has_unsupported_video = FALSE;
@@ -2299,8 +3376,12 @@ parse_stream_info (BaconVideoWidget *bvw)
 
     bvw->media_has_video = TRUE;
 
-    for (i = 0; i < n_video && videopad == NULL; i++)
-      g_signal_emit_by_name (bvw->play, "get-video-pad", i, &videopad);
+    if (bvw->use_playbin3) {
+      videopad = gst_element_get_static_pad (bvw->video_sink, "sink");
+    } else {
+      for (i = 0; i < n_video && videopad == NULL; i++)
+        g_signal_emit_by_name (bvw->play, "get-video-pad", i, &videopad);
+    }
   }
 
   bvw->media_has_audio = (n_audio > 0);
@@ -2312,12 +3393,15 @@ parse_stream_info (BaconVideoWidget *bvw)
       caps_set (G_OBJECT (videopad), NULL, bvw);
       gst_caps_unref (caps);
     }
+    /* The video sink pad is reused across streams with playbin3 */
+    g_signal_handlers_disconnect_by_func (videopad, caps_set, bvw);
     g_signal_connect (videopad, "notify::caps",
         G_CALLBACK (caps_set), bvw);
     gst_object_unref (videopad);
   }
 
   set_current_actor (bvw);
+  bvw_update_tick_mode (bvw);
 }
 
 static void
@@ -2337,6 +3421,7 @@ static void
 bacon_video_widget_finalize (GObject * object)
 {
   BaconVideoWidget *bvw = (BaconVideoWidget *) object;
+  guint i;
 
   GST_DEBUG ("finalizing");
 
@@ -2362,6 +3447,10 @@ bacon_video_widget_finalize (GObject * object)
   g_clear_pointer (&bvw->subtitle_uri, g_free);
   g_clear_pointer (&bvw->user_id, g_free);
   g_clear_pointer (&bvw->user_pw, g_free);
+  g_clear_pointer (&bvw->next_mrl, g_free);
+  g_clear_pointer (&bvw->next_subtitle_uri, g_free);
+  gst_clear_object (&bvw->collection);
+  bvw_clear_stream_selection (bvw);
 
   g_clear_object (&bvw->clock);
 
@@ -2374,6 +3463,7 @@ bacon_video_widget_finalize (GObject * object)
     g_source_remove (bvw->update_id);
     bvw->update_id = 0;
   }
+  bvw_disconnect_frame_clock (bvw);
 
   if (bvw->chapters) {
     g_list_free_full (bvw->chapters, (GDestroyNotify) gst_mini_object_unref);
@@ -2388,13 +3478,12 @@ bacon_video_widget_finalize (GObject * object)
     bvw->languages = NULL;
   }
 
-  g_clear_pointer (&bvw->tagcache, gst_tag_list_unref);
-  g_clear_pointer (&bvw->audiotags, gst_tag_list_unref);
-  g_clear_pointer (&bvw->videotags, gst_tag_list_unref);
+  bvw_clear_tags (bvw);
 
-  if (bvw->tag_update_id != 0)
-    g_source_remove (bvw->tag_update_id);
-  g_async_queue_unref (bvw->tag_update_queue);
+  g_source_destroy (bvw->tag_update_source);
+  g_clear_pointer (&bvw->tag_update_source, g_source_unref);
+  for (i = 0; i < BVW_TAGS_N_TYPES; i++)
+    g_clear_pointer (&bvw->pending_tags[i], gst_tag_list_unref);
 
   if (bvw->eos_id != 0) {
     g_source_remove (bvw->eos_id);
@@ -2406,6 +3495,7 @@ bacon_video_widget_finalize (GObject * object)
   g_clear_object (&bvw->mount_cancellable);
 
   g_mutex_clear (&bvw->seek_mutex);
+  g_mutex_clear (&bvw->gapless_mutex);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -2452,6 +3542,9 @@ bacon_video_widget_set_property (GObject * object, guint property_id,
     case PROP_SHOW_CURSOR:
       bacon_video_widget_set_show_cursor (bvw, g_value_get_boolean (value));
       break;
+    case PROP_USE_PLAYBIN3:
+      bvw->use_playbin3 = g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -2515,6 +3608,12 @@ bacon_video_widget_get_property (GObject * object, guint property_id,
     case PROP_SHOW_CURSOR:
       g_value_set_boolean (value, bvw->cursor_shown);
       break;
+    case PROP_STATS:
+      g_value_take_variant (value, bvw_stats_to_variant (bvw));
+      break;
+    case PROP_USE_PLAYBIN3:
+      g_value_set_boolean (value, bvw->use_playbin3);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -2552,7 +3651,7 @@ bacon_video_widget_get_subtitle (BaconVideoWidget * bvw)
   if ((flags & GST_PLAY_FLAG_TEXT) == 0)
     return BVW_TRACK_NONE;
 
-  g_object_get (G_OBJECT (bvw->play), "current-text", &subtitle, NULL);
+  subtitle = bvw_get_current_stream_num (bvw, "text");
 
   return subtitle;
 }
@@ -2595,11 +3694,19 @@ bacon_video_widget_set_subtitle (BaconVideoWidget * bvw, int subtitle)
   if (subtitle == BVW_TRACK_NONE) {
     flags &= ~GST_PLAY_FLAG_TEXT;
     g_object_set (bvw->play, "flags", flags, NULL);
+    if (bvw->use_playbin3)
+      bvw_select_stream (bvw, GST_STREAM_TYPE_TEXT, -1);
   } else {
     flags |= GST_PLAY_FLAG_TEXT;
-    g_object_set (bvw->play, "flags", flags, "current-text", subtitle, NULL);
-    g_signal_emit_by_name (G_OBJECT (bvw->play), "get-text-tags", subtitle, &tags);
-    bvw_update_tags (bvw, tags, "text");
+    if (bvw->use_playbin3) {
+      g_object_set (bvw->play, "flags", flags, NULL);
+      bvw_select_stream (bvw, GST_STREAM_TYPE_TEXT, subtitle);
+    } else {
+      g_object_set (bvw->play, "flags", flags, "current-text", subtitle, NULL);
+    }
+    tags = bvw_get_stream_tags (bvw, GST_STREAM_TYPE_TEXT, subtitle);
+    if (tags)
+      bvw_update_tags (bvw, tags, "text");
   }
 }
 
@@ -2623,6 +3730,12 @@ bacon_video_toggle_subtitles (BaconVideoWidget *bvw)
   else
     flags |= GST_PLAY_FLAG_TEXT;
   g_object_set (bvw->play, "flags", flags, NULL);
+  if (bvw->use_playbin3) {
+    gint current;
+
+    current = bvw_get_current_stream_num (bvw, "text");
+    bvw_select_stream (bvw, GST_STREAM_TYPE_TEXT, MAX (current, 0));
+  }
   g_signal_emit (bvw, bvw_signals[SIGNAL_SUBTITLES_CHANGED], 0);
 }
 
@@ -2802,30 +3915,26 @@ get_lang_list_for_type (BaconVideoWidget * bvw, const gchar * type_name)
 {
   GList *ret = NULL;
   gint i, n;
-  const char *prop;
-  const char *signal;
+  GstStreamType type;
 
   if (g_str_equal (type_name, "AUDIO")) {
-    prop = "n-audio";
-    signal = "get-audio-tags";
+    type = GST_STREAM_TYPE_AUDIO;
   } else if (g_str_equal (type_name, "TEXT")) {
-    prop = "n-text";
-    signal = "get-text-tags";
+    type = GST_STREAM_TYPE_TEXT;
   } else {
     g_critical ("Invalid stream type '%s'", type_name);
     return NULL;
   }
 
-  n = 0;
-  g_object_get (G_OBJECT (bvw->play), prop, &n, NULL);
+  n = bvw_get_n_streams (bvw, type);
   if (n == 0)
     return NULL;
 
   for (i = 0; i < n; i++) {
-    GstTagList *tags = NULL;
+    GstTagList *tags;
     BvwLangInfo *info;
 
-    g_signal_emit_by_name (G_OBJECT (bvw->play), signal, i, &tags);
+    tags = bvw_get_stream_tags (bvw, type, i);
 
     info = g_new0 (BvwLangInfo, 1);
     info->id = i;
@@ -2984,7 +4093,7 @@ bacon_video_widget_get_language (BaconVideoWidget * bvw)
   g_return_val_if_fail (BACON_IS_VIDEO_WIDGET (bvw), -1);
   g_return_val_if_fail (bvw->play != NULL, -1);
 
-  g_object_get (G_OBJECT (bvw->play), "current-audio", &language, NULL);
+  language = bvw_get_current_stream_num (bvw, "audio");
 
   return language;
 }
@@ -3007,10 +4116,14 @@ bacon_video_widget_set_language (BaconVideoWidget * bvw, int language)
 
   GST_DEBUG ("setting language to %d", language);
 
-  g_object_set (bvw->play, "current-audio", language, NULL);
+  if (bvw->use_playbin3)
+    bvw_select_stream (bvw, GST_STREAM_TYPE_AUDIO, language);
+  else
+    g_object_set (bvw->play, "current-audio", language, NULL);
 
-  g_signal_emit_by_name (G_OBJECT (bvw->play), "get-audio-tags", language, &tags);
-  bvw_update_tags (bvw, tags, "audio");
+  tags = bvw_get_stream_tags (bvw, GST_STREAM_TYPE_AUDIO, language);
+  if (tags)
+    bvw_update_tags (bvw, tags, "audio");
   if (update_languages_tracks (bvw))
     g_signal_emit (bvw, bvw_signals[SIGNAL_LANGUAGES_CHANGED], 0);
 
@@ -3033,7 +4146,7 @@ bacon_video_widget_set_next_language (BaconVideoWidget *bvw)
   BvwLangInfo *info;
   int current_audio;
 
-  g_object_get (bvw->play, "current-audio", &current_audio, NULL);
+  current_audio = bvw_get_current_stream_num (bvw, "audio");
   info = find_next_info_for_id (bvw->languages, current_audio);
   if (!info) {
     GST_DEBUG ("Could not find next language id (current = %d)", current_audio);
@@ -3449,6 +4562,142 @@ get_target_uri (GFile *file)
   return target;
 }
 
+static char *
+bvw_resolve_mrl (const char *mrl)
+{
+  GFile *file;
+  char *ret;
+
+  /* this allows non-URI type of files in the thumbnailer and so on */
+  file = g_file_new_for_commandline_arg (mrl);
+
+  if (g_file_has_uri_scheme (file, "trash") != FALSE ||
+      g_file_has_uri_scheme (file, "recent") != FALSE) {
+    ret = get_target_uri (file);
+    GST_DEBUG ("Found target location '%s' for original MRL '%s'",
+	       GST_STR_NULL (ret), mrl);
+  } else if (g_file_has_uri_scheme (file, "cdda") != FALSE) {
+    char *path;
+    path = g_file_get_path (file);
+    ret = g_filename_to_uri (path, NULL, NULL);
+    g_free (path);
+  } else {
+    ret = g_strdup (mrl);
+  }
+
+  g_object_unref (file);
+
+  return ret;
+}
+
+/* The rate is also read from the streaming thread in
+ * playbin_about_to_finish_cb() */
+static void
+bvw_set_rate_value (BaconVideoWidget *bvw,
+                    float             rate)
+{
+  g_mutex_lock (&bvw->gapless_mutex);
+  bvw->rate = rate;
+  g_mutex_unlock (&bvw->gapless_mutex);
+}
+
+static void
+bvw_clear_next_mrl (BaconVideoWidget *bvw)
+{
+  g_mutex_lock (&bvw->gapless_mutex);
+  g_clear_pointer (&bvw->next_mrl, g_free);
+  g_clear_pointer (&bvw->next_subtitle_uri, g_free);
+  bvw->gapless_pending = FALSE;
+  g_mutex_unlock (&bvw->gapless_mutex);
+}
+
+static void
+playbin_about_to_finish_cb (GstElement       *play,
+			    BaconVideoWidget *bvw)
+{
+  g_autofree char *uri = NULL;
+  g_autofree char *suburi = NULL;
+  gint64 pos = -1, len = -1;
+  gint64 end_time;
+  float rate;
+
+  /* Called from a streaming thread, only copy what's needed under the
+   * lock, the queries and setting the URI can take a while */
+  g_mutex_lock (&bvw->gapless_mutex);
+  if (bvw->next_mrl == NULL || bvw->gapless_pending) {
+    g_mutex_unlock (&bvw->gapless_mutex);
+    GST_DEBUG ("About to finish, no next MRL queued");
+    return;
+  }
+  uri = g_strdup (bvw->next_mrl);
+  suburi = g_strdup (bvw->next_subtitle_uri);
+  rate = bvw->rate;
+  end_time = g_get_monotonic_time ();
+  bvw->gapless_end_time = end_time;
+  bvw->gapless_pending = TRUE;
+  g_mutex_unlock (&bvw->gapless_mutex);
+
+  GST_DEBUG ("About to finish, prerolling next MRL '%s'", uri);
+  g_object_set (play,
+                "uri", uri,
+                "suburi", suburi,
+                NULL);
+
+  /* Estimate when the current stream will have finished rendering,
+   * so the switch latency can be computed when the next one starts */
+  if (rate > 0.0 &&
+      gst_element_query_position (play, GST_FORMAT_TIME, &pos) &&
+      gst_element_query_duration (play, GST_FORMAT_TIME, &len) &&
+      len > pos) {
+    end_time += (gint64) ((len - pos) / GST_USECOND / rate);
+
+    g_mutex_lock (&bvw->gapless_mutex);
+    bvw->gapless_end_time = end_time;
+    g_mutex_unlock (&bvw->gapless_mutex);
+  }
+}
+
+/**
+ * bacon_video_widget_set_next_mrl:
+ * @bvw: a #BaconVideoWidget
+ * @mrl: (allow-none): the MRL to play after the current one, or %NULL
+ * @subtitle: (allow-none): a subtitle URI for @mrl, or %NULL
+ *
+ * Queues @mrl to be played once the current stream finishes, without
+ * tearing down the pipeline in between. The new stream is prerolled while
+ * the current one is still playing, and #BaconVideoWidget::stream-switched
+ * is emitted instead of #BaconVideoWidget::eos when playback moves on to it.
+ *
+ * Passing %NULL cancels a previously queued MRL, if the switch has not
+ * started yet.
+ **/
+void
+bacon_video_widget_set_next_mrl (BaconVideoWidget *bvw,
+                                 const char       *mrl,
+                                 const char       *subtitle)
+{
+  g_return_if_fail (BACON_IS_VIDEO_WIDGET (bvw));
+  g_return_if_fail (bvw->play != NULL);
+
+  g_mutex_lock (&bvw->gapless_mutex);
+  if (bvw->gapless_pending) {
+    /* playbin already has it, too late */
+    g_mutex_unlock (&bvw->gapless_mutex);
+    GST_DEBUG ("Next MRL already prerolling, ignoring '%s'", GST_STR_NULL (mrl));
+    return;
+  }
+
+  g_clear_pointer (&bvw->next_mrl, g_free);
+  g_clear_pointer (&bvw->next_subtitle_uri, g_free);
+  if (mrl != NULL) {
+    bvw->next_mrl = bvw_resolve_mrl (mrl);
+    bvw->next_subtitle_uri = g_strdup (subtitle);
+  }
+  g_mutex_unlock (&bvw->gapless_mutex);
+
+  GST_DEBUG ("next mrl = %s", GST_STR_NULL (mrl));
+}
+
 /**
  * bacon_video_widget_open:
  * @bvw: a #BaconVideoWidget
@@ -3462,37 +4711,23 @@ void
 bacon_video_widget_open (BaconVideoWidget *bvw,
                          const char       *mrl)
 {
-  GFile *file;
+  gint64 start_time;
 
   g_return_if_fail (mrl != NULL);
   g_return_if_fail (BACON_IS_VIDEO_WIDGET (bvw));
   g_return_if_fail (bvw->play != NULL);
-  
+
+  start_time = g_get_monotonic_time ();
+
   /* So we aren't closed yet... */
   if (bvw->mrl) {
     bacon_video_widget_close (bvw);
   }
+  bvw->switch_start_time = start_time;
   
   GST_DEBUG ("mrl = %s", GST_STR_NULL (mrl));
 
-  /* this allows non-URI type of files in the thumbnailer and so on */
-  file = g_file_new_for_commandline_arg (mrl);
-
-  if (g_file_has_uri_scheme (file, "trash") != FALSE ||
-      g_file_has_uri_scheme (file, "recent") != FALSE) {
-    bvw->mrl = get_target_uri (file);
-    GST_DEBUG ("Found target location '%s' for original MRL '%s'",
-	       GST_STR_NULL (bvw->mrl), mrl);
-  } else if (g_file_has_uri_scheme (file, "cdda") != FALSE) {
-    char *path;
-    path = g_file_get_path (file);
-    bvw->mrl = g_filename_to_uri (path, NULL, NULL);
-    g_free (path);
-  } else {
-    bvw->mrl = g_strdup (mrl);
-  }
-
-  g_object_unref (file);
+  bvw->mrl = bvw_resolve_mrl (mrl);
 
   bvw->got_redirect = FALSE;
   bvw->media_has_video = FALSE;
@@ -3513,6 +4748,7 @@ bacon_video_widget_open (BaconVideoWidget *bvw,
   bvw->target_state = GST_STATE_PAUSED;
   bvw_clear_missing_plugins_messages (bvw);
 
+  bvw_start_state_change (bvw, GST_STATE_PAUSED);
   gst_element_set_state (bvw->play, GST_STATE_PAUSED);
 
   if (update_subtitles_tracks (bvw))
@@ -3583,6 +4819,7 @@ bacon_video_widget_play (BaconVideoWidget * bvw, GError ** error)
   g_signal_emit (bvw, bvw_signals[SIGNAL_PLAY_STARTING], 0);
 
   GST_DEBUG ("play");
+  bvw_start_state_change (bvw, GST_STATE_PLAYING);
   gst_element_set_state (bvw->play, GST_STATE_PLAYING);
 
   /* will handle all errors asynchroneously */
@@ -3617,6 +4854,11 @@ bacon_video_widget_can_direct_seek (BaconVideoWidget *bvw)
       g_str_has_prefix (bvw->mrl, "trash:/"))
     return TRUE;
 
+  /* Network streams that have proven fast enough to seek in */
+  if (bvw->n_seek_latencies >= DIRECT_SEEK_MIN_SAMPLES &&
+      bvw->seek_latency <= DIRECT_SEEK_MAX_LATENCY)
+    return TRUE;
+
   return FALSE;
 }
 
@@ -3631,12 +4873,19 @@ bacon_video_widget_seek_time_no_lock (BaconVideoWidget *bvw,
 
   bvw->seek_time = -1;
 
+  /* The flush resets the sink's counters */
+  bvw_update_frame_stats (bvw);
+
   gst_element_set_state (bvw->play, GST_STATE_PAUSED);
 
-  gst_element_seek (bvw->play, bvw->rate,
-		    GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | flag,
-		    GST_SEEK_TYPE_SET, _time * GST_MSECOND,
-		    GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+  if (!gst_element_seek (bvw->play, bvw->rate,
+			 GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | flag,
+			 GST_SEEK_TYPE_SET, _time * GST_MSECOND,
+			 GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE)) {
+    GST_DEBUG ("Seek to %" GST_TIME_FORMAT " failed", GST_TIME_ARGS (_time * GST_MSECOND));
+    /* No ASYNC_DONE will be coming */
+    bvw->seek_in_flight = FALSE;
+  }
 
   return TRUE;
 }
@@ -3669,27 +4918,38 @@ bacon_video_widget_seek_time (BaconVideoWidget *bvw, gint64 _time, gboolean accu
   /* Emit a time tick of where we are going, we are paused */
   got_time_tick (bvw->play, _time * GST_MSECOND, bvw);
 
+  if (bvw->scrubbing) {
+    /* Land on the keyframe nearest to the pointer, the accurate
+     * seek happens when scrubbing stops */
+    bvw->scrub_time = _time;
+    flag = SCRUB_SEEK_FLAGS;
+  } else {
+    flag = (accurate ? GST_SEEK_FLAG_ACCURATE : GST_SEEK_FLAG_NONE);
+  }
+
   /* Is there a pending seek? */
   g_mutex_lock (&bvw->seek_mutex);
 
-  /* If there's no pending seek, or
+  /* If there's no seek in flight, or
    * it's been too long since the seek,
-   * or we don't have an accurate seek requested */
+   * or we have an accurate seek requested */
   cur_time = gst_clock_get_internal_time (bvw->clock);
-  if (bvw->seek_req_time == GST_CLOCK_TIME_NONE ||
+  if (!bvw->seek_in_flight ||
       cur_time > bvw->seek_req_time + SEEK_TIMEOUT ||
-      accurate) {
+      (accurate && !bvw->scrubbing)) {
     bvw->seek_time = -1;
     bvw->seek_req_time = cur_time;
+    bvw->seek_in_flight = TRUE;
     g_mutex_unlock (&bvw->seek_mutex);
   } else {
-    GST_LOG ("Not long enough since last seek, queuing it");
+    /* Only the newest target matters */
+    GST_LOG ("Previous seek still in progress, queuing it");
     bvw->seek_time = _time;
+    bvw->seek_flags = flag;
     g_mutex_unlock (&bvw->seek_mutex);
     return TRUE;
   }
 
-  flag = (accurate ? GST_SEEK_FLAG_ACCURATE : GST_SEEK_FLAG_NONE);
   bacon_video_widget_seek_time_no_lock (bvw, _time, flag, error);
 
   return TRUE;
@@ -3723,6 +4983,56 @@ bacon_video_widget_seek (BaconVideoWidget *bvw, double position, GError **error)
   return bacon_video_widget_seek_time (bvw, seek_time / GST_MSECOND, FALSE, error);
 }
 
+/**
+ * bacon_video_widget_set_scrubbing:
+ * @bvw: a #BaconVideoWidget
+ * @scrubbing: whether the user is dragging the seek bar
+ *
+ * Sets whether seeks are part of a scrub, for example while a seek bar
+ * is being dragged. While scrubbing, only the newest of the seeks
+ * requested whilst another one is in progress is performed, playback stays
+ * paused, and seeks land on the keyframe nearest to the requested position.
+ *
+ * When scrubbing stops, a single accurate seek is made to the last position
+ * requested, and playback resumes if it was playing.
+ **/
+void
+bacon_video_widget_set_scrubbing (BaconVideoWidget *bvw,
+                                  gboolean          scrubbing)
+{
+  gint64 scrub_time;
+
+  g_return_if_fail (BACON_IS_VIDEO_WIDGET (bvw));
+  g_return_if_fail (GST_IS_ELEMENT (bvw->play));
+
+  scrubbing = !!scrubbing;
+  if (bvw->scrubbing == scrubbing)
+    return;
+
+  GST_DEBUG ("%s scrubbing", scrubbing ? "Starting" : "Stopping");
+  bvw->scrubbing = scrubbing;
+
+  scrub_time = bvw->scrub_time;
+  bvw->scrub_time = -1;
+
+  if (scrubbing || scrub_time < 0)
+    return;
+
+  g_mutex_lock (&bvw->seek_mutex);
+  if (bvw->seek_in_flight) {
+    /* Replaces whatever key unit seek was queued */
+    bvw->seek_time = scrub_time;
+    bvw->seek_flags = GST_SEEK_FLAG_ACCURATE;
+    g_mutex_unlock (&bvw->seek_mutex);
+    return;
+  }
+  bvw->seek_req_time = gst_clock_get_internal_time (bvw->clock);
+  bvw->seek_in_flight = TRUE;
+  g_mutex_unlock (&bvw->seek_mutex);
+
+  bacon_video_widget_seek_time_no_lock (bvw, scrub_time, GST_SEEK_FLAG_ACCURATE, NULL);
+}
+
 /**
  * bacon_video_widget_step:
  * @bvw: a #BaconVideoWidget
@@ -3744,16 +5054,65 @@ bacon_video_widget_step (BaconVideoWidget *bvw, gboolean forward, GError **error
 
   event = gst_event_new_step (GST_FORMAT_BUFFERS, 1, 1.0, TRUE, FALSE);
 
+  bvw->step_start = g_get_monotonic_time ();
   retval = gst_element_send_event (bvw->play, event);
 
   if (retval != FALSE)
-    bvw_query_timeout (bvw);
+    bvw_tick (bvw);
   else
     GST_WARNING ("Failed to step %s", DIRECTION_STR);
 
   return retval;
 }
 
+/**
+ * bacon_video_widget_get_stats:
+ * @bvw: a #BaconVideoWidget
+ * @stats: (out caller-allocates): return location for the statistics
+ *
+ * Gets the playback quality statistics for the current stream. They are
+ * reset when the stream is closed.
+ **/
+void
+bacon_video_widget_get_stats (BaconVideoWidget *bvw, BvwStats *stats)
+{
+  g_return_if_fail (BACON_IS_VIDEO_WIDGET (bvw));
+  g_return_if_fail (stats != NULL);
+
+  bvw_update_frame_stats (bvw);
+
+  *stats = bvw->stats;
+  stats->seeks = bvw->n_seek_latencies;
+  stats->seek_latency = bvw->seek_latency / GST_USECOND;
+  if (bvw->buffering_start != 0)
+    stats->buffering_time += g_get_monotonic_time () - bvw->buffering_start;
+}
+
+static GVariant *
+bvw_stats_to_variant (BaconVideoWidget *bvw)
+{
+  GVariantBuilder builder;
+  BvwStats stats;
+
+  bacon_video_widget_get_stats (bvw, &stats);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "frames-rendered", g_variant_new_uint64 (stats.frames_rendered));
+  g_variant_builder_add (&builder, "{sv}", "frames-dropped", g_variant_new_uint64 (stats.frames_dropped));
+  g_variant_builder_add (&builder, "{sv}", "latency", g_variant_new_int64 (stats.latency));
+  g_variant_builder_add (&builder, "{sv}", "max-lateness", g_variant_new_int64 (stats.max_lateness));
+  g_variant_builder_add (&builder, "{sv}", "buffering-stalls", g_variant_new_uint32 (stats.buffering_stalls));
+  g_variant_builder_add (&builder, "{sv}", "buffering-time", g_variant_new_int64 (stats.buffering_time));
+  g_variant_builder_add (&builder, "{sv}", "seeks", g_variant_new_uint32 (stats.seeks));
+  g_variant_builder_add (&builder, "{sv}", "seek-latency", g_variant_new_int64 (stats.seek_latency));
+  g_variant_builder_add (&builder, "{sv}", "max-seek-latency", g_variant_new_int64 (stats.max_seek_latency));
+  g_variant_builder_add (&builder, "{sv}", "step-latency", g_variant_new_int64 (stats.step_latency));
+  g_variant_builder_add (&builder, "{sv}", "preroll-time", g_variant_new_int64 (stats.preroll_time));
+  g_variant_builder_add (&builder, "{sv}", "resume-time", g_variant_new_int64 (stats.resume_time));
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
 static void
 bvw_stop_play_pipeline (BaconVideoWidget * bvw)
 {
@@ -3828,7 +5187,12 @@ bacon_video_widget_close (BaconVideoWidget * bvw)
   g_return_if_fail (GST_IS_ELEMENT (bvw->play));
   
   GST_LOG ("Closing");
+  bvw_record_decoder_playback (bvw);
   bvw_stop_play_pipeline (bvw);
+  bvw_clear_next_mrl (bvw);
+  bvw->switch_start_time = 0;
+  gst_clear_object (&bvw->collection);
+  bvw_clear_stream_selection (bvw);
 
   g_clear_pointer (&bvw->mrl, g_free);
   g_clear_pointer (&bvw->subtitle_uri, g_free);
@@ -3839,13 +5203,25 @@ bacon_video_widget_close (BaconVideoWidget * bvw)
   bvw->is_live = FALSE;
   bvw->is_menu = FALSE;
   bvw->has_angles = FALSE;
-  bvw->rate = FORWARD_RATE;
+  bvw_set_rate_value (bvw, FORWARD_RATE);
 
   bvw->current_time = 0;
   bvw->seek_req_time = GST_CLOCK_TIME_NONE;
+  bvw->seek_in_flight = FALSE;
   bvw->seek_time = -1;
+  bvw->scrub_time = -1;
+  bvw->seek_latency = 0;
+  bvw->n_seek_latencies = 0;
   bvw->stream_length = 0;
 
+  memset (&bvw->stats, 0, sizeof (bvw->stats));
+  bvw->sink_rendered = bvw->sink_dropped = 0;
+  bvw->decoder_rendered = bvw->decoder_dropped = 0;
+  bvw->buffering_start = 0;
+  bvw->step_start = 0;
+  bvw->state_change_start = 0;
+  bvw->decoder_playback_recorded = FALSE;
+
   if (bvw->eos_id != 0)
     g_source_remove (bvw->eos_id);
 
@@ -3862,9 +5238,7 @@ bacon_video_widget_close (BaconVideoWidget * bvw)
     bvw->languages = NULL;
   }
 
-  g_clear_pointer (&bvw->tagcache, gst_tag_list_unref);
-  g_clear_pointer (&bvw->audiotags, gst_tag_list_unref);
-  g_clear_pointer (&bvw->videotags, gst_tag_list_unref);
+  bvw_clear_tags (bvw);
 
   g_object_notify (G_OBJECT (bvw), "seekable");
   g_signal_emit (bvw, bvw_signals[SIGNAL_SUBTITLES_CHANGED], 0);
@@ -3958,7 +5332,7 @@ handle_dvd_seek (BaconVideoWidget *bvw,
     GST_DEBUG ("seeking to %s: %" G_GINT64_FORMAT, fmt_name, val);
     gst_element_seek (bvw->play, FORWARD_RATE, fmt, GST_SEEK_FLAG_FLUSH,
 		      GST_SEEK_TYPE_SET, val, GST_SEEK_TYPE_NONE, G_GINT64_CONSTANT (0));
-    bvw->rate = FORWARD_RATE;
+    bvw_set_rate_value (bvw, FORWARD_RATE);
   } else {
     GST_DEBUG ("failed to query position (%s)", fmt_name);
   }
@@ -4534,7 +5908,7 @@ bacon_video_widget_has_angles (BaconVideoWidget *bvw)
     if (bvw->has_angles)
         return TRUE;
 
-    g_object_get (G_OBJECT (bvw->play), "n-video", &n_video, NULL);
+    n_video = bvw_get_n_streams (bvw, GST_STREAM_TYPE_VIDEO);
 
     return n_video > 1;
 }
@@ -4561,10 +5935,8 @@ bacon_video_widget_set_next_angle (BaconVideoWidget *bvw)
         return;
     }
 
-    g_object_get (G_OBJECT (bvw->play),
-		  "current-video", &current_video,
-		  "n-video", &n_video,
-		  NULL);
+    current_video = bvw_get_current_stream_num (bvw, "video");
+    n_video = bvw_get_n_streams (bvw, GST_STREAM_TYPE_VIDEO);
 
     if (n_video <= 1) {
         GST_DEBUG ("Not setting next video stream, we have %d video streams", n_video);
@@ -4576,7 +5948,10 @@ bacon_video_widget_set_next_angle (BaconVideoWidget *bvw)
       current_video = 0;
 
     GST_DEBUG ("Setting current-video to %d/%d", current_video, n_video);
-    g_object_set (G_OBJECT (bvw->play), "current-video", current_video, NULL);
+    if (bvw->use_playbin3)
+      bvw_select_stream (bvw, GST_STREAM_TYPE_VIDEO, current_video);
+    else
+      g_object_set (G_OBJECT (bvw->play), "current-video", current_video, NULL);
 }
 
 static gboolean
@@ -4664,6 +6039,7 @@ double
 bacon_video_widget_get_position (BaconVideoWidget * bvw)
 {
   g_return_val_if_fail (BACON_IS_VIDEO_WIDGET (bvw), -1);
+  bvw_refresh_position (bvw);
   return bvw->current_position;
 }
 
@@ -4680,6 +6056,7 @@ gint64
 bacon_video_widget_get_current_time (BaconVideoWidget * bvw)
 {
   g_return_val_if_fail (BACON_IS_VIDEO_WIDGET (bvw), -1);
+  bvw_refresh_position (bvw);
   return bvw->current_time;
 }
 
@@ -4802,6 +6179,16 @@ bvw_get_current_stream_num (BaconVideoWidget * bvw,
   if (bvw->play == NULL)
     return stream_num;
 
+  if (bvw->use_playbin3) {
+    GstStreamType type;
+
+    type = bvw_stream_type_from_name (stream_type);
+    stream_num = bvw_get_stream_index (bvw, type,
+                                       *bvw_get_selected_stream_id_ptr (bvw, type));
+    GST_LOG ("current %s stream: %d", stream_type, stream_num);
+    return stream_num;
+  }
+
   lower = g_ascii_strdown (stream_type, -1);
   cur_prop_str = g_strconcat ("current-", lower, NULL);
   g_object_get (bvw->play, cur_prop_str, &stream_num, NULL);
@@ -4818,17 +6205,12 @@ bvw_get_tags_of_current_stream (BaconVideoWidget * bvw,
 {
   GstTagList *tags = NULL;
   gint stream_num = -1;
-  gchar *lower, *cur_sig_str;
 
   stream_num = bvw_get_current_stream_num (bvw, stream_type);
   if (stream_num < 0)
     return NULL;
 
-  lower = g_ascii_strdown (stream_type, -1);
-  cur_sig_str = g_strconcat ("get-", lower, "-tags", NULL);
-  g_signal_emit_by_name (bvw->play, cur_sig_str, stream_num, &tags);
-  g_free (cur_sig_str);
-  g_free (lower);
+  tags = bvw_get_stream_tags (bvw, bvw_stream_type_from_name (stream_type), stream_num);
 
   GST_LOG ("current %s stream tags %" GST_PTR_FORMAT, stream_type, tags);
   return tags;
@@ -4847,11 +6229,22 @@ bvw_get_caps_of_current_stream (BaconVideoWidget * bvw,
   if (stream_num < 0)
     return NULL;
 
-  lower = g_ascii_strdown (stream_type, -1);
-  cur_sig_str = g_strconcat ("get-", lower, "-pad", NULL);
-  g_signal_emit_by_name (bvw->play, cur_sig_str, stream_num, &current);
-  g_free (cur_sig_str);
-  g_free (lower);
+  if (bvw->use_playbin3) {
+    /* playbin3 has no per-stream pads, but only the selected
+     * stream reaches the sinks */
+    if (g_ascii_strcasecmp (stream_type, "video") == 0)
+      current = gst_element_get_static_pad (bvw->video_sink, "sink");
+    else if (g_ascii_strcasecmp (stream_type, "audio") == 0)
+      current = gst_element_get_static_pad (bvw->audio_capsfilter, "sink");
+    else
+      current = NULL;
+  } else {
+    lower = g_ascii_strdown (stream_type, -1);
+    cur_sig_str = g_strconcat ("get-", lower, "-pad", NULL);
+    g_signal_emit_by_name (bvw->play, cur_sig_str, stream_num, &current);
+    g_free (cur_sig_str);
+    g_free (lower);
+  }
 
   if (current != NULL) {
     caps = gst_pad_get_current_caps (current);
@@ -5307,6 +6700,89 @@ bacon_video_widget_get_current_frame (BaconVideoWidget * bvw)
   return ret;
 }
 
+static void
+get_current_frame_cb (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  GError *error = NULL;
+  GdkPixbuf *pixbuf;
+
+  pixbuf = totem_gst_sample_to_pixbuf_finish (result, &error);
+  if (!pixbuf) {
+    GST_DEBUG ("Could not take screenshot: %s", error->message);
+    g_task_return_error (task, error);
+    return;
+  }
+  g_task_return_pointer (task, pixbuf, g_object_unref);
+}
+
+/**
+ * bacon_video_widget_get_current_frame_async:
+ * @bvw: a #BaconVideoWidget
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: a #GAsyncReadyCallback
+ * @user_data: data to pass to @callback
+ *
+ * Grabs the current frame from the playing stream, without copying it,
+ * and converts it to a #GdkPixbuf in a worker thread, so that neither
+ * the main loop nor the pipeline are blocked by the conversion.
+ **/
+void
+bacon_video_widget_get_current_frame_async (BaconVideoWidget    *bvw,
+                                            GCancellable        *cancellable,
+                                            GAsyncReadyCallback  callback,
+                                            gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GstSample) sample = NULL;
+  GError *error = NULL;
+
+  g_return_if_fail (BACON_IS_VIDEO_WIDGET (bvw));
+  g_return_if_fail (GST_IS_ELEMENT (bvw->play));
+
+  task = g_task_new (bvw, cancellable, callback, user_data);
+  g_task_set_source_tag (task, bacon_video_widget_get_current_frame_async);
+
+  if (!bvw->video_width || !bvw->video_height) {
+    GST_DEBUG ("Could not take screenshot: %s", "no video info");
+    g_task_return_new_error (task, BVW_ERROR, BVW_ERROR_CANNOT_CAPTURE,
+                             "%s", _("Media contains no supported video streams."));
+    return;
+  }
+
+  sample = totem_gst_playbin_get_sample (bvw->play, &error);
+  if (!sample) {
+    GST_DEBUG ("Could not take screenshot: %s", error->message);
+    g_task_return_error (task, error);
+    return;
+  }
+
+  totem_gst_sample_to_pixbuf_async (sample, cancellable,
+                                    get_current_frame_cb, g_steal_pointer (&task));
+}
+
+/**
+ * bacon_video_widget_get_current_frame_finish:
+ * @bvw: a #BaconVideoWidget
+ * @result: a #GAsyncResult
+ * @error: a #GError, or %NULL
+ *
+ * Finishes a bacon_video_widget_get_current_frame_async() call.
+ *
+ * Return value: the current frame, or %NULL; unref with g_object_unref()
+ **/
+GdkPixbuf *
+bacon_video_widget_get_current_frame_finish (BaconVideoWidget  *bvw,
+                                             GAsyncResult      *result,
+                                             GError           **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, bvw), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 /* =========================================== */
 /*                                             */
 /*          Widget typing & Creation           */
@@ -5358,6 +6834,7 @@ bvw_set_playback_direction (BaconVideoWidget *bvw, gboolean forward)
 
   if (gst_element_query_position (bvw->play, GST_FORMAT_TIME, &cur)) {
     GST_DEBUG ("Setting playback direction to %s at %"G_GINT64_FORMAT"", DIRECTION_STR, cur);
+    bvw_update_frame_stats (bvw);
     event = gst_event_new_seek (target_rate,
 				GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
 				GST_SEEK_TYPE_SET, forward ? cur : G_GINT64_CONSTANT (0),
@@ -5366,7 +6843,7 @@ bvw_set_playback_direction (BaconVideoWidget *bvw, gboolean forward)
       GST_WARNING ("Failed to set playback direction to %s", DIRECTION_STR);
     } else {
       gst_element_get_state (bvw->play, NULL, NULL, GST_CLOCK_TIME_NONE);
-      bvw->rate = target_rate;
+      bvw_set_rate_value (bvw, target_rate);
       retval = TRUE;
     }
   } else {
@@ -5400,12 +6877,7 @@ is_feature_enabled (const char *env)
 static void
 bacon_video_widget_init (BaconVideoWidget *bvw)
 {
-  GstElement *audio_sink = NULL;
   gchar *version_str;
-  GstPlayFlags flags;
-  GstElement *glsinkbin, *audio_bin;
-  GstPad *audio_pad;
-  char *template;
 
   gtk_widget_set_can_focus (GTK_WIDGET (bvw), TRUE);
 
@@ -5415,11 +6887,17 @@ bacon_video_widget_init (BaconVideoWidget *bvw)
 
   bvw->volume = -1.0;
   bvw->rate = FORWARD_RATE;
-  bvw->tag_update_queue = g_async_queue_new_full ((GDestroyNotify) update_tags_delayed_data_destroy);
+  bvw->tag_update_source = g_source_new (&bvw_tag_source_funcs, sizeof (GSource));
+  g_source_set_priority (bvw->tag_update_source, G_PRIORITY_DEFAULT_IDLE);
+  g_source_set_callback (bvw->tag_update_source, (GSourceFunc) bvw_update_tags_dispatcher, bvw, NULL);
+  g_source_set_name (bvw->tag_update_source, "[totem] bvw_update_tags_dispatcher");
+  g_source_attach (bvw->tag_update_source, NULL);
   g_mutex_init (&bvw->seek_mutex);
+  g_mutex_init (&bvw->gapless_mutex);
   bvw->clock = gst_system_clock_obtain ();
   bvw->seek_req_time = GST_CLOCK_TIME_NONE;
   bvw->seek_time = -1;
+  bvw->scrub_time = -1;
   bvw->auth_last_result = G_MOUNT_OPERATION_HANDLED;
 
 #ifndef GST_DISABLE_GST_DEBUG
@@ -5435,6 +6913,9 @@ bacon_video_widget_init (BaconVideoWidget *bvw)
 
   gst_pb_utils_init ();
 
+  /* Cache HTTP streams, see also playbin_source_setup_cb() */
+  bacon_cache_src_register ();
+
   gtk_widget_set_events (GTK_WIDGET (bvw),
 			 gtk_widget_get_events (GTK_WIDGET (bvw)) |
 			 GDK_SCROLL_MASK |
@@ -5444,9 +6925,31 @@ bacon_video_widget_init (BaconVideoWidget *bvw)
 			 GDK_BUTTON_RELEASE_MASK |
 			 GDK_KEY_PRESS_MASK);
   gtk_widget_init_template (GTK_WIDGET (bvw));
+}
+
+/* The pipeline is only created once the construct properties are set,
+ * as it depends on the use-playbin3 property */
+static void
+bacon_video_widget_constructed (GObject *object)
+{
+  BaconVideoWidget *bvw = BACON_VIDEO_WIDGET (object);
+  GstElement *audio_sink = NULL;
+  GstPlayFlags flags;
+  GstElement *glsinkbin, *audio_bin;
+  GstPad *audio_pad;
+  char *template;
+
+  G_OBJECT_CLASS (parent_class)->constructed (object);
 
   /* Instantiate all the fallible plugins */
-  bvw->play = element_make_or_warn ("playbin", "play");
+  if (is_feature_enabled ("TOTEM_PLAYBIN3"))
+    bvw->use_playbin3 = TRUE;
+  /* decodebin3 has no autoplug-sort signal, and changing the ranks
+   * in the registry would affect every pipeline in the process, so
+   * failing decoders are only skipped with playbin */
+  if (bvw->use_playbin3)
+    GST_INFO ("Using playbin3, the decoder policy won't be applied");
+  bvw->play = element_make_or_warn (bvw->use_playbin3 ? "playbin3" : "playbin", "play");
   bvw->audio_pitchcontrol = element_make_or_warn ("scaletempo", "scaletempo");
   bvw->video_sink = element_make_or_warn ("gtkglsink", "video-sink");
   glsinkbin = element_make_or_warn ("glsinkbin", "glsinkbin");
@@ -5549,14 +7052,22 @@ bacon_video_widget_init (BaconVideoWidget *bvw)
       G_CALLBACK (playbin_source_setup_cb), bvw);
   g_signal_connect (bvw->play, "element-setup",
       G_CALLBACK (playbin_element_setup_cb), bvw);
+  g_signal_connect (bvw->play, "deep-notify::temp-location",
+      G_CALLBACK (playbin_deep_notify_cb), bvw);
+  g_signal_connect (bvw->play, "about-to-finish",
+      G_CALLBACK (playbin_about_to_finish_cb), bvw);
+
+  /* playbin3 posts stream-collection and streams-selected
+   * messages instead */
+  if (bvw->use_playbin3)
+    return;
+
   g_signal_connect (bvw->play, "video-changed",
       G_CALLBACK (playbin_stream_changed_cb), bvw);
   g_signal_connect (bvw->play, "audio-changed",
       G_CALLBACK (playbin_stream_changed_cb), bvw);
   g_signal_connect (bvw->play, "text-changed",
       G_CALLBACK (playbin_stream_changed_cb), bvw);
-  g_signal_connect (bvw->play, "deep-notify::temp-location",
-      G_CALLBACK (playbin_deep_notify_cb), bvw);
 
   g_signal_connect (bvw->play, "video-tags-changed",
       G_CALLBACK (video_tags_changed_cb), bvw);
@@ -5646,6 +7157,8 @@ bacon_video_widget_set_rate (BaconVideoWidget *bvw,
 
   if (gst_element_query_position (bvw->play, GST_FORMAT_TIME, &cur)) {
     GST_DEBUG ("Setting new rate at %"G_GINT64_FORMAT"", cur);
+    /* The flush resets the sink's counters */
+    bvw_update_frame_stats (bvw);
     event = gst_event_new_seek (new_rate,
 				GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
 				GST_SEEK_TYPE_SET, cur,
@@ -5654,7 +7167,7 @@ bacon_video_widget_set_rate (BaconVideoWidget *bvw,
       GST_DEBUG ("Failed to change rate");
     } else {
       gst_element_get_state (bvw->play, NULL, NULL, GST_CLOCK_TIME_NONE);
-      bvw->rate = new_rate;
+      bvw_set_rate_value (bvw, new_rate);
       retval = TRUE;
     }
   } else {
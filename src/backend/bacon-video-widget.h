@@ -73,6 +73,9 @@ gboolean bacon_video_widget_check_init		 (BaconVideoWidget  *bvw,
 /* Actions */
 void bacon_video_widget_open			 (BaconVideoWidget *bvw,
 						  const char *mrl);
+void bacon_video_widget_set_next_mrl          (BaconVideoWidget *bvw,
+						  const char *mrl,
+						  const char *subtitle);
 gboolean bacon_video_widget_play                 (BaconVideoWidget *bvw,
 						  GError **error);
 void bacon_video_widget_pause			 (BaconVideoWidget *bvw);
@@ -90,6 +93,8 @@ gboolean bacon_video_widget_seek_time		 (BaconVideoWidget *bvw,
 gboolean bacon_video_widget_step		 (BaconVideoWidget *bvw,
 						  gboolean forward,
 						  GError **error);
+void bacon_video_widget_set_scrubbing		 (BaconVideoWidget *bvw,
+						  gboolean scrubbing);
 gboolean bacon_video_widget_can_direct_seek	 (BaconVideoWidget *bvw);
 double bacon_video_widget_get_position           (BaconVideoWidget *bvw);
 gint64 bacon_video_widget_get_current_time       (BaconVideoWidget *bvw);
@@ -388,6 +393,50 @@ gboolean bacon_video_widget_has_previous_track	 (BaconVideoWidget *bvw);
 gboolean bacon_video_widget_can_get_frames       (BaconVideoWidget *bvw,
 						  GError **error);
 GdkPixbuf *bacon_video_widget_get_current_frame (BaconVideoWidget *bvw);
+void bacon_video_widget_get_current_frame_async (BaconVideoWidget *bvw,
+						 GCancellable *cancellable,
+						 GAsyncReadyCallback callback,
+						 gpointer user_data);
+GdkPixbuf *bacon_video_widget_get_current_frame_finish (BaconVideoWidget *bvw,
+							GAsyncResult *result,
+							GError **error);
+
+/**
+ * BvwStats:
+ * @frames_rendered: the number of video frames shown
+ * @frames_dropped: the number of video frames dropped for being late
+ * @latency: the pipeline latency, in microseconds
+ * @max_lateness: the most a video frame was late at the sink, in microseconds
+ * @buffering_stalls: the number of times playback paused to buffer
+ * @buffering_time: the time spent buffering while playback was wanted, in microseconds
+ * @seeks: the number of seeks that completed
+ * @seek_latency: the recent average time a seek took, in microseconds
+ * @max_seek_latency: the longest time a seek took, in microseconds
+ * @step_latency: the time the latest frame step took, in microseconds
+ * @preroll_time: the time it took to have the first frame ready, in microseconds
+ * @resume_time: the time it took to start playing, in microseconds
+ *
+ * Playback quality statistics for the current stream, as returned by
+ * bacon_video_widget_get_stats(). Times that haven't been measured
+ * are <code class="literal">0</code>.
+ */
+typedef struct {
+	guint64 frames_rendered;
+	guint64 frames_dropped;
+	gint64 latency;
+	gint64 max_lateness;
+	guint buffering_stalls;
+	gint64 buffering_time;
+	guint seeks;
+	gint64 seek_latency;
+	gint64 max_seek_latency;
+	gint64 step_latency;
+	gint64 preroll_time;
+	gint64 resume_time;
+} BvwStats;
+
+void bacon_video_widget_get_stats                (BaconVideoWidget *bvw,
+						  BvwStats *stats);
 
 /* Audio-out functions */
 /**
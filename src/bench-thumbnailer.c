@@ -0,0 +1,241 @@
+/*
+ * Throughput and seeks benchmark for totem-video-thumbnailer
+ *
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int n_files = 24;
+static int duration = 10;
+static int width = 640;
+static int height = 360;
+static int max_jobs = 0;
+static char **thumbnailer = NULL;
+
+/* Mostly detailed patterns, with a few solid colours that the
+ * thumbnailer will find boring and search through */
+static const char *patterns[] = {
+	"smpte", "snow", "checkers-8", "black", "circular", "zone-plate",
+	"gamut", "white", "chroma-zone-plate", "ball", "smpte75", "blue",
+	"pinwheel", "spokes", "colors", "black"
+};
+
+static const GOptionEntry entries[] = {
+	{ "files", 'f', 0, G_OPTION_ARG_INT, &n_files, "Number of videos in the corpus", "N" },
+	{ "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Length of each video in seconds", "SECONDS" },
+	{ "width", 'W', 0, G_OPTION_ARG_INT, &width, "Width of the videos", "PIXELS" },
+	{ "height", 'H', 0, G_OPTION_ARG_INT, &height, "Height of the videos", "PIXELS" },
+	{ "jobs", 'j', 0, G_OPTION_ARG_INT, &max_jobs, "Maximum number of parallel jobs (defaults to the number of processors)", "N" },
+	{ G_OPTION_REMAINING, '\0', 0, G_OPTION_ARG_FILENAME_ARRAY, &thumbnailer, NULL, "THUMBNAILER" },
+	{ NULL }
+};
+
+static gboolean
+generate_video (const char *path,
+		guint       pattern)
+{
+	g_autofree char *description = NULL;
+	g_autoptr(GstElement) pipeline = NULL;
+	g_autoptr(GstBus) bus = NULL;
+	g_autoptr(GstMessage) msg = NULL;
+	GError *err = NULL;
+
+	description = g_strdup_printf ("videotestsrc pattern=%s num-buffers=%d ! "
+				       "video/x-raw,width=%d,height=%d,framerate=25/1 ! "
+				       "jpegenc ! avimux ! filesink location=\"%s\"",
+				       patterns[pattern % G_N_ELEMENTS (patterns)], duration * 25,
+				       width, height, path);
+	pipeline = gst_parse_launch (description, &err);
+	if (pipeline == NULL) {
+		g_printerr ("Couldn't create corpus pipeline: %s\n", err->message);
+		g_error_free (err);
+		return FALSE;
+	}
+
+	gst_element_set_state (pipeline, GST_STATE_PLAYING);
+	bus = gst_element_get_bus (pipeline);
+	msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+					  GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+
+	if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+		gst_message_parse_error (msg, &err, NULL);
+		g_printerr ("Couldn't generate '%s': %s\n", path, err->message);
+		g_error_free (err);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static char *
+generate_corpus (const char *dir)
+{
+	GString *manifest;
+	char *manifest_path;
+	int i;
+
+	manifest = g_string_new (NULL);
+	for (i = 0; i < n_files; i++) {
+		g_autofree char *name = NULL;
+		g_autofree char *video = NULL;
+		g_autofree char *thumb = NULL;
+
+		name = g_strdup_printf ("video-%03d.avi", i);
+		video = g_build_filename (dir, name, NULL);
+		if (!generate_video (video, i)) {
+			g_string_free (manifest, TRUE);
+			return NULL;
+		}
+
+		thumb = g_strdup_printf ("%s.png", video);
+		g_string_append_printf (manifest, "%s\t%s\n", video, thumb);
+	}
+
+	manifest_path = g_build_filename (dir, "manifest", NULL);
+	g_file_set_contents (manifest_path, manifest->str, -1, NULL);
+	g_string_free (manifest, TRUE);
+
+	return manifest_path;
+}
+
+static gboolean
+run_thumbnailer (const char *manifest,
+		 int         jobs,
+		 gboolean    raw)
+{
+	g_autoptr(GSubprocess) process = NULL;
+	g_autofree char *jobs_str = NULL;
+	g_autofree char *output = NULL;
+	g_autofree char *debug = NULL;
+	GError *err = NULL;
+	gint64 start, elapsed;
+	char **lines, **l;
+	guint ok = 0, seeks = 0;
+	glong peak_rss = 0;
+
+	jobs_str = g_strdup_printf ("%d", jobs);
+	start = g_get_monotonic_time ();
+	/* The debug output tells us about every seek, and memory usage */
+	process = g_subprocess_new (G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_PIPE, &err,
+				    thumbnailer[0], "--verbose", "--batch", manifest, "--jobs", jobs_str,
+				    raw ? "--raw" : NULL, NULL);
+	if (process == NULL ||
+	    !g_subprocess_communicate_utf8 (process, NULL, NULL, &output, &debug, &err)) {
+		g_printerr ("Couldn't run '%s': %s\n", thumbnailer[0], err->message);
+		g_error_free (err);
+		return FALSE;
+	}
+	elapsed = g_get_monotonic_time () - start;
+
+	lines = g_strsplit (output, "\n", -1);
+	for (l = lines; *l != NULL; l++) {
+		if (g_str_has_prefix (*l, "OK\t"))
+			ok++;
+	}
+	g_strfreev (lines);
+
+	lines = g_strsplit (debug, "\n", -1);
+	for (l = lines; *l != NULL; l++) {
+		const char *peak;
+
+		if (strstr (*l, "About to seek to") != NULL)
+			seeks++;
+		else if ((peak = strstr (*l, "Peak memory usage: ")) != NULL)
+			peak_rss = strtol (peak + strlen ("Peak memory usage: "), NULL, 10);
+	}
+	g_strfreev (lines);
+
+	g_print ("%2d jobs%s: %u/%d files in %.2f s, %.2f files/s, %.2f seeks per file, %ld MB peak RSS\n",
+		 jobs, raw ? " (raw)" : "", ok, n_files,
+		 (double) elapsed / G_USEC_PER_SEC,
+		 ok * (double) G_USEC_PER_SEC / elapsed,
+		 (double) seeks / n_files,
+		 peak_rss / 1024);
+
+	return ok == (guint) n_files;
+}
+
+static void
+remove_dir (const char *path)
+{
+	GDir *dir;
+	const char *name;
+
+	dir = g_dir_open (path, 0, NULL);
+	if (dir == NULL)
+		return;
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		g_autofree char *child = NULL;
+
+		child = g_build_filename (path, name, NULL);
+		g_unlink (child);
+	}
+	g_dir_close (dir);
+	g_rmdir (path);
+}
+
+int main (int argc, char **argv)
+{
+	GOptionContext *context;
+	GError *err = NULL;
+	g_autofree char *dir = NULL;
+	g_autofree char *manifest = NULL;
+	gboolean ret = TRUE;
+	int jobs;
+
+	context = g_option_context_new ("- measure totem-video-thumbnailer throughput and seeks");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &err)) {
+		g_printerr ("%s\n", err->message);
+		g_error_free (err);
+		return 1;
+	}
+	g_option_context_free (context);
+
+	if (thumbnailer == NULL || thumbnailer[0] == NULL || n_files < 1 || duration < 1 ||
+	    width < 16 || height < 16) {
+		g_printerr ("Usage: %s [--files N] [--duration SECONDS] [--width PIXELS] [--height PIXELS] [--jobs N] THUMBNAILER\n", argv[0]);
+		return 1;
+	}
+	if (max_jobs < 1)
+		max_jobs = g_get_num_processors ();
+
+	dir = g_dir_make_tmp ("totem-bench-XXXXXX", &err);
+	if (dir == NULL) {
+		g_printerr ("Couldn't create corpus directory: %s\n", err->message);
+		g_error_free (err);
+		return 1;
+	}
+
+	g_print ("Generating %d videos of %d seconds at %dx%d\n", n_files, duration, width, height);
+	manifest = generate_corpus (dir);
+	if (manifest == NULL) {
+		remove_dir (dir);
+		return 1;
+	}
+
+	/* Double the number of jobs up to the maximum */
+	jobs = 1;
+	while (ret) {
+		ret = run_thumbnailer (manifest, jobs, FALSE);
+		if (jobs == max_jobs)
+			break;
+		jobs = MIN (jobs * 2, max_jobs);
+	}
+
+	/* Against capturing full-size frames */
+	if (ret)
+		ret = run_thumbnailer (manifest, 1, TRUE);
+
+	remove_dir (dir);
+
+	return ret ? 0 : 1;
+}
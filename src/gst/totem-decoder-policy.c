@@ -0,0 +1,472 @@
+/*
+ * Hardware decoder selection policy
+ *
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+/*
+ * TotemDecoderPolicy remembers how hardware video decoders fared with
+ * each codec and resolution: decoding errors, and the ratio of frames
+ * dropped, as reported through QoS. A decoder that fails is demoted for
+ * a while, so that the next playback uses another decoder.
+ *
+ * Results are stored in a small key file, with one group per decoder,
+ * codec and size class, for example "[vah264dec video/x-h264 hd]".
+ */
+
+#include "totem-decoder-policy.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+
+#define MIN_QOS_FRAMES 250                          /* Ignore playbacks showing fewer frames */
+#define MAX_DROPPED_RATIO 0.2
+#define DEMOTION_DURATION (30 * 24 * 60 * 60)       /* In seconds */
+
+struct _TotemDecoderPolicy {
+  GObject parent;
+
+  char *path;
+  GKeyFile *keyfile;
+};
+
+G_DEFINE_TYPE (TotemDecoderPolicy, totem_decoder_policy, G_TYPE_OBJECT)
+
+static const char *size_classes[] = {
+  "any",
+  "sd",
+  "hd",
+  "uhd"
+};
+
+static const char *
+get_size_class (int width,
+                int height)
+{
+  gint64 pixels = (gint64) width * height;
+
+  if (width <= 0 || height <= 0)
+    return size_classes[0];
+  if (pixels <= 720 * 576)
+    return size_classes[1];
+  if (pixels <= 1920 * 1088)
+    return size_classes[2];
+  return size_classes[3];
+}
+
+static char *
+get_group_name (const char *decoder,
+                const char *codec,
+                const char *size_class)
+{
+  return g_strdup_printf ("%s %s %s", decoder, codec, size_class);
+}
+
+static void
+totem_decoder_policy_save (TotemDecoderPolicy *policy)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree char *dir = NULL;
+
+  if (policy->path == NULL)
+    return;
+
+  dir = g_path_get_dirname (policy->path);
+  if (g_mkdir_with_parents (dir, 0700) < 0 ||
+      !g_key_file_save_to_file (policy->keyfile, policy->path, &error)) {
+    GST_WARNING ("Could not save decoder policy to '%s': %s",
+                 policy->path, error ? error->message : g_strerror (errno));
+  }
+}
+
+static void
+totem_decoder_policy_demote (TotemDecoderPolicy *policy,
+                             const char         *group)
+{
+  int failures;
+
+  failures = g_key_file_get_integer (policy->keyfile, group, "Failures", NULL);
+  g_key_file_set_integer (policy->keyfile, group, "Failures", failures + 1);
+  g_key_file_set_int64 (policy->keyfile, group, "DemotedAt",
+                        g_get_real_time () / G_USEC_PER_SEC);
+
+  GST_INFO ("Demoting decoder for '%s' after %d failures", group, failures + 1);
+}
+
+static gboolean
+totem_decoder_policy_group_is_demoted (TotemDecoderPolicy *policy,
+                                       const char         *group)
+{
+  gint64 demoted_at;
+
+  demoted_at = g_key_file_get_int64 (policy->keyfile, group, "DemotedAt", NULL);
+  if (demoted_at <= 0)
+    return FALSE;
+
+  /* Give the decoder another chance eventually, drivers get fixed */
+  return g_get_real_time () / G_USEC_PER_SEC - demoted_at < DEMOTION_DURATION;
+}
+
+/**
+ * totem_decoder_policy_record_failure:
+ * @policy: a #TotemDecoderPolicy
+ * @decoder: the name of the decoder's element factory
+ * @codec: the media type of the decoded stream, eg. "video/x-h264"
+ * @width: the width of the video, or 0 if unknown
+ * @height: the height of the video, or 0 if unknown
+ *
+ * Records that @decoder failed to decode a stream, and demotes it
+ * for that codec and size.
+ */
+void
+totem_decoder_policy_record_failure (TotemDecoderPolicy *policy,
+                                     const char         *decoder,
+                                     const char         *codec,
+                                     int                 width,
+                                     int                 height)
+{
+  g_autofree char *group = NULL;
+
+  g_return_if_fail (TOTEM_IS_DECODER_POLICY (policy));
+  g_return_if_fail (decoder != NULL);
+  g_return_if_fail (codec != NULL);
+
+  group = get_group_name (decoder, codec, get_size_class (width, height));
+  totem_decoder_policy_demote (policy, group);
+  totem_decoder_policy_save (policy);
+}
+
+/**
+ * totem_decoder_policy_record_playback:
+ * @policy: a #TotemDecoderPolicy
+ * @decoder: the name of the decoder's element factory
+ * @codec: the media type of the decoded stream, eg. "video/x-h264"
+ * @width: the width of the video, or 0 if unknown
+ * @height: the height of the video, or 0 if unknown
+ * @processed: the number of frames shown
+ * @dropped: the number of frames dropped
+ *
+ * Records the QoS results of a playback with @decoder. Dropping too
+ * many frames counts as a failure, as long as enough frames were shown
+ * for the results to mean something.
+ */
+void
+totem_decoder_policy_record_playback (TotemDecoderPolicy *policy,
+                                      const char         *decoder,
+                                      const char         *codec,
+                                      int                 width,
+                                      int                 height,
+                                      guint64             processed,
+                                      guint64             dropped)
+{
+  g_autofree char *group = NULL;
+  double ratio;
+  int playbacks;
+
+  g_return_if_fail (TOTEM_IS_DECODER_POLICY (policy));
+  g_return_if_fail (decoder != NULL);
+  g_return_if_fail (codec != NULL);
+
+  if (processed < MIN_QOS_FRAMES)
+    return;
+
+  group = get_group_name (decoder, codec, get_size_class (width, height));
+  ratio = (double) dropped / (processed + dropped);
+
+  playbacks = g_key_file_get_integer (policy->keyfile, group, "Playbacks", NULL);
+  g_key_file_set_integer (policy->keyfile, group, "Playbacks", playbacks + 1);
+  g_key_file_set_double (policy->keyfile, group, "DroppedRatio", ratio);
+
+  GST_DEBUG ("Decoder for '%s' dropped %.1f%% of frames", group, ratio * 100.0);
+
+  if (ratio > MAX_DROPPED_RATIO)
+    totem_decoder_policy_demote (policy, group);
+
+  totem_decoder_policy_save (policy);
+}
+
+/**
+ * totem_decoder_policy_is_demoted:
+ * @policy: a #TotemDecoderPolicy
+ * @decoder: the name of the decoder's element factory
+ * @codec: the media type of the stream, eg. "video/x-h264"
+ * @width: the width of the video, or 0 if unknown
+ * @height: the height of the video, or 0 if unknown
+ *
+ * Returns whether @decoder failed recently for @codec, at that size.
+ * If the size isn't known, failures at any size count.
+ *
+ * Returns: %TRUE if the decoder should be avoided
+ */
+gboolean
+totem_decoder_policy_is_demoted (TotemDecoderPolicy *policy,
+                                 const char         *decoder,
+                                 const char         *codec,
+                                 int                 width,
+                                 int                 height)
+{
+  guint i;
+
+  g_return_val_if_fail (TOTEM_IS_DECODER_POLICY (policy), FALSE);
+  g_return_val_if_fail (decoder != NULL, FALSE);
+  g_return_val_if_fail (codec != NULL, FALSE);
+
+  for (i = 0; i < G_N_ELEMENTS (size_classes); i++) {
+    g_autofree char *group = NULL;
+
+    /* Failures with an unknown size apply to all sizes */
+    if (width > 0 && height > 0 &&
+        i != 0 &&
+        size_classes[i] != get_size_class (width, height))
+      continue;
+
+    group = get_group_name (decoder, codec, size_classes[i]);
+    if (totem_decoder_policy_group_is_demoted (policy, group))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/**
+ * totem_decoder_policy_is_hardware_video_decoder:
+ * @factory: a #GstElementFactory
+ *
+ * Returns: whether @factory creates hardware video or image decoders
+ */
+gboolean
+totem_decoder_policy_is_hardware_video_decoder (GstElementFactory *factory)
+{
+  g_return_val_if_fail (GST_IS_ELEMENT_FACTORY (factory), FALSE);
+
+  if (!gst_element_factory_list_is_type (factory,
+                                         GST_ELEMENT_FACTORY_TYPE_DECODER |
+                                         GST_ELEMENT_FACTORY_TYPE_MEDIA_VIDEO |
+                                         GST_ELEMENT_FACTORY_TYPE_MEDIA_IMAGE))
+    return FALSE;
+
+  return gst_element_factory_list_is_type (factory,
+                                           GST_ELEMENT_FACTORY_TYPE_HARDWARE);
+}
+
+typedef struct {
+  TotemDecoderPolicy *policy;
+  const char *codec;
+  int width;
+  int height;
+} RankData;
+
+static guint
+get_effective_rank (GstPluginFeature *feature,
+                    RankData         *data)
+{
+  if (data->codec != NULL &&
+      totem_decoder_policy_is_hardware_video_decoder (GST_ELEMENT_FACTORY (feature)) &&
+      totem_decoder_policy_is_demoted (data->policy,
+                                       gst_plugin_feature_get_name (feature),
+                                       data->codec, data->width, data->height))
+    return GST_RANK_NONE;
+
+  return gst_plugin_feature_get_rank (feature);
+}
+
+static int
+compare_factories (gconstpointer a,
+                   gconstpointer b,
+                   gpointer      user_data)
+{
+  guint rank_a, rank_b;
+
+  rank_a = get_effective_rank (GST_PLUGIN_FEATURE (a), user_data);
+  rank_b = get_effective_rank (GST_PLUGIN_FEATURE (b), user_data);
+  if (rank_a != rank_b)
+    return rank_a > rank_b ? -1 : 1;
+
+  return gst_plugin_feature_rank_compare_func (a, b);
+}
+
+/**
+ * totem_decoder_policy_rank_factories:
+ * @policy: a #TotemDecoderPolicy
+ * @factories: (element-type GstElementFactory): a list of decoder factories
+ * @caps: the caps of the stream to decode
+ *
+ * Sorts @factories by preference for decoding @caps: by rank, except
+ * for hardware decoders demoted for that codec and size, which come last.
+ * Meant for decodebin's #GstBin::autoplug-sort signal.
+ *
+ * Returns: (transfer full) (element-type GstElementFactory): a sorted copy
+ * of @factories, free with gst_plugin_feature_list_free()
+ */
+GList *
+totem_decoder_policy_rank_factories (TotemDecoderPolicy *policy,
+                                     GList              *factories,
+                                     GstCaps            *caps)
+{
+  RankData data = { policy, NULL, 0, 0 };
+  GList *ret;
+
+  g_return_val_if_fail (TOTEM_IS_DECODER_POLICY (policy), NULL);
+
+  if (caps != NULL && gst_caps_get_size (caps) > 0) {
+    GstStructure *s;
+
+    s = gst_caps_get_structure (caps, 0);
+    data.codec = gst_structure_get_name (s);
+    gst_structure_get_int (s, "width", &data.width);
+    gst_structure_get_int (s, "height", &data.height);
+  }
+
+  ret = g_list_copy_deep (factories, (GCopyFunc) gst_object_ref, NULL);
+  return g_list_sort_with_data (ret, compare_factories, &data);
+}
+
+static gboolean
+filter_hw_decoders (GstPluginFeature *feature,
+                    gpointer          user_data)
+{
+  if (!GST_IS_ELEMENT_FACTORY (feature))
+    return FALSE;
+
+  return totem_decoder_policy_is_hardware_video_decoder (GST_ELEMENT_FACTORY (feature));
+}
+
+static gboolean
+factory_is_demoted (TotemDecoderPolicy *policy,
+                    GstElementFactory  *factory)
+{
+  const char *name;
+  const GList *l;
+
+  name = gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory));
+
+  for (l = gst_element_factory_get_static_pad_templates (factory); l != NULL; l = l->next) {
+    GstStaticPadTemplate *templ = l->data;
+    g_autoptr(GstCaps) caps = NULL;
+    guint i;
+
+    if (templ->direction != GST_PAD_SINK)
+      continue;
+
+    caps = gst_static_caps_get (&templ->static_caps);
+    for (i = 0; i < gst_caps_get_size (caps); i++) {
+      const char *codec;
+
+      codec = gst_structure_get_name (gst_caps_get_structure (caps, i));
+      if (totem_decoder_policy_is_demoted (policy, name, codec, 0, 0))
+        return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+ * totem_decoder_policy_apply:
+ * @policy: a #TotemDecoderPolicy
+ * @registry: a #GstRegistry
+ *
+ * Lowers the rank of demoted hardware decoders in @registry, so that
+ * autoplugging picks another decoder, if one is available. Only for
+ * pipelines which can't use totem_decoder_policy_rank_factories(),
+ * such as playbin3's.
+ *
+ * Ranks are per-factory, so a decoder demoted for any size of a codec
+ * it handles gets demoted for all of them.
+ */
+void
+totem_decoder_policy_apply (TotemDecoderPolicy *policy,
+                            GstRegistry        *registry)
+{
+  g_autolist(GstPluginFeature) hw_list = NULL;
+  GList *l;
+
+  g_return_if_fail (TOTEM_IS_DECODER_POLICY (policy));
+  g_return_if_fail (GST_IS_REGISTRY (registry));
+
+  hw_list = gst_registry_feature_filter (registry, filter_hw_decoders, FALSE, NULL);
+  for (l = hw_list; l != NULL; l = l->next) {
+    if (!factory_is_demoted (policy, l->data))
+      continue;
+
+    GST_INFO ("Lowering rank of demoted decoder %s",
+              gst_plugin_feature_get_name (l->data));
+    gst_plugin_feature_set_rank (l->data, GST_RANK_MARGINAL);
+  }
+}
+
+/**
+ * totem_decoder_policy_new:
+ * @path: (nullable): the file to store results in, or %NULL to
+ *   only keep them in memory
+ *
+ * Returns: (transfer full): a new #TotemDecoderPolicy
+ */
+TotemDecoderPolicy *
+totem_decoder_policy_new (const char *path)
+{
+  TotemDecoderPolicy *policy;
+  g_autoptr(GError) error = NULL;
+
+  policy = g_object_new (TOTEM_TYPE_DECODER_POLICY, NULL);
+  policy->path = g_strdup (path);
+
+  if (path != NULL &&
+      !g_key_file_load_from_file (policy->keyfile, path, G_KEY_FILE_NONE, &error) &&
+      !g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+    GST_WARNING ("Could not load decoder policy from '%s': %s", path, error->message);
+  }
+
+  return policy;
+}
+
+/**
+ * totem_decoder_policy_get_default:
+ *
+ * Returns: (transfer none): the #TotemDecoderPolicy stored in the
+ * user's cache directory
+ */
+TotemDecoderPolicy *
+totem_decoder_policy_get_default (void)
+{
+  static TotemDecoderPolicy *policy = NULL;
+
+  if (g_once_init_enter (&policy)) {
+    g_autofree char *path = NULL;
+
+    path = g_build_filename (g_get_user_cache_dir (), "totem", "decoder-policy.ini", NULL);
+    g_once_init_leave (&policy, totem_decoder_policy_new (path));
+  }
+
+  return policy;
+}
+
+static void
+totem_decoder_policy_finalize (GObject *object)
+{
+  TotemDecoderPolicy *policy = TOTEM_DECODER_POLICY (object);
+
+  g_free (policy->path);
+  g_key_file_free (policy->keyfile);
+
+  G_OBJECT_CLASS (totem_decoder_policy_parent_class)->finalize (object);
+}
+
+static void
+totem_decoder_policy_class_init (TotemDecoderPolicyClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = totem_decoder_policy_finalize;
+}
+
+static void
+totem_decoder_policy_init (TotemDecoderPolicy *policy)
+{
+  policy->keyfile = g_key_file_new ();
+}
+
+/*
+ * vim: sw=2 ts=8 cindent noai bs=2
+ */
@@ -0,0 +1,42 @@
+/*
+ * Hardware decoder selection policy
+ *
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+#pragma once
+
+#include <gst/gst.h>
+
+#define TOTEM_TYPE_DECODER_POLICY (totem_decoder_policy_get_type ())
+G_DECLARE_FINAL_TYPE (TotemDecoderPolicy, totem_decoder_policy, TOTEM, DECODER_POLICY, GObject)
+
+TotemDecoderPolicy *totem_decoder_policy_new            (const char         *path);
+TotemDecoderPolicy *totem_decoder_policy_get_default    (void);
+
+void                totem_decoder_policy_record_failure (TotemDecoderPolicy *policy,
+                                                         const char         *decoder,
+                                                         const char         *codec,
+                                                         int                 width,
+                                                         int                 height);
+void                totem_decoder_policy_record_playback (TotemDecoderPolicy *policy,
+                                                          const char         *decoder,
+                                                          const char         *codec,
+                                                          int                 width,
+                                                          int                 height,
+                                                          guint64             processed,
+                                                          guint64             dropped);
+gboolean            totem_decoder_policy_is_demoted     (TotemDecoderPolicy *policy,
+                                                         const char         *decoder,
+                                                         const char         *codec,
+                                                         int                 width,
+                                                         int                 height);
+
+GList              *totem_decoder_policy_rank_factories (TotemDecoderPolicy *policy,
+                                                         GList              *factories,
+                                                         GstCaps            *caps);
+void                totem_decoder_policy_apply          (TotemDecoderPolicy *policy,
+                                                         GstRegistry        *registry);
+
+gboolean            totem_decoder_policy_is_hardware_video_decoder (GstElementFactory *factory);
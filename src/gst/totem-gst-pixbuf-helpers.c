@@ -13,100 +13,19 @@
 
 #include "totem-gst-pixbuf-helpers.h"
 
+#include <gio/gio.h>
 #include <gst/tag/tag.h>
-#include <gst/video/video-format.h>
+#include <gst/video/video.h>
 
-typedef enum {
-  FRAME_CAPTURE_TYPE_RAW,
-  FRAME_CAPTURE_TYPE_GL
-} FrameCaptureType;
+/* Name of the info structure attached to samples returned by
+ * totem_gst_playbin_get_sample() */
+#define FRAME_INFO_NAME "totem-frame-info"
 
-static void
-destroy_pixbuf (guchar *pix, gpointer data)
-{
-  gst_sample_unref (GST_SAMPLE (data));
-}
-
-GdkPixbuf *
-totem_gst_playbin_get_frame (GstElement *play, GError **error)
+static GdkPixbufRotation
+totem_gst_playbin_get_rotation (GstElement *play)
 {
-  FrameCaptureType capture_type;
-  GstStructure *s;
-  GstSample *sample = NULL;
-  guint bpp;
-  GdkPixbuf *pixbuf = NULL;
-  GstCaps *to_caps, *sample_caps;
-  gint outwidth = 0;
-  gint outheight = 0;
-  GstMemory *memory;
-  GstMapInfo info;
   GdkPixbufRotation rotation = GDK_PIXBUF_ROTATE_NONE;
 
-  g_return_val_if_fail (play != NULL, NULL);
-  g_return_val_if_fail (GST_IS_ELEMENT (play), NULL);
-
-  capture_type = gst_bin_get_by_name (GST_BIN (play), "glcolorbalance0") ?
-    FRAME_CAPTURE_TYPE_GL : FRAME_CAPTURE_TYPE_RAW;
-
-  /* our desired output format (RGB24) */
-  to_caps = gst_caps_new_simple ("video/x-raw",
-      "format", G_TYPE_STRING, capture_type == FRAME_CAPTURE_TYPE_RAW ? "RGB" : "RGBA",
-      /* Note: we don't ask for a specific width/height here, so that
-       * videoscale can adjust dimensions from a non-1/1 pixel aspect
-       * ratio to a 1/1 pixel-aspect-ratio. We also don't ask for a
-       * specific framerate, because the input framerate won't
-       * necessarily match the output framerate if there's a deinterlacer
-       * in the pipeline. */
-      "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
-      NULL);
-
-  /* get frame */
-  g_signal_emit_by_name (play, "convert-sample", to_caps, &sample);
-  gst_caps_unref (to_caps);
-
-  if (!sample) {
-    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                         "Failed to retrieve or convert video frame");
-    return NULL;
-  }
-
-  sample_caps = gst_sample_get_caps (sample);
-  if (!sample_caps) {
-    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                         "No caps on output buffer");
-    return NULL;
-  }
-
-  GST_DEBUG ("frame caps: %" GST_PTR_FORMAT, sample_caps);
-
-  s = gst_caps_get_structure (sample_caps, 0);
-  gst_structure_get_int (s, "width", &outwidth);
-  gst_structure_get_int (s, "height", &outheight);
-  if (outwidth <= 0 || outheight <= 0) {
-    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                 "Could not prepare buffer memory for image dimensions %dx%d", outwidth, outheight);
-    goto done;
-  }
-
-  memory = gst_buffer_get_memory (gst_sample_get_buffer (sample), 0);
-  gst_memory_map (memory, &info, GST_MAP_READ);
-
-  /* create pixbuf from that - use our own destroy function */
-  bpp = capture_type == FRAME_CAPTURE_TYPE_GL ? 4 : 3;
-  pixbuf = gdk_pixbuf_new_from_data (info.data,
-      GDK_COLORSPACE_RGB, capture_type == FRAME_CAPTURE_TYPE_GL, 8, outwidth, outheight,
-      GST_ROUND_UP_4 (outwidth * bpp), destroy_pixbuf, sample);
-
-  gst_memory_unmap (memory, &info);
-  gst_memory_unref (memory);
-
-done:
-  if (!pixbuf) {
-    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                         "Could not create pixbuf");
-    gst_sample_unref (sample);
-  }
-
   /* Did we check whether we need to rotate the video? */
   if (g_object_get_data (G_OBJECT (play), "orientation-checked") == NULL) {
     GstTagList *tags = NULL;
@@ -133,7 +52,191 @@ done:
     g_object_set_data (G_OBJECT (play), "orientation", GINT_TO_POINTER(rotation));
   }
 
-  rotation = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (play), "orientation"));
+  return GPOINTER_TO_INT (g_object_get_data (G_OBJECT (play), "orientation"));
+}
+
+/**
+ * totem_gst_playbin_get_sample:
+ * @play: a playbin element
+ * @error: a #GError, or %NULL
+ *
+ * Returns the last video frame shown by @play, as is: in its native
+ * format, and in whatever memory the decoder or sink used. Nothing is
+ * converted or copied, pass the sample to totem_gst_sample_to_pixbuf()
+ * when pixels are actually needed.
+ *
+ * Returns: (transfer full) (nullable): a #GstSample, or %NULL
+ */
+GstSample *
+totem_gst_playbin_get_sample (GstElement *play, GError **error)
+{
+  GstSample *sample = NULL;
+  GstSample *ret;
+  GstStructure *info;
+
+  g_return_val_if_fail (GST_IS_ELEMENT (play), NULL);
+
+  g_object_get (G_OBJECT (play), "sample", &sample, NULL);
+  if (!sample || !gst_sample_get_buffer (sample) || !gst_sample_get_caps (sample)) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                         "Failed to retrieve video frame");
+    g_clear_pointer (&sample, gst_sample_unref);
+    return NULL;
+  }
+
+  GST_DEBUG ("frame caps: %" GST_PTR_FORMAT, gst_sample_get_caps (sample));
+
+  /* Remember how the frame needs to be rotated, so that it can be
+   * applied when converting, away from the pipeline */
+  info = gst_structure_new (FRAME_INFO_NAME,
+                            "rotation", G_TYPE_INT, totem_gst_playbin_get_rotation (play),
+                            NULL);
+  ret = gst_sample_new (gst_sample_get_buffer (sample),
+                        gst_sample_get_caps (sample),
+                        gst_sample_get_segment (sample),
+                        info);
+  gst_sample_unref (sample);
+
+  return ret;
+}
+
+static void
+destroy_frame (guchar *pix, gpointer data)
+{
+  GstVideoFrame *frame = data;
+
+  gst_video_frame_unmap (frame);
+  g_free (frame);
+}
+
+/* Whether the sample can be wrapped in a GdkPixbuf without converting it */
+static gboolean
+sample_is_pixbuf_compatible (GstSample *sample)
+{
+  GstVideoInfo info;
+
+  if (!gst_video_info_from_caps (&info, gst_sample_get_caps (sample)))
+    return FALSE;
+
+  return (GST_VIDEO_INFO_FORMAT (&info) == GST_VIDEO_FORMAT_RGB ||
+          GST_VIDEO_INFO_FORMAT (&info) == GST_VIDEO_FORMAT_RGBA) &&
+    GST_VIDEO_INFO_PAR_N (&info) == GST_VIDEO_INFO_PAR_D (&info);
+}
+
+static GdkPixbuf *
+wrap_sample (GstSample *sample, GError **error)
+{
+  GstVideoInfo info;
+  GstVideoFrame *frame;
+  GstBuffer *buffer;
+  GdkPixbuf *pixbuf, *copy;
+  gboolean writable;
+
+  if (!gst_video_info_from_caps (&info, gst_sample_get_caps (sample)) ||
+      GST_VIDEO_INFO_WIDTH (&info) <= 0 || GST_VIDEO_INFO_HEIGHT (&info) <= 0) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                         "Could not prepare buffer memory for image dimensions");
+    return NULL;
+  }
+
+  /* The frame keeps a reference to the buffer until the pixbuf is gone.
+   * Only buffers nobody else holds, such as converted ones, can be
+   * handed out as writable pixbufs. */
+  buffer = gst_sample_get_buffer (sample);
+  frame = g_new0 (GstVideoFrame, 1);
+  writable = gst_buffer_is_writable (buffer) &&
+    gst_video_frame_map (frame, &info, buffer, GST_MAP_READWRITE);
+  if (!writable &&
+      !gst_video_frame_map (frame, &info, buffer, GST_MAP_READ)) {
+    g_free (frame);
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                         "Could not map video frame");
+    return NULL;
+  }
+
+  pixbuf = gdk_pixbuf_new_from_data (GST_VIDEO_FRAME_PLANE_DATA (frame, 0),
+                                     GDK_COLORSPACE_RGB,
+                                     GST_VIDEO_INFO_HAS_ALPHA (&info),
+                                     8,
+                                     GST_VIDEO_FRAME_WIDTH (frame),
+                                     GST_VIDEO_FRAME_HEIGHT (frame),
+                                     GST_VIDEO_FRAME_PLANE_STRIDE (frame, 0),
+                                     destroy_frame, frame);
+  if (writable)
+    return pixbuf;
+
+  /* The sink's last frame is shared with the pipeline, which can still
+   * be showing or reusing it, so the caller gets a copy */
+  copy = gdk_pixbuf_copy (pixbuf);
+  g_object_unref (pixbuf);
+  if (!copy)
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                         "Could not allocate memory for the video frame");
+
+  return copy;
+}
+
+/**
+ * totem_gst_sample_to_pixbuf:
+ * @sample: a #GstSample, as returned by totem_gst_playbin_get_sample()
+ * @error: a #GError, or %NULL
+ *
+ * Converts @sample to an upright RGB #GdkPixbuf with square pixels.
+ * Samples that already are in a compatible format aren't converted,
+ * their pixels are copied once, as their buffer is still shared with
+ * the pipeline. The returned pixbuf is always safe to modify.
+ *
+ * This can be slow, and is safe to call from any thread.
+ *
+ * Returns: (transfer full) (nullable): a #GdkPixbuf, or %NULL
+ */
+GdkPixbuf *
+totem_gst_sample_to_pixbuf (GstSample *sample, GError **error)
+{
+  g_autoptr(GstSample) converted = NULL;
+  const GstStructure *frame_info;
+  GdkPixbuf *pixbuf;
+  int rotation = GDK_PIXBUF_ROTATE_NONE;
+
+  g_return_val_if_fail (GST_IS_SAMPLE (sample), NULL);
+  g_return_val_if_fail (gst_sample_get_caps (sample) != NULL, NULL);
+
+  if (sample_is_pixbuf_compatible (sample)) {
+    converted = gst_sample_ref (sample);
+  } else {
+    g_autoptr(GstSample) raw_sample = NULL;
+    GstCaps *raw_caps, *to_caps;
+
+    /* GL and other special memories can still be mapped, but the
+     * conversion pipeline would fail to negotiate their caps features */
+    raw_caps = gst_caps_copy (gst_sample_get_caps (sample));
+    gst_caps_set_features (raw_caps, 0, NULL);
+    raw_sample = gst_sample_new (gst_sample_get_buffer (sample), raw_caps,
+                                 gst_sample_get_segment (sample), NULL);
+    gst_caps_unref (raw_caps);
+
+    /* Note: we don't ask for a specific width/height here, so that
+     * videoscale can adjust dimensions from a non-1/1 pixel aspect
+     * ratio to a 1/1 pixel-aspect-ratio. */
+    to_caps = gst_caps_new_simple ("video/x-raw",
+        "format", G_TYPE_STRING, "RGB",
+        "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+        NULL);
+    converted = gst_video_convert_sample (raw_sample, to_caps, GST_CLOCK_TIME_NONE, error);
+    gst_caps_unref (to_caps);
+
+    if (!converted)
+      return NULL;
+  }
+
+  pixbuf = wrap_sample (converted, error);
+  if (!pixbuf)
+    return NULL;
+
+  frame_info = gst_sample_get_info (sample);
+  if (frame_info && gst_structure_has_name (frame_info, FRAME_INFO_NAME))
+    gst_structure_get_int (frame_info, "rotation", &rotation);
+
   if (rotation != GDK_PIXBUF_ROTATE_NONE) {
     GdkPixbuf *rotated;
 
@@ -147,8 +250,236 @@ done:
   return pixbuf;
 }
 
+static void
+sample_to_pixbuf_thread (GTask        *task,
+                         gpointer      source_object,
+                         gpointer      task_data,
+                         GCancellable *cancellable)
+{
+  GError *error = NULL;
+  GdkPixbuf *pixbuf;
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  pixbuf = totem_gst_sample_to_pixbuf (task_data, &error);
+  if (pixbuf)
+    g_task_return_pointer (task, pixbuf, g_object_unref);
+  else
+    g_task_return_error (task, error);
+}
+
+/**
+ * totem_gst_sample_to_pixbuf_async:
+ * @sample: a #GstSample, as returned by totem_gst_playbin_get_sample()
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: a #GAsyncReadyCallback
+ * @user_data: data to pass to @callback
+ *
+ * Runs totem_gst_sample_to_pixbuf() in a worker thread.
+ */
+void
+totem_gst_sample_to_pixbuf_async (GstSample           *sample,
+                                  GCancellable        *cancellable,
+                                  GAsyncReadyCallback  callback,
+                                  gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_return_if_fail (GST_IS_SAMPLE (sample));
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, totem_gst_sample_to_pixbuf_async);
+  g_task_set_task_data (task, gst_sample_ref (sample), (GDestroyNotify) gst_sample_unref);
+  g_task_run_in_thread (task, sample_to_pixbuf_thread);
+}
+
+/**
+ * totem_gst_sample_to_pixbuf_finish:
+ * @result: a #GAsyncResult
+ * @error: a #GError, or %NULL
+ *
+ * Finishes a totem_gst_sample_to_pixbuf_async() call.
+ *
+ * Returns: (transfer full) (nullable): a #GdkPixbuf, or %NULL
+ */
+GdkPixbuf *
+totem_gst_sample_to_pixbuf_finish (GAsyncResult  *result,
+                                   GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/* Number of luma samples taken across each dimension of a frame */
+#define FRAME_STATS_SAMPLES 128
+
+/**
+ * totem_gst_sample_get_frame_stats:
+ * @sample: a #GstSample, as returned by totem_gst_playbin_get_sample()
+ * @stats: (out caller-allocates): a #TotemGstFrameStats to fill in
+ *
+ * Computes the brightness and contrast of @sample, along with a coarse
+ * signature that can be compared with totem_gst_frame_stats_distance().
+ *
+ * This works in a single pass over a subsampled grid of the decoded
+ * luma plane, without converting or copying the frame. Only formats
+ * with 8-bit components are supported, and the green component is used
+ * as an approximation of the luma in RGB formats.
+ *
+ * Returns: %TRUE if @stats was filled in, %FALSE if the format of
+ *   @sample is not supported
+ */
+gboolean
+totem_gst_sample_get_frame_stats (GstSample          *sample,
+                                  TotemGstFrameStats *stats)
+{
+  GstVideoInfo info;
+  GstVideoFrame frame;
+  GstCaps *caps;
+  const guint8 *data;
+  guint64 sum = 0, sum_sq = 0, n = 0;
+  guint64 cell_sum[TOTEM_GST_FRAME_STATS_GRID * TOTEM_GST_FRAME_STATS_GRID] = { 0, };
+  guint cell_n[TOTEM_GST_FRAME_STATS_GRID * TOTEM_GST_FRAME_STATS_GRID] = { 0, };
+  guint width, height, stride, pstride, step_x, step_y;
+  guint comp, x, y, i;
+  gboolean ret;
+
+  g_return_val_if_fail (GST_IS_SAMPLE (sample), FALSE);
+  g_return_val_if_fail (stats != NULL, FALSE);
+
+  if (gst_sample_get_caps (sample) == NULL || gst_sample_get_buffer (sample) == NULL)
+    return FALSE;
+
+  /* Special memories can still be mapped, see totem_gst_sample_to_pixbuf() */
+  caps = gst_caps_copy (gst_sample_get_caps (sample));
+  gst_caps_set_features (caps, 0, NULL);
+  ret = gst_video_info_from_caps (&info, caps);
+  gst_caps_unref (caps);
+  if (!ret)
+    return FALSE;
+
+  if (GST_VIDEO_INFO_IS_RGB (&info))
+    comp = 1;
+  else if (GST_VIDEO_INFO_IS_YUV (&info) || GST_VIDEO_INFO_IS_GRAY (&info))
+    comp = 0;
+  else
+    return FALSE;
+
+  if (GST_VIDEO_INFO_COMP_DEPTH (&info, comp) != 8 ||
+      GST_VIDEO_FORMAT_INFO_IS_TILED (info.finfo))
+    return FALSE;
+
+  if (!gst_video_frame_map (&frame, &info, gst_sample_get_buffer (sample), GST_MAP_READ))
+    return FALSE;
+
+  data = GST_VIDEO_FRAME_COMP_DATA (&frame, comp);
+  width = GST_VIDEO_FRAME_COMP_WIDTH (&frame, comp);
+  height = GST_VIDEO_FRAME_COMP_HEIGHT (&frame, comp);
+  stride = GST_VIDEO_FRAME_COMP_STRIDE (&frame, comp);
+  pstride = GST_VIDEO_FRAME_COMP_PSTRIDE (&frame, comp);
+  step_x = MAX (1, width / FRAME_STATS_SAMPLES);
+  step_y = MAX (1, height / FRAME_STATS_SAMPLES);
+
+  for (y = 0; y < height; y += step_y) {
+    const guint8 *row = data + (gsize) y * stride;
+    guint cell_row = (y * TOTEM_GST_FRAME_STATS_GRID / height) * TOTEM_GST_FRAME_STATS_GRID;
+
+    for (x = 0; x < width; x += step_x) {
+      guint value = row[x * pstride];
+      guint cell = cell_row + x * TOTEM_GST_FRAME_STATS_GRID / width;
+
+      sum += value;
+      sum_sq += value * value;
+      cell_sum[cell] += value;
+      cell_n[cell]++;
+    }
+    n += (width + step_x - 1) / step_x;
+  }
+
+  gst_video_frame_unmap (&frame);
+
+  if (n == 0)
+    return FALSE;
+
+  stats->brightness = sum / n;
+  stats->variance = (sum_sq - sum * sum / n) / n;
+  for (i = 0; i < G_N_ELEMENTS (stats->signature); i++)
+    stats->signature[i] = cell_n[i] ? cell_sum[i] / cell_n[i] : stats->brightness;
+
+  return TRUE;
+}
+
+/**
+ * totem_gst_frame_stats_distance:
+ * @a: a #TotemGstFrameStats
+ * @b: another #TotemGstFrameStats
+ *
+ * Compares the signatures of two frames, to tell scene changes apart
+ * from frames showing the same picture.
+ *
+ * Returns: the average luma difference between the frames, from 0
+ *   for identical frames to 255
+ */
+guint
+totem_gst_frame_stats_distance (const TotemGstFrameStats *a,
+                                const TotemGstFrameStats *b)
+{
+  guint i, total = 0;
+
+  for (i = 0; i < G_N_ELEMENTS (a->signature); i++)
+    total += ABS ((int) a->signature[i] - (int) b->signature[i]);
+
+  return total / G_N_ELEMENTS (a->signature);
+}
+
+GdkPixbuf *
+totem_gst_playbin_get_frame (GstElement *play, GError **error)
+{
+  g_autoptr(GstSample) sample = NULL;
+
+  g_return_val_if_fail (play != NULL, NULL);
+  g_return_val_if_fail (GST_IS_ELEMENT (play), NULL);
+
+  sample = totem_gst_playbin_get_sample (play, error);
+  if (!sample)
+    return NULL;
+
+  return totem_gst_sample_to_pixbuf (sample, error);
+}
+
+typedef struct {
+  int size;
+  int width;
+  int height;
+} CoverSize;
+
+static void
+cover_size_prepared_cb (GdkPixbufLoader *loader,
+                        int              width,
+                        int              height,
+                        CoverSize       *cover_size)
+{
+  cover_size->width = width;
+  cover_size->height = height;
+
+  if (cover_size->size <= 0 ||
+      (width <= cover_size->size && height <= cover_size->size))
+    return;
+
+  /* Let the loader scale while decoding, JPEG can skip most of the work */
+  if (width > height)
+    gdk_pixbuf_loader_set_size (loader, cover_size->size,
+                                MAX (cover_size->size * height / width, 1));
+  else
+    gdk_pixbuf_loader_set_size (loader, MAX (cover_size->size * width / height, 1),
+                                cover_size->size);
+}
+
 static GdkPixbuf *
-totem_gst_buffer_to_pixbuf (GstBuffer *buffer)
+totem_gst_buffer_to_pixbuf (GstBuffer *buffer,
+                            CoverSize *cover_size)
 {
   GdkPixbufLoader *loader;
   GdkPixbuf *pixbuf = NULL;
@@ -161,6 +492,8 @@ totem_gst_buffer_to_pixbuf (GstBuffer *buffer)
   }
 
   loader = gdk_pixbuf_loader_new ();
+  g_signal_connect (loader, "size-prepared",
+                    G_CALLBACK (cover_size_prepared_cb), cover_size);
 
   if (gdk_pixbuf_loader_write (loader, info.data, info.size, &err) &&
       gdk_pixbuf_loader_close (loader, &err)) {
@@ -215,31 +548,55 @@ totem_gst_tag_list_get_cover_real (GstTagList *tag_list)
   return cover_sample;
 }
 
+/**
+ * totem_gst_tag_list_get_cover_at_size:
+ * @tag_list: a #GstTagList
+ * @size: the maximum width and height of the cover, or -1 for the full size
+ * @width: (out) (optional): the original width of the cover
+ * @height: (out) (optional): the original height of the cover
+ *
+ * Decodes the front cover, or the preview image, from @tag_list,
+ * scaling it down while decoding so it fits in @size.
+ *
+ * Returns: (transfer full) (nullable): the cover
+ */
 GdkPixbuf *
-totem_gst_tag_list_get_cover (GstTagList *tag_list)
+totem_gst_tag_list_get_cover_at_size (GstTagList *tag_list,
+                                      int         size,
+                                      int        *width,
+                                      int        *height)
 {
   GstSample *cover_sample;
+  CoverSize cover_size = { size, -1, -1 };
+  GdkPixbuf *pixbuf;
 
-  g_return_val_if_fail (tag_list != NULL, FALSE);
+  g_return_val_if_fail (tag_list != NULL, NULL);
 
   cover_sample = totem_gst_tag_list_get_cover_real (tag_list);
   /* Fallback to preview */
-    if (!cover_sample) {
-      gst_tag_list_get_sample_index (tag_list, GST_TAG_PREVIEW_IMAGE, 0,
-				     &cover_sample);
-    }
+  if (!cover_sample) {
+    gst_tag_list_get_sample_index (tag_list, GST_TAG_PREVIEW_IMAGE, 0,
+                                   &cover_sample);
+  }
 
-  if (cover_sample) {
-    GstBuffer *buffer;
-    GdkPixbuf *pixbuf;
+  if (!cover_sample)
+    return NULL;
 
-    buffer = gst_sample_get_buffer (cover_sample);
-    pixbuf = totem_gst_buffer_to_pixbuf (buffer);
-    gst_sample_unref (cover_sample);
-    return pixbuf;
-  }
+  pixbuf = totem_gst_buffer_to_pixbuf (gst_sample_get_buffer (cover_sample), &cover_size);
+  gst_sample_unref (cover_sample);
+
+  if (width)
+    *width = cover_size.width;
+  if (height)
+    *height = cover_size.height;
+
+  return pixbuf;
+}
 
-  return NULL;
+GdkPixbuf *
+totem_gst_tag_list_get_cover (GstTagList *tag_list)
+{
+  return totem_gst_tag_list_get_cover_at_size (tag_list, -1, NULL, NULL);
 }
 
 /*
@@ -10,5 +10,31 @@
 #include <gst/gst.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 
+#define TOTEM_GST_FRAME_STATS_GRID 8
+
+typedef struct {
+  guint8 brightness;
+  guint  variance;
+  guint8 signature[TOTEM_GST_FRAME_STATS_GRID * TOTEM_GST_FRAME_STATS_GRID];
+} TotemGstFrameStats;
+
+GstSample * totem_gst_playbin_get_sample (GstElement *play, GError **error);
+GdkPixbuf * totem_gst_sample_to_pixbuf (GstSample *sample, GError **error);
+void        totem_gst_sample_to_pixbuf_async (GstSample           *sample,
+                                              GCancellable        *cancellable,
+                                              GAsyncReadyCallback  callback,
+                                              gpointer             user_data);
+GdkPixbuf * totem_gst_sample_to_pixbuf_finish (GAsyncResult  *result,
+                                               GError       **error);
+
+gboolean    totem_gst_sample_get_frame_stats (GstSample          *sample,
+                                              TotemGstFrameStats *stats);
+guint       totem_gst_frame_stats_distance   (const TotemGstFrameStats *a,
+                                              const TotemGstFrameStats *b);
+
 GdkPixbuf * totem_gst_playbin_get_frame (GstElement *play, GError **error);
 GdkPixbuf * totem_gst_tag_list_get_cover (GstTagList *tag_list);
+GdkPixbuf * totem_gst_tag_list_get_cover_at_size (GstTagList *tag_list,
+                                                  int         size,
+                                                  int        *width,
+                                                  int        *height);
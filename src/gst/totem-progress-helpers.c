@@ -0,0 +1,133 @@
+/*
+ * Progress messages between the thumbnailers and their callers
+ *
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <gio/gio.h>
+
+#include "totem-progress-helpers.h"
+
+static const char *message_types[] = {
+	"progress",
+	"done",
+	"error"
+};
+
+/* Writes the whole of @msg in one go, so that readers never
+ * see partial messages from well-behaved writers. Callers writing
+ * from several threads need to serialise calls themselves. */
+gboolean
+totem_progress_message_write (int                         fd,
+			      const TotemProgressMessage *msg)
+{
+	GVariantDict dict;
+	g_autoptr(GVariant) variant = NULL;
+	g_autofree guint8 *buffer = NULL;
+	gsize size, written;
+	guint32 length;
+
+	g_return_val_if_fail (msg->type < G_N_ELEMENTS (message_types), FALSE);
+
+	g_variant_dict_init (&dict, NULL);
+	g_variant_dict_insert (&dict, "type", "s", message_types[msg->type]);
+	g_variant_dict_insert (&dict, "fraction", "d", msg->fraction);
+	g_variant_dict_insert (&dict, "elapsed", "x", msg->elapsed);
+	if (msg->n_tiles > 0) {
+		g_variant_dict_insert (&dict, "tile", "u", msg->tile);
+		g_variant_dict_insert (&dict, "n-tiles", "u", msg->n_tiles);
+	}
+	if (msg->output != NULL)
+		g_variant_dict_insert (&dict, "output", "s", msg->output);
+	if (msg->message != NULL)
+		g_variant_dict_insert (&dict, "message", "s", msg->message);
+	variant = g_variant_ref_sink (g_variant_dict_end (&dict));
+
+	size = g_variant_get_size (variant);
+	g_return_val_if_fail (size <= TOTEM_PROGRESS_MAX_MESSAGE_SIZE, FALSE);
+
+	buffer = g_malloc (TOTEM_PROGRESS_HEADER_SIZE + size);
+	length = GUINT32_TO_BE (size);
+	memcpy (buffer, &length, TOTEM_PROGRESS_HEADER_SIZE);
+	g_variant_store (variant, buffer + TOTEM_PROGRESS_HEADER_SIZE);
+	size += TOTEM_PROGRESS_HEADER_SIZE;
+
+	written = 0;
+	while (written < size) {
+		gssize ret;
+
+		ret = write (fd, buffer + written, size - written);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		written += ret;
+	}
+
+	return TRUE;
+}
+
+/* Returns the length of the message following @header, which
+ * must be TOTEM_PROGRESS_HEADER_SIZE bytes long */
+gsize
+totem_progress_message_get_length (const guint8 *header)
+{
+	guint32 length;
+
+	memcpy (&length, header, TOTEM_PROGRESS_HEADER_SIZE);
+	return GUINT32_FROM_BE (length);
+}
+
+gboolean
+totem_progress_message_parse (GBytes                *bytes,
+			      TotemProgressMessage  *msg,
+			      GError               **error)
+{
+	g_autoptr(GVariant) variant = NULL;
+	const char *type = NULL;
+	guint i;
+
+	memset (msg, 0, sizeof (*msg));
+
+	variant = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE_VARDICT, bytes, FALSE));
+	if (!g_variant_is_normal_form (variant)) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+				     "Progress message is not in normal form");
+		return FALSE;
+	}
+
+	g_variant_lookup (variant, "type", "&s", &type);
+	for (i = 0; i < G_N_ELEMENTS (message_types); i++) {
+		if (g_strcmp0 (type, message_types[i]) == 0)
+			break;
+	}
+	if (i == G_N_ELEMENTS (message_types)) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+			     "Unknown progress message type '%s'", type ? type : "(null)");
+		return FALSE;
+	}
+	msg->type = i;
+
+	g_variant_lookup (variant, "fraction", "d", &msg->fraction);
+	g_variant_lookup (variant, "elapsed", "x", &msg->elapsed);
+	g_variant_lookup (variant, "tile", "u", &msg->tile);
+	g_variant_lookup (variant, "n-tiles", "u", &msg->n_tiles);
+	g_variant_lookup (variant, "output", "s", &msg->output);
+	g_variant_lookup (variant, "message", "s", &msg->message);
+
+	msg->fraction = CLAMP (msg->fraction, 0.0, 1.0);
+
+	return TRUE;
+}
+
+void
+totem_progress_message_clear (TotemProgressMessage *msg)
+{
+	g_clear_pointer (&msg->output, g_free);
+	g_clear_pointer (&msg->message, g_free);
+}
@@ -0,0 +1,40 @@
+/*
+ * Progress messages between the thumbnailers and their callers
+ *
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/* Each message is a 32-bit big-endian length, followed by that many
+ * bytes of a serialised "a{sv}" GVariant. Unknown keys are ignored,
+ * so new fields can be added without breaking older readers. */
+#define TOTEM_PROGRESS_HEADER_SIZE 4
+#define TOTEM_PROGRESS_MAX_MESSAGE_SIZE 65536
+
+typedef enum {
+	TOTEM_PROGRESS_MESSAGE_PROGRESS,
+	TOTEM_PROGRESS_MESSAGE_DONE,
+	TOTEM_PROGRESS_MESSAGE_ERROR
+} TotemProgressMessageType;
+
+typedef struct {
+	TotemProgressMessageType type;
+	gdouble   fraction;	/* from 0.0 to 1.0 */
+	guint     tile;		/* tiles done so far, for galleries */
+	guint     n_tiles;
+	gint64    elapsed;	/* in microseconds since the thumbnailer started */
+	char     *output;	/* output file, for DONE messages */
+	char     *message;	/* for ERROR messages */
+} TotemProgressMessage;
+
+gboolean totem_progress_message_write       (int                         fd,
+					     const TotemProgressMessage *msg);
+gsize    totem_progress_message_get_length  (const guint8               *header);
+gboolean totem_progress_message_parse       (GBytes                     *bytes,
+					     TotemProgressMessage       *msg,
+					     GError                    **error);
+void     totem_progress_message_clear       (TotemProgressMessage       *msg);
@@ -0,0 +1,735 @@
+/*
+ * Persistent cache for network streams
+ *
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+/*
+ * TotemStreamCache keeps the parts of network streams that were
+ * downloaded, so that seeking back, or watching again, doesn't need
+ * downloading them again.
+ *
+ * Each stream is keyed on its URI and a validator, its ETag or
+ * modification date, so that a changed resource isn't served from the
+ * cache. The data is stored in a sparse file per stream, at the same
+ * offsets as in the stream, along with the list of byte ranges that
+ * were written, in "index.ini". When the cache goes over its size
+ * budget, the least recently used streams get evicted.
+ */
+
+#include "totem-stream-cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#define DEFAULT_MAX_SIZE (512 * 1024 * 1024)
+#define SAVE_INTERVAL (16 * 1024 * 1024)     /* Bytes written between index saves */
+
+typedef struct {
+  guint64 start;
+  guint64 end;
+} CacheRange;
+
+typedef struct {
+  char *key;
+  char *uri;
+  char *validator;
+  guint64 length;       /* 0 if unknown */
+  GArray *ranges;       /* sorted, disjoint and non-adjacent CacheRanges */
+  guint64 size;         /* total size of the ranges */
+  gint64 last_used;     /* wall-clock time, in seconds */
+  int fd;
+  guint open_count;
+} CacheItem;
+
+struct _TotemStreamCacheEntry {
+  TotemStreamCache *cache;
+  CacheItem *item;
+};
+
+struct _TotemStreamCache {
+  GObject parent;
+
+  GMutex lock;
+  char *path;
+  guint64 max_size;
+  guint64 size;
+  guint64 unsaved;
+  GHashTable *items; /* key → CacheItem */
+};
+
+G_DEFINE_TYPE (TotemStreamCache, totem_stream_cache, G_TYPE_OBJECT)
+
+static void
+cache_item_free (CacheItem *item)
+{
+  if (item->fd >= 0)
+    close (item->fd);
+  g_free (item->key);
+  g_free (item->uri);
+  g_free (item->validator);
+  g_array_unref (item->ranges);
+  g_free (item);
+}
+
+static CacheItem *
+cache_item_new (const char *key,
+                const char *uri,
+                const char *validator,
+                guint64     length)
+{
+  CacheItem *item;
+
+  item = g_new0 (CacheItem, 1);
+  item->key = g_strdup (key);
+  item->uri = g_strdup (uri);
+  item->validator = g_strdup (validator);
+  item->length = length;
+  item->ranges = g_array_new (FALSE, FALSE, sizeof (CacheRange));
+  item->fd = -1;
+
+  return item;
+}
+
+static char *
+get_data_path (TotemStreamCache *cache,
+               const char       *key)
+{
+  g_autofree char *filename = NULL;
+
+  filename = g_strdup_printf ("%s.data", key);
+  return g_build_filename (cache->path, filename, NULL);
+}
+
+/* Returns the number of bytes that weren't in @ranges already */
+static guint64
+ranges_add (GArray  *ranges,
+            guint64  start,
+            guint64  end)
+{
+  guint64 removed = 0;
+  CacheRange range = { start, end };
+  guint i = 0;
+
+  /* Skip the ranges entirely before the new one */
+  while (i < ranges->len && g_array_index (ranges, CacheRange, i).end < start)
+    i++;
+
+  /* And merge the ones it overlaps or touches */
+  while (i < ranges->len && g_array_index (ranges, CacheRange, i).start <= end) {
+    CacheRange *r = &g_array_index (ranges, CacheRange, i);
+
+    range.start = MIN (range.start, r->start);
+    range.end = MAX (range.end, r->end);
+    removed += r->end - r->start;
+    g_array_remove_index (ranges, i);
+  }
+
+  g_array_insert_val (ranges, i, range);
+
+  return (range.end - range.start) - removed;
+}
+
+static guint64
+ranges_get_available (GArray  *ranges,
+                      guint64  offset)
+{
+  guint low = 0, high = ranges->len;
+
+  while (low < high) {
+    guint mid = (low + high) / 2;
+    CacheRange *r = &g_array_index (ranges, CacheRange, mid);
+
+    if (offset < r->start)
+      high = mid;
+    else if (offset >= r->end)
+      low = mid + 1;
+    else
+      return r->end - offset;
+  }
+
+  return 0;
+}
+
+static void
+totem_stream_cache_save (TotemStreamCache *cache)
+{
+  g_autoptr(GKeyFile) keyfile = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *path = NULL;
+  GHashTableIter iter;
+  CacheItem *item;
+
+  keyfile = g_key_file_new ();
+  g_hash_table_iter_init (&iter, cache->items);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &item)) {
+    g_autoptr(GPtrArray) ranges = NULL;
+    guint i;
+
+    ranges = g_ptr_array_new_with_free_func (g_free);
+    for (i = 0; i < item->ranges->len; i++) {
+      CacheRange *r = &g_array_index (item->ranges, CacheRange, i);
+      g_ptr_array_add (ranges, g_strdup_printf ("%" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT,
+                                                r->start, r->end));
+    }
+
+    g_key_file_set_string (keyfile, item->key, "URI", item->uri);
+    g_key_file_set_string (keyfile, item->key, "Validator", item->validator);
+    g_key_file_set_uint64 (keyfile, item->key, "Length", item->length);
+    g_key_file_set_int64 (keyfile, item->key, "LastUsed", item->last_used);
+    g_key_file_set_string_list (keyfile, item->key, "Ranges",
+                                (const char * const *) ranges->pdata, ranges->len);
+  }
+
+  path = g_build_filename (cache->path, "index.ini", NULL);
+  if (g_mkdir_with_parents (cache->path, 0700) < 0 ||
+      !g_key_file_save_to_file (keyfile, path, &error)) {
+    GST_WARNING ("Could not save stream cache index to '%s': %s",
+                 path, error ? error->message : g_strerror (errno));
+  }
+  cache->unsaved = 0;
+}
+
+static void
+totem_stream_cache_load (TotemStreamCache *cache)
+{
+  g_autoptr(GKeyFile) keyfile = NULL;
+  g_autoptr(GDir) dir = NULL;
+  g_auto(GStrv) groups = NULL;
+  g_autofree char *path = NULL;
+  const char *name;
+  guint i;
+
+  keyfile = g_key_file_new ();
+  path = g_build_filename (cache->path, "index.ini", NULL);
+  g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, NULL);
+
+  groups = g_key_file_get_groups (keyfile, NULL);
+  for (i = 0; groups[i] != NULL; i++) {
+    g_autofree char *uri = NULL;
+    g_autofree char *validator = NULL;
+    g_autofree char *data_path = NULL;
+    g_auto(GStrv) ranges = NULL;
+    CacheItem *item;
+    guint j;
+
+    uri = g_key_file_get_string (keyfile, groups[i], "URI", NULL);
+    validator = g_key_file_get_string (keyfile, groups[i], "Validator", NULL);
+    ranges = g_key_file_get_string_list (keyfile, groups[i], "Ranges", NULL, NULL);
+    data_path = get_data_path (cache, groups[i]);
+    if (uri == NULL || validator == NULL || ranges == NULL ||
+        !g_file_test (data_path, G_FILE_TEST_IS_REGULAR))
+      continue;
+
+    item = cache_item_new (groups[i], uri, validator,
+                           g_key_file_get_uint64 (keyfile, groups[i], "Length", NULL));
+    item->last_used = g_key_file_get_int64 (keyfile, groups[i], "LastUsed", NULL);
+    for (j = 0; ranges[j] != NULL; j++) {
+      guint64 start, end;
+
+      if (sscanf (ranges[j], "%" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT, &start, &end) == 2 &&
+          start < end)
+        item->size += ranges_add (item->ranges, start, end);
+    }
+
+    cache->size += item->size;
+    g_hash_table_insert (cache->items, item->key, item);
+  }
+
+  /* Remove data files the index doesn't know about, eg. after a crash */
+  dir = g_dir_open (cache->path, 0, NULL);
+  while (dir != NULL && (name = g_dir_read_name (dir)) != NULL) {
+    g_autofree char *key = NULL;
+
+    if (!g_str_has_suffix (name, ".data"))
+      continue;
+    key = g_strndup (name, strlen (name) - strlen (".data"));
+    if (!g_hash_table_contains (cache->items, key)) {
+      g_autofree char *data_path = NULL;
+
+      data_path = g_build_filename (cache->path, name, NULL);
+      g_unlink (data_path);
+    }
+  }
+
+  GST_DEBUG ("Loaded stream cache from '%s', %u streams, %" G_GUINT64_FORMAT " bytes",
+             cache->path, g_hash_table_size (cache->items), cache->size);
+}
+
+static void
+totem_stream_cache_remove_item (TotemStreamCache *cache,
+                                CacheItem        *item)
+{
+  g_autofree char *data_path = NULL;
+
+  g_assert (item->open_count == 0);
+
+  GST_DEBUG ("Evicting '%s' from the stream cache, %" G_GUINT64_FORMAT " bytes",
+             item->uri, item->size);
+
+  data_path = get_data_path (cache, item->key);
+  g_unlink (data_path);
+  cache->size -= item->size;
+  g_hash_table_remove (cache->items, item->key);
+}
+
+/* Evicts the least recently used streams, that aren't open, until
+ * @needed more bytes fit in the budget */
+static gboolean
+totem_stream_cache_make_room (TotemStreamCache *cache,
+                              guint64           needed)
+{
+  gboolean evicted = FALSE;
+
+  while (cache->size + needed > cache->max_size) {
+    GHashTableIter iter;
+    CacheItem *item, *oldest = NULL;
+
+    g_hash_table_iter_init (&iter, cache->items);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &item)) {
+      if (item->open_count > 0 || item->size == 0)
+        continue;
+      if (oldest == NULL || item->last_used < oldest->last_used)
+        oldest = item;
+    }
+
+    if (oldest == NULL)
+      break;
+    totem_stream_cache_remove_item (cache, oldest);
+    evicted = TRUE;
+  }
+
+  if (evicted)
+    totem_stream_cache_save (cache);
+
+  return cache->size + needed <= cache->max_size;
+}
+
+/**
+ * totem_stream_cache_open:
+ * @cache: a #TotemStreamCache
+ * @uri: the URI of the stream
+ * @validator: the stream's ETag, or modification date
+ * @length: the length of the stream in bytes, or 0 if unknown
+ *
+ * Opens the cache entry for a stream, creating it if needed. Data
+ * cached for other versions of the stream is thrown away.
+ *
+ * Returns: (transfer full) (nullable): a #TotemStreamCacheEntry, or
+ * %NULL if the cache couldn't be used
+ */
+TotemStreamCacheEntry *
+totem_stream_cache_open (TotemStreamCache *cache,
+                         const char       *uri,
+                         const char       *validator,
+                         guint64           length)
+{
+  TotemStreamCacheEntry *entry;
+  g_autofree char *key = NULL;
+  g_autofree char *data_path = NULL;
+  g_autoptr(GString) str = NULL;
+  GHashTableIter iter;
+  CacheItem *item;
+
+  g_return_val_if_fail (TOTEM_IS_STREAM_CACHE (cache), NULL);
+  g_return_val_if_fail (uri != NULL, NULL);
+  g_return_val_if_fail (validator != NULL, NULL);
+
+  str = g_string_new (uri);
+  g_string_append_c (str, '\n');
+  g_string_append (str, validator);
+  key = g_compute_checksum_for_string (G_CHECKSUM_SHA256, str->str, str->len);
+
+  g_mutex_lock (&cache->lock);
+
+  if (cache->max_size == 0) {
+    g_mutex_unlock (&cache->lock);
+    return NULL;
+  }
+
+  /* Older versions of the same stream won't be of use anymore */
+  g_hash_table_iter_init (&iter, cache->items);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &item)) {
+    if (item->open_count == 0 &&
+        g_str_equal (item->uri, uri) &&
+        !g_str_equal (item->key, key)) {
+      g_autofree char *stale_path = NULL;
+
+      stale_path = get_data_path (cache, item->key);
+      g_unlink (stale_path);
+      cache->size -= item->size;
+      g_hash_table_iter_remove (&iter);
+    }
+  }
+
+  item = g_hash_table_lookup (cache->items, key);
+  if (item != NULL && length != 0 && item->length != length && item->open_count == 0) {
+    totem_stream_cache_remove_item (cache, item);
+    item = NULL;
+  }
+
+  if (item == NULL) {
+    item = cache_item_new (key, uri, validator, length);
+    g_hash_table_insert (cache->items, item->key, item);
+  } else if (item->length == 0) {
+    item->length = length;
+  }
+
+  if (item->fd < 0) {
+    data_path = get_data_path (cache, key);
+    g_mkdir_with_parents (cache->path, 0700);
+    item->fd = g_open (data_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (item->fd < 0) {
+      GST_WARNING ("Could not open stream cache file '%s': %s",
+                   data_path, g_strerror (errno));
+      if (item->open_count == 0)
+        totem_stream_cache_remove_item (cache, item);
+      g_mutex_unlock (&cache->lock);
+      return NULL;
+    }
+  }
+
+  item->open_count++;
+  item->last_used = g_get_real_time () / G_USEC_PER_SEC;
+
+  GST_DEBUG ("Opened stream cache entry for '%s', %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " bytes cached",
+             uri, item->size, item->length);
+
+  g_mutex_unlock (&cache->lock);
+
+  entry = g_new0 (TotemStreamCacheEntry, 1);
+  entry->cache = g_object_ref (cache);
+  entry->item = item;
+
+  return entry;
+}
+
+/**
+ * totem_stream_cache_entry_close:
+ * @entry: a #TotemStreamCacheEntry
+ *
+ * Closes @entry, and saves the list of cached ranges.
+ */
+void
+totem_stream_cache_entry_close (TotemStreamCacheEntry *entry)
+{
+  TotemStreamCache *cache;
+  CacheItem *item;
+
+  g_return_if_fail (entry != NULL);
+
+  cache = entry->cache;
+  item = entry->item;
+
+  g_mutex_lock (&cache->lock);
+  item->last_used = g_get_real_time () / G_USEC_PER_SEC;
+  if (--item->open_count == 0) {
+    close (item->fd);
+    item->fd = -1;
+  }
+  totem_stream_cache_save (cache);
+  g_mutex_unlock (&cache->lock);
+
+  g_object_unref (cache);
+  g_free (entry);
+}
+
+/**
+ * totem_stream_cache_entry_get_length:
+ * @entry: a #TotemStreamCacheEntry
+ *
+ * Returns: the length of the stream, or 0 if unknown
+ */
+guint64
+totem_stream_cache_entry_get_length (TotemStreamCacheEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, 0);
+
+  return entry->item->length;
+}
+
+/**
+ * totem_stream_cache_entry_get_available:
+ * @entry: a #TotemStreamCacheEntry
+ * @offset: an offset in the stream
+ *
+ * Returns: the number of bytes cached from @offset onwards,
+ * without a gap
+ */
+guint64
+totem_stream_cache_entry_get_available (TotemStreamCacheEntry *entry,
+                                        guint64                offset)
+{
+  guint64 available;
+
+  g_return_val_if_fail (entry != NULL, 0);
+
+  g_mutex_lock (&entry->cache->lock);
+  available = ranges_get_available (entry->item->ranges, offset);
+  g_mutex_unlock (&entry->cache->lock);
+
+  return available;
+}
+
+/**
+ * totem_stream_cache_entry_is_complete:
+ * @entry: a #TotemStreamCacheEntry
+ *
+ * Returns: %TRUE if the whole stream is cached
+ */
+gboolean
+totem_stream_cache_entry_is_complete (TotemStreamCacheEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, FALSE);
+
+  return entry->item->length != 0 &&
+    totem_stream_cache_entry_get_available (entry, 0) >= entry->item->length;
+}
+
+/**
+ * totem_stream_cache_entry_read:
+ * @entry: a #TotemStreamCacheEntry
+ * @offset: the offset to read from
+ * @data: (out caller-allocates) (array length=size): the buffer to read into
+ * @size: the size of @data
+ *
+ * Reads cached data, up to the first gap.
+ *
+ * Returns: the number of bytes read, 0 if @offset isn't cached, or
+ * -1 on error
+ */
+gssize
+totem_stream_cache_entry_read (TotemStreamCacheEntry *entry,
+                               guint64                offset,
+                               guint8                *data,
+                               gsize                  size)
+{
+  CacheItem *item;
+  gsize done = 0;
+
+  g_return_val_if_fail (entry != NULL, -1);
+
+  item = entry->item;
+
+  g_mutex_lock (&entry->cache->lock);
+  size = MIN (size, ranges_get_available (item->ranges, offset));
+  g_mutex_unlock (&entry->cache->lock);
+
+  while (done < size) {
+    ssize_t ret;
+
+    ret = pread (item->fd, data + done, size - done, offset + done);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0) {
+      GST_WARNING ("Could not read cached data for '%s': %s",
+                   item->uri, ret < 0 ? g_strerror (errno) : "short file");
+      return -1;
+    }
+    done += ret;
+  }
+
+  return done;
+}
+
+/**
+ * totem_stream_cache_entry_write:
+ * @entry: a #TotemStreamCacheEntry
+ * @offset: the offset of @data in the stream
+ * @data: (array length=size): the data to cache
+ * @size: the size of @data
+ *
+ * Adds data to the cache, evicting other streams if needed to stay
+ * within the cache's maximum size.
+ *
+ * Returns: %TRUE if @data was cached
+ */
+gboolean
+totem_stream_cache_entry_write (TotemStreamCacheEntry *entry,
+                                guint64                offset,
+                                const guint8          *data,
+                                gsize                  size)
+{
+  TotemStreamCache *cache;
+  CacheItem *item;
+  gsize done = 0;
+  guint64 added;
+
+  g_return_val_if_fail (entry != NULL, FALSE);
+
+  if (size == 0)
+    return TRUE;
+
+  cache = entry->cache;
+  item = entry->item;
+
+  g_mutex_lock (&cache->lock);
+
+  if (ranges_get_available (item->ranges, offset) >= size) {
+    g_mutex_unlock (&cache->lock);
+    return TRUE;
+  }
+
+  if (!totem_stream_cache_make_room (cache, size)) {
+    g_mutex_unlock (&cache->lock);
+    return FALSE;
+  }
+
+  while (done < size) {
+    ssize_t ret;
+
+    ret = pwrite (item->fd, data + done, size - done, offset + done);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret < 0) {
+      GST_WARNING ("Could not write cached data for '%s': %s",
+                   item->uri, g_strerror (errno));
+      g_mutex_unlock (&cache->lock);
+      return FALSE;
+    }
+    done += ret;
+  }
+
+  added = ranges_add (item->ranges, offset, offset + size);
+  item->size += added;
+  cache->size += added;
+
+  cache->unsaved += added;
+  if (cache->unsaved >= SAVE_INTERVAL)
+    totem_stream_cache_save (cache);
+
+  g_mutex_unlock (&cache->lock);
+
+  return TRUE;
+}
+
+/**
+ * totem_stream_cache_set_max_size:
+ * @cache: a #TotemStreamCache
+ * @max_size: the maximum size of the cache, in bytes
+ *
+ * Sets the size budget of the cache, evicting streams if it's
+ * already over it. A size of 0 disables caching.
+ */
+void
+totem_stream_cache_set_max_size (TotemStreamCache *cache,
+                                 guint64           max_size)
+{
+  g_return_if_fail (TOTEM_IS_STREAM_CACHE (cache));
+
+  g_mutex_lock (&cache->lock);
+  cache->max_size = max_size;
+  totem_stream_cache_make_room (cache, 0);
+  g_mutex_unlock (&cache->lock);
+}
+
+guint64
+totem_stream_cache_get_max_size (TotemStreamCache *cache)
+{
+  g_return_val_if_fail (TOTEM_IS_STREAM_CACHE (cache), 0);
+
+  return cache->max_size;
+}
+
+/**
+ * totem_stream_cache_get_size:
+ * @cache: a #TotemStreamCache
+ *
+ * Returns: the number of bytes cached, over all streams
+ */
+guint64
+totem_stream_cache_get_size (TotemStreamCache *cache)
+{
+  guint64 size;
+
+  g_return_val_if_fail (TOTEM_IS_STREAM_CACHE (cache), 0);
+
+  g_mutex_lock (&cache->lock);
+  size = cache->size;
+  g_mutex_unlock (&cache->lock);
+
+  return size;
+}
+
+/**
+ * totem_stream_cache_new:
+ * @path: the directory to store the cache in
+ * @max_size: the maximum size of the cache, in bytes
+ *
+ * Returns: (transfer full): a new #TotemStreamCache
+ */
+TotemStreamCache *
+totem_stream_cache_new (const char *path,
+                        guint64     max_size)
+{
+  TotemStreamCache *cache;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  cache = g_object_new (TOTEM_TYPE_STREAM_CACHE, NULL);
+  cache->path = g_strdup (path);
+  cache->max_size = max_size;
+  totem_stream_cache_load (cache);
+
+  return cache;
+}
+
+/**
+ * totem_stream_cache_get_default:
+ *
+ * Returns: (transfer none): the #TotemStreamCache in the user's
+ * cache directory
+ */
+TotemStreamCache *
+totem_stream_cache_get_default (void)
+{
+  static TotemStreamCache *cache = NULL;
+
+  if (g_once_init_enter (&cache)) {
+    g_autofree char *path = NULL;
+
+    path = g_build_filename (g_get_user_cache_dir (), "totem", "stream-cache", NULL);
+    g_once_init_leave (&cache, totem_stream_cache_new (path, DEFAULT_MAX_SIZE));
+  }
+
+  return cache;
+}
+
+static void
+totem_stream_cache_finalize (GObject *object)
+{
+  TotemStreamCache *cache = TOTEM_STREAM_CACHE (object);
+
+  if (cache->unsaved > 0)
+    totem_stream_cache_save (cache);
+  g_hash_table_destroy (cache->items);
+  g_free (cache->path);
+  g_mutex_clear (&cache->lock);
+
+  G_OBJECT_CLASS (totem_stream_cache_parent_class)->finalize (object);
+}
+
+static void
+totem_stream_cache_class_init (TotemStreamCacheClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = totem_stream_cache_finalize;
+}
+
+static void
+totem_stream_cache_init (TotemStreamCache *cache)
+{
+  g_mutex_init (&cache->lock);
+  cache->items = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                        NULL, (GDestroyNotify) cache_item_free);
+}
+
+/*
+ * vim: sw=2 ts=8 cindent noai bs=2
+ */
@@ -0,0 +1,45 @@
+/*
+ * Persistent cache for network streams
+ *
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+#pragma once
+
+#include <gst/gst.h>
+
+#define TOTEM_TYPE_STREAM_CACHE (totem_stream_cache_get_type ())
+G_DECLARE_FINAL_TYPE (TotemStreamCache, totem_stream_cache, TOTEM, STREAM_CACHE, GObject)
+
+typedef struct _TotemStreamCacheEntry TotemStreamCacheEntry;
+
+TotemStreamCache      *totem_stream_cache_new                 (const char            *path,
+                                                               guint64                max_size);
+TotemStreamCache      *totem_stream_cache_get_default         (void);
+
+void                   totem_stream_cache_set_max_size        (TotemStreamCache      *cache,
+                                                               guint64                max_size);
+guint64                totem_stream_cache_get_max_size        (TotemStreamCache      *cache);
+guint64                totem_stream_cache_get_size            (TotemStreamCache      *cache);
+
+TotemStreamCacheEntry *totem_stream_cache_open                (TotemStreamCache      *cache,
+                                                               const char            *uri,
+                                                               const char            *validator,
+                                                               guint64                length);
+void                   totem_stream_cache_entry_close         (TotemStreamCacheEntry *entry);
+
+guint64                totem_stream_cache_entry_get_length    (TotemStreamCacheEntry *entry);
+guint64                totem_stream_cache_entry_get_available (TotemStreamCacheEntry *entry,
+                                                               guint64                offset);
+gboolean               totem_stream_cache_entry_is_complete   (TotemStreamCacheEntry *entry);
+gssize                 totem_stream_cache_entry_read          (TotemStreamCacheEntry *entry,
+                                                               guint64                offset,
+                                                               guint8                *data,
+                                                               gsize                  size);
+gboolean               totem_stream_cache_entry_write         (TotemStreamCacheEntry *entry,
+                                                               guint64                offset,
+                                                               const guint8          *data,
+                                                               gsize                  size);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (TotemStreamCacheEntry, totem_stream_cache_entry_close)
@@ -6,6 +6,7 @@
  */
 
 #include <icon-helpers.h>
+#include "totem-thumbnail-generator.h"
 
 #define GNOME_DESKTOP_USE_UNSTABLE_API 1
 #include <libgnome-desktop/gnome-desktop-thumbnail.h>
@@ -15,6 +16,14 @@
 #define THUMB_SEARCH_HEIGHT   THUMB_SEARCH_SIZE
 #define SOURCES_MAX_HEIGHT    64
 #define VIDEO_ICON_SIZE       32
+#define THUMB_LARGE_SIZE      256 /* GNOME_DESKTOP_THUMBNAIL_SIZE_LARGE */
+
+/* Framed thumbnails are THUMB_SEARCH_SIZE pixels square, so about 256 kB
+ * each. Past those budgets, the least recently used ones are only kept
+ * as the original file contents, and then dropped altogether. */
+#define CACHE_PIXBUF_BUDGET   (64 * 1024 * 1024)
+#define CACHE_ENCODED_BUDGET  (32 * 1024 * 1024)
+#define CACHE_ENCODED_MAX     (CACHE_ENCODED_BUDGET / 64)
 
 typedef enum {
 	ICON_BOX = 0,
@@ -27,8 +36,19 @@ typedef enum {
 
 static GnomeDesktopThumbnailFactory *factory;
 static GThreadPool *thumbnail_pool;
+static guint thumbnail_sequence;
 static GdkPixbuf *icons[NUM_ICONS];
-static GHashTable *cache_thumbnails; /* key=url, value=GdkPixbuf */
+
+typedef struct {
+	char      *url;
+	GdkPixbuf *pixbuf;	/* framed, or NULL if evicted */
+	GBytes    *encoded;	/* file contents, or NULL if too big */
+	GList      link;	/* in cache_lru */
+} CacheEntry;
+
+static GHashTable *cache_thumbnails; /* key=url, value=CacheEntry */
+static GQueue cache_lru = G_QUEUE_INIT; /* most recently used first */
+static TotemGriloThumbnailCacheStats cache_stats;
 
 #define STROKE           0x3b3c38ff
 #define FILL_DEFAULT     0x2d2d2dff
@@ -42,6 +62,99 @@ static GdkPixbuf *load_named_icon (const char *name,
 				   int         size,
 				   guint32     fill);
 
+static void
+cache_entry_free (CacheEntry *entry)
+{
+	g_queue_unlink (&cache_lru, &entry->link);
+	if (entry->pixbuf != NULL)
+		cache_stats.pixbuf_size -= gdk_pixbuf_get_byte_length (entry->pixbuf);
+	if (entry->encoded != NULL)
+		cache_stats.encoded_size -= g_bytes_get_size (entry->encoded);
+	g_clear_object (&entry->pixbuf);
+	g_clear_pointer (&entry->encoded, g_bytes_unref);
+	g_free (entry->url);
+	g_free (entry);
+}
+
+static void
+cache_touch (CacheEntry *entry)
+{
+	g_queue_unlink (&cache_lru, &entry->link);
+	g_queue_push_head_link (&cache_lru, &entry->link);
+}
+
+/* Walks from the least recently used entries, dropping decoded
+ * thumbnails first, and whole entries once the encoded tier is full */
+static void
+cache_trim (void)
+{
+	GList *l, *prev;
+
+	for (l = cache_lru.tail; l != NULL; l = prev) {
+		CacheEntry *entry = l->data;
+
+		if (cache_stats.pixbuf_size <= CACHE_PIXBUF_BUDGET &&
+		    cache_stats.encoded_size <= CACHE_ENCODED_BUDGET)
+			break;
+		prev = l->prev;
+
+		if (cache_stats.encoded_size > CACHE_ENCODED_BUDGET ||
+		    (entry->pixbuf != NULL && entry->encoded == NULL)) {
+			cache_stats.evictions++;
+			g_hash_table_remove (cache_thumbnails, entry->url);
+		} else if (entry->pixbuf != NULL) {
+			cache_stats.evictions++;
+			cache_stats.pixbuf_size -= gdk_pixbuf_get_byte_length (entry->pixbuf);
+			g_clear_object (&entry->pixbuf);
+		}
+	}
+}
+
+static void
+cache_insert (const char *url,
+	      GdkPixbuf  *pixbuf,
+	      GBytes     *encoded)
+{
+	CacheEntry *entry;
+
+	entry = g_hash_table_lookup (cache_thumbnails, url);
+	if (entry == NULL) {
+		entry = g_new0 (CacheEntry, 1);
+		entry->url = g_strdup (url);
+		entry->link.data = entry;
+		g_hash_table_insert (cache_thumbnails, entry->url, entry);
+		g_queue_push_head_link (&cache_lru, &entry->link);
+	} else {
+		cache_touch (entry);
+	}
+
+	if (entry->pixbuf == NULL) {
+		entry->pixbuf = g_object_ref (pixbuf);
+		cache_stats.pixbuf_size += gdk_pixbuf_get_byte_length (pixbuf);
+	}
+	if (entry->encoded == NULL && encoded != NULL &&
+	    g_bytes_get_size (encoded) <= CACHE_ENCODED_MAX) {
+		entry->encoded = g_bytes_ref (encoded);
+		cache_stats.encoded_size += g_bytes_get_size (encoded);
+	}
+
+	cache_trim ();
+}
+
+/**
+ * totem_grilo_get_thumbnail_cache_stats:
+ * @stats: (out caller-allocates): where to store the statistics
+ *
+ * Gets the number of thumbnails found in the cache since startup,
+ * decoded or not, the number of cache misses and evictions, and
+ * the memory currently used by each tier of the cache.
+ **/
+void
+totem_grilo_get_thumbnail_cache_stats (TotemGriloThumbnailCacheStats *stats)
+{
+	*stats = cache_stats;
+}
+
 static gboolean
 media_is_local (GrlMedia *media)
 {
@@ -74,7 +187,7 @@ load_thumbnail_cb (GObject *source_object,
 	GTask *task = user_data;
 	GdkPixbuf *pixbuf;
 	GError *error = NULL;
-	const GFile *file;
+	const char *url;
 
 	pixbuf = gdk_pixbuf_new_from_stream_finish (res, &error);
 	if (!pixbuf) {
@@ -84,8 +197,8 @@ load_thumbnail_cb (GObject *source_object,
 	}
 
 	/* Cache it */
-	file = g_task_get_task_data (task);
-	if (file) {
+	url = g_task_get_task_data (task);
+	if (url) {
 		gboolean is_source;
 
 		is_source = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (task), "is-source"));
@@ -102,41 +215,55 @@ load_thumbnail_cb (GObject *source_object,
 			g_object_unref (pixbuf);
 			pixbuf = new_pixbuf;
 		}
-		g_hash_table_insert (cache_thumbnails,
-				     g_file_get_uri (G_FILE (file)),
-				     g_object_ref (pixbuf));
+		cache_insert (url, pixbuf, g_object_get_data (G_OBJECT (task), "encoded"));
 	}
 
 	g_task_return_pointer (task, pixbuf, g_object_unref);
 	g_object_unref (task);
 }
 
+/* Decodes thumbnails from memory, whether they were just read
+ * or kept in the cache */
 static void
-get_stream_thumbnail_cb (GObject *source_object,
-			 GAsyncResult *res,
-			 gpointer user_data)
+decode_thumbnail (GTask  *task,
+		  GBytes *encoded)
 {
-	GTask *task = user_data;
-	GFileInputStream *stream;
-	GError *error = NULL;
+	GInputStream *stream;
 	gboolean is_source;
 
-	stream = g_file_read_finish (G_FILE (source_object), res, &error);
-	if (!stream) {
-		g_task_return_error (task, error);
-		g_object_unref (task);
-		return;
-	}
+	g_object_set_data_full (G_OBJECT (task), "encoded",
+				g_bytes_ref (encoded), (GDestroyNotify) g_bytes_unref);
 
+	stream = g_memory_input_stream_new_from_bytes (encoded);
 	is_source = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (task), "is-source"));
-	gdk_pixbuf_new_from_stream_at_scale_async (G_INPUT_STREAM (stream),
+	gdk_pixbuf_new_from_stream_at_scale_async (stream,
 						   is_source ? -1 : THUMB_SEARCH_SIZE - 2,
 						   is_source ? -1 : THUMB_SEARCH_HEIGHT -2 ,
 						   TRUE,
 						   g_task_get_cancellable (task),
 						   load_thumbnail_cb,
 						   task);
-	g_object_unref (G_OBJECT (stream));
+	g_object_unref (stream);
+}
+
+static void
+get_bytes_thumbnail_cb (GObject *source_object,
+			GAsyncResult *res,
+			gpointer user_data)
+{
+	GTask *task = user_data;
+	GBytes *bytes;
+	GError *error = NULL;
+
+	bytes = g_file_load_bytes_finish (G_FILE (source_object), res, NULL, &error);
+	if (!bytes) {
+		g_task_return_error (task, error);
+		g_object_unref (task);
+		return;
+	}
+
+	decode_thumbnail (task, bytes);
+	g_bytes_unref (bytes);
 }
 
 static void
@@ -174,6 +301,7 @@ thumbnail_media_async_thread (GTask    *task,
 	const char *uri;
 	GDateTime *mtime;
 	gint64 unix_date;
+	gboolean in_process = TRUE;
 	GError *error = NULL;
 
 	if (g_task_return_error_if_cancelled (task)) {
@@ -201,25 +329,44 @@ thumbnail_media_async_thread (GTask    *task,
 		return;
 	}
 
-	tmp_pixbuf = gnome_desktop_thumbnail_factory_generate_thumbnail (factory, uri, "video/x-totem-stream", NULL, &error);
-
+	/* Grab a frame ourselves, and only run totem-video-thumbnailer,
+	 * and its search for an interesting frame, if that fails */
+	tmp_pixbuf = totem_thumbnail_generator_generate (uri, THUMB_LARGE_SIZE,
+							 g_task_get_cancellable (task), &error);
 	if (!tmp_pixbuf) {
-		g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Thumbnailing failed: %s", error->message);
-		g_object_unref (task);
-		g_error_free (error);
-		return;
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_task_return_error (task, error);
+			g_object_unref (task);
+			return;
+		}
+		g_debug ("Couldn't thumbnail '%s' in-process: %s", uri, error->message);
+		g_clear_error (&error);
+		in_process = FALSE;
+		tmp_pixbuf = gnome_desktop_thumbnail_factory_generate_thumbnail (factory, uri, "video/x-totem-stream", NULL, &error);
 	}
 
-	gnome_desktop_thumbnail_factory_save_thumbnail (factory, tmp_pixbuf, uri, unix_date, NULL, &error);
-	if (error) {
+	if (!tmp_pixbuf) {
 		g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Thumbnailing failed: %s", error->message);
 		g_object_unref (task);
 		g_error_free (error);
 		return;
 	}
 
-	/* Save the thumbnail URL for the bookmarks source */
-	save_bookmark_thumbnail (media, uri);
+	/* Frames grabbed in-process skip the external thumbnailer's resource
+	 * limits, and its search for an interesting frame, so they're only
+	 * shown, leaving the shared cache for the proper thumbnails */
+	if (!in_process) {
+		gnome_desktop_thumbnail_factory_save_thumbnail (factory, tmp_pixbuf, uri, unix_date, NULL, &error);
+		if (error) {
+			g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Thumbnailing failed: %s", error->message);
+			g_object_unref (task);
+			g_error_free (error);
+			return;
+		}
+
+		/* Save the thumbnail URL for the bookmarks source */
+		save_bookmark_thumbnail (media, uri);
+	}
 
 	/* Add frame */
 	pixbuf = load_icon (tmp_pixbuf, FALSE, FILL_MOVIE);
@@ -231,6 +378,7 @@ thumbnail_media_async_thread (GTask    *task,
 
 static void
 totem_grilo_thumbnail_media (GrlMedia            *media,
+			     int                  io_priority,
 			     GCancellable        *cancellable,
 			     GAsyncReadyCallback  callback,
 			     gpointer             user_data)
@@ -238,10 +386,28 @@ totem_grilo_thumbnail_media (GrlMedia            *media,
 	GTask *task;
 
 	task = g_task_new (media, cancellable, callback, user_data);
-	g_task_set_priority (task, G_PRIORITY_LOW);
+	g_task_set_priority (task, io_priority);
+	g_object_set_data (G_OBJECT (task), "sequence", GUINT_TO_POINTER (++thumbnail_sequence));
 	g_thread_pool_push (thumbnail_pool, task, NULL);
 }
 
+/* Most urgent first, then in the order they were queued */
+static gint
+compare_thumbnail_tasks (GTask    *a,
+			 GTask    *b,
+			 gpointer  user_data)
+{
+	int priority_a, priority_b;
+
+	priority_a = g_task_get_priority (a);
+	priority_b = g_task_get_priority (b);
+	if (priority_a != priority_b)
+		return priority_a < priority_b ? -1 : 1;
+
+	return GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (a), "sequence")) <
+		GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (b), "sequence")) ? -1 : 1;
+}
+
 static GdkPixbuf *
 totem_grilo_thumbnail_media_finish (GrlMedia      *media,
 				    GAsyncResult  *res,
@@ -271,24 +437,28 @@ thumbnail_media_cb (GObject      *source_object,
 
 void
 totem_grilo_get_thumbnail (GObject             *object,
+			   int                  io_priority,
 			   GCancellable        *cancellable,
 			   GAsyncReadyCallback  callback,
 			   gpointer             user_data)
 {
 	GTask *task;
 	const char *url_thumb = NULL;
-	const GdkPixbuf *thumbnail = NULL;
+	g_autofree char *source_url = NULL;
+	CacheEntry *entry;
 	GFile *file;
 
 	task = g_task_new (G_OBJECT (object),
 			   cancellable,
 			   callback,
 			   user_data);
+	g_task_set_priority (task, io_priority);
 
 	if (GRL_IS_MEDIA (object)) {
 		url_thumb = grl_media_get_thumbnail (GRL_MEDIA (object));
 		if (!url_thumb && media_is_local (GRL_MEDIA (object))) {
 			totem_grilo_thumbnail_media (GRL_MEDIA (object),
+						     io_priority,
 						     cancellable,
 						     thumbnail_media_cb,
 						     task);
@@ -302,7 +472,8 @@ totem_grilo_get_thumbnail (GObject             *object,
 			GFile *file;
 
 			file = g_file_icon_get_file (G_FILE_ICON (icon));
-			url_thumb = g_file_get_uri (file);
+			source_url = g_file_get_uri (file);
+			url_thumb = source_url;
 
 			g_object_set_data (G_OBJECT (task), "is-source", GUINT_TO_POINTER (TRUE));
 		}
@@ -314,19 +485,29 @@ totem_grilo_get_thumbnail (GObject             *object,
 	}
 
 	/* Check cache */
-	thumbnail = g_hash_table_lookup (cache_thumbnails, url_thumb);
-	if (thumbnail) {
+	entry = g_hash_table_lookup (cache_thumbnails, url_thumb);
+	if (entry && entry->pixbuf) {
+		cache_stats.hits++;
+		cache_touch (entry);
 		g_task_return_pointer (task,
-				       g_object_ref (G_OBJECT (thumbnail)),
+				       g_object_ref (entry->pixbuf),
 				       g_object_unref);
 		g_object_unref (task);
 		return;
 	}
 
+	g_task_set_task_data (task, g_strdup (url_thumb), g_free);
+	if (entry) {
+		cache_stats.encoded_hits++;
+		cache_touch (entry);
+		decode_thumbnail (task, entry->encoded);
+		return;
+	}
+
+	cache_stats.misses++;
 	file = g_file_new_for_uri (url_thumb);
-	g_task_set_task_data (task, file, g_object_unref);
-	g_file_read_async (file, G_PRIORITY_DEFAULT, cancellable,
-			   get_stream_thumbnail_cb, task);
+	g_file_load_bytes_async (file, cancellable, get_bytes_thumbnail_cb, task);
+	g_object_unref (file);
 }
 
 static void
@@ -497,10 +678,15 @@ totem_grilo_clear_icons (void)
 	for (i = 0; i < NUM_ICONS; i++)
 		g_clear_object (&icons[i]);
 
+	g_debug ("Thumbnail cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " decoded again, "
+		 "%" G_GUINT64_FORMAT " misses, %" G_GUINT64_FORMAT " evictions",
+		 cache_stats.hits, cache_stats.encoded_hits,
+		 cache_stats.misses, cache_stats.evictions);
 	g_clear_pointer (&cache_thumbnails, g_hash_table_destroy);
 	g_clear_object (&factory);
 	g_thread_pool_free (thumbnail_pool, TRUE, FALSE);
 	thumbnail_pool = NULL;
+	totem_thumbnail_generator_clear ();
 }
 
 void
@@ -514,11 +700,12 @@ totem_grilo_setup_icons (void)
 
 	cache_thumbnails = g_hash_table_new_full (g_str_hash,
 						  g_str_equal,
-						  g_free,
-						  g_object_unref);
+						  NULL,
+						  (GDestroyNotify) cache_entry_free);
 
 	factory = gnome_desktop_thumbnail_factory_new (GNOME_DESKTOP_THUMBNAIL_SIZE_LARGE);
 	thumbnail_pool = g_thread_pool_new ((GFunc) thumbnail_media_async_thread, NULL, DEFAULT_MAX_THREADS, TRUE, NULL);
+	g_thread_pool_set_sort_function (thumbnail_pool, (GCompareDataFunc) compare_thumbnail_tasks, NULL);
 }
 
 void
@@ -8,6 +8,15 @@
 #include <gtk/gtk.h>
 #include <grilo.h>
 
+typedef struct {
+	guint64 hits;		/* found decoded */
+	guint64 encoded_hits;	/* decoded again from memory */
+	guint64 misses;		/* read from disk */
+	guint64 evictions;
+	gsize   pixbuf_size;	/* in bytes */
+	gsize   encoded_size;	/* in bytes */
+} TotemGriloThumbnailCacheStats;
+
 void             totem_grilo_setup_icons          (void);
 void             totem_grilo_clear_icons          (void);
 GdkPixbuf       *totem_grilo_get_icon             (GrlMedia *media,
@@ -21,9 +30,11 @@ void             totem_grilo_pause_icon_thumbnailing  (void);
 void             totem_grilo_resume_icon_thumbnailing (void);
 
 void             totem_grilo_get_thumbnail        (GObject             *object,
+						   int                  io_priority,
 						   GCancellable        *cancellable,
 						   GAsyncReadyCallback  callback,
 						   gpointer             user_data);
 GdkPixbuf       *totem_grilo_get_thumbnail_finish (GObject             *object,
 						   GAsyncResult        *res,
 						   GError             **error);
+void             totem_grilo_get_thumbnail_cache_stats (TotemGriloThumbnailCacheStats *stats);
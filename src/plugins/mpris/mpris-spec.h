@@ -10,6 +10,9 @@
 #define MPRIS_TRACKLIST_INTERFACE "org.mpris.MediaPlayer2.TrackList"
 #define MPRIS_PLAYLISTS_INTERFACE "org.mpris.MediaPlayer2.Playlists"
 
+/* Not part of MPRIS, see BaconVideoWidget:stats */
+#define TOTEM_STATS_INTERFACE "org.gnome.Totem.PlaybackStats"
+
 const char *mpris_introspection_xml =
 	"<node>"
 	"  <interface name='org.mpris.MediaPlayer2'>"
@@ -108,4 +111,9 @@ const char *mpris_introspection_xml =
 	"    <property name='Orderings' type='as' access='read'/>"
 	"    <property name='ActivePlaylist' type='(b(oss))' access='read'/>"
 	"  </interface>"
+	"  <interface name='org.gnome.Totem.PlaybackStats'>"
+	"    <property name='Stats' type='a{sv}' access='read'>"
+	"      <annotation name='org.freedesktop.DBus.Property.EmitsChangedSignal' value='false'/>"
+	"    </property>"
+	"  </interface>"
 	"</node>";
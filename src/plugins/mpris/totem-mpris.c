@@ -31,6 +31,7 @@ typedef struct {
 	guint name_own_id;
 	guint root_id;
 	guint player_id;
+	guint stats_id;
 
 	TotemObject *totem;
 
@@ -504,6 +505,45 @@ static const GDBusInterfaceVTable player_vtable =
 	(GDBusInterfaceSetPropertyFunc) set_player_property,
 };
 
+/* Playback statistics interface */
+
+static GVariant *
+get_stats_property (GDBusConnection *connection,
+		    const char *sender,
+		    const char *object_path,
+		    const char *interface_name,
+		    const char *property_name,
+		    GError **error,
+		    TotemMprisPlugin *pi)
+{
+	if (g_strcmp0 (object_path, MPRIS_OBJECT_NAME) == 0 &&
+	    g_strcmp0 (interface_name, TOTEM_STATS_INTERFACE) == 0 &&
+	    g_strcmp0 (property_name, "Stats") == 0) {
+		GtkWidget *bvw;
+		GVariant *stats;
+
+		bvw = totem_object_get_video_widget (pi->totem);
+		g_object_get (bvw, "stats", &stats, NULL);
+		g_object_unref (bvw);
+		return stats;
+	}
+
+	g_set_error (error,
+		     G_DBUS_ERROR,
+		     G_DBUS_ERROR_NOT_SUPPORTED,
+		     "Property %s.%s not supported",
+		     interface_name,
+		     property_name);
+	return NULL;
+}
+
+static const GDBusInterfaceVTable stats_vtable =
+{
+	NULL,
+	(GDBusInterfaceGetPropertyFunc) get_stats_property,
+	NULL
+};
+
 static void
 playing_changed_cb (TotemObject *totem, GParamSpec *pspec, TotemMprisPlugin *pi)
 {
@@ -634,6 +674,20 @@ impl_activate (TotemPluginActivatable *plugin)
 		g_clear_error (&error);
 	}
 
+	/* register playback statistics interface */
+	ifaceinfo = g_dbus_node_info_lookup_interface (pi->node_info, TOTEM_STATS_INTERFACE);
+	pi->stats_id = g_dbus_connection_register_object (pi->connection,
+							  MPRIS_OBJECT_NAME,
+							  ifaceinfo,
+							  &stats_vtable,
+							  plugin,
+							  NULL,
+							  &error);
+	if (error != NULL) {
+		g_warning ("Unable to register playback statistics interface: %s", error->message);
+		g_clear_error (&error);
+	}
+
 	pi->totem = g_object_get_data (G_OBJECT (plugin), "object");
 
 	/* connect signal handlers for stuff */
@@ -685,6 +739,10 @@ impl_deactivate (TotemPluginActivatable *plugin)
 		g_dbus_connection_unregister_object (pi->connection, pi->player_id);
 		pi->player_id = 0;
 	}
+	if (pi->stats_id != 0) {
+		g_dbus_connection_unregister_object (pi->connection, pi->stats_id);
+		pi->stats_id = 0;
+	}
 
 	g_clear_handle_id (&pi->property_emit_id, g_source_remove);
 	g_clear_pointer (&pi->player_property_changes, g_hash_table_destroy);
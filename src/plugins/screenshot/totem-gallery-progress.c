@@ -11,25 +11,38 @@
 
 #include <signal.h>
 #include <unistd.h>
-#include <fcntl.h>
 #include <glib.h>
+#include <glib-unix.h>
 #include <gtk/gtk.h>
 #include <glib/gi18n-lib.h>
 #include <glib/gstdio.h>
+#include <gio/gunixinputstream.h>
 
 #include "totem-gallery-progress.h"
+#include "totem-progress-helpers.h"
+
+/* The file descriptor the thumbnailer writes its progress messages to */
+#define PROGRESS_FD 3
 
 static void totem_gallery_progress_finalize (GObject *object);
+static void read_header (TotemGalleryProgress *self);
 
 struct _TotemGalleryProgress {
 	GObject parent;
-	GPid child_pid;
-	GString *line;
+	GSubprocess *process;
+	GInputStream *stream;
+	GCancellable *cancellable;
+	guint8 header[TOTEM_PROGRESS_HEADER_SIZE];
+	guint8 *payload;
+	gsize length;
+	gboolean finished;
 	gchar *output_filename;
 };
 
 enum {
 	PROGRESS,
+	TILE,
+	FINISHED,
 	NUM_SIGNALS
 };
 
@@ -48,13 +61,38 @@ totem_gallery_progress_class_init (TotemGalleryProgressClass *klass)
 	                                  TOTEM_TYPE_GALLERY_PROGRESS,
 	                                  G_SIGNAL_RUN_LAST,
 	                                  0, NULL, NULL, NULL,
-									  G_TYPE_NONE,
+	                                  G_TYPE_NONE,
 	                                  1, G_TYPE_DOUBLE);
+	/* Emitted with the number of screenshots taken so far, and the total */
+	signals[TILE] = g_signal_new ("tile",
+	                              TOTEM_TYPE_GALLERY_PROGRESS,
+	                              G_SIGNAL_RUN_LAST,
+	                              0, NULL, NULL, NULL,
+	                              G_TYPE_NONE,
+	                              2, G_TYPE_UINT, G_TYPE_UINT);
+	/* Emitted once, with the path of the gallery, or NULL on failure */
+	signals[FINISHED] = g_signal_new ("finished",
+	                                  TOTEM_TYPE_GALLERY_PROGRESS,
+	                                  G_SIGNAL_RUN_LAST,
+	                                  0, NULL, NULL, NULL,
+	                                  G_TYPE_NONE,
+	                                  1, G_TYPE_STRING);
 }
 
 static void
 totem_gallery_progress_init (TotemGalleryProgress *self)
 {
+	self->cancellable = g_cancellable_new ();
+}
+
+static void
+child_exited_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	gchar *output_filename = user_data;
+
+	/* Nothing can recreate the output file anymore */
+	g_unlink (output_filename);
+	g_free (output_filename);
 }
 
 static void
@@ -62,21 +100,29 @@ totem_gallery_progress_finalize (GObject *object)
 {
 	TotemGalleryProgress *progress = TOTEM_GALLERY_PROGRESS (object);
 
-	g_spawn_close_pid (progress->child_pid);
+	g_cancellable_cancel (progress->cancellable);
+	g_clear_object (&progress->cancellable);
+	g_clear_object (&progress->stream);
+	g_clear_pointer (&progress->payload, g_free);
+
+	/* Remove the output file, unless it was moved away. If the thumbnailer
+	 * is still running, stop it and wait for it to exit first. */
+	if (progress->process != NULL && progress->finished == FALSE) {
+		g_subprocess_send_signal (progress->process, SIGTERM);
+		g_subprocess_wait_async (progress->process, NULL, child_exited_cb,
+					 g_strdup (progress->output_filename));
+	} else {
+		g_unlink (progress->output_filename);
+	}
+	g_clear_object (&progress->process);
 	g_free (progress->output_filename);
 
-	if (progress->line != NULL)
-		g_string_free (progress->line, TRUE);
-
-	/* Unlink the output file, just in case (race condition) it's already been created */
-	g_unlink (progress->output_filename);
-
 	/* Chain up to the parent class */
 	G_OBJECT_CLASS (totem_gallery_progress_parent_class)->finalize (object);
 }
 
 TotemGalleryProgress *
-totem_gallery_progress_new (GPid child_pid, const gchar *output_filename)
+totem_gallery_progress_new (const gchar *output_filename)
 {
 	TotemGalleryProgress *self;
 
@@ -84,99 +130,156 @@ totem_gallery_progress_new (GPid child_pid, const gchar *output_filename)
 	self = g_object_new (TOTEM_TYPE_GALLERY_PROGRESS, NULL);
 
 	/* Initialize class variables */
-	self->child_pid = child_pid;
 	self->output_filename = g_strdup (output_filename);
 
 	return self;
 }
 
-static gboolean
-process_line (TotemGalleryProgress *self, const gchar *line)
+static void
+finish (TotemGalleryProgress *self, const gchar *output)
 {
-	gfloat percent_complete;
+	if (self->finished)
+		return;
+
+	self->finished = TRUE;
+	g_cancellable_cancel (self->cancellable);
+	g_signal_emit (self, signals[FINISHED], 0, output);
+}
 
-	if (sscanf (line, "%f%% complete", &percent_complete) == 1) {
-		g_signal_emit (self, signals[PROGRESS], 0, percent_complete / 100.0);
-		return TRUE;
+static void
+process_message (TotemGalleryProgress *self, const TotemProgressMessage *msg)
+{
+	switch (msg->type) {
+	case TOTEM_PROGRESS_MESSAGE_PROGRESS:
+		g_signal_emit (self, signals[PROGRESS], 0, msg->fraction);
+		if (msg->n_tiles > 0)
+			g_signal_emit (self, signals[TILE], 0, msg->tile, msg->n_tiles);
+		break;
+	case TOTEM_PROGRESS_MESSAGE_DONE:
+		g_debug ("Gallery written to '%s' in %" G_GINT64_FORMAT " ms",
+			 msg->output, msg->elapsed / 1000);
+		g_signal_emit (self, signals[PROGRESS], 0, 1.0);
+		finish (self, msg->output ? msg->output : self->output_filename);
+		break;
+	case TOTEM_PROGRESS_MESSAGE_ERROR:
+		g_warning ("Error creating gallery: %s", msg->message);
+		finish (self, NULL);
+		break;
+	default:
+		g_assert_not_reached ();
 	}
+}
 
-	/* Error! */
-	return FALSE;
+static void
+payload_read_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	TotemGalleryProgress *self;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	TotemProgressMessage msg;
+	gsize bytes_read;
+	gboolean ret;
+
+	ret = g_input_stream_read_all_finish (G_INPUT_STREAM (source), result, &bytes_read, &error);
+	if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		return;
+
+	self = TOTEM_GALLERY_PROGRESS (user_data);
+	if (ret == FALSE || bytes_read < self->length) {
+		g_warning ("Couldn't read progress from the gallery thumbnailer: %s",
+			   error ? error->message : "Truncated message");
+		finish (self, NULL);
+		return;
+	}
+
+	bytes = g_bytes_new_take (g_steal_pointer (&self->payload), self->length);
+	if (totem_progress_message_parse (bytes, &msg, &error) == FALSE) {
+		g_warning ("Invalid progress message from the gallery thumbnailer: %s", error->message);
+		finish (self, NULL);
+		return;
+	}
+
+	process_message (self, &msg);
+	totem_progress_message_clear (&msg);
+
+	if (self->finished == FALSE)
+		read_header (self);
 }
 
-static gboolean
-stdout_watch_cb (GIOChannel *source, GIOCondition condition, TotemGalleryProgress *self)
+static void
+header_read_cb (GObject *source, GAsyncResult *result, gpointer user_data)
 {
-	gboolean retval = TRUE;
-
-	if (condition & G_IO_IN) {
-		gchar *line;
-		gchar buf[1];
-		GIOStatus status;
-
-		status = g_io_channel_read_line (source, &line, NULL, NULL, NULL);
-
-		if (status == G_IO_STATUS_NORMAL) {
-			if (self->line != NULL) {
-				g_string_append (self->line, line);
-				g_free (line);
-				line = g_string_free (self->line, FALSE);
-				self->line = NULL;
-			}
-
-			retval = process_line (self, line);
-			g_free (line);
-		} else if (status == G_IO_STATUS_AGAIN) {
-			/* A non-terminated line was read, read the data into the buffer. */
-			status = g_io_channel_read_chars (source, buf, 1, NULL, NULL);
-
-			if (status == G_IO_STATUS_NORMAL) {
-				gchar *line2;
-
-				if (self->line == NULL)
-					self->line = g_string_new (NULL);
-				g_string_append_c (self->line, buf[0]);
-
-				switch (buf[0]) {
-				case '\n':
-				case '\r':
-				case '\xe2':
-				case '\0':
-					line2 = g_string_free (self->line, FALSE);
-					self->line = NULL;
-
-					retval = process_line (self, line2);
-					g_free (line2);
-					break;
-				default:
-					break;
-				}
-			}
-		} else if (status == G_IO_STATUS_EOF) {
-			/* Emit as complete and stop processing */
-			g_signal_emit (self, signals[PROGRESS], 0, 1.0);
-			retval = FALSE;
-		}
-	} else if (condition & G_IO_HUP) {
-		retval = FALSE;
+	TotemGalleryProgress *self;
+	g_autoptr(GError) error = NULL;
+	gsize bytes_read;
+	gboolean ret;
+
+	ret = g_input_stream_read_all_finish (G_INPUT_STREAM (source), result, &bytes_read, &error);
+	if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		return;
+
+	self = TOTEM_GALLERY_PROGRESS (user_data);
+	if (ret == FALSE || bytes_read < TOTEM_PROGRESS_HEADER_SIZE) {
+		/* The thumbnailer exited without telling us about the result */
+		if (error != NULL)
+			g_warning ("Couldn't read progress from the gallery thumbnailer: %s", error->message);
+		finish (self, NULL);
+		return;
+	}
+
+	self->length = totem_progress_message_get_length (self->header);
+	if (self->length == 0 || self->length > TOTEM_PROGRESS_MAX_MESSAGE_SIZE) {
+		g_warning ("Invalid progress message length %" G_GSIZE_FORMAT " from the gallery thumbnailer", self->length);
+		finish (self, NULL);
+		return;
 	}
 
-	return retval;
+	self->payload = g_malloc (self->length);
+	g_input_stream_read_all_async (self->stream, self->payload, self->length,
+				       G_PRIORITY_DEFAULT, self->cancellable,
+				       payload_read_cb, self);
 }
 
-void
-totem_gallery_progress_run (TotemGalleryProgress *self, gint stdout_fd)
+static void
+read_header (TotemGalleryProgress *self)
 {
-	GIOChannel *channel;
+	g_input_stream_read_all_async (self->stream, self->header, TOTEM_PROGRESS_HEADER_SIZE,
+				       G_PRIORITY_DEFAULT, self->cancellable,
+				       header_read_cb, self);
+}
 
-	fcntl (stdout_fd, F_SETFL, O_NONBLOCK);
+gboolean
+totem_gallery_progress_run (TotemGalleryProgress *self, const gchar * const *argv, GError **error)
+{
+	g_autoptr(GSubprocessLauncher) launcher = NULL;
+	g_autoptr(GPtrArray) args = NULL;
+	int fds[2];
 
-	/* Watch the output from totem-video-thumbnailer */
-	channel = g_io_channel_unix_new (stdout_fd);
-	g_io_channel_set_flags (channel, g_io_channel_get_flags (channel) | G_IO_FLAG_NONBLOCK, NULL);
+	g_return_val_if_fail (self->process == NULL, FALSE);
 
-	g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL, (GIOFunc) stdout_watch_cb, self);
+	if (g_unix_open_pipe (fds, FD_CLOEXEC, error) == FALSE)
+		return FALSE;
 
-	g_io_channel_unref (channel);
-}
+	/* Pass the write end of the pipe to totem-gallery-thumbnailer */
+	args = g_ptr_array_new_with_free_func (g_free);
+	for (; *argv != NULL; argv++)
+		g_ptr_array_add (args, g_strdup (*argv));
+	g_ptr_array_add (args, g_strdup_printf ("--progress-fd=%d", PROGRESS_FD));
+	g_ptr_array_add (args, NULL);
+
+	launcher = g_subprocess_launcher_new (G_SUBPROCESS_FLAGS_STDOUT_SILENCE);
+	g_subprocess_launcher_take_fd (launcher, fds[1], PROGRESS_FD);
 
+	self->process = g_subprocess_launcher_spawnv (launcher, (const gchar * const *) args->pdata, error);
+	if (self->process == NULL) {
+		close (fds[0]);
+		return FALSE;
+	}
+
+	/* Our copy of the write end is closed along with the launcher,
+	 * so we get an end-of-file once the thumbnailer exits */
+	self->stream = g_unix_input_stream_new (fds[0], TRUE);
+	read_header (self);
+
+	return TRUE;
+}
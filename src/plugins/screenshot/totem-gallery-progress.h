@@ -16,5 +16,5 @@
 G_DECLARE_FINAL_TYPE(TotemGalleryProgress, totem_gallery_progress, TOTEM, GALLERY_PROGRESS, GObject)
 
 GType totem_gallery_progress_get_type (void);
-TotemGalleryProgress *totem_gallery_progress_new (GPid child_pid, const gchar *output_filename);
-void totem_gallery_progress_run (TotemGalleryProgress *self, gint stdout_fd);
+TotemGalleryProgress *totem_gallery_progress_new (const gchar *output_filename);
+gboolean totem_gallery_progress_run (TotemGalleryProgress *self, const gchar * const *argv, GError **error);
@@ -8,6 +8,7 @@
 
 #include "config.h"
 
+#include <unistd.h>
 #include <glib.h>
 #include <gtk/gtk.h>
 #include <glib/gi18n-lib.h>
@@ -41,6 +42,7 @@ totem_gallery_finalize (GObject *object)
 	TotemGallery *self = TOTEM_GALLERY (object);
 
 	g_clear_object (&self->progress_bar);
+	g_clear_object (&self->gallery_progress);
 	g_clear_object(&self->saved_tmp_file);
 
 	/* Chain up to the parent class */
@@ -121,9 +123,31 @@ static void
 gallery_progress_cb (TotemGalleryProgress *gallery_progress, double progress, TotemGallery *self)
 {
 	gtk_progress_bar_set_fraction (self->progress_bar, progress);
+}
+
+static void
+gallery_tile_cb (TotemGalleryProgress *gallery_progress, guint tile, guint n_tiles, TotemGallery *self)
+{
+	g_autofree char *text = NULL;
+
+	/* Translators: The first number is the number of screenshots taken so far,
+	 * the second is the total number of screenshots in the gallery. */
+	text = g_strdup_printf (_("Screenshot %u of %u"), tile, n_tiles);
+	gtk_progress_bar_set_show_text (self->progress_bar, TRUE);
+	gtk_progress_bar_set_text (self->progress_bar, text);
+}
+
+static void
+gallery_finished_cb (TotemGalleryProgress *gallery_progress, const char *output, TotemGallery *self)
+{
+	if (output == NULL) {
+		gtk_window_close (GTK_WINDOW (self));
+		return;
+	}
 
-	if (1.0 == progress)
-		save_gallery_file (self);
+	g_clear_object (&self->saved_tmp_file);
+	self->saved_tmp_file = g_file_new_for_path (output);
+	save_gallery_file (self);
 }
 
 static void
@@ -132,8 +156,6 @@ create_gallery_cb (GtkButton *button, TotemGallery *self)
 	g_autofree char *tmp_filename = NULL;
 	gchar *video_mrl, *argv[6];
 	guint screenshot_count, i;
-	gint stdout_fd;
-	GPid child_pid;
 	gboolean ret;
 	GError *error = NULL;
 	int fd;
@@ -153,8 +175,7 @@ create_gallery_cb (GtkButton *button, TotemGallery *self)
 		gtk_window_close (GTK_WINDOW (self));
 		return;
 	}
-
-	self->saved_tmp_file = g_file_new_for_path (tmp_filename);
+	close (fd);
 
 	/* Build the command and arguments to pass it */
 	argv[0] = (gchar*) LIBEXECDIR "/totem-gallery-thumbnailer"; /* a little hacky, but only the allocated stuff is freed below */
@@ -164,9 +185,12 @@ create_gallery_cb (GtkButton *button, TotemGallery *self)
 	argv[4] = tmp_filename; /* output filename */
 	argv[5] = NULL;
 
-	/* Run the command */
-	ret = g_spawn_async_with_pipes (NULL, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL,
-					&child_pid, NULL, &stdout_fd, NULL, &error);
+	/* Run the command, and follow its progress */
+	self->gallery_progress = totem_gallery_progress_new (tmp_filename);
+	g_signal_connect (self->gallery_progress, "progress", G_CALLBACK (gallery_progress_cb), self);
+	g_signal_connect (self->gallery_progress, "tile", G_CALLBACK (gallery_tile_cb), self);
+	g_signal_connect (self->gallery_progress, "finished", G_CALLBACK (gallery_finished_cb), self);
+	ret = totem_gallery_progress_run (self->gallery_progress, (const gchar * const *) argv, &error);
 
 	/* Free argv, minus the filename */
 	for (i = 1; i < G_N_ELEMENTS (argv) - 2; i++)
@@ -175,15 +199,12 @@ create_gallery_cb (GtkButton *button, TotemGallery *self)
 	if (ret == FALSE) {
 		g_warning ("Error spawning totem-video-thumbnailer: %s", error->message);
 		g_error_free (error);
+		g_clear_object (&self->gallery_progress);
 		return;
 	}
 
 	/* Create the progress dialogue */
 	gtk_widget_set_visible (GTK_WIDGET (self->progress_bar), TRUE);
-
-	self->gallery_progress = totem_gallery_progress_new (child_pid, tmp_filename);
-	g_signal_connect (self->gallery_progress, "progress", G_CALLBACK (gallery_progress_cb), self);
-	totem_gallery_progress_run (TOTEM_GALLERY_PROGRESS (self->gallery_progress), stdout_fd);
 }
 
 static void
@@ -149,25 +149,29 @@ totem_screenshot_plugin_filename_for_current_video (TotemObject *totem,
 }
 
 static void
-take_screenshot_action_cb (GSimpleAction         *action,
-			   GVariant              *parameter,
-			   TotemScreenshotPlugin *pi)
+got_current_frame_cb (GObject               *source_object,
+		      GAsyncResult          *result,
+		      TotemScreenshotPlugin *pi)
 {
 	GtkFileChooserNative *file_chooser;
 	GdkPixbuf *pixbuf;
-	GError *err = NULL;
 	ScreenshotSaveJob *job;
+	g_autoptr(GError) err = NULL;
 	g_autofree char *video_filename = NULL;
 
-	if (bacon_video_widget_can_get_frames (pi->bvw, &err) == FALSE) {
-		totem_object_show_error (pi->totem, _("Totem could not get a screenshot of the video."), err->message ?: _("No reason."));
-		g_error_free (err);
+	pixbuf = bacon_video_widget_get_current_frame_finish (BACON_VIDEO_WIDGET (source_object), result, &err);
+	if (pixbuf == NULL) {
+		g_warning ("Could not take screenshot: %s", err->message);
+		if (pi->totem != NULL)
+			totem_object_show_error (pi->totem, _("Totem could not get a screenshot of the video."), _("This is not supposed to happen; please file a bug report."));
+		g_object_unref (pi);
 		return;
 	}
 
-	pixbuf = bacon_video_widget_get_current_frame (pi->bvw);
-	if (pixbuf == NULL) {
-		totem_object_show_error (pi->totem, _("Totem could not get a screenshot of the video."), _("This is not supposed to happen; please file a bug report."));
+	/* The plugin was deactivated while the frame was being converted */
+	if (pi->totem == NULL) {
+		g_object_unref (pixbuf);
+		g_object_unref (pi);
 		return;
 	}
 
@@ -189,6 +193,28 @@ take_screenshot_action_cb (GSimpleAction         *action,
 			  G_CALLBACK (filechooser_response_callback), job);
 
 	gtk_native_dialog_show (GTK_NATIVE_DIALOG (file_chooser));
+
+	g_object_unref (pi);
+}
+
+static void
+take_screenshot_action_cb (GSimpleAction         *action,
+			   GVariant              *parameter,
+			   TotemScreenshotPlugin *pi)
+{
+	GError *err = NULL;
+
+	if (bacon_video_widget_can_get_frames (pi->bvw, &err) == FALSE) {
+		totem_object_show_error (pi->totem, _("Totem could not get a screenshot of the video."), err->message ?: _("No reason."));
+		g_error_free (err);
+		return;
+	}
+
+	/* The frame is converted in a thread, the file chooser shows up
+	 * once it's ready */
+	bacon_video_widget_get_current_frame_async (pi->bvw, NULL,
+						    (GAsyncReadyCallback) got_current_frame_cb,
+						    g_object_ref (pi));
 }
 
 static void
@@ -296,7 +322,8 @@ impl_deactivate (TotemPluginActivatable *plugin)
 	/* Remove the menu */
 	totem_object_empty_menu_section (pi->totem, "screenshot-placeholder");
 
-	g_object_unref (pi->bvw);
+	g_clear_object (&pi->bvw);
+	pi->totem = NULL;
 }
 
 void
@@ -81,7 +81,7 @@ static void
 set_icon_from_grl (GObject   *object,
 		   GtkWidget *image)
 {
-	totem_grilo_get_thumbnail (object, NULL, icon_ready, image);
+	totem_grilo_get_thumbnail (object, G_PRIORITY_DEFAULT, NULL, icon_ready, image);
 }
 
 static const char *labels[] = {
@@ -5,13 +5,23 @@
 #include "config.h"
 
 #include <locale.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib-unix.h>
+#include <glib/gstdio.h>
 #define GST_USE_UNSTABLE_API 1
 #include <gst/tag/tag.h>
+#include <gst/video/video.h>
 
+#include "gst/totem-decoder-policy.h"
+#include "gst/totem-gst-pixbuf-helpers.h"
+#include "gst/totem-progress-helpers.h"
+#include "gst/totem-stream-cache.h"
 #include "gst/totem-time-helpers.h"
 #include "backend/bacon-video-widget.h"
 #include "backend/bacon-time-label.h"
 #include "totem-menu.h"
+#include "totem-thumbnail-cache.h"
 
 static BvwLangInfo *
 bvw_lang_info_new (const char *title,
@@ -202,16 +212,443 @@ test_time_label (void)
 	g_free (str);
 }
 
+static void
+fake_decoder_class_init (gpointer klass,
+			 gpointer class_data)
+{
+	GstElementClass *element_class = klass;
+	GstCaps *caps;
+
+	gst_element_class_set_static_metadata (element_class,
+					       "Fake decoder",
+					       class_data,
+					       "Fake decoder for tests",
+					       "Totem");
+
+	caps = gst_caps_from_string ("video/x-h264");
+	gst_element_class_add_pad_template (element_class,
+					    gst_pad_template_new ("sink", GST_PAD_SINK, GST_PAD_ALWAYS, caps));
+	gst_caps_unref (caps);
+}
+
+static GstElementFactory *
+register_fake_decoder (const char *name,
+		       const char *klass,
+		       guint       rank)
+{
+	GTypeInfo info = { 0, };
+	g_autofree char *type_name = NULL;
+	GType type;
+
+	info.class_size = sizeof (GstElementClass);
+	info.class_init = fake_decoder_class_init;
+	info.class_data = klass;
+	info.instance_size = sizeof (GstElement);
+
+	type_name = g_strconcat ("TotemTest_", name, NULL);
+	type = g_type_register_static (GST_TYPE_ELEMENT, type_name, &info, 0);
+	g_assert_true (gst_element_register (NULL, name, rank, type));
+
+	return gst_element_factory_find (name);
+}
+
+static void
+test_decoder_policy (void)
+{
+	g_autoptr(TotemDecoderPolicy) policy = NULL;
+	g_autoptr(GstCaps) hd_caps = NULL;
+	g_autoptr(GstCaps) sd_caps = NULL;
+	g_autoptr(GstElementFactory) hw = NULL;
+	g_autoptr(GstElementFactory) sw = NULL;
+	g_autofree char *dir = NULL;
+	g_autofree char *path = NULL;
+	GList *factories, *ranked;
+
+	/* No GPU needed, the "hardware" decoder is a fake */
+	hw = register_fake_decoder ("totemtesthwdec", "Codec/Decoder/Video/Hardware", GST_RANK_PRIMARY + 1);
+	sw = register_fake_decoder ("totemtestswdec", "Codec/Decoder/Video", GST_RANK_PRIMARY);
+	g_assert_true (totem_decoder_policy_is_hardware_video_decoder (hw));
+	g_assert_false (totem_decoder_policy_is_hardware_video_decoder (sw));
+
+	dir = g_dir_make_tmp ("totem-test-XXXXXX", NULL);
+	g_assert_nonnull (dir);
+	path = g_build_filename (dir, "decoder-policy.ini", NULL);
+	policy = totem_decoder_policy_new (path);
+
+	hd_caps = gst_caps_from_string ("video/x-h264, width=(int)1920, height=(int)1080");
+	sd_caps = gst_caps_from_string ("video/x-h264, width=(int)640, height=(int)480");
+	factories = g_list_append (NULL, sw);
+	factories = g_list_append (factories, hw);
+
+	/* By rank first */
+	ranked = totem_decoder_policy_rank_factories (policy, factories, hd_caps);
+	g_assert_true (ranked->data == hw);
+	gst_plugin_feature_list_free (ranked);
+
+	/* Short playbacks, or few dropped frames, don't demote */
+	totem_decoder_policy_record_playback (policy, "totemtesthwdec", "video/x-h264", 1920, 1080, 100, 100);
+	totem_decoder_policy_record_playback (policy, "totemtesthwdec", "video/x-h264", 1920, 1080, 200, 5000);
+	totem_decoder_policy_record_playback (policy, "totemtesthwdec", "video/x-h264", 1920, 1080, 1000, 10);
+	g_assert_false (totem_decoder_policy_is_demoted (policy, "totemtesthwdec", "video/x-h264", 1920, 1080));
+
+	/* Failures demote, for that size only */
+	totem_decoder_policy_record_failure (policy, "totemtesthwdec", "video/x-h264", 1920, 1080);
+	g_assert_true (totem_decoder_policy_is_demoted (policy, "totemtesthwdec", "video/x-h264", 1920, 1080));
+	g_assert_true (totem_decoder_policy_is_demoted (policy, "totemtesthwdec", "video/x-h264", 0, 0));
+	g_assert_false (totem_decoder_policy_is_demoted (policy, "totemtesthwdec", "video/x-h264", 640, 480));
+	g_assert_false (totem_decoder_policy_is_demoted (policy, "totemtesthwdec", "video/x-h265", 1920, 1080));
+
+	ranked = totem_decoder_policy_rank_factories (policy, factories, hd_caps);
+	g_assert_true (ranked->data == sw);
+	gst_plugin_feature_list_free (ranked);
+	ranked = totem_decoder_policy_rank_factories (policy, factories, sd_caps);
+	g_assert_true (ranked->data == hw);
+	gst_plugin_feature_list_free (ranked);
+
+	/* Too many dropped frames demote too */
+	totem_decoder_policy_record_playback (policy, "totemtesthwdec", "video/x-h264", 640, 480, 500, 500);
+	g_assert_true (totem_decoder_policy_is_demoted (policy, "totemtesthwdec", "video/x-h264", 640, 480));
+
+	/* Results persist */
+	g_clear_object (&policy);
+	policy = totem_decoder_policy_new (path);
+	g_assert_true (totem_decoder_policy_is_demoted (policy, "totemtesthwdec", "video/x-h264", 1920, 1080));
+
+	/* And get applied to the registry */
+	totem_decoder_policy_apply (policy, gst_registry_get ());
+	g_assert_cmpuint (gst_plugin_feature_get_rank (GST_PLUGIN_FEATURE (hw)), ==, GST_RANK_MARGINAL);
+	g_assert_cmpuint (gst_plugin_feature_get_rank (GST_PLUGIN_FEATURE (sw)), ==, GST_RANK_PRIMARY);
+
+	g_list_free (factories);
+	g_unlink (path);
+	g_rmdir (dir);
+}
+
+static void
+remove_dir (const char *path)
+{
+	g_autoptr(GDir) dir = NULL;
+	const char *name;
+
+	dir = g_dir_open (path, 0, NULL);
+	while (dir != NULL && (name = g_dir_read_name (dir)) != NULL) {
+		g_autofree char *file = NULL;
+
+		file = g_build_filename (path, name, NULL);
+		g_unlink (file);
+	}
+	g_rmdir (path);
+}
+
+static void
+test_stream_cache (void)
+{
+	g_autoptr(TotemStreamCache) cache = NULL;
+	g_autofree char *dir = NULL;
+	TotemStreamCacheEntry *entry, *other;
+	guint8 data[600], buf[600];
+	guint i;
+
+	for (i = 0; i < sizeof (data); i++)
+		data[i] = i % 251;
+
+	dir = g_dir_make_tmp ("totem-test-XXXXXX", NULL);
+	g_assert_nonnull (dir);
+	cache = totem_stream_cache_new (dir, 1000);
+
+	/* Sparse ranges */
+	entry = totem_stream_cache_open (cache, "http://example.com/a", "\"1\"", 600);
+	g_assert_nonnull (entry);
+	g_assert_true (totem_stream_cache_entry_write (entry, 0, data, 100));
+	g_assert_true (totem_stream_cache_entry_write (entry, 200, data + 200, 100));
+	g_assert_cmpuint (totem_stream_cache_entry_get_available (entry, 0), ==, 100);
+	g_assert_cmpuint (totem_stream_cache_entry_get_available (entry, 50), ==, 50);
+	g_assert_cmpuint (totem_stream_cache_entry_get_available (entry, 100), ==, 0);
+	g_assert_cmpuint (totem_stream_cache_entry_get_available (entry, 250), ==, 50);
+	g_assert_cmpuint (totem_stream_cache_get_size (cache), ==, 200);
+
+	/* Filling the gap merges the ranges */
+	g_assert_true (totem_stream_cache_entry_write (entry, 50, data + 50, 200));
+	g_assert_cmpuint (totem_stream_cache_entry_get_available (entry, 0), ==, 300);
+	g_assert_cmpuint (totem_stream_cache_get_size (cache), ==, 300);
+	g_assert_false (totem_stream_cache_entry_is_complete (entry));
+	g_assert_cmpint (totem_stream_cache_entry_read (entry, 10, buf, sizeof (buf)), ==, 290);
+	g_assert_cmpmem (buf, 290, data + 10, 290);
+	g_assert_cmpint (totem_stream_cache_entry_read (entry, 400, buf, sizeof (buf)), ==, 0);
+	totem_stream_cache_entry_close (entry);
+
+	/* Persistence */
+	g_clear_object (&cache);
+	cache = totem_stream_cache_new (dir, 1000);
+	g_assert_cmpuint (totem_stream_cache_get_size (cache), ==, 300);
+	entry = totem_stream_cache_open (cache, "http://example.com/a", "\"1\"", 600);
+	g_assert_cmpuint (totem_stream_cache_entry_get_available (entry, 0), ==, 300);
+	g_assert_true (totem_stream_cache_entry_write (entry, 300, data + 300, 300));
+	g_assert_true (totem_stream_cache_entry_is_complete (entry));
+	totem_stream_cache_entry_close (entry);
+
+	/* Least recently used streams get evicted, open ones don't */
+	entry = totem_stream_cache_open (cache, "http://example.com/b", "\"1\"", 600);
+	g_assert_true (totem_stream_cache_entry_write (entry, 0, data, 500));
+	g_assert_cmpuint (totem_stream_cache_get_size (cache), ==, 500);
+	other = totem_stream_cache_open (cache, "http://example.com/c", "\"1\"", 600);
+	g_assert_false (totem_stream_cache_entry_write (other, 0, data, 600));
+	g_assert_cmpuint (totem_stream_cache_entry_get_available (entry, 0), ==, 500);
+	totem_stream_cache_entry_close (other);
+	totem_stream_cache_entry_close (entry);
+
+	/* A changed stream isn't served from the cache */
+	entry = totem_stream_cache_open (cache, "http://example.com/b", "\"2\"", 600);
+	g_assert_cmpuint (totem_stream_cache_entry_get_available (entry, 0), ==, 0);
+	g_assert_cmpuint (totem_stream_cache_get_size (cache), ==, 0);
+	totem_stream_cache_entry_close (entry);
+
+	/* Disabled */
+	totem_stream_cache_set_max_size (cache, 0);
+	g_assert_null (totem_stream_cache_open (cache, "http://example.com/a", "\"1\"", 600));
+
+	g_clear_object (&cache);
+	remove_dir (dir);
+}
+
+static guint8
+luma_grey (guint x, guint y)
+{
+	return 128;
+}
+
+static guint8
+luma_dark (guint x, guint y)
+{
+	return 8;
+}
+
+static guint8
+luma_split (guint x, guint y)
+{
+	return x < 80 ? 0 : 255;
+}
+
+static guint8
+luma_split_inverted (guint x, guint y)
+{
+	return x < 80 ? 255 : 0;
+}
+
+static GstSample *
+frame_sample_new (GstVideoFormat format,
+		  guint8 (*luma) (guint x, guint y))
+{
+	GstVideoInfo info;
+	GstVideoFrame frame;
+	GstBuffer *buffer;
+	GstCaps *caps;
+	GstSample *sample;
+	guint x, y;
+
+	gst_video_info_set_format (&info, format, 160, 120);
+	buffer = gst_buffer_new_allocate (NULL, GST_VIDEO_INFO_SIZE (&info), NULL);
+	gst_buffer_memset (buffer, 0, 128, GST_VIDEO_INFO_SIZE (&info));
+	g_assert_true (gst_video_frame_map (&frame, &info, buffer, GST_MAP_WRITE));
+	for (y = 0; y < 120; y++) {
+		guint8 *row = (guint8 *) GST_VIDEO_FRAME_COMP_DATA (&frame, 0) + y * GST_VIDEO_FRAME_COMP_STRIDE (&frame, 0);
+
+		for (x = 0; x < 160; x++)
+			row[x * GST_VIDEO_FRAME_COMP_PSTRIDE (&frame, 0)] = luma (x, y);
+	}
+	gst_video_frame_unmap (&frame);
+
+	caps = gst_video_info_to_caps (&info);
+	sample = gst_sample_new (buffer, caps, NULL, NULL);
+	gst_caps_unref (caps);
+	gst_buffer_unref (buffer);
+
+	return sample;
+}
+
+static void
+test_frame_stats (void)
+{
+	g_autoptr(GstSample) grey = NULL;
+	g_autoptr(GstSample) dark = NULL;
+	g_autoptr(GstSample) split = NULL;
+	g_autoptr(GstSample) inverted = NULL;
+	g_autoptr(GstSample) packed = NULL;
+	g_autoptr(GstSample) unsupported = NULL;
+	TotemGstFrameStats grey_stats, dark_stats, split_stats, inverted_stats, packed_stats, stats;
+
+	grey = frame_sample_new (GST_VIDEO_FORMAT_I420, luma_grey);
+	g_assert_true (totem_gst_sample_get_frame_stats (grey, &grey_stats));
+	g_assert_cmpuint (grey_stats.brightness, ==, 128);
+	g_assert_cmpuint (grey_stats.variance, ==, 0);
+
+	dark = frame_sample_new (GST_VIDEO_FORMAT_I420, luma_dark);
+	g_assert_true (totem_gst_sample_get_frame_stats (dark, &dark_stats));
+	g_assert_cmpuint (dark_stats.brightness, ==, 8);
+	g_assert_cmpuint (totem_gst_frame_stats_distance (&grey_stats, &dark_stats), ==, 120);
+
+	/* Half black, half white */
+	split = frame_sample_new (GST_VIDEO_FORMAT_I420, luma_split);
+	g_assert_true (totem_gst_sample_get_frame_stats (split, &split_stats));
+	g_assert_cmpuint (split_stats.brightness, ==, 127);
+	g_assert_cmpuint (split_stats.variance, >=, 16000);
+	g_assert_cmpuint (totem_gst_frame_stats_distance (&split_stats, &split_stats), ==, 0);
+
+	/* Same statistics, different picture */
+	inverted = frame_sample_new (GST_VIDEO_FORMAT_I420, luma_split_inverted);
+	g_assert_true (totem_gst_sample_get_frame_stats (inverted, &inverted_stats));
+	g_assert_cmpuint (inverted_stats.variance, ==, split_stats.variance);
+	g_assert_cmpuint (totem_gst_frame_stats_distance (&split_stats, &inverted_stats), ==, 255);
+
+	/* Packed formats */
+	packed = frame_sample_new (GST_VIDEO_FORMAT_YUY2, luma_split);
+	g_assert_true (totem_gst_sample_get_frame_stats (packed, &packed_stats));
+	g_assert_cmpuint (packed_stats.brightness, ==, split_stats.brightness);
+	g_assert_cmpuint (packed_stats.variance, ==, split_stats.variance);
+
+	/* No 8-bit luma to work with */
+	unsupported = frame_sample_new (GST_VIDEO_FORMAT_RGB16, luma_grey);
+	g_assert_false (totem_gst_sample_get_frame_stats (unsupported, &stats));
+}
+
+static GBytes *
+read_progress_message (int fd)
+{
+	guint8 header[TOTEM_PROGRESS_HEADER_SIZE];
+	guint8 *payload;
+	gsize length;
+
+	g_assert_cmpint (read (fd, header, sizeof (header)), ==, sizeof (header));
+	length = totem_progress_message_get_length (header);
+	g_assert_cmpuint (length, >, 0);
+	g_assert_cmpuint (length, <=, TOTEM_PROGRESS_MAX_MESSAGE_SIZE);
+
+	payload = g_malloc (length);
+	g_assert_cmpint (read (fd, payload, length), ==, length);
+
+	return g_bytes_new_take (payload, length);
+}
+
+static void
+test_progress_messages (void)
+{
+	TotemProgressMessage msg = { TOTEM_PROGRESS_MESSAGE_PROGRESS, };
+	TotemProgressMessage parsed;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GBytes) garbage = NULL;
+	GError *error = NULL;
+	int fds[2];
+
+	g_assert_true (g_unix_open_pipe (fds, FD_CLOEXEC, NULL));
+
+	msg.fraction = 0.5;
+	msg.tile = 3;
+	msg.n_tiles = 12;
+	msg.elapsed = 1500000;
+	g_assert_true (totem_progress_message_write (fds[1], &msg));
+
+	msg.type = TOTEM_PROGRESS_MESSAGE_DONE;
+	msg.fraction = 1.0;
+	msg.n_tiles = 0;
+	msg.output = (char *) "/tmp/gallery.jpg";
+	g_assert_true (totem_progress_message_write (fds[1], &msg));
+
+	bytes = read_progress_message (fds[0]);
+	g_assert_true (totem_progress_message_parse (bytes, &parsed, &error));
+	g_assert_no_error (error);
+	g_assert_cmpint (parsed.type, ==, TOTEM_PROGRESS_MESSAGE_PROGRESS);
+	g_assert_cmpfloat (parsed.fraction, ==, 0.5);
+	g_assert_cmpuint (parsed.tile, ==, 3);
+	g_assert_cmpuint (parsed.n_tiles, ==, 12);
+	g_assert_cmpint (parsed.elapsed, ==, 1500000);
+	g_assert_null (parsed.output);
+	totem_progress_message_clear (&parsed);
+	g_clear_pointer (&bytes, g_bytes_unref);
+
+	bytes = read_progress_message (fds[0]);
+	g_assert_true (totem_progress_message_parse (bytes, &parsed, &error));
+	g_assert_cmpint (parsed.type, ==, TOTEM_PROGRESS_MESSAGE_DONE);
+	g_assert_cmpuint (parsed.n_tiles, ==, 0);
+	g_assert_cmpstr (parsed.output, ==, "/tmp/gallery.jpg");
+	totem_progress_message_clear (&parsed);
+
+	/* Not a dictionary */
+	garbage = g_bytes_new_static ("complete", strlen ("complete"));
+	g_assert_false (totem_progress_message_parse (garbage, &parsed, &error));
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_clear_error (&error);
+
+	close (fds[0]);
+	close (fds[1]);
+}
+
+static void
+test_thumbnail_cache (void)
+{
+	g_autofree char *dir = NULL;
+	g_autofree char *cache_dir = NULL;
+	g_autofree char *video = NULL;
+	g_autofree char *thumbnail = NULL;
+	g_autofree char *copy = NULL;
+	g_autofree char *contents = NULL;
+	g_autofree char *key = NULL;
+	gint64 position;
+	gsize length;
+
+	dir = g_dir_make_tmp ("totem-test-XXXXXX", NULL);
+	g_assert_nonnull (dir);
+	cache_dir = g_build_filename (dir, "cache", NULL);
+	video = g_build_filename (dir, "video.mkv", NULL);
+	thumbnail = g_build_filename (dir, "thumbnail.png", NULL);
+	copy = g_build_filename (dir, "copy.png", NULL);
+
+	/* Too small to be hashed */
+	g_assert_true (g_file_set_contents (video, "video", -1, NULL));
+	g_assert_null (totem_thumbnail_cache_get_key (video));
+
+	contents = g_malloc0 (256 * 1024);
+	contents[0] = 1;
+	g_assert_true (g_file_set_contents (video, contents, 256 * 1024, NULL));
+	key = totem_thumbnail_cache_get_key (video);
+	g_assert_nonnull (key);
+	g_clear_pointer (&contents, g_free);
+
+	g_assert_false (totem_thumbnail_cache_lookup (cache_dir, key, "256", copy, &position));
+	g_assert_cmpint (position, ==, -1);
+
+	/* The frame's position is kept for the other variants */
+	g_assert_true (g_file_set_contents (thumbnail, "PNG", -1, NULL));
+	totem_thumbnail_cache_store (cache_dir, key, "256", thumbnail, 42 * GST_SECOND);
+	g_assert_true (totem_thumbnail_cache_lookup (cache_dir, key, "256", copy, &position));
+	g_assert_cmpint (position, ==, 42 * GST_SECOND);
+	g_assert_true (g_file_get_contents (copy, &contents, &length, NULL));
+	g_assert_cmpstr (contents, ==, "PNG");
+
+	g_assert_false (totem_thumbnail_cache_lookup (cache_dir, key, "512", copy, &position));
+	g_assert_cmpint (position, ==, 42 * GST_SECOND);
+
+	/* Covers have no position */
+	totem_thumbnail_cache_store (cache_dir, key, "512", thumbnail, -1);
+	g_assert_true (totem_thumbnail_cache_lookup (cache_dir, key, "512", copy, &position));
+	g_assert_cmpint (position, ==, -1);
+}
+
 int main (int argc, char **argv)
 {
 	setlocale (LC_ALL, "en_GB.UTF-8");
 
 	g_test_init (&argc, &argv, NULL);
 	gtk_init (&argc, &argv);
+	gst_init (&argc, &argv);
 	g_test_bug_base ("http://bugzilla.gnome.org/show_bug.cgi?id=");
 
 	g_test_add_func ("/menus/lang_info", test_menus_lang_info);
 	g_test_add_func ("/osd/time_label", test_time_label);
+	g_test_add_func ("/gst/decoder_policy", test_decoder_policy);
+	g_test_add_func ("/gst/stream_cache", test_stream_cache);
+	g_test_add_func ("/gst/frame_stats", test_frame_stats);
+	g_test_add_func ("/thumbnailer/progress_messages", test_progress_messages);
+	g_test_add_func ("/thumbnailer/cache", test_thumbnail_cache);
 
 	return g_test_run ();
 }
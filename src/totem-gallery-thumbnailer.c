@@ -29,15 +29,17 @@
 #include "gst/totem-gst-helpers.h"
 #include "gst/totem-time-helpers.h"
 #include "gst/totem-gst-pixbuf-helpers.h"
+#include "gst/totem-progress-helpers.h"
 
 /* The main() function controls progress in the first and last 10% */
-#define PRINT_PROGRESS(p) { g_printf ("%f%% complete\n", p); }
+#define PRINT_PROGRESS(p) report_progress (p, 0)
 #define MIN_PROGRESS 10.0
 #define MAX_PROGRESS 90.0
 
 #define GALLERY_MIN 3				/* minimum number of screenshots in a gallery */
 #define GALLERY_MAX 30				/* maximum number of screenshots in a gallery */
 #define GALLERY_HEADER_HEIGHT 66		/* header height (in pixels) for the gallery */
+#define GALLERY_MAX_WORKERS 8			/* maximum number of pipelines taking screenshots */
 #define DEFAULT_OUTPUT_SIZE 256
 
 static gboolean raw_output = FALSE;
@@ -45,6 +47,9 @@ static int output_size = -1;
 static gint gallery = -1;
 static gint64 second_index = -1;
 static char **filenames = NULL;
+static int progress_fd = -1;
+static gint64 start_time = 0;
+static mode_t output_umask = 022;
 
 typedef struct {
 	const char *output;
@@ -53,7 +58,70 @@ typedef struct {
 	gint64      duration;
 } ThumbApp;
 
-static void save_pixbuf (GdkPixbuf *pixbuf, const char *path,
+/* Shared by all the pipelines taking screenshots */
+typedef struct {
+	guchar    *data;
+	gint       stride;
+	gint64     screenshot_interval;
+	gint64     stream_length;
+	guint      columns;
+	guint      x_padding;
+	guint      y_padding;
+	guint      y_offset;
+	gint       tile_height;
+
+	GMutex     lock;
+	guint      n_done;
+} GalleryTiles;
+
+typedef struct {
+	GalleryTiles *tiles;
+	ThumbApp      app;
+	guint         first;
+	guint         last;
+	gboolean      failed;
+} GalleryWorker;
+
+/* Progress goes to --progress-fd as structured messages if it was
+ * passed, or to stdout as text otherwise */
+static void
+report_progress (gdouble percent,
+		 guint   n_tiles_done)
+{
+	TotemProgressMessage msg = { TOTEM_PROGRESS_MESSAGE_PROGRESS, };
+
+	if (progress_fd < 0) {
+		g_printf ("%f%% complete\n", percent);
+		return;
+	}
+
+	msg.fraction = percent / 100.0;
+	if (n_tiles_done > 0) {
+		msg.tile = n_tiles_done;
+		msg.n_tiles = gallery;
+	}
+	msg.elapsed = g_get_monotonic_time () - start_time;
+	totem_progress_message_write (progress_fd, &msg);
+}
+
+static void
+report_result (const char *output,
+	       const char *message)
+{
+	TotemProgressMessage msg = { 0, };
+
+	if (progress_fd < 0)
+		return;
+
+	msg.type = output ? TOTEM_PROGRESS_MESSAGE_DONE : TOTEM_PROGRESS_MESSAGE_ERROR;
+	msg.fraction = 1.0;
+	msg.elapsed = g_get_monotonic_time () - start_time;
+	msg.output = (char *) output;
+	msg.message = (char *) message;
+	totem_progress_message_write (progress_fd, &msg);
+}
+
+static gboolean save_pixbuf (GdkPixbuf *pixbuf, const char *path,
 			 const char *video_path, int size, gboolean is_still);
 
 static void
@@ -225,6 +293,7 @@ assert_duration (ThumbApp *app)
 	if (app->duration != -1)
 		return;
 	g_print ("totem-video-thumbnailer couldn't get the duration of file '%s'\n", app->input);
+	report_result (NULL, "couldn't get the duration");
 	exit (1);
 }
 
@@ -319,6 +388,33 @@ thumb_app_start (ThumbApp *app)
 	return async_received;
 }
 
+/* Manually set number of worker threads for decoders, as we're running
+ * one pipeline per core already */
+static void
+element_setup_cb (GstElement * playbin, GstElement * element, gpointer udata)
+{
+	gchar *name;
+
+	name = gst_element_get_name (element);
+	if (g_str_has_prefix (name, "avdec_")) {
+		GObjectClass *gobject_class;
+		GParamSpec *pspec;
+
+		gobject_class = G_OBJECT_GET_CLASS (element);
+		pspec = g_object_class_find_property (gobject_class, "max-threads");
+
+		if (pspec)
+			g_object_set (element, "max-threads", 1, NULL);
+	} else if (g_str_has_prefix (name, "dav1ddec")) {
+		g_object_set (element, "n-threads", 1, NULL);
+	} else if (g_str_has_prefix (name, "vp8dec") ||
+		   g_str_has_prefix (name, "vp9dec")) {
+		g_object_set (element, "threads", 1, NULL);
+	}
+
+	g_free (name);
+}
+
 static void
 thumb_app_setup_play (ThumbApp *app)
 {
@@ -336,9 +432,10 @@ thumb_app_setup_play (ThumbApp *app)
 		      "flags", GST_PLAY_FLAG_VIDEO | GST_PLAY_FLAG_AUDIO,
 		      NULL);
 
-	app->play = play;
+	if (g_get_num_processors () > 1)
+		g_signal_connect (play, "element-setup", G_CALLBACK (element_setup_cb), NULL);
 
-	totem_gst_disable_hardware_decoders ();
+	app->play = play;
 }
 
 static void
@@ -390,13 +487,30 @@ scale_pixbuf (GdkPixbuf *pixbuf, int size, gboolean is_still)
 	return result;
 }
 
-static void
+/* Picks the image format from the output file's extension,
+ * defaulting to JPEG */
+static const char *
+get_image_format (const char *path)
+{
+	g_autofree char *lower = NULL;
+
+	lower = g_ascii_strdown (path, -1);
+	if (g_str_has_suffix (lower, ".png"))
+		return "png";
+	if (g_str_has_suffix (lower, ".webp"))
+		return "webp";
+	return "jpeg";
+}
+
+static gboolean
 save_pixbuf (GdkPixbuf *pixbuf, const char *path,
 	     const char *video_path, int size, gboolean is_still)
 {
 	GdkPixbuf *with_holes;
 	GError *err = NULL;
+	g_autofree char *tmp_path = NULL;
 	gboolean ret;
+	int fd;
 
 	/* If we're outputting a gallery or a raw image without a size,
 	 * don't scale the pixbuf or add borders */
@@ -407,22 +521,54 @@ save_pixbuf (GdkPixbuf *pixbuf, const char *path,
 	else
 		with_holes = scale_pixbuf (pixbuf, size, is_still);
 
-
-	ret = gdk_pixbuf_save (with_holes, path, "jpeg", &err, NULL);
+	/* Write to a temporary file next to the output, and move it in place
+	 * once it's complete, so nobody ever sees a partial image */
+	tmp_path = g_strdup_printf ("%s.XXXXXX", path);
+	fd = g_mkstemp (tmp_path);
+	if (fd < 0) {
+		g_set_error (&err, G_FILE_ERROR, g_file_error_from_errno (errno),
+			     "%s", g_strerror (errno));
+		ret = FALSE;
+	} else {
+		GStatBuf buf;
+		mode_t mode;
+
+		/* g_mkstemp() makes the file private, so give it the mode
+		 * of the file it replaces, or the one it'd have been
+		 * created with otherwise */
+		if (g_stat (path, &buf) == 0)
+			mode = buf.st_mode & 07777;
+		else
+			mode = 0666 & ~output_umask;
+		if (fchmod (fd, mode) < 0)
+			g_debug ("Couldn't change the mode of '%s': %s", tmp_path, g_strerror (errno));
+		close (fd);
+		ret = gdk_pixbuf_save (with_holes, tmp_path, get_image_format (path), &err, NULL);
+		if (ret != FALSE && g_rename (tmp_path, path) < 0) {
+			g_set_error (&err, G_FILE_ERROR, g_file_error_from_errno (errno),
+				     "%s", g_strerror (errno));
+			ret = FALSE;
+		}
+		if (ret == FALSE)
+			g_unlink (tmp_path);
+	}
 
 	if (ret == FALSE) {
+		g_autofree char *message = NULL;
+
 		if (err != NULL) {
-			g_print ("totem-video-thumbnailer couldn't write the thumbnail '%s' for video '%s': %s\n", path, video_path, err->message);
+			message = g_strdup_printf ("totem-video-thumbnailer couldn't write the thumbnail '%s' for video '%s': %s", path, video_path, err->message);
 			g_error_free (err);
 		} else {
-			g_print ("totem-video-thumbnailer couldn't write the thumbnail '%s' for video '%s'\n", path, video_path);
+			message = g_strdup_printf ("totem-video-thumbnailer couldn't write the thumbnail '%s' for video '%s'", path, video_path);
 		}
-
-		g_object_unref (with_holes);
-		return;
+		g_print ("%s\n", message);
+		report_result (NULL, message);
 	}
 
 	g_object_unref (with_holes);
+
+	return ret;
 }
 
 static GdkPixbuf *
@@ -435,54 +581,173 @@ capture_frame_at_time (ThumbApp   *app,
 	return totem_gst_playbin_get_frame (app->play, NULL);
 }
 
+static void
+surface_destroy_notify (guchar   *pixels,
+			gpointer  data)
+{
+	cairo_surface_destroy (data);
+}
+
+/* Converts the Cairo RGB24 surface to RGBA in place, and wraps the
+ * result in a pixbuf, so the gallery is never copied. The loop is
+ * written so that compilers vectorise it into byte shuffles. */
 static GdkPixbuf *
 cairo_surface_to_pixbuf (cairo_surface_t *surface)
 {
 	gint stride, width, height, x, y;
-	guchar *data, *output, *output_pixel;
+	guchar *data;
 
-	/* This doesn't deal with alpha --- it simply converts the 4-byte Cairo ARGB
-	 * format to the 3-byte GdkPixbuf packed RGB format. */
 	g_assert (cairo_image_surface_get_format (surface) == CAIRO_FORMAT_RGB24);
 
+	cairo_surface_flush (surface);
+
 	stride = cairo_image_surface_get_stride (surface);
 	width = cairo_image_surface_get_width (surface);
 	height = cairo_image_surface_get_height (surface);
 	data = cairo_image_surface_get_data (surface);
 
-	output = g_malloc (stride * height);
-	output_pixel = output;
-
 	for (y = 0; y < height; y++) {
 		guint32 *row = (guint32*) (data + y * stride);
 
 		for (x = 0; x < width; x++) {
-			output_pixel[0] = (row[x] & 0x00ff0000) >> 16;
-			output_pixel[1] = (row[x] & 0x0000ff00) >> 8;
-			output_pixel[2] = (row[x] & 0x000000ff);
+			/* Native-endian xRGB to R, G, B, A bytes */
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+			row[x] = 0xff000000 | (GUINT32_SWAP_LE_BE (row[x]) >> 8);
+#else
+			row[x] = (row[x] << 8) | 0x000000ff;
+#endif
+		}
+	}
+
+	return gdk_pixbuf_new_from_data (data, GDK_COLORSPACE_RGB, TRUE, 8,
+					 width, height, stride,
+					 surface_destroy_notify, cairo_surface_reference (surface));
+}
+
+/* Scales @screenshot to the size of a tile, and writes it out
+ * as native-endian xRGB pixels at @data */
+static void
+write_tile (GdkPixbuf *screenshot,
+	    gint       tile_width,
+	    gint       tile_height,
+	    guchar    *data,
+	    gint       stride)
+{
+	GdkPixbuf *tile;
+	const guchar *pixels;
+	gint rowstride, n_channels, x, y;
 
-			output_pixel += 3;
+	tile = gdk_pixbuf_scale_simple (screenshot, tile_width, tile_height, GDK_INTERP_BILINEAR);
+	pixels = gdk_pixbuf_read_pixels (tile);
+	rowstride = gdk_pixbuf_get_rowstride (tile);
+	n_channels = gdk_pixbuf_get_n_channels (tile);
+
+	for (y = 0; y < tile_height; y++) {
+		const guchar *p = pixels + y * rowstride;
+		guint32 *row = (guint32*) (data + y * stride);
+
+		for (x = 0; x < tile_width; x++) {
+			row[x] = 0xff000000 | (p[0] << 16) | (p[1] << 8) | p[2];
+			p += n_channels;
 		}
 	}
 
-	return gdk_pixbuf_new_from_data (output, GDK_COLORSPACE_RGB, FALSE, 8,
-					 width, height, width * 3,
-					 (GdkPixbufDestroyNotify) g_free, NULL);
+	g_object_unref (tile);
+}
+
+static gint64
+gallery_get_screenshot_time (GalleryTiles *tiles,
+			     guint         index)
+{
+	gint64 pos;
+
+	pos = (index + 1) * tiles->screenshot_interval;
+	if (pos >= tiles->stream_length)
+		pos = tiles->stream_length - 1;
+	return pos;
 }
 
+/* Screenshots can be written out from any thread, as they all
+ * go to separate areas of the gallery surface */
+static void
+gallery_add_screenshot (GalleryTiles *tiles,
+			guint         index,
+			GdkPixbuf    *screenshot)
+{
+	guint x, y;
+	guint n_done;
+
+	x = tiles->x_padding + (index % tiles->columns) * (output_size + tiles->x_padding);
+	y = tiles->y_offset + tiles->y_padding + (index / tiles->columns) *
+		(guint) (tiles->tile_height + tiles->y_padding);
+
+	if (screenshot != NULL) {
+		write_tile (screenshot, output_size, tiles->tile_height,
+			    tiles->data + y * tiles->stride + x * 4, tiles->stride);
+	}
+
+	g_debug ("Composited screenshot %u from %" G_GINT64_FORMAT " milliseconds at (%u,%u).",
+		 index, gallery_get_screenshot_time (tiles, index), x, y);
+
+	/* Progress is reported under the lock, so messages from different
+	 * pipelines don't get mixed up */
+	g_mutex_lock (&tiles->lock);
+	n_done = ++tiles->n_done;
+	/* We print progress in the range 10% (MIN_PROGRESS) to 50% (MAX_PROGRESS - MIN_PROGRESS) / 2.0 */
+	report_progress (MIN_PROGRESS + n_done * (((MAX_PROGRESS - MIN_PROGRESS) / gallery) / 2.0), n_done);
+	g_mutex_unlock (&tiles->lock);
+}
+
+static void
+gallery_worker_capture (GalleryWorker *worker)
+{
+	guint i;
+
+	for (i = worker->first; i < worker->last; i++) {
+		GdkPixbuf *screenshot;
+
+		screenshot = capture_frame_at_time (&worker->app, gallery_get_screenshot_time (worker->tiles, i));
+		gallery_add_screenshot (worker->tiles, i, screenshot);
+		g_clear_object (&screenshot);
+	}
+}
+
+static gpointer
+gallery_worker_thread (gpointer data)
+{
+	GalleryWorker *worker = data;
+
+	thumb_app_setup_play (&worker->app);
+	thumb_app_set_filename (&worker->app);
+
+	if (thumb_app_start (&worker->app) == FALSE) {
+		g_debug ("Worker for screenshots %u to %u couldn't open the file", worker->first, worker->last - 1);
+		worker->failed = TRUE;
+	} else {
+		thumb_app_set_error_handler (&worker->app);
+		gallery_worker_capture (worker);
+	}
+
+	thumb_app_cleanup (&worker->app);
+
+	return NULL;
+}
 
 static GdkPixbuf *
 create_gallery (ThumbApp *app)
 {
-	GdkPixbuf *screenshot, *pixbuf = NULL;
+	GdkPixbuf *screenshot, *pixbuf;
+	GalleryTiles tiles = { 0, };
+	GalleryWorker *workers;
+	GThread *threads[GALLERY_MAX_WORKERS];
 	cairo_t *cr;
 	cairo_surface_t *surface;
 	PangoLayout *layout;
 	PangoFontDescription *font_desc;
 	gint64 stream_length, screenshot_interval, pos;
-	guint columns = 3, rows, current_column, current_row, x, y;
-	gint screenshot_width = 0, screenshot_height = 0, x_padding = 0, y_padding = 0;
-	gfloat scale = 1.0;
+	guint columns = 3, rows, current_column, current_row, x, y, i, n_workers;
+	gint screenshot_width, screenshot_height, x_padding, y_padding;
+	gfloat scale;
 	gchar *header_text, *duration_text, *filename;
 	GFile *file;
 
@@ -532,73 +797,86 @@ create_gallery (ThumbApp *app)
 
 	g_debug ("Outputting as %u rows and %u columns.", rows, columns);
 
-	/* Take the screenshots and composite them into a pixbuf */
-	current_column = current_row = x = y = 0;
-	for (pos = screenshot_interval; pos <= stream_length; pos += screenshot_interval) {
-		if (pos == stream_length)
-			screenshot = capture_frame_at_time (app, pos - 1);
-		else
-			screenshot = capture_frame_at_time (app, pos);
+	g_mutex_init (&tiles.lock);
+	tiles.screenshot_interval = screenshot_interval;
+	tiles.stream_length = stream_length;
+	tiles.columns = columns;
 
-		if (pixbuf == NULL) {
-			screenshot_width = gdk_pixbuf_get_width (screenshot);
-			screenshot_height = gdk_pixbuf_get_height (screenshot);
 
-			/* Calculate a scaling factor so that screenshot_width -> output_size */
-			scale = (float) output_size / (float) screenshot_width;
+	/* Take the first screenshot to find out how big the gallery is going to be */
+	screenshot = capture_frame_at_time (app, gallery_get_screenshot_time (&tiles, 0));
+	screenshot_width = gdk_pixbuf_get_width (screenshot);
+	screenshot_height = gdk_pixbuf_get_height (screenshot);
 
-			x_padding = x = MAX (output_size * 0.05, 1);
-			y_padding = y = MAX (scale * screenshot_height * 0.05, 1);
+	/* Calculate a scaling factor so that screenshot_width -> output_size */
+	scale = (float) output_size / (float) screenshot_width;
 
-			g_debug ("Scaling each screenshot by %f.", scale);
+	x_padding = MAX (output_size * 0.05, 1);
+	y_padding = MAX (scale * screenshot_height * 0.05, 1);
 
-			/* Create our massive pixbuf */
-			pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
-						 columns * output_size + (columns + 1) * x_padding,
-						 (guint) (rows * scale * screenshot_height + (rows + 1) * y_padding));
-			gdk_pixbuf_fill (pixbuf, 0x000000ff);
+	g_debug ("Scaling each screenshot by %f.", scale);
 
-			g_debug ("Created output pixbuf (%ux%u).", gdk_pixbuf_get_width (pixbuf), gdk_pixbuf_get_height (pixbuf));
-		}
+	/* Create the one surface the whole gallery gets drawn on. The height is the height of
+	 * the screenshots plus the necessary height for 3 lines of header (at ~18px each), plus
+	 * some extra padding. New surfaces are cleared to black. */
+	surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24,
+					      columns * output_size + (columns + 1) * x_padding,
+					      (guint) (rows * scale * screenshot_height + (rows + 1) * y_padding) +
+					      GALLERY_HEADER_HEIGHT + y_padding);
+	cairo_surface_flush (surface);
 
-		/* Composite the screenshot into our gallery */
-		gdk_pixbuf_composite (screenshot, pixbuf,
-				      x, y, output_size, scale * screenshot_height,
-				      (gdouble) x, (gdouble) y, scale, scale,
-				      GDK_INTERP_BILINEAR, 255);
-		g_object_unref (screenshot);
+	g_debug ("Created output surface (%ux%u).", cairo_image_surface_get_width (surface), cairo_image_surface_get_height (surface));
 
-		g_debug ("Composited screenshot from %" G_GINT64_FORMAT " milliseconds (address %u) at (%u,%u).",
-				pos, GPOINTER_TO_UINT (screenshot), x, y);
+	tiles.data = cairo_image_surface_get_data (surface);
+	tiles.stride = cairo_image_surface_get_stride (surface);
+	tiles.x_padding = x_padding;
+	tiles.y_padding = y_padding;
+	tiles.y_offset = GALLERY_HEADER_HEIGHT + y_padding;
+	tiles.tile_height = scale * screenshot_height;
 
-		/* We print progress in the range 10% (MIN_PROGRESS) to 50% (MAX_PROGRESS - MIN_PROGRESS) / 2.0 */
-		PRINT_PROGRESS (MIN_PROGRESS + (current_row * columns + current_column) * (((MAX_PROGRESS - MIN_PROGRESS) / gallery) / 2.0));
+	gallery_add_screenshot (&tiles, 0, screenshot);
+	g_object_unref (screenshot);
 
-		current_column = (current_column + 1) % columns;
-		x += output_size + x_padding;
-		if (current_column == 0) {
-			x = x_padding;
-			y += scale * screenshot_height + y_padding;
-			current_row++;
+	/* Split the rest of the stream between one pipeline per core, the first
+	 * of which is the one we already have open. Each of them composites its
+	 * screenshots into the gallery as soon as they're taken. */
+	n_workers = MIN (MIN (g_get_num_processors (), GALLERY_MAX_WORKERS), (guint) gallery - 1);
+	n_workers = MAX (n_workers, 1);
+	workers = g_new0 (GalleryWorker, n_workers);
+
+	g_debug ("Taking the remaining screenshots with %u pipelines.", n_workers);
+
+	for (i = 0; i < n_workers; i++) {
+		workers[i].tiles = &tiles;
+		workers[i].first = 1 + i * (gallery - 1) / n_workers;
+		workers[i].last = 1 + (i + 1) * (gallery - 1) / n_workers;
+		workers[i].app.input = app->input;
+	}
+
+	for (i = 1; i < n_workers; i++)
+		threads[i] = g_thread_new ("gallery-worker", gallery_worker_thread, &workers[i]);
+
+	workers[0].app = *app;
+	gallery_worker_capture (&workers[0]);
+
+	for (i = 1; i < n_workers; i++) {
+		g_thread_join (threads[i]);
+
+		/* Fall back to our own pipeline if the worker couldn't open the file */
+		if (workers[i].failed) {
+			workers[i].app = *app;
+			gallery_worker_capture (&workers[i]);
 		}
 	}
 
-	g_debug ("Converting pixbuf to a Cairo surface.");
+	g_free (workers);
+	g_mutex_clear (&tiles.lock);
 
-	/* Load the pixbuf into a Cairo surface and overlay the text. The height is the height of
-	 * the gallery plus the necessary height for 3 lines of header (at ~18px each), plus some
-	 * extra padding. */
-	surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, gdk_pixbuf_get_width (pixbuf),
-					      gdk_pixbuf_get_height (pixbuf) + GALLERY_HEADER_HEIGHT + y_padding);
+	/* Overlay the text on the screenshots */
+	cairo_surface_mark_dirty (surface);
 	cr = cairo_create (surface);
 	cairo_surface_destroy (surface);
 
-	/* First, copy across the gallery pixbuf */
-	gdk_cairo_set_source_pixbuf (cr, pixbuf, 0.0, GALLERY_HEADER_HEIGHT + y_padding);
-	cairo_rectangle (cr, 0.0, GALLERY_HEADER_HEIGHT + y_padding, gdk_pixbuf_get_width (pixbuf), gdk_pixbuf_get_height (pixbuf));
-	cairo_fill (cr);
-	g_object_unref (pixbuf);
-
 	/* Build the header information */
 	duration_text = totem_time_to_string (stream_length, TOTEM_TIME_FLAG_NONE);
 	file = g_file_new_for_commandline_arg (app->input);
@@ -645,10 +923,12 @@ create_gallery (ThumbApp *app)
 
 	g_debug ("Writing screenshot timestamps with Pango.");
 
-	for (pos = screenshot_interval; pos <= stream_length; pos += screenshot_interval) {
+	for (i = 0; i < (guint) gallery; i++) {
 		gchar *timestamp_text;
 		gint layout_width, layout_height;
 
+		pos = (i + 1) * screenshot_interval;
+
 		timestamp_text = totem_time_to_string (pos, TOTEM_TIME_FLAG_NONE);
 
 		pango_layout_set_text (layout, timestamp_text, -1);
@@ -685,9 +965,9 @@ create_gallery (ThumbApp *app)
 
 	g_object_unref (layout);
 
-	g_debug ("Converting Cairo surface back to pixbuf.");
+	g_debug ("Wrapping Cairo surface in a pixbuf.");
 
-	/* Create a new pixbuf from the Cairo context */
+	/* Create a new pixbuf sharing the Cairo surface's data */
 	pixbuf = cairo_surface_to_pixbuf (cairo_get_target (cr));
 	cairo_destroy (cr);
 
@@ -699,6 +979,7 @@ static const GOptionEntry entries[] = {
 	{ "raw", 'r', 0, G_OPTION_ARG_NONE, &raw_output, "Output the raw picture of the video without scaling or adding borders", NULL },
 	{ "time", 't', 0, G_OPTION_ARG_INT64, &second_index, "Choose this time (in seconds) as the thumbnail (can't be used with --gallery)", NULL },
 	{ "gallery", 'g', 0, G_OPTION_ARG_INT, &gallery, "Output a gallery of the given number (0 is default) of screenshots (can't be used with --time)", NULL },
+	{ "progress-fd", 0, 0, G_OPTION_ARG_INT, &progress_fd, "Write progress messages to the given file descriptor instead of stdout", "FD" },
 	{ G_OPTION_REMAINING, '\0', 0, G_OPTION_ARG_FILENAME_ARRAY, &filenames, NULL, "[INPUT FILE] [OUTPUT FILE]" },
 	{ NULL }
 };
@@ -712,6 +993,10 @@ int main (int argc, char *argv[])
 	const char *input, *output;
 	ThumbApp app;
 
+	/* Can only be read by changing it, so before starting any threads */
+	output_umask = umask (0);
+	umask (output_umask);
+
 	setlocale (LC_ALL, "");
 	bindtextdomain (GETTEXT_PACKAGE, GNOMELOCALEDIR);
 	bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
@@ -728,7 +1013,12 @@ int main (int argc, char *argv[])
 		return 1;
 	}
 
-	fcntl (fileno (stdout), F_SETFL, O_NONBLOCK);
+	start_time = g_get_monotonic_time ();
+
+	/* Text progress is best-effort, but messages on --progress-fd
+	 * are always written out whole */
+	if (progress_fd < 0)
+		fcntl (fileno (stdout), F_SETFL, O_NONBLOCK);
 	setbuf (stdout, NULL);
 
 	if (raw_output == FALSE && output_size == -1)
@@ -748,6 +1038,8 @@ int main (int argc, char *argv[])
 	g_debug("Initialised libraries, about to create video widget");
 	PRINT_PROGRESS (2.0);
 
+	totem_gst_disable_hardware_decoders ();
+
 	app.input = input;
 	app.output = output;
 
@@ -761,12 +1053,14 @@ int main (int argc, char *argv[])
 
 	if (thumb_app_start (&app) == FALSE) {
 		g_print ("totem-video-thumbnailer couldn't open file '%s'\n", input);
+		report_result (NULL, "couldn't open file");
 		exit (1);
 	}
 	thumb_app_set_error_handler (&app);
 
 	if (thumb_app_get_has_video (&app) == FALSE) {
 		g_debug ("totem-video-thumbnailer couldn't find a video track in '%s'\n", input);
+		report_result (NULL, "couldn't find a video track");
 		exit (1);
 	}
 	thumb_app_set_duration (&app);
@@ -784,13 +1078,16 @@ int main (int argc, char *argv[])
 
 	if (pixbuf == NULL) {
 		g_print ("totem-video-thumbnailer couldn't get a picture from '%s'\n", input);
+		report_result (NULL, "couldn't get a picture");
 		exit (1);
 	}
 
 	g_debug("Saving captured screenshot to %s", output);
-	save_pixbuf (pixbuf, output, input, output_size, FALSE);
+	if (save_pixbuf (pixbuf, output, input, output_size, FALSE) == FALSE)
+		exit (1);
 	g_object_unref (pixbuf);
 	PRINT_PROGRESS (100.0);
+	report_result (output, NULL);
 
 	return 0;
 }
@@ -36,6 +36,12 @@
 #define SCROLL_GET_MORE_LIMIT 0.8
 #define MIN_DURATION          5
 #define MAX_DURATION          G_MAXINT
+/* Search pages are sized so that each source fills one in about
+ * SEARCH_PAGE_TIME, starting from PAGE_SIZE */
+#define SEARCH_PAGE_TIME      (G_USEC_PER_SEC / 2)
+#define MIN_SEARCH_PAGE_SIZE  10
+#define MAX_SEARCH_PAGE_SIZE  200
+#define SEARCH_ALL_SOURCES_ID "totem-all-sources"
 
 /* casts are to shut gcc up */
 static const GtkTargetEntry target_table[] = {
@@ -64,11 +70,11 @@ struct _TotemGrilo {
 	GrlMedia *selected_media;
 
 	/* Search related information */
-	GrlSource *search_source;
-	guint search_id;
-	gint search_page;
-	guint search_remaining;
+	GPtrArray *search_queries; /* SearchQuery, by decreasing source priority */
 	gchar *search_text;
+	gint64 search_start_time;
+	gboolean search_reported_first;
+	gboolean search_reported_page;
 
 	/* Toolbar widgets */
 	GtkWidget *header;
@@ -105,7 +111,10 @@ struct _TotemGrilo {
 	GtkWidget *selection_bar;
 	GtkWidget *selection_revealer;
 
-	GCancellable *thumbnail_cancellable;
+	/* Pending SetThumbnailData, for the rows around the visible ones */
+	GList *thumbnail_requests;
+	gdouble last_scroll_value;
+	gboolean scrolling_up;
 };
 
 enum {
@@ -131,8 +140,25 @@ typedef struct {
 	GrlSource *source;
 	GtkTreeModel *model;
 	GtkTreeRowReference *reference;
+	GCancellable *cancellable;
+	int priority;
 } SetThumbnailData;
 
+typedef struct {
+	TotemGrilo *totem_grilo;
+	GrlSource *source;
+	int priority;
+	guint operation_id;
+	gboolean running;
+	gboolean cancelled;
+	gboolean exhausted;
+	guint page_size;
+	guint skip;
+	guint received; /* in the running operation */
+	guint n_first_page; /* rows of the first page in the model */
+	gint64 start_time;
+} SearchQuery;
+
 typedef struct {
 	gboolean found;
 	GrlKeyID key;
@@ -344,6 +370,40 @@ fallback:
 	return CAN_REMOVE_FALSE;
 }
 
+/* The views are flat, but the rows might be in a filtered, or
+ * sorted, version of the model holding the thumbnails */
+static GtkTreePath *
+view_path_to_model_path (GtkTreeModel *view_model,
+			 GtkTreePath  *view_path)
+{
+	if (GTK_IS_TREE_MODEL_FILTER (view_model))
+		return gtk_tree_model_filter_convert_path_to_child_path (GTK_TREE_MODEL_FILTER (view_model), view_path);
+	if (GTK_IS_TREE_MODEL_SORT (view_model))
+		return gtk_tree_model_sort_convert_path_to_child_path (GTK_TREE_MODEL_SORT (view_model), view_path);
+	return gtk_tree_path_copy (view_path);
+}
+
+static GtkTreePath *
+model_path_to_view_path (GtkTreeModel *view_model,
+			 GtkTreePath  *path)
+{
+	if (GTK_IS_TREE_MODEL_FILTER (view_model))
+		return gtk_tree_model_filter_convert_child_path_to_path (GTK_TREE_MODEL_FILTER (view_model), path);
+	if (GTK_IS_TREE_MODEL_SORT (view_model))
+		return gtk_tree_model_sort_convert_child_path_to_path (GTK_TREE_MODEL_SORT (view_model), path);
+	return gtk_tree_path_copy (path);
+}
+
+static GtkTreeModel *
+get_thumbnails_model (GtkTreeModel *view_model)
+{
+	if (GTK_IS_TREE_MODEL_FILTER (view_model))
+		return gtk_tree_model_filter_get_model (GTK_TREE_MODEL_FILTER (view_model));
+	if (GTK_IS_TREE_MODEL_SORT (view_model))
+		return gtk_tree_model_sort_get_model (GTK_TREE_MODEL_SORT (view_model));
+	return view_model;
+}
+
 static void
 get_thumbnail_cb (GObject *source_object,
 		  GAsyncResult *res,
@@ -351,7 +411,7 @@ get_thumbnail_cb (GObject *source_object,
 {
 	GtkTreeIter iter;
 	SetThumbnailData *thumb_data = (SetThumbnailData *) user_data;
-	GtkTreePath *path;
+	GtkTreePath *path, *view_path;
 	GdkPixbuf *thumbnail;
 	const GdkPixbuf *fallback_thumbnail;
 	GtkTreeModel *view_model;
@@ -387,30 +447,23 @@ get_thumbnail_cb (GObject *source_object,
 
 	/* Can we find that thumbnail in the view model? */
 	view_model = gd_main_view_get_model (GD_MAIN_VIEW (thumb_data->totem_grilo->browser));
-	if (GTK_IS_TREE_MODEL_FILTER (view_model)) {
-		GtkTreePath *parent_path;
-		parent_path = gtk_tree_model_filter_convert_child_path_to_path (GTK_TREE_MODEL_FILTER (view_model), path);
-		gtk_tree_path_free (path);
-		path = parent_path;
-	} else if (GTK_IS_TREE_MODEL_SORT (view_model)) {
-		GtkTreePath *parent_path;
-		parent_path = gtk_tree_model_sort_convert_child_path_to_path (GTK_TREE_MODEL_SORT (view_model), path);
-		gtk_tree_path_free (path);
-		path = parent_path;
-	}
+	view_path = model_path_to_view_path (view_model, path);
+	gtk_tree_path_free (path);
 
-	if (path != NULL && gtk_tree_model_get_iter (view_model, &iter, path))
-		gtk_tree_model_row_changed (view_model, path, &iter);
-	g_clear_pointer (&path, gtk_tree_path_free);
+	if (view_path != NULL && gtk_tree_model_get_iter (view_model, &iter, view_path))
+		gtk_tree_model_row_changed (view_model, view_path, &iter);
+	g_clear_pointer (&view_path, gtk_tree_path_free);
 
 out:
 	g_clear_error (&error);
 
 	/* Free thumb data */
+	thumb_data->totem_grilo->thumbnail_requests = g_list_remove (thumb_data->totem_grilo->thumbnail_requests, thumb_data);
 	g_object_unref (thumb_data->totem_grilo);
 	g_clear_object (&thumb_data->media);
 	g_clear_object (&thumb_data->source);
 	g_object_unref (thumb_data->model);
+	g_object_unref (thumb_data->cancellable);
 	gtk_tree_row_reference_free (thumb_data->reference);
 	g_slice_free (SetThumbnailData, thumb_data);
 }
@@ -419,7 +472,8 @@ static void
 set_thumbnail_async (TotemGrilo   *self,
 		     GObject      *object,
 		     GtkTreeModel *model,
-		     GtkTreePath  *path)
+		     GtkTreePath  *path,
+		     int           priority)
 {
 	SetThumbnailData *thumb_data;
 
@@ -432,19 +486,119 @@ set_thumbnail_async (TotemGrilo   *self,
 		thumb_data->media = GRL_MEDIA (g_object_ref (object));
 	thumb_data->model = g_object_ref (model);
 	thumb_data->reference = gtk_tree_row_reference_new (model, path);
+	thumb_data->cancellable = g_cancellable_new ();
+	thumb_data->priority = priority;
+	self->thumbnail_requests = g_list_prepend (self->thumbnail_requests, thumb_data);
+
+	totem_grilo_get_thumbnail (object, priority, thumb_data->cancellable, get_thumbnail_cb, thumb_data);
+}
+
+/* Gives up on the thumbnails for rows that scrolled away, and for the
+ * prefetched rows that came into view, so that those get requested
+ * again before the ones further down the queue */
+static void
+cancel_thumbnail_requests (TotemGrilo   *self,
+			   GtkTreeModel *view_model,
+			   int           first_visible,
+			   int           last_visible,
+			   int           first,
+			   int           last)
+{
+	GtkTreeModel *model;
+	GList *l;
+
+	model = get_thumbnails_model (view_model);
+
+	for (l = self->thumbnail_requests; l != NULL; l = l->next) {
+		SetThumbnailData *thumb_data = l->data;
+		GtkTreePath *path, *view_path = NULL;
+		GtkTreeIter iter;
+		int index = -1;
+
+		if (g_cancellable_is_cancelled (thumb_data->cancellable))
+			continue;
+
+		path = gtk_tree_row_reference_get_path (thumb_data->reference);
+		if (path != NULL && thumb_data->model == model)
+			view_path = model_path_to_view_path (view_model, path);
+		if (view_path != NULL)
+			index = gtk_tree_path_get_indices (view_path)[0];
+		g_clear_pointer (&view_path, gtk_tree_path_free);
+
+		if ((index >= first_visible && index <= last_visible &&
+		     thumb_data->priority == G_PRIORITY_DEFAULT) ||
+		    (index >= first && index <= last &&
+		     (index < first_visible || index > last_visible))) {
+			gtk_tree_path_free (path);
+			continue;
+		}
 
-	totem_grilo_get_thumbnail (object, self->thumbnail_cancellable, get_thumbnail_cb, thumb_data);
+		g_cancellable_cancel (thumb_data->cancellable);
+		if (path != NULL && gtk_tree_model_get_iter (thumb_data->model, &iter, path)) {
+			gtk_tree_store_set (GTK_TREE_STORE (thumb_data->model),
+					    &iter,
+					    MODEL_RESULTS_IS_PRETHUMBNAIL, TRUE,
+					    -1);
+		}
+		g_clear_pointer (&path, gtk_tree_path_free);
+	}
 }
 
+/* Returns FALSE if there's no such row */
+static gboolean
+request_thumbnail (TotemGrilo   *self,
+		   GtkTreeModel *view_model,
+		   int           index,
+		   int           priority)
+{
+	GtkTreePath *view_path, *path;
+	GtkTreeModel *model;
+	GtkTreeIter iter;
+	GrlMedia *media = NULL;
+	GrlSource *source = NULL;
+	gboolean is_prethumbnail = FALSE;
+
+	model = get_thumbnails_model (view_model);
+	view_path = gtk_tree_path_new_from_indices (index, -1);
+	path = view_path_to_model_path (view_model, view_path);
+	gtk_tree_path_free (view_path);
+
+	if (path == NULL || gtk_tree_model_get_iter (model, &iter, path) == FALSE) {
+		g_clear_pointer (&path, gtk_tree_path_free);
+		return FALSE;
+	}
+
+	gtk_tree_model_get (model,
+	                    &iter,
+	                    MODEL_RESULTS_CONTENT, &media,
+	                    MODEL_RESULTS_SOURCE, &source,
+	                    MODEL_RESULTS_IS_PRETHUMBNAIL, &is_prethumbnail,
+	                    -1);
+	if ((media != NULL || source != NULL) && is_prethumbnail) {
+		set_thumbnail_async (self, media ? G_OBJECT (media) : G_OBJECT (source), model, path, priority);
+		gtk_tree_store_set (GTK_TREE_STORE (model),
+		                    &iter,
+		                    MODEL_RESULTS_IS_PRETHUMBNAIL, FALSE,
+		                    -1);
+	}
+
+	g_clear_object (&media);
+	g_clear_object (&source);
+	gtk_tree_path_free (path);
+
+	return TRUE;
+}
+
+/* Thumbnails for the visible rows come first, then for the next
+ * page in the direction we're scrolling in */
 static gboolean
 update_search_thumbnails_idle (TotemGrilo *self)
 {
 	GtkTreePath *start_path;
 	GtkTreePath *end_path;
-	GrlSource *source;
-	gboolean is_prethumbnail = FALSE;
-	GtkTreeModel *view_model, *model;
+	GtkTreeModel *view_model;
 	GtkIconView *icon_view;
+	int first_visible, last_visible, first, last, i;
 
 	self->thumbnail_update_id = 0;
 
@@ -453,56 +607,36 @@ update_search_thumbnails_idle (TotemGrilo *self)
 		return FALSE;
 	}
 
-	view_model = gtk_icon_view_get_model (icon_view);
-	if (GTK_IS_TREE_MODEL_FILTER (view_model))
-		model = gtk_tree_model_filter_get_model (GTK_TREE_MODEL_FILTER (view_model));
-	else if (GTK_IS_TREE_MODEL_SORT (view_model))
-		model = gtk_tree_model_sort_get_model (GTK_TREE_MODEL_SORT (view_model));
-	else
-		model = view_model;
+	first_visible = gtk_tree_path_get_indices (start_path)[0];
+	last_visible = gtk_tree_path_get_indices (end_path)[0];
+	gtk_tree_path_free (start_path);
+	gtk_tree_path_free (end_path);
 
-	for (;
-	     gtk_tree_path_compare (start_path, end_path) <= 0;
-	     gtk_tree_path_next (start_path)) {
-		GtkTreePath *path;
-		GtkTreeIter iter;
-		GrlMedia *media;
+	if (self->scrolling_up) {
+		first = MAX (0, first_visible - (last_visible - first_visible + 1));
+		last = last_visible;
+	} else {
+		first = first_visible;
+		last = last_visible + (last_visible - first_visible + 1);
+	}
 
-		if (GTK_IS_TREE_MODEL_FILTER (view_model)) {
-			path = gtk_tree_model_filter_convert_path_to_child_path (GTK_TREE_MODEL_FILTER (view_model),
-										 start_path);
-		} else if (GTK_IS_TREE_MODEL_SORT (view_model)) {
-			path = gtk_tree_model_sort_convert_path_to_child_path (GTK_TREE_MODEL_SORT (view_model),
-									       start_path);
-		} else {
-			path = gtk_tree_path_copy (start_path);
-		}
+	view_model = gtk_icon_view_get_model (icon_view);
+	cancel_thumbnail_requests (self, view_model, first_visible, last_visible, first, last);
 
-		if (gtk_tree_model_get_iter (model, &iter, path) == FALSE) {
-			gtk_tree_path_free (path);
+	for (i = first_visible; i <= last_visible; i++) {
+		if (!request_thumbnail (self, view_model, i, G_PRIORITY_DEFAULT))
 			break;
-		}
+	}
 
-		media = NULL;
-		gtk_tree_model_get (model,
-		                    &iter,
-		                    MODEL_RESULTS_CONTENT, &media,
-		                    MODEL_RESULTS_SOURCE, &source,
-		                    MODEL_RESULTS_IS_PRETHUMBNAIL, &is_prethumbnail,
-		                    -1);
-		if ((media != NULL || source != NULL) && is_prethumbnail) {
-			set_thumbnail_async (self, media ? G_OBJECT (media) : G_OBJECT (source), model, path);
-			gtk_tree_store_set (GTK_TREE_STORE (model),
-			                    &iter,
-			                    MODEL_RESULTS_IS_PRETHUMBNAIL, FALSE,
-			                    -1);
+	if (self->scrolling_up) {
+		for (i = first_visible - 1; i >= first; i--)
+			request_thumbnail (self, view_model, i, G_PRIORITY_LOW);
+	} else {
+		for (i = last_visible + 1; i <= last; i++) {
+			if (!request_thumbnail (self, view_model, i, G_PRIORITY_LOW))
+				break;
 		}
-
-		g_clear_object (&media);
-		g_clear_object (&source);
 	}
-	gtk_tree_path_free (start_path);
-	gtk_tree_path_free (end_path);
 
 	return FALSE;
 }
@@ -612,14 +746,129 @@ get_source_priority (GrlSource *source)
 	return 0;
 }
 
+/* The stores' iters persist, so each store keeps its rows indexed by
+ * media ID, to find them without walking the whole library. The index
+ * needs to be kept up to date by using remove_row() and clear_model(). */
+static GHashTable *
+get_media_index (GtkTreeModel *model)
+{
+	GHashTable *index;
+
+	index = g_object_get_data (G_OBJECT (model), "media-index");
+	if (index == NULL) {
+		index = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free, (GDestroyNotify) g_array_unref);
+		g_object_set_data_full (G_OBJECT (model), "media-index",
+					index, (GDestroyNotify) g_hash_table_unref);
+	}
+
+	return index;
+}
+
+static void
+media_index_add (GtkTreeModel *model,
+		 GrlMedia     *media,
+		 GtkTreeIter  *iter)
+{
+	GHashTable *index;
+	GArray *rows;
+	const char *id;
+
+	id = grl_media_get_id (media);
+	if (id == NULL)
+		return;
+
+	index = get_media_index (model);
+	rows = g_hash_table_lookup (index, id);
+	if (rows == NULL) {
+		rows = g_array_new (FALSE, FALSE, sizeof (GtkTreeIter));
+		g_hash_table_insert (index, g_strdup (id), rows);
+	}
+	g_array_append_val (rows, *iter);
+}
+
+/* Removes the row at @iter, and its children, from the index */
+static void
+media_index_remove (GtkTreeModel *model,
+		    GtkTreeIter  *iter)
+{
+	GHashTable *index;
+	GtkTreeIter child;
+	GrlMedia *media;
+	GArray *rows;
+	const char *id;
+	guint i;
+
+	if (gtk_tree_model_iter_children (model, &child, iter)) {
+		do {
+			media_index_remove (model, &child);
+		} while (gtk_tree_model_iter_next (model, &child));
+	}
+
+	gtk_tree_model_get (model, iter,
+			    MODEL_RESULTS_CONTENT, &media,
+			    -1);
+	if (media == NULL)
+		return;
+
+	id = grl_media_get_id (media);
+	index = get_media_index (model);
+	rows = id ? g_hash_table_lookup (index, id) : NULL;
+	for (i = 0; rows != NULL && i < rows->len; i++) {
+		if (g_array_index (rows, GtkTreeIter, i).user_data == iter->user_data) {
+			g_array_remove_index_fast (rows, i);
+			break;
+		}
+	}
+	if (rows != NULL && rows->len == 0)
+		g_hash_table_remove (index, id);
+
+	g_object_unref (media);
+}
+
+static gboolean
+media_index_lookup (GtkTreeModel *model,
+		    const char   *id,
+		    GtkTreeIter  *iter)
+{
+	GArray *rows;
+
+	if (id == NULL)
+		return FALSE;
+
+	rows = g_hash_table_lookup (get_media_index (model), id);
+	if (rows == NULL)
+		return FALSE;
+
+	*iter = g_array_index (rows, GtkTreeIter, 0);
+	return TRUE;
+}
+
+static gboolean
+remove_row (GtkTreeModel *model,
+	    GtkTreeIter  *iter)
+{
+	media_index_remove (model, iter);
+	return gtk_tree_store_remove (GTK_TREE_STORE (model), iter);
+}
+
+static void
+clear_model (GtkTreeModel *model)
+{
+	g_hash_table_remove_all (get_media_index (model));
+	gtk_tree_store_clear (GTK_TREE_STORE (model));
+}
+
 static void
 add_media_to_model (GtkTreeStore *model,
 		    GtkTreeIter  *parent,
+		    int           position,
 		    GrlSource    *source,
 		    GrlMedia     *media)
 {
 	GdkPixbuf *thumbnail;
 	gboolean thumbnailing;
+	GtkTreeIter iter;
 	char *secondary;
 	GDateTime *mtime;
 	int prio;
@@ -629,7 +878,7 @@ add_media_to_model (GtkTreeStore *model,
 	mtime = grl_media_get_modification_date (media);
 	prio = get_source_priority (source);
 
-	gtk_tree_store_insert_with_values (GTK_TREE_STORE (model), NULL, parent, -1,
+	gtk_tree_store_insert_with_values (GTK_TREE_STORE (model), &iter, parent, position,
 					   MODEL_RESULTS_SOURCE, source,
 					   MODEL_RESULTS_CONTENT, media,
 					   GD_MAIN_COLUMN_ICON, thumbnail,
@@ -640,6 +889,7 @@ add_media_to_model (GtkTreeStore *model,
 					   MODEL_RESULTS_SORT_PRIORITY, prio,
 					   MODEL_RESULTS_CAN_REMOVE, can_remove (source, media),
 					   -1);
+	media_index_add (GTK_TREE_MODEL (model), media, &iter);
 
 	g_clear_object (&thumbnail);
 	g_free (secondary);
@@ -698,7 +948,7 @@ browse_cb (GrlSource    *source,
 				add_local_metadata (self, source, media);
 				add_media_to_model (GTK_TREE_STORE (bud->model),
 						    bud->ref_parent ? &parent : NULL,
-						    source, media);
+						    -1, source, media);
 			}
 		} else {
 			g_debug ("Ignoring %s browse result at %s",
@@ -794,6 +1044,181 @@ play (TotemGrilo *self,
 	g_free (title);
 }
 
+static void
+search_query_free (SearchQuery *query)
+{
+	g_object_unref (query->source);
+	g_slice_free (SearchQuery, query);
+}
+
+static gboolean
+search_is_running (TotemGrilo *self)
+{
+	guint i;
+
+	for (i = 0; i < self->search_queries->len; i++) {
+		SearchQuery *query = g_ptr_array_index (self->search_queries, i);
+		if (query->running)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static gboolean
+search_is_exhausted (TotemGrilo *self)
+{
+	guint i;
+
+	for (i = 0; i < self->search_queries->len; i++) {
+		SearchQuery *query = g_ptr_array_index (self->search_queries, i);
+		if (!query->exhausted)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* Queries still running are freed by search_cb once cancelled */
+static void
+stop_search_query (SearchQuery *query)
+{
+	if (query->running) {
+		query->cancelled = TRUE;
+		if (query->operation_id != 0)
+			grl_operation_cancel (query->operation_id);
+	} else {
+		search_query_free (query);
+	}
+}
+
+static void
+stop_search (TotemGrilo *self)
+{
+	guint i;
+
+	for (i = 0; i < self->search_queries->len; i++)
+		stop_search_query (g_ptr_array_index (self->search_queries, i));
+	g_ptr_array_set_size (self->search_queries, 0);
+}
+
+static guint
+get_search_query_index (TotemGrilo *self,
+			GrlSource  *source)
+{
+	guint i;
+
+	for (i = 0; i < self->search_queries->len; i++) {
+		SearchQuery *query = g_ptr_array_index (self->search_queries, i);
+		if (query->source == source)
+			break;
+	}
+	return i;
+}
+
+/* The first page of each source is grouped with the others in the
+ * order of the queries, so the best sources come first even if they're
+ * slower, which moves down the rows of the other sources shown until
+ * then. The later pages are fetched once all the sources are done with
+ * the previous ones, and get appended, so that scrolling doesn't
+ * move rows around. */
+static int
+get_search_position (TotemGrilo  *self,
+		     SearchQuery *query)
+{
+	guint i;
+	int position = 0;
+
+	if (query->skip > 0)
+		return -1;
+
+	/* Just after the rows of this source and those before it */
+	for (i = 0; i < self->search_queries->len; i++) {
+		SearchQuery *other = g_ptr_array_index (self->search_queries, i);
+
+		position += other->n_first_page;
+		if (other == query)
+			break;
+	}
+
+	return position;
+}
+
+/* Keeps the counts used by get_search_position() in sync when rows
+ * are removed while results arrive. The first pages are at the top,
+ * in the order of the queries, so the row's position tells which
+ * query it came from. */
+static void
+search_results_row_deleted_cb (GtkTreeModel *model,
+			       GtkTreePath  *path,
+			       TotemGrilo   *self)
+{
+	guint i;
+	int index, end = 0;
+
+	if (gtk_tree_path_get_depth (path) != 1)
+		return;
+
+	index = gtk_tree_path_get_indices (path)[0];
+	for (i = 0; i < self->search_queries->len; i++) {
+		SearchQuery *query = g_ptr_array_index (self->search_queries, i);
+
+		end += query->n_first_page;
+		if (index < end) {
+			query->n_first_page--;
+			break;
+		}
+	}
+}
+
+static void
+report_search_progress (TotemGrilo *self)
+{
+	gint64 elapsed;
+
+	elapsed = (g_get_monotonic_time () - self->search_start_time) / 1000;
+
+	if (!self->search_reported_first &&
+	    gtk_tree_model_iter_n_children (self->search_results_model, NULL) > 0) {
+		g_debug ("Search for '%s': first result after %" G_GINT64_FORMAT " ms",
+			 self->search_text, elapsed);
+		self->search_reported_first = TRUE;
+	}
+
+	if (!self->search_reported_page &&
+	    (gtk_tree_model_iter_n_children (self->search_results_model, NULL) >= PAGE_SIZE ||
+	     (!search_is_running (self) && search_is_exhausted (self)))) {
+		g_debug ("Search for '%s': first page after %" G_GINT64_FORMAT " ms",
+			 self->search_text, elapsed);
+		self->search_reported_page = TRUE;
+	}
+}
+
+/* Sizes the next page after the rate at which the source returned this
+ * one, halfway between the two to smooth out the odd slow reply. The
+ * size is kept on the source for the next searches. */
+static void
+update_search_page_size (SearchQuery *query)
+{
+	gint64 elapsed;
+	guint page_size;
+
+	elapsed = g_get_monotonic_time () - query->start_time;
+	if (query->received < query->page_size)
+		query->exhausted = TRUE;
+	query->skip += query->received;
+
+	if (!query->exhausted && elapsed > 0) {
+		page_size = MIN (query->received * SEARCH_PAGE_TIME / elapsed, MAX_SEARCH_PAGE_SIZE);
+		query->page_size = CLAMP ((query->page_size + page_size) / 2,
+					  MIN_SEARCH_PAGE_SIZE, MAX_SEARCH_PAGE_SIZE);
+		g_object_set_data (G_OBJECT (query->source), "totem-search-page-size",
+				   GUINT_TO_POINTER (query->page_size));
+	}
+
+	g_debug ("Search on '%s': %u results in %" G_GINT64_FORMAT " ms%s, next page size %u",
+		 grl_source_get_id (query->source), query->received, elapsed / 1000,
+		 query->exhausted ? " (done)" : "", query->page_size);
+}
+
 static void
 search_cb (GrlSource    *source,
            guint         search_id,
@@ -804,17 +1229,33 @@ search_cb (GrlSource    *source,
 {
 	GtkWindow *window;
 	TotemGrilo *self;
+	SearchQuery *query;
 
-	self = TOTEM_GRILO (user_data);
+	query = user_data;
+	self = query->totem_grilo;
+
+	/* Not in self->search_queries any more */
+	if (query->cancelled) {
+		g_clear_object (&media);
+		if (remaining == 0) {
+			g_application_unmark_busy (g_application_get_default ());
+			search_query_free (query);
+		}
+		return;
+	}
 
 	if (error != NULL) {
 		if (g_error_matches (error,
 	                             GRL_CORE_ERROR,
 	                             GRL_CORE_ERROR_OPERATION_CANCELLED)) {
 			g_application_unmark_busy (g_application_get_default ());
-			/* Don't zero out self->search_id to avoid a race
-			 * condition with next search. Don't update thumbnails. */
+			query->running = FALSE;
+			query->exhausted = TRUE;
 			return;
+		} else if (self->search_queries->len > 1) {
+			/* Don't interrupt the results of the other sources */
+			g_message ("Search on '%s' failed: %s",
+				   grl_source_get_id (source), error->message);
 		} else {
 			window = totem_object_get_main_window (self->totem);
 			totem_interface_error (_("Search Error"), error->message, window);
@@ -822,13 +1263,16 @@ search_cb (GrlSource    *source,
 	}
 
 	if (media != NULL) {
-		self->search_remaining--;
+		query->received++;
 
 		if (!grl_media_is_image (media) &&
 		    !grl_media_is_audio (media)) {
 			add_local_metadata (self, source, media);
 			add_media_to_model (GTK_TREE_STORE (self->search_results_model),
-					    NULL, source, media);
+					    NULL, get_search_position (self, query),
+					    source, media);
+			if (query->skip == 0)
+				query->n_first_page++;
 		} else {
 			g_debug ("Ignoring %s search result at %s",
 				 grl_media_get_media_type (media) == GRL_MEDIA_TYPE_IMAGE ? "image" : "audio",
@@ -840,21 +1284,25 @@ search_cb (GrlSource    *source,
 
 	if (remaining == 0) {
 		g_application_unmark_busy (g_application_get_default ());
-		self->search_id = 0;
+		query->running = FALSE;
+		query->operation_id = 0;
+		update_search_page_size (query);
 		update_search_thumbnails (self);
 	}
+
+	report_search_progress (self);
 }
 
 static GrlOperationOptions *
-get_search_options (TotemGrilo *self)
+get_search_options (SearchQuery *query)
 {
 	GrlOperationOptions *default_options;
 	GrlOperationOptions *supported_options;
 
 	default_options = grl_operation_options_new (NULL);
 	grl_operation_options_set_resolution_flags (default_options, BROWSE_FLAGS);
-	grl_operation_options_set_skip (default_options, self->search_page * PAGE_SIZE);
-	grl_operation_options_set_count (default_options, PAGE_SIZE);
+	grl_operation_options_set_skip (default_options, query->skip);
+	grl_operation_options_set_count (default_options, query->page_size);
 	grl_operation_options_set_type_filter (default_options, GRL_TYPE_FILTER_VIDEO);
 	grl_operation_options_set_key_range_filter (default_options,
 						    GRL_METADATA_KEY_DURATION, MIN_DURATION, NULL,
@@ -862,7 +1310,7 @@ get_search_options (TotemGrilo *self)
 
 	/* And now remove all the unsupported filters and options */
 	grl_operation_options_obey_caps (default_options,
-					 grl_source_get_caps (GRL_SOURCE (self->search_source), GRL_OP_SEARCH),
+					 grl_source_get_caps (query->source, GRL_OP_SEARCH),
 					 &supported_options,
 					 NULL);
 	g_object_unref (default_options);
@@ -871,43 +1319,105 @@ get_search_options (TotemGrilo *self)
 }
 
 static void
-search_more (TotemGrilo *self)
+search_query_more (TotemGrilo  *self,
+		   SearchQuery *query)
 {
 	GrlOperationOptions *search_options;
+	guint operation_id;
 
-	search_options = get_search_options (self);
+	search_options = get_search_options (query);
 
-	self->search_page++;
-	self->search_remaining = PAGE_SIZE;
+	query->received = 0;
+	query->start_time = g_get_monotonic_time ();
+	/* Set first, the source might reply before returning */
+	query->running = TRUE;
 
 	g_application_mark_busy (g_application_get_default ());
 
-	self->search_id =
-		grl_source_search (self->search_source,
-				   self->search_text,
-				   self->metadata_keys,
-				   search_options,
-				   search_cb,
-				   self);
+	operation_id = grl_source_search (query->source,
+					  self->search_text,
+					  self->metadata_keys,
+					  search_options,
+					  search_cb,
+					  query);
 	g_object_unref (search_options);
 
-	if (self->search_id == 0)
-		search_cb (self->search_source, 0, NULL, 0, self, NULL);
+	if (!query->running)
+		return;
+	query->operation_id = operation_id;
+	if (operation_id == 0)
+		search_cb (query->source, 0, NULL, 0, query, NULL);
+}
+
+/* Gets the next page from all the sources with results left, at once */
+static void
+search_more (TotemGrilo *self)
+{
+	guint i;
+
+	for (i = 0; i < self->search_queries->len; i++) {
+		SearchQuery *query = g_ptr_array_index (self->search_queries, i);
+
+		if (!query->running && !query->exhausted)
+			search_query_more (self, query);
+	}
 }
 
+static void
+add_search_query (TotemGrilo *self,
+		  GrlSource  *source)
+{
+	SearchQuery *query;
+	guint page_size;
+
+	page_size = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (source), "totem-search-page-size"));
+
+	query = g_slice_new0 (SearchQuery);
+	query->totem_grilo = self;
+	query->source = g_object_ref (source);
+	query->priority = get_source_priority (source);
+	query->page_size = page_size ? page_size : PAGE_SIZE;
+	g_ptr_array_add (self->search_queries, query);
+}
+
+static int
+compare_search_queries (gconstpointer a,
+			gconstpointer b)
+{
+	const SearchQuery *query_a = *(SearchQuery **) a;
+	const SearchQuery *query_b = *(SearchQuery **) b;
+
+	return query_b->priority - query_a->priority;
+}
+
+/* Searches all the searchable sources if @source is %NULL */
 static void
 search (TotemGrilo  *self,
 	GrlSource   *source,
 	const gchar *text)
 {
-	g_clear_handle_id (&self->search_id, grl_operation_cancel);
+	stop_search (self);
 
-	gtk_tree_store_clear (GTK_TREE_STORE (self->search_results_model));
+	clear_model (self->search_results_model);
 //	g_hash_table_remove_all (self->cache_thumbnails);
-	self->search_source = source;
 	g_free (self->search_text);
 	self->search_text = g_strdup (text);
-	self->search_page = 0;
+	self->search_start_time = g_get_monotonic_time ();
+	self->search_reported_first = FALSE;
+	self->search_reported_page = FALSE;
+
+	if (source != NULL) {
+		add_search_query (self, source);
+	} else {
+		GHashTableIter iter;
+		gpointer value;
+
+		g_hash_table_iter_init (&iter, self->search_sources_ht);
+		while (g_hash_table_iter_next (&iter, NULL, &value))
+			add_search_query (self, GRL_SOURCE (value));
+		g_ptr_array_sort (self->search_queries, compare_search_queries);
+	}
+
 	gd_main_view_set_model (GD_MAIN_VIEW (self->browser),
 				self->search_results_model);
 	self->browser_filter_model = NULL;
@@ -927,9 +1437,13 @@ search_entry_activate_cb (GtkEntry   *entry,
 
 	id = totem_search_entry_get_selected_id (TOTEM_SEARCH_ENTRY (self->search_entry));
 	g_return_if_fail (id != NULL);
-	registry = grl_registry_get_default ();
-	source = grl_registry_lookup_source (registry, id);
-	g_return_if_fail (source != NULL);
+	if (g_strcmp0 (id, SEARCH_ALL_SOURCES_ID) == 0) {
+		source = NULL;
+	} else {
+		registry = grl_registry_get_default ();
+		source = grl_registry_lookup_source (registry, id);
+		g_return_if_fail (source != NULL);
+	}
 
 	text = totem_search_entry_get_text (TOTEM_SEARCH_ENTRY (self->search_entry));
 	g_return_if_fail (text != NULL);
@@ -1032,11 +1546,8 @@ search_entry_source_changed_cb (GObject    *object,
                                 TotemGrilo *self)
 {
 	/* FIXME: Do we actually want to do that? */
-	if (self->search_id > 0) {
-		grl_operation_cancel (self->search_id);
-		self->search_id = 0;
-	}
-	gtk_tree_store_clear (GTK_TREE_STORE (self->search_results_model));
+	stop_search (self);
+	clear_model (self->search_results_model);
 }
 
 static void
@@ -1112,19 +1623,9 @@ find_media_cb (GtkTreeModel  *model,
 static gboolean
 find_media (GtkTreeModel  *model,
 	    GrlMedia      *media,
-	    GtkTreeIter  **iter)
+	    GtkTreeIter   *iter)
 {
-	FindMediaData data;
-
-	data.found = FALSE;
-	data.key = GRL_METADATA_KEY_ID;
-	data.media = media;
-	data.iter = NULL;
-	gtk_tree_model_foreach (model, (GtkTreeModelForeachFunc) find_media_cb, &data);
-
-	*iter = data.iter;
-
-	return data.found;
+	return media_index_lookup (model, grl_media_get_id (media), iter);
 }
 
 static GtkTreeModel *
@@ -1149,7 +1650,7 @@ content_changed (TotemGrilo   *self,
 
 	for (i = 0; i < changed_medias->len; i++) {
 		GrlMedia *media = changed_medias->pdata[i];
-		GtkTreeIter *iter;
+		GtkTreeIter iter;
 		g_autofree char *str;
 
 		str = grl_media_serialize (media);
@@ -1162,8 +1663,7 @@ content_changed (TotemGrilo   *self,
 		g_debug ("About to change %s in the store", str);
 
 		if (find_media (model, media, &iter)) {
-			update_media (GTK_TREE_STORE (model), iter, source, media);
-			gtk_tree_iter_free (iter);
+			update_media (GTK_TREE_STORE (model), &iter, source, media);
 		} else {
 			g_debug ("Could not find '%s' to change in the store",
 				 grl_media_get_id (media));
@@ -1183,15 +1683,14 @@ content_removed (TotemGrilo   *self,
 
 	for (i = 0; i < changed_medias->len; i++) {
 		GrlMedia *media = changed_medias->pdata[i];
-		GtkTreeIter *iter;
+		GtkTreeIter iter;
 		g_autofree char *str;
 
 		str = grl_media_serialize (media);
 		g_debug ("About to remove %s from the store", str);
 
 		if (find_media (model, media, &iter)) {
-			gtk_tree_store_remove (GTK_TREE_STORE (model), iter);
-			gtk_tree_iter_free (iter);
+			remove_row (model, &iter);
 		} else {
 			g_debug ("Could not find '%s' to remove in the store",
 				 grl_media_get_id (media));
@@ -1225,7 +1724,7 @@ content_added (TotemGrilo   *self,
 		g_debug ("About to add %s to the store", str);
 
 		add_local_metadata (self, source, media);
-		add_media_to_model (GTK_TREE_STORE (model), NULL, source, media);
+		add_media_to_model (GTK_TREE_STORE (model), NULL, -1, source, media);
 	}
 }
 
@@ -1345,6 +1844,17 @@ source_added_cb (GrlRegistry *registry,
 					       grl_source_get_id (source),
 					       name,
 					       get_source_priority (source));
+		g_hash_table_insert (self->search_sources_ht,
+				     g_strdup (grl_source_get_id (source)),
+				     g_object_ref (source));
+
+		/* Above every single source, but not selected by default */
+		if (g_hash_table_size (self->search_sources_ht) == 2) {
+			totem_search_entry_add_source (TOTEM_SEARCH_ENTRY (self->search_entry),
+						       SEARCH_ALL_SOURCES_ID,
+						       _("All Sources"),
+						       200);
+		}
 	}
 }
 
@@ -1365,7 +1875,7 @@ remove_browse_result (GtkTreeModel *model,
 	same_source = (model_source == removed_source);
 
 	if (same_source)
-		gtk_tree_store_remove (GTK_TREE_STORE (model), iter);
+		remove_row (model, iter);
 
 	g_object_unref (model_source);
 
@@ -1409,18 +1919,43 @@ source_removed_cb (GrlRegistry *registry,
 		                        source);
 	}
 
-	/* If current search results belongs to removed source, clear the results. In
-	   any case, remove the source from the list of searchable sources */
+	/* If the current search includes the removed source, stop searching it,
+	   and remove its results, leaving those of the other sources. In any
+	   case, remove the source from the list of searchable sources */
 	if (ops & GRL_OP_SEARCH) {
 		const char *id;
+		guint i;
+
+		i = get_search_query_index (self, source);
+		if (i < self->search_queries->len) {
+			GtkTreeIter iter;
+			gboolean valid;
 
-		if (self->search_source == source) {
-			gtk_tree_store_clear (GTK_TREE_STORE (self->search_results_model));
-			self->search_source = NULL;
+			valid = gtk_tree_model_get_iter_first (self->search_results_model, &iter);
+			while (valid) {
+				GrlSource *model_source;
+
+				gtk_tree_model_get (self->search_results_model, &iter,
+						    MODEL_RESULTS_SOURCE, &model_source,
+						    -1);
+				if (model_source == source)
+					valid = remove_row (self->search_results_model, &iter);
+				else
+					valid = gtk_tree_model_iter_next (self->search_results_model, &iter);
+				g_clear_object (&model_source);
+			}
+
+			stop_search_query (g_ptr_array_remove_index (self->search_queries, i));
 		}
 
 		id = grl_source_get_id (source);
 		totem_search_entry_remove_source (TOTEM_SEARCH_ENTRY (self->search_entry), id);
+
+		if (g_hash_table_remove (self->search_sources_ht, id) &&
+		    g_hash_table_size (self->search_sources_ht) == 1) {
+			totem_search_entry_remove_source (TOTEM_SEARCH_ENTRY (self->search_entry),
+							  SEARCH_ALL_SOURCES_ID);
+		}
 	}
 }
 
@@ -1592,6 +2127,14 @@ static void
 adjustment_value_changed_cb (GtkAdjustment *adjustment,
                              TotemGrilo    *self)
 {
+	gdouble value;
+
+	/* To prefetch thumbnails in the right direction */
+	value = gtk_adjustment_get_value (adjustment);
+	if (value != self->last_scroll_value)
+		self->scrolling_up = (value < self->last_scroll_value);
+	self->last_scroll_value = value;
+
 	update_search_thumbnails (self);
 
 	if (self->in_search == FALSE) {
@@ -1600,11 +2143,11 @@ adjustment_value_changed_cb (GtkAdjustment *adjustment,
 	}
 
 	/* Do not get more results if search is in progress */
-	if (self->search_id != 0)
+	if (search_is_running (self))
 		return;
 
 	/* Do not get more results if there are no more results to get :) */
-	if (self->search_remaining > 0)
+	if (search_is_exhausted (self))
 		return;
 
 	if (adjustment_over_limit (adjustment))
@@ -1637,7 +2180,7 @@ totem_grilo_back_button_clicked (TotemGrilo *self)
 		GtkTreeIter child;
 
 		if (gtk_tree_model_iter_children (self->browser_model, &child, &iter)) {
-			while (gtk_tree_store_remove (GTK_TREE_STORE (self->browser_model), &child))
+			while (remove_row (self->browser_model, &child))
 				;
 		}
 
@@ -2188,7 +2731,7 @@ delete_foreach (gpointer data,
 		g_assert_not_reached ();
 	}
 
-	gtk_tree_store_remove (GTK_TREE_STORE (model), &real_model_iter);
+	remove_row (model, &real_model_iter);
 
 end:
 	g_clear_object (&media);
@@ -2472,6 +3015,9 @@ setup_ui (TotemGrilo *self)
 	totem_grilo_setup_icons ();
 	setup_browse (self);
 
+	g_signal_connect_object (self->search_results_model, "row-deleted",
+				 G_CALLBACK (search_results_row_deleted_cb), self, 0);
+
 	/* create_debug_window (self, self->browser_model); */
 	/* create_debug_window (self, self->recent_model); */
 	/* create_debug_window (self, self->search_results_model); */
@@ -2506,13 +3052,17 @@ totem_grilo_finalize (GObject *object)
 		self->thumbnail_update_id = 0;
 	}
 
-	g_cancellable_cancel (self->thumbnail_cancellable);
-	g_clear_object (&self->thumbnail_cancellable);
+	/* Pending thumbnail requests hold a reference on us */
+	g_warn_if_fail (self->thumbnail_requests == NULL);
 
 	registry = grl_registry_get_default ();
 	g_signal_handlers_disconnect_by_func (registry, source_added_cb, self);
 	g_signal_handlers_disconnect_by_func (registry, source_removed_cb, self);
 
+	stop_search (self);
+	g_clear_pointer (&self->search_queries, g_ptr_array_unref);
+	g_clear_pointer (&self->search_sources_ht, g_hash_table_destroy);
+	g_clear_pointer (&self->search_text, g_free);
 	g_clear_pointer (&self->metadata_keys, g_list_free);
 
 	grl_deinit ();
@@ -2804,7 +3354,6 @@ totem_grilo_class_init (TotemGriloClass *klass)
 static void
 totem_grilo_init (TotemGrilo *self)
 {
-	self->thumbnail_cancellable = g_cancellable_new ();
 	self->metadata_keys = grl_metadata_key_list_new (GRL_METADATA_KEY_ARTIST,
 							 GRL_METADATA_KEY_AUTHOR,
 							 GRL_METADATA_KEY_DURATION,
@@ -2818,6 +3367,9 @@ totem_grilo_init (TotemGrilo *self)
 							 GRL_METADATA_KEY_EPISODE,
 							 GRL_METADATA_KEY_TITLE_FROM_FILENAME,
 							 NULL);
+	self->search_queries = g_ptr_array_new ();
+	self->search_sources_ht = g_hash_table_new_full (g_str_hash, g_str_equal,
+							 g_free, g_object_unref);
 
 	gtk_widget_init_template (GTK_WIDGET (self));
 }
@@ -27,6 +27,7 @@
 
 #include <string.h>
 
+#include "gst/totem-stream-cache.h"
 #include "gst/totem-gst-helpers.h"
 #include "totem.h"
 #include "totem-private.h"
@@ -77,6 +78,7 @@ static void totem_object_set_mrl_and_play (TotemObject *totem, const char *mrl,
 static void mark_popup_busy (TotemObject *totem, const char *reason);
 static void unmark_popup_busy (TotemObject *totem, const char *reason);
 static void video_widget_create (TotemObject *totem);
+static void seek_preview_setup (TotemObject *totem);
 static void grilo_widget_setup (TotemObject *totem);
 static void playlist_widget_setup (TotemObject *totem);
 static void totem_callback_connect (TotemObject *totem);
@@ -105,6 +107,8 @@ G_MODULE_EXPORT void popup_menu_shown_cb                (GtkToggleButton *button
 G_MODULE_EXPORT gboolean seek_slider_pressed_cb         (GtkWidget *widget, GdkEventButton *event, TotemObject *totem);
 G_MODULE_EXPORT gboolean seek_slider_released_cb        (GtkWidget *widget, GdkEventButton *event, TotemObject *totem);
 G_MODULE_EXPORT gboolean seek_slider_scroll_event_cb    (GtkWidget *widget, GdkEventScroll *event, gpointer data);
+G_MODULE_EXPORT gboolean seek_slider_motion_notify_cb   (GtkWidget *widget, GdkEventMotion *event, TotemObject *totem);
+G_MODULE_EXPORT gboolean seek_slider_leave_notify_cb    (GtkWidget *widget, GdkEventCrossing *event, TotemObject *totem);
 
 /* Volume */
 G_MODULE_EXPORT void     volume_button_value_changed_cb (GtkScaleButton *button, gdouble value, TotemObject *totem);
@@ -126,6 +130,11 @@ G_MODULE_EXPORT void     on_buffering_event             (BaconVideoWidget *bvw,
 G_MODULE_EXPORT void     on_download_buffering_event    (BaconVideoWidget *bvw, gdouble level, TotemObject *totem);
 G_MODULE_EXPORT void     on_error_event                 (BaconVideoWidget *bvw, char *message, gboolean playback_stopped, TotemObject *totem);
 G_MODULE_EXPORT void     play_starting_cb               (BaconVideoWidget *bvw, TotemObject *totem);
+G_MODULE_EXPORT void     on_stream_switched_event       (BaconVideoWidget *bvw,
+                                                         const char       *mrl,
+                                                         gint64            latency,
+                                                         gboolean          gapless,
+                                                         TotemObject      *totem);
 G_MODULE_EXPORT gboolean on_bvw_motion_notify_cb        (BaconVideoWidget *bvw, GdkEventMotion *event, TotemObject *totem);
 G_MODULE_EXPORT void     drop_video_cb                  (GtkWidget          *widget,
                                                          GdkDragContext     *context,
@@ -224,6 +233,43 @@ totem_object_app_open (GApplication  *application,
 	g_slist_free_full (slist, g_free);
 }
 
+/* Not in totem.ui, as the playback engine can only be picked when
+ * the widget is created */
+static BaconVideoWidget *
+video_widget_new (TotemObject *totem)
+{
+	GtkWidget *bvw;
+
+	bvw = g_object_new (BACON_TYPE_VIDEO_WIDGET,
+			    "use-playbin3", g_settings_get_boolean (totem->settings, "use-playbin3"),
+			    "visible", TRUE,
+			    "events", GDK_KEY_PRESS_MASK | GDK_KEY_RELEASE_MASK,
+			    NULL);
+
+	g_signal_connect (bvw, "notify::volume", G_CALLBACK (property_notify_cb_volume), totem);
+	g_signal_connect (bvw, "notify::seekable", G_CALLBACK (property_notify_cb_seekable), totem);
+	g_signal_connect_swapped (bvw, "subtitles-changed", G_CALLBACK (totem_subtitles_menu_update), totem);
+	g_signal_connect_swapped (bvw, "languages-changed", G_CALLBACK (totem_languages_menu_update), totem);
+	g_signal_connect_after (bvw, "button-press-event", G_CALLBACK (on_video_button_press_event), totem);
+	g_signal_connect (bvw, "download-buffering", G_CALLBACK (on_download_buffering_event), totem);
+	g_signal_connect (bvw, "motion-notify-event", G_CALLBACK (on_bvw_motion_notify_cb), totem);
+	g_signal_connect (bvw, "key-release-event", G_CALLBACK (window_key_press_event_cb), totem);
+	g_signal_connect (bvw, "key-press-event", G_CALLBACK (window_key_press_event_cb), totem);
+	g_signal_connect (bvw, "scroll-event", G_CALLBACK (seek_slider_scroll_event_cb), totem);
+	g_signal_connect (bvw, "channels-change", G_CALLBACK (on_channels_change_event), totem);
+	g_signal_connect (bvw, "got-metadata", G_CALLBACK (on_got_metadata_event), totem);
+	g_signal_connect (bvw, "drag-data-received", G_CALLBACK (drop_video_cb), totem);
+	g_signal_connect (bvw, "play-starting", G_CALLBACK (play_starting_cb), totem);
+	g_signal_connect (bvw, "got-redirect", G_CALLBACK (on_got_redirect), totem);
+	g_signal_connect (bvw, "buffering", G_CALLBACK (on_buffering_event), totem);
+	g_signal_connect (bvw, "tick", G_CALLBACK (update_current_time), totem);
+	g_signal_connect (bvw, "error", G_CALLBACK (on_error_event), totem);
+	g_signal_connect (bvw, "eos", G_CALLBACK (on_eos_event), totem);
+	g_signal_connect (bvw, "stream-switched", G_CALLBACK (on_stream_switched_event), totem);
+
+	return BACON_VIDEO_WIDGET (bvw);
+}
+
 static void
 totem_object_app_activate (GApplication *app)
 {
@@ -242,7 +288,9 @@ totem_object_app_activate (GApplication *app)
 	/* Main window */
 	totem->xml = gtk_builder_new_from_resource ("/org/gnome/totem/ui/totem.ui");
 	gtk_builder_connect_signals (totem->xml, totem);
-	totem->bvw = BACON_VIDEO_WIDGET (gtk_builder_get_object (totem->xml, "bvw"));
+	totem->bvw = video_widget_new (totem);
+	gtk_container_add (GTK_CONTAINER (gtk_builder_get_object (totem->xml, "bvw_overlay")),
+			   GTK_WIDGET (totem->bvw));
 	totem->win = GTK_WIDGET (gtk_builder_get_object (totem->xml, "totem_main_window"));
 #if DEVELOPMENT_VERSION
 	style_context = gtk_widget_get_style_context (GTK_WIDGET (totem->win));
@@ -281,6 +329,7 @@ totem_object_app_activate (GApplication *app)
 
 	totem->seek = GTK_WIDGET (gtk_builder_get_object (totem->xml, "seek_scale"));
 	totem->seekadj = gtk_range_get_adjustment (GTK_RANGE (totem->seek));
+	seek_preview_setup (totem);
 	totem->volume = GTK_WIDGET (gtk_builder_get_object (totem->xml, "volume_button"));
 	totem->time_label = BACON_TIME_LABEL (gtk_builder_get_object (totem->xml, "time_label"));
 	totem->time_rem_label = BACON_TIME_LABEL (gtk_builder_get_object (totem->xml, "time_rem_label"));
@@ -593,6 +642,7 @@ totem_object_finalize (GObject *object)
 	g_clear_pointer (&totem->search_string, g_free);
 	g_clear_pointer (&totem->player_title, g_free);
 	g_clear_object (&totem->custom_title);
+	g_clear_object (&totem->frame_strip);
 
 	G_OBJECT_CLASS (totem_object_parent_class)->finalize (object);
 }
@@ -1271,6 +1321,7 @@ reset_seek_status (TotemObject *totem)
 	if (totem->seek_lock != FALSE) {
 		totem->seek_lock = FALSE;
 		unmark_popup_busy (totem, "seek started");
+		bacon_video_widget_set_scrubbing (totem->bvw, FALSE);
 		bacon_video_widget_seek (totem->bvw, 0, NULL);
 		bacon_video_widget_stop (totem->bvw);
 		play_pause_set_label (totem, STATE_STOPPED);
@@ -1868,6 +1919,39 @@ unmark_popup_busy (TotemObject      *totem,
 	}
 }
 
+/* Hand the next playlist entry to the video widget, so that it
+ * can be prerolled before the current one finishes */
+static void
+update_next_mrl (TotemObject *totem)
+{
+	g_autofree char *mrl = NULL;
+	g_autofree char *subtitle = NULL;
+	g_autofree char *user_agent = NULL;
+
+	if (totem->mrl == NULL ||
+	    g_settings_get_boolean (totem->settings, "gapless-playback") == FALSE) {
+		bacon_video_widget_set_next_mrl (totem->bvw, NULL, NULL);
+		return;
+	}
+
+	mrl = totem_playlist_get_next_mrl (totem->playlist, &subtitle);
+
+	/* Special MRLs need mounting or menus, and custom user-agents
+	 * need a new source, so those go through a full open */
+	if (mrl != NULL && totem_is_special_mrl (mrl))
+		g_clear_pointer (&mrl, g_free);
+	if (mrl != NULL) {
+		g_signal_emit (G_OBJECT (totem), totem_table_signals[GET_USER_AGENT], 0, mrl, &user_agent);
+		if (user_agent != NULL)
+			g_clear_pointer (&mrl, g_free);
+	}
+
+	if (mrl != NULL && subtitle == NULL)
+		g_signal_emit (G_OBJECT (totem), totem_table_signals[GET_TEXT_SUBTITLE], 0, mrl, &subtitle);
+
+	bacon_video_widget_set_next_mrl (totem->bvw, mrl, subtitle);
+}
+
 /**
  * totem_object_set_mrl:
  * @totem: a #TotemObject
@@ -1965,6 +2049,9 @@ totem_object_set_mrl (TotemObject *totem,
 		totem_object_set_main_page (totem, "player");
 	}
 
+	update_next_mrl (totem);
+	bacon_frame_strip_set_uri (totem->frame_strip, totem->mrl);
+
 	g_object_notify (G_OBJECT (totem), "current-mrl");
 
 	update_buttons (totem);
@@ -2538,6 +2625,40 @@ play_starting_cb (BaconVideoWidget *bvw,
 	unmark_popup_busy (totem, "opening file");
 }
 
+void
+on_stream_switched_event (BaconVideoWidget *bvw,
+			  const char       *mrl,
+			  gint64            latency,
+			  gboolean          gapless,
+			  TotemObject      *totem)
+{
+	g_debug ("Switched to '%s' in %" G_GINT64_FORMAT " µs%s",
+		 mrl, latency, gapless ? " (gapless)" : "");
+
+	/* Full opens went through totem_object_set_mrl() already */
+	if (gapless == FALSE)
+		return;
+
+	reset_seek_status (totem);
+	emit_file_closed (totem);
+
+	totem_playlist_set_next (totem->playlist);
+	g_free (totem->mrl);
+	totem->mrl = totem_playlist_get_current_mrl (totem->playlist, NULL);
+	totem_playlist_set_playing (totem->playlist, TOTEM_PLAYLIST_STATUS_PLAYING);
+
+	emit_file_opened (totem, totem->mrl);
+	totem_file_has_played (totem, totem->mrl);
+	totem->has_played_emitted = TRUE;
+	bacon_frame_strip_set_uri (totem->frame_strip, totem->mrl);
+
+	g_object_notify (G_OBJECT (totem), "current-mrl");
+
+	update_buttons (totem);
+	update_media_menu_items (totem);
+	update_next_mrl (totem);
+}
+
 gboolean
 on_bvw_motion_notify_cb (BaconVideoWidget *bvw,
 			 GdkEventMotion   *event,
@@ -2704,6 +2825,64 @@ property_notify_cb_seekable (BaconVideoWidget *bvw, GParamSpec *spec, TotemObjec
 	update_seekable (totem);
 }
 
+static void
+seek_preview_setup (TotemObject *totem)
+{
+	totem->frame_strip = bacon_frame_strip_new ();
+
+	totem->seek_preview_image = gtk_image_new ();
+	gtk_widget_show (totem->seek_preview_image);
+
+	/* Not modal, so that it doesn't grab the pointer from the seek bar */
+	totem->seek_preview = gtk_popover_new (totem->seek);
+	gtk_popover_set_modal (GTK_POPOVER (totem->seek_preview), FALSE);
+	gtk_popover_set_position (GTK_POPOVER (totem->seek_preview), GTK_POS_TOP);
+	gtk_widget_set_can_focus (totem->seek_preview, FALSE);
+	gtk_container_add (GTK_CONTAINER (totem->seek_preview), totem->seek_preview_image);
+}
+
+gboolean
+seek_slider_motion_notify_cb (GtkWidget *widget, GdkEventMotion *event, TotemObject *totem)
+{
+	g_autoptr(GdkPixbuf) frame = NULL;
+	GdkRectangle rect;
+	gint64 length;
+	double pos;
+
+	length = bacon_video_widget_get_stream_length (totem->bvw);
+	gtk_range_get_range_rect (GTK_RANGE (widget), &rect);
+	if (length <= 0 || rect.width <= 0) {
+		gtk_widget_hide (totem->seek_preview);
+		return GDK_EVENT_PROPAGATE;
+	}
+
+	/* Only cached frames are used, this never waits for the decoder */
+	pos = CLAMP ((event->x - rect.x) / rect.width, 0.0, 1.0);
+	frame = bacon_frame_strip_get_frame (totem->frame_strip, pos * length);
+	if (frame == NULL) {
+		gtk_widget_hide (totem->seek_preview);
+		return GDK_EVENT_PROPAGATE;
+	}
+
+	gtk_image_set_from_pixbuf (GTK_IMAGE (totem->seek_preview_image), frame);
+	rect.x = event->x;
+	rect.width = 1;
+	gtk_popover_set_pointing_to (GTK_POPOVER (totem->seek_preview), &rect);
+	gtk_widget_show (totem->seek_preview);
+
+	return GDK_EVENT_PROPAGATE;
+}
+
+gboolean
+seek_slider_leave_notify_cb (GtkWidget *widget, GdkEventCrossing *event, TotemObject *totem)
+{
+	/* Keep showing the preview while dragging outside the seek bar */
+	if (totem->seek_lock == FALSE)
+		gtk_widget_hide (totem->seek_preview);
+
+	return GDK_EVENT_PROPAGATE;
+}
+
 gboolean
 seek_slider_pressed_cb (GtkWidget *widget, GdkEventButton *event, TotemObject *totem)
 {
@@ -2720,6 +2899,7 @@ seek_slider_pressed_cb (GtkWidget *widget, GdkEventButton *event, TotemObject *t
 
 	totem->seek_lock = TRUE;
 	mark_popup_busy (totem, "seek started");
+	bacon_video_widget_set_scrubbing (totem->bvw, TRUE);
 
 	return FALSE;
 }
@@ -2758,6 +2938,10 @@ seek_slider_released_cb (GtkWidget *widget, GdkEventButton *event, TotemObject *
 	 * syncing the adjustments while being in direct seek mode */
 	totem->seek_lock = FALSE;
 	unmark_popup_busy (totem, "seek started");
+	gtk_widget_hide (totem->seek_preview);
+
+	/* Does the final accurate seek, if we were direct seeking */
+	bacon_video_widget_set_scrubbing (totem->bvw, FALSE);
 
 	/* sync both adjustments */
 	adj = gtk_range_get_adjustment (GTK_RANGE (widget));
@@ -3104,6 +3288,9 @@ playlist_changed_cb (GtkWidget *playlist, TotemObject *totem)
 	if (mrl == NULL)
 		return;
 
+	/* The entry after the current one might have changed */
+	update_next_mrl (totem);
+
 	if (totem_playlist_get_playing (totem->playlist) == TOTEM_PLAYLIST_STATUS_NONE) {
 		if (totem->pause_start)
 			totem_object_set_mrl (totem, mrl, subtitle);
@@ -3923,6 +4110,16 @@ grilo_widget_setup (TotemObject *totem)
 	gtk_stack_set_visible_child_name (GTK_STACK (totem->stack), "grilo");
 }
 
+static void
+update_stream_cache_size (TotemObject *totem)
+{
+	guint size;
+
+	size = g_settings_get_uint (totem->settings, "stream-cache-size");
+	totem_stream_cache_set_max_size (totem_stream_cache_get_default (),
+					 (guint64) size * 1024 * 1024);
+}
+
 void
 video_widget_create (TotemObject *totem)
 {
@@ -3933,6 +4130,13 @@ video_widget_create (TotemObject *totem)
 	else
 		totem_gst_ensure_newer_hardware_decoders ();
 
+	g_signal_connect_swapped (totem->settings, "changed::gapless-playback",
+				  G_CALLBACK (update_next_mrl), totem);
+
+	update_stream_cache_size (totem);
+	g_signal_connect_swapped (totem->settings, "changed::stream-cache-size",
+				  G_CALLBACK (update_stream_cache_size), totem);
+
 	if (!bacon_video_widget_check_init (totem->bvw, &err)) {
 		totem_interface_error_blocking (_("Totem could not startup."),
 						err != NULL ? err->message : _("No reason."),
@@ -1852,6 +1852,46 @@ totem_playlist_has_next_mrl (TotemPlaylist *playlist)
 	return gtk_tree_model_iter_next (playlist->model, &iter);
 }
 
+char *
+totem_playlist_get_next_mrl (TotemPlaylist *playlist, char **subtitle)
+{
+	GtkTreeIter iter;
+	char *path;
+
+	if (subtitle != NULL)
+		*subtitle = NULL;
+
+	g_return_val_if_fail (TOTEM_IS_PLAYLIST (playlist), NULL);
+
+	if (update_current_from_playlist (playlist) == FALSE)
+		return NULL;
+
+	if (gtk_tree_model_get_iter (playlist->model, &iter,
+				     playlist->current) == FALSE)
+		return NULL;
+
+	/* Wrap around to the first entry when repeating, like
+	 * totem_playlist_set_next() does */
+	if (gtk_tree_model_iter_next (playlist->model, &iter) == FALSE) {
+		if (playlist->repeat == FALSE ||
+		    gtk_tree_model_get_iter_first (playlist->model, &iter) == FALSE)
+			return NULL;
+	}
+
+	if (subtitle != NULL) {
+		gtk_tree_model_get (playlist->model, &iter,
+				    URI_COL, &path,
+				    SUBTITLE_URI_COL, subtitle,
+				    -1);
+	} else {
+		gtk_tree_model_get (playlist->model, &iter,
+				    URI_COL, &path,
+				    -1);
+	}
+
+	return path;
+}
+
 gboolean
 totem_playlist_set_title (TotemPlaylist *playlist, const char *title)
 {
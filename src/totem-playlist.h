@@ -101,6 +101,8 @@ void       totem_playlist_set_current_subtitle (TotemPlaylist *playlist,
 #define    totem_playlist_has_direction(playlist, direction) (direction == TOTEM_PLAYLIST_DIRECTION_NEXT ? totem_playlist_has_next_mrl (playlist) : totem_playlist_has_previous_mrl (playlist))
 gboolean   totem_playlist_has_previous_mrl (TotemPlaylist *playlist);
 gboolean   totem_playlist_has_next_mrl (TotemPlaylist *playlist);
+char      *totem_playlist_get_next_mrl (TotemPlaylist *playlist,
+					char **subtitle);
 
 #define    totem_playlist_set_direction(playlist, direction) (direction == TOTEM_PLAYLIST_DIRECTION_NEXT ? totem_playlist_set_next (playlist) : totem_playlist_set_previous (playlist))
 void       totem_playlist_set_previous (TotemPlaylist *playlist);
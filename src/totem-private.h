@@ -13,6 +13,7 @@
 #include "totem-playlist.h"
 #include "backend/bacon-video-widget.h"
 #include "backend/bacon-time-label.h"
+#include "backend/bacon-frame-strip.h"
 #include "totem-open-location.h"
 #include "totem-plugins-engine.h"
 
@@ -59,6 +60,9 @@ struct _TotemObject {
 	GtkAdjustment *seekadj;
 	gboolean seek_lock;
 	gboolean seekable;
+	BaconFrameStrip *frame_strip;
+	GtkWidget *seek_preview;
+	GtkWidget *seek_preview_image;
 
 	/* Volume */
 	GtkWidget *volume;
@@ -10,8 +10,12 @@
 #include <glib.h>
 #include <glib/gstdio.h>
 
-#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -23,92 +27,785 @@
 
 #define MAX_HELPER_MEMORY (1024 * 1024 * 1024)	/* 1024 MB */
 #define MAX_HELPER_SECONDS (15)			/* 15 seconds */
-#define DEFAULT_SLEEP_TIME (30 * G_USEC_PER_SEC) /* 30 seconds */
+#define DEFAULT_SLEEP_TIME (30)			/* 30 seconds */
+#define DEFAULT_NICE_INCREMENT (20)
 
-static guint sleep_time = DEFAULT_SLEEP_TIME;
-static gboolean finished = TRUE;
+#define TIMEOUT_GRACE_TIME (5 * G_USEC_PER_SEC) /* 5 seconds */
+#define POLL_INTERVAL (G_USEC_PER_SEC)		/* 1 second */
 
-static void
-set_resource_limits (const char *input, gboolean verbose)
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+typedef enum {
+	BACKEND_AUTO,
+	BACKEND_CGROUP,
+	BACKEND_RLIMIT
+} Backend;
+
+struct _TotemResourcesMonitor {
+	gint                       ref_count;
+	char                      *input;
+	guint64                    memory;
+	gint64                     sleep_time;
+	gint64                     start_time;
+	gint64                     start_cpu_time;
+	guint64                    start_memory_events;
+	guint                      cpu_limit_generation;
+	TotemResourcesLimit        limit;
+	gboolean                   finished;
+	TotemResourcesTimeoutFunc  func;
+	gpointer                   user_data;
+};
+
+/* Budgets for each file, changed with the options below */
+static int memory_budget = MAX_HELPER_MEMORY / 1024 / 1024;
+static int cpu_budget = MAX_HELPER_SECONDS;
+static int time_budget = DEFAULT_SLEEP_TIME;
+static int nice_increment = DEFAULT_NICE_INCREMENT;
+static char *backend_name = NULL;
+
+static Backend backend = BACKEND_AUTO;
+static char *cgroup_dir = NULL;
+/* The cgroup's limits before we changed them */
+static char *saved_memory_high = NULL;
+static char *saved_memory_max = NULL;
+
+/* Set from the SIGXCPU handler */
+static volatile sig_atomic_t cpu_limit_hit = 0;
+
+/* Protects all the monitors, and the totals below */
+static GMutex monitor_lock;
+static GCond monitor_cond;
+static guint n_active = 0;
+static guint64 active_memory = 0;
+/* Bumped every time the CPU time limit is hit */
+static guint cpu_limit_generation = 0;
+
+static TotemResourcesMonitor *default_monitor = NULL;
+
+static const char *limit_names[] = {
+	"none",
+	"time",
+	"cpu",
+	"memory"
+};
+
+static const char *backend_names[] = {
+	"none",
+	"cgroup",
+	"rlimit"
+};
+
+/* Set the maximum virtual size depending on the size
+ * of the file to process, as we wouldn't be able to
+ * mmap it otherwise */
+static guint64
+get_memory_limit (const char *input)
 {
-#ifdef G_OS_UNIX
-	struct rlimit limit;
 	struct stat buf;
-	rlim_t max;
+	guint64 max;
 
-	max = MAX_HELPER_MEMORY;
+	max = (guint64) memory_budget * 1024 * 1024;
+	if (max == 0)
+		return 0;
 
-	/* Set the maximum virtual size depending on the size
-	 * of the file to process, as we wouldn't be able to
-	 * mmap it otherwise */
 	if (input == NULL) {
-		max = MAX_HELPER_MEMORY;
+		/* Nothing to add */
 	} else if (g_stat (input, &buf) == 0) {
-		max = MAX_HELPER_MEMORY + buf.st_size;
+		max += buf.st_size;
 	} else if (g_str_has_prefix (input, "file://") != FALSE) {
 		char *file;
 		file = g_filename_from_uri (input, NULL, NULL);
 		if (file != NULL && g_stat (file, &buf) == 0)
-			max = MAX_HELPER_MEMORY + buf.st_size;
+			max += buf.st_size;
 		g_free (file);
 	}
 
-	limit.rlim_cur = max;
-	limit.rlim_max = max;
+	return max;
+}
+
+static char *
+read_cgroup_file (const char *dir,
+		  const char *name)
+{
+	g_autofree char *path = NULL;
+	char *contents;
+
+	path = g_build_filename (dir, name, NULL);
+	if (g_file_get_contents (path, &contents, NULL, NULL) == FALSE)
+		return NULL;
+	return contents;
+}
+
+/* Reads a single number from a cgroup file, or a "key value" pair
+ * from a flat-keyed one such as memory.events when @key is set */
+static gboolean
+read_cgroup_value (const char *name,
+		   const char *key,
+		   guint64    *value)
+{
+	g_autofree char *contents = NULL;
+	g_auto(GStrv) lines = NULL;
+	guint i;
+
+	if (cgroup_dir == NULL)
+		return FALSE;
+
+	contents = read_cgroup_file (cgroup_dir, name);
+	if (contents == NULL)
+		return FALSE;
+
+	if (key == NULL)
+		return g_ascii_string_to_unsigned (g_strstrip (contents), 10, 0, G_MAXUINT64, value, NULL);
+
+	lines = g_strsplit (contents, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		const char *line = lines[i];
+
+		if (g_str_has_prefix (line, key) && line[strlen (key)] == ' ')
+			return g_ascii_string_to_unsigned (line + strlen (key) + 1, 10, 0, G_MAXUINT64, value, NULL);
+	}
+
+	return FALSE;
+}
+
+static gboolean
+write_cgroup_string (const char *name,
+		     const char *value)
+{
+	g_autofree char *path = NULL;
+	FILE *file;
+	gboolean ret;
+
+	path = g_build_filename (cgroup_dir, name, NULL);
+	file = g_fopen (path, "we");
+	if (file == NULL)
+		return FALSE;
+
+	ret = (fputs (value, file) >= 0);
+	return (fclose (file) == 0 && ret);
+}
+
+static gboolean
+write_cgroup_value (const char *name,
+		    guint64     value)
+{
+	g_autofree char *str = NULL;
+
+	if (value == 0)
+		return write_cgroup_string (name, "max\n");
+
+	str = g_strdup_printf ("%" G_GUINT64_FORMAT "\n", value);
+	return write_cgroup_string (name, str);
+}
+
+/* Whether cgroup.procs in @dir lists no other process than us */
+static gboolean
+cgroup_has_only_us (const char *dir)
+{
+	g_autofree char *contents = NULL;
+	g_auto(GStrv) pids = NULL;
+	guint64 pid;
+	guint i;
+
+	contents = read_cgroup_file (dir, "cgroup.procs");
+	if (contents == NULL)
+		return FALSE;
+
+	pids = g_strsplit (g_strstrip (contents), "\n", -1);
+	for (i = 0; pids[i] != NULL; i++) {
+		if (!g_ascii_string_to_unsigned (pids[i], 10, 1, G_MAXUINT64, &pid, NULL) ||
+		    pid != (guint64) getpid ())
+			return FALSE;
+	}
+
+	return (i == 1);
+}
+
+/* The memory controller can only be used if we're the only ones in
+ * our cgroup v2, and it was delegated to us, as for systemd scopes
+ * and services started with Delegate=yes. Otherwise, the limits would
+ * apply to the processes we share it with, such as the shell or the
+ * application that started us. */
+static char *
+find_cgroup (void)
+{
+	g_autofree char *contents = NULL;
+	g_autofree char *dir = NULL;
+	g_autofree char *memory_max = NULL;
+	g_autofree char *memory_high = NULL;
+	char *path, *end;
+
+	if (g_file_get_contents ("/proc/self/cgroup", &contents, NULL, NULL) == FALSE)
+		return NULL;
+
+	/* The unified hierarchy is the only line with an ID of 0 */
+	if (g_str_has_prefix (contents, "0::"))
+		path = contents + strlen ("0::");
+	else if ((path = strstr (contents, "\n0::")) != NULL)
+		path += strlen ("\n0::");
+	else
+		return NULL;
+
+	end = strchr (path, '\n');
+	if (end != NULL)
+		*end = '\0';
+
+	dir = g_build_filename (CGROUP_ROOT, path, NULL);
+	memory_max = g_build_filename (dir, "memory.max", NULL);
+	memory_high = g_build_filename (dir, "memory.high", NULL);
+	if (g_access (memory_max, W_OK) < 0 || g_access (memory_high, W_OK) < 0)
+		return NULL;
+
+	if (!cgroup_has_only_us (dir))
+		return NULL;
+
+	return g_steal_pointer (&dir);
+}
+
+/* Puts the cgroup's limits back the way we found them, as the cgroup
+ * might be reused once we're gone */
+static void
+restore_cgroup_limits (void)
+{
+	if (saved_memory_high == NULL || saved_memory_max == NULL)
+		return;
+
+	write_cgroup_string ("memory.high", saved_memory_high);
+	write_cgroup_string ("memory.max", saved_memory_max);
+}
+
+static gboolean
+save_cgroup_limits (void)
+{
+	saved_memory_high = read_cgroup_file (cgroup_dir, "memory.high");
+	saved_memory_max = read_cgroup_file (cgroup_dir, "memory.max");
+	if (saved_memory_high == NULL || saved_memory_max == NULL) {
+		g_clear_pointer (&saved_memory_high, g_free);
+		g_clear_pointer (&saved_memory_max, g_free);
+		return FALSE;
+	}
+
+	/* Also covers the monitor giving up on the whole process */
+	atexit (restore_cgroup_limits);
+	return TRUE;
+}
+
+#ifdef G_OS_UNIX
+static void
+sigxcpu_handler (int signum)
+{
+	cpu_limit_hit = 1;
+}
+
+/* The CPU time limit is cumulative for the whole process, so when
+ * processing more than one file per process, each file gets its
+ * budget on top of what was already used */
+static gint64
+get_cpu_time_used (void)
+{
+	struct rusage usage;
+
+	if (getrusage (RUSAGE_SELF, &usage) < 0)
+		return 0;
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC +
+		usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/* Only the soft limit is changed so that it can be raised again
+ * for the next file */
+static void
+set_soft_limit (int resource, rlim_t value)
+{
+	struct rlimit limit;
+
+	if (getrlimit (resource, &limit) < 0)
+		return;
+	if (limit.rlim_max != RLIM_INFINITY && value > limit.rlim_max)
+		value = limit.rlim_max;
+	limit.rlim_cur = value;
+	setrlimit (resource, &limit);
+}
+#endif
+
+static guint64
+get_memory_used (void)
+{
+	g_autofree char *contents = NULL;
+	guint64 value;
+
+	if (backend == BACKEND_CGROUP &&
+	    read_cgroup_value ("memory.current", NULL, &value))
+		return value;
+
+	/* Resident pages */
+	if (g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL)) {
+		g_auto(GStrv) fields = g_strsplit (contents, " ", 3);
+
+		if (g_strv_length (fields) >= 2 &&
+		    g_ascii_string_to_unsigned (fields[1], 10, 0, G_MAXUINT64, &value, NULL))
+			return value * sysconf (_SC_PAGESIZE);
+	}
+
+	return 0;
+}
+
+static guint64
+get_peak_memory (void)
+{
+#ifdef G_OS_UNIX
+	struct rusage usage;
+#endif
+	guint64 value;
+
+	/* Only in Linux 5.19 and newer */
+	if (backend == BACKEND_CGROUP &&
+	    read_cgroup_value ("memory.peak", NULL, &value))
+		return value;
+
+#ifdef G_OS_UNIX
+	if (getrusage (RUSAGE_SELF, &usage) == 0)
+		return (guint64) usage.ru_maxrss * 1024;
+#endif
+	return 0;
+}
+
+/* The number of times the cgroup went over its memory.high
+ * budget, and got throttled */
+static guint64
+get_memory_events (void)
+{
+	guint64 value;
+
+	if (backend == BACKEND_CGROUP &&
+	    read_cgroup_value ("memory.events", "high", &value))
+		return value;
+	return 0;
+}
+
+static void
+setup_backend (void)
+{
+	if (backend != BACKEND_RLIMIT && cgroup_dir == NULL) {
+		cgroup_dir = find_cgroup ();
+		if (cgroup_dir != NULL && !save_cgroup_limits ())
+			g_clear_pointer (&cgroup_dir, g_free);
+	}
+
+	if (cgroup_dir != NULL) {
+		backend = BACKEND_CGROUP;
+	} else {
+		if (backend == BACKEND_CGROUP)
+			g_warning ("Couldn't find a cgroup v2 of our own with a delegated memory controller, using rlimits");
+		backend = BACKEND_RLIMIT;
+	}
+
+#ifdef G_OS_UNIX
+	signal (SIGXCPU, sigxcpu_handler);
+#endif
+}
+
+/* Called with the monitor lock held */
+static guint64
+get_memory_budget (void)
+{
+	if (memory_budget == 0)
+		return 0;
+	return MAX (active_memory, (guint64) memory_budget * 1024 * 1024);
+}
+
+#ifdef G_OS_UNIX
+/* Called with the monitor lock held */
+static void
+set_memory_limits (guint64 max)
+{
+	if (backend == BACKEND_CGROUP) {
+		write_cgroup_value ("memory.high", max);
+		write_cgroup_value ("memory.max", max + max / 4);
+	} else {
+		set_soft_limit (RLIMIT_DATA, max ? max + max / 4 : RLIM_INFINITY);
+	}
+}
+#endif
 
-	setrlimit (RLIMIT_DATA, &limit);
+/* Files processed in parallel share the process' limits, which
+ * are the sum of the limits for each file. The budgets are checked
+ * by the monitors, so that files can be given up on one by one,
+ * and the hard limits set a quarter above are only there to stop
+ * runaway processes. Called with the monitor lock held. */
+static void
+set_resource_limits (gboolean verbose)
+{
+#ifdef G_OS_UNIX
+	guint64 max;
+	rlim_t seconds;
 
-	limit.rlim_cur = MAX_HELPER_SECONDS;
-	limit.rlim_max = MAX_HELPER_SECONDS;
-	setrlimit (RLIMIT_CPU, &limit);
+	if (backend == BACKEND_AUTO)
+		setup_backend ();
+
+	max = get_memory_budget ();
+	seconds = cpu_budget * MAX (n_active, 1);
+
+	set_memory_limits (max);
+	set_soft_limit (RLIMIT_CPU, seconds ? get_cpu_time_used () / G_USEC_PER_SEC + seconds : RLIM_INFINITY);
 
 	if (verbose)
-		g_message ("Setting limit to %lu MB RAM usage and %d seconds CPU time",
-			   max / 1024 / 1024, MAX_HELPER_SECONDS);
+		g_message ("Setting limit to %lu MB RAM usage and %lu seconds CPU time for %u files using %s",
+			   (gulong) (max / 1024 / 1024), (gulong) seconds, MAX (n_active, 1),
+			   backend_names[backend]);
 #else
 #warning unimplemented
 #endif
 }
 
-G_GNUC_NORETURN static gpointer
+/* Brings the limits down to the budgets of the files still being
+ * processed, once one of them is done. The CPU time limit is never
+ * raised here, so that the other files don't get a fresh budget.
+ * Called with the monitor lock held. */
+static void
+lower_resource_limits (void)
+{
+#ifdef G_OS_UNIX
+	struct rlimit limit;
+	rlim_t seconds;
+
+	set_memory_limits (get_memory_budget ());
+
+	if (cpu_budget == 0 || getrlimit (RLIMIT_CPU, &limit) < 0)
+		return;
+	seconds = get_cpu_time_used () / G_USEC_PER_SEC + cpu_budget * n_active;
+	if (limit.rlim_cur == RLIM_INFINITY || seconds < limit.rlim_cur)
+		set_soft_limit (RLIMIT_CPU, seconds);
+#endif
+}
+
+static void
+monitor_unref (TotemResourcesMonitor *monitor)
+{
+	if (!g_atomic_int_dec_and_test (&monitor->ref_count))
+		return;
+	g_free (monitor->input);
+	g_free (monitor);
+}
+
+static gboolean
+wait_for_finished (TotemResourcesMonitor *monitor,
+		   gint64                 end_time)
+{
+	while (monitor->finished == FALSE) {
+		if (!g_cond_wait_until (&monitor_cond, &monitor_lock, end_time))
+			break;
+	}
+	return monitor->finished;
+}
+
+/* Memory and CPU time are only known for the whole process, so
+ * when processing files in parallel, every file still running
+ * when the budget is blown is given up on. The signal for the CPU
+ * time limit is turned into a new generation, so that every monitor
+ * sees it, not only the first one to poll. Called with the monitor
+ * lock held. */
+static TotemResourcesLimit
+check_limits (TotemResourcesMonitor *monitor,
+	      gint64                 end_time)
+{
+	if (g_get_monotonic_time () >= end_time)
+		return TOTEM_RESOURCES_LIMIT_TIME;
+
+	if (cpu_limit_hit) {
+		cpu_limit_hit = 0;
+		cpu_limit_generation++;
+#ifdef G_OS_UNIX
+		/* Leave some time to give up, without more signals */
+		set_soft_limit (RLIMIT_CPU, get_cpu_time_used () / G_USEC_PER_SEC + MAX (cpu_budget, 1));
+#endif
+	}
+	if (monitor->cpu_limit_generation != cpu_limit_generation)
+		return TOTEM_RESOURCES_LIMIT_CPU;
+
+	if (memory_budget > 0 &&
+	    (get_memory_events () > monitor->start_memory_events ||
+	     get_memory_used () > get_memory_budget ()))
+		return TOTEM_RESOURCES_LIMIT_MEMORY;
+
+	return TOTEM_RESOURCES_LIMIT_NONE;
+}
+
+static gpointer
 time_monitor (gpointer data)
 {
+	TotemResourcesMonitor *monitor = data;
+	TotemResourcesLimit limit;
+	TotemResourcesUsage usage;
+	g_autofree char *usage_str = NULL;
 	const char *app_name;
+	gint64 end_time;
+	gboolean finished;
 
-	g_usleep (sleep_time);
+	end_time = monitor->sleep_time > 0 ? monitor->start_time + monitor->sleep_time : G_MAXINT64;
+	limit = TOTEM_RESOURCES_LIMIT_NONE;
 
-	if (finished != FALSE)
-		g_thread_exit (NULL);
+	g_mutex_lock (&monitor_lock);
+	while (TRUE) {
+		finished = wait_for_finished (monitor, MIN (g_get_monotonic_time () + POLL_INTERVAL, end_time));
+		if (finished)
+			break;
+		limit = check_limits (monitor, end_time);
+		if (limit != TOTEM_RESOURCES_LIMIT_NONE)
+			break;
+	}
+
+	/* Give the caller a chance to give up on this file before
+	 * giving up on the whole process */
+	if (finished == FALSE) {
+		monitor->limit = limit;
+		if (monitor->func != NULL) {
+			monitor->func (limit, monitor->user_data);
+			finished = wait_for_finished (monitor, g_get_monotonic_time () + TIMEOUT_GRACE_TIME);
+		}
+	}
+	g_mutex_unlock (&monitor_lock);
+
+	if (finished != FALSE) {
+		monitor_unref (monitor);
+		return NULL;
+	}
+
+	totem_resources_monitor_get_usage (monitor, &usage);
+	usage_str = totem_resources_usage_to_string (&usage);
 
 	app_name = g_get_application_name ();
 	if (app_name == NULL)
 		app_name = g_get_prgname ();
 	g_print ("%s couldn't process file: '%s'\n"
-		 "Reason: Took too much time to process.\n",
+		 "Reason: Went over its %s limit.\n"
+		 "Resources: %s\n",
 		 app_name,
-		 (const char *) data);
+		 monitor->input,
+		 limit_names[limit],
+		 usage_str);
 
 	exit (0);
 }
 
-void
-totem_resources_monitor_start (const char *input, gint wall_clock_time, gboolean verbose)
+static gboolean
+post_parse_hook (GOptionContext  *context,
+		 GOptionGroup    *group,
+		 gpointer         data,
+		 GError         **error)
+{
+	if (memory_budget < 0 || cpu_budget < 0 || time_budget < 0) {
+		g_set_error_literal (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+				     "Resource limits can't be negative");
+		return FALSE;
+	}
+
+	if (backend_name == NULL || g_str_equal (backend_name, "auto")) {
+		backend = BACKEND_AUTO;
+	} else if (g_str_equal (backend_name, "cgroup")) {
+		backend = BACKEND_CGROUP;
+	} else if (g_str_equal (backend_name, "rlimit")) {
+		backend = BACKEND_RLIMIT;
+	} else {
+		g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+			     "Unknown limits backend '%s'", backend_name);
+		return FALSE;
+	}
+	g_clear_pointer (&backend_name, g_free);
+	setup_backend ();
+
+	/* Before any threads get started, as they inherit it */
+	if (nice_increment != 0) {
+		errno = 0;
+		if (nice (nice_increment) == -1 && errno != 0)
+			g_warning ("Couldn't change nice value of process.");
+	}
+
+	return TRUE;
+}
+
+static const GOptionEntry entries[] = {
+	{ "memory-limit", '\0', 0, G_OPTION_ARG_INT, &memory_budget, "Memory budget for each file, on top of its size, in MB, or 0 for no limit (default: 1024)", "MB" },
+	{ "cpu-limit", '\0', 0, G_OPTION_ARG_INT, &cpu_budget, "CPU time budget for each file in seconds, or 0 for no limit (default: 15)", "SECONDS" },
+	{ "time-limit", '\0', 0, G_OPTION_ARG_INT, &time_budget, "Processing time budget for each file in seconds, or 0 for no limit (default: 30)", "SECONDS" },
+	{ "limits-backend", '\0', 0, G_OPTION_ARG_STRING, &backend_name, "How to enforce the memory budget: auto, cgroup or rlimit (default: auto)", "BACKEND" },
+	{ "nice", '\0', 0, G_OPTION_ARG_INT, &nice_increment, "Increment to the nice value of the process (default: 20)", "N" },
+	{ NULL }
+};
+
+/**
+ * totem_resources_get_option_group:
+ *
+ * Returns the command-line options used to change the budgets for
+ * each file, and the way they're enforced. The process' nice value
+ * is changed once the options are parsed, so the group needs to be
+ * parsed before starting any threads.
+ *
+ * Returns: (transfer full): a #GOptionGroup
+ **/
+GOptionGroup *
+totem_resources_get_option_group (void)
+{
+	GOptionGroup *group;
+
+	group = g_option_group_new ("resources", "Resource Limits Options:",
+				    "Show resource limits options", NULL, NULL);
+	g_option_group_add_entries (group, entries);
+	g_option_group_set_parse_hooks (group, NULL, post_parse_hook);
+
+	return group;
+}
+
+/**
+ * totem_resources_monitor_new:
+ * @input: the file about to be processed
+ * @wall_clock_time: the maximum processing time in microseconds,
+ *   0 for the configured budget, or a negative value for no limits
+ *   other than the process' hard limits
+ * @verbose: whether to print the limits being set
+ * @func: (nullable): called from another thread, with internal locks
+ *   held, when a limit is hit
+ * @user_data: data for @func
+ *
+ * Limits the resources used by the process while @input is processed,
+ * on top of those used by the other monitored files. When the time is
+ * up, or the process goes over its CPU time or memory budget, @func is
+ * called with the limit that was hit, and the process exits unless the
+ * monitor is freed shortly afterwards. Without @func, the process exits
+ * straight away.
+ *
+ * Returns: a monitor to free with totem_resources_monitor_free()
+ **/
+TotemResourcesMonitor *
+totem_resources_monitor_new (const char                *input,
+			     gint                       wall_clock_time,
+			     gboolean                   verbose,
+			     TotemResourcesTimeoutFunc  func,
+			     gpointer                   user_data)
 {
-	set_resource_limits (input, verbose);
+	TotemResourcesMonitor *monitor;
+	GThread *thread;
+
+	monitor = g_new0 (TotemResourcesMonitor, 1);
+	monitor->ref_count = 1;
+	monitor->input = g_strdup (input);
+	monitor->memory = get_memory_limit (input);
+	monitor->sleep_time = wall_clock_time > 0 ? wall_clock_time : (gint64) time_budget * G_USEC_PER_SEC;
+	monitor->start_time = g_get_monotonic_time ();
+#ifdef G_OS_UNIX
+	monitor->start_cpu_time = get_cpu_time_used ();
+#endif
+	monitor->finished = (wall_clock_time < 0);
+	monitor->func = func;
+	monitor->user_data = user_data;
+
+	g_mutex_lock (&monitor_lock);
+	n_active++;
+	active_memory += monitor->memory;
+	set_resource_limits (verbose);
+	monitor->start_memory_events = get_memory_events ();
+	monitor->cpu_limit_generation = cpu_limit_generation;
+	g_mutex_unlock (&monitor_lock);
 
 	if (wall_clock_time < 0)
-		return;
+		return monitor;
 
-	if (wall_clock_time > 0)
-		sleep_time = wall_clock_time;
+	g_atomic_int_inc (&monitor->ref_count);
+	thread = g_thread_new ("time-monitor", time_monitor, monitor);
+	g_thread_unref (thread);
 
-	finished = FALSE;
-	g_thread_new ("time-monitor", time_monitor, (gpointer) input);
+	return monitor;
 }
 
+/**
+ * totem_resources_monitor_get_usage:
+ * @monitor: a #TotemResourcesMonitor
+ * @usage: (out caller-allocates): the resources used so far
+ *
+ * Gets the resources used since @monitor was created, and the limit
+ * that was hit, if any. The CPU time includes that of any other files
+ * processed in parallel, and the peak memory usage is for the whole
+ * process, or for its cgroup.
+ **/
 void
-totem_resources_monitor_stop (void)
+totem_resources_monitor_get_usage (TotemResourcesMonitor *monitor,
+				   TotemResourcesUsage   *usage)
 {
-	finished = TRUE;
+	g_mutex_lock (&monitor_lock);
+	usage->limit = monitor->limit;
+	g_mutex_unlock (&monitor_lock);
+
+	usage->backend = backend_names[backend];
+	usage->wall_clock_time = g_get_monotonic_time () - monitor->start_time;
+#ifdef G_OS_UNIX
+	usage->cpu_time = get_cpu_time_used () - monitor->start_cpu_time;
+#else
+	usage->cpu_time = 0;
+#endif
+	usage->peak_memory = get_peak_memory ();
+}
+
+/**
+ * totem_resources_monitor_free:
+ * @monitor: a #TotemResourcesMonitor
+ *
+ * Stops monitoring the file, once it has been processed. The limits
+ * are brought down to the budgets of the files still being processed.
+ **/
+void
+totem_resources_monitor_free (TotemResourcesMonitor *monitor)
+{
+	g_mutex_lock (&monitor_lock);
+	monitor->finished = TRUE;
+	n_active--;
+	active_memory -= monitor->memory;
+	if (n_active == 0 && backend == BACKEND_CGROUP)
+		restore_cgroup_limits ();
+	else if (n_active > 0)
+		lower_resource_limits ();
+	g_cond_broadcast (&monitor_cond);
+	g_mutex_unlock (&monitor_lock);
+
+	monitor_unref (monitor);
 }
 
+const char *
+totem_resources_limit_to_string (TotemResourcesLimit limit)
+{
+	g_return_val_if_fail (limit < G_N_ELEMENTS (limit_names), NULL);
+
+	return limit_names[limit];
+}
+
+/**
+ * totem_resources_usage_to_string:
+ * @usage: a #TotemResourcesUsage
+ *
+ * Formats @usage as space-separated "key=value" pairs, with times
+ * in milliseconds and memory in kB, for scripts to parse.
+ *
+ * Returns: (transfer full): a newly allocated string
+ **/
+char *
+totem_resources_usage_to_string (const TotemResourcesUsage *usage)
+{
+	return g_strdup_printf ("limit=%s backend=%s wall-clock-ms=%" G_GINT64_FORMAT
+				" cpu-ms=%" G_GINT64_FORMAT " peak-memory-kb=%" G_GUINT64_FORMAT,
+				totem_resources_limit_to_string (usage->limit),
+				usage->backend,
+				usage->wall_clock_time / 1000,
+				usage->cpu_time / 1000,
+				usage->peak_memory / 1024);
+}
+
+void
+totem_resources_monitor_start (const char *input, gint wall_clock_time, gboolean verbose)
+{
+	totem_resources_monitor_stop ();
+	default_monitor = totem_resources_monitor_new (input, wall_clock_time, verbose, NULL, NULL);
+}
+
+void
+totem_resources_monitor_stop (void)
+{
+	g_clear_pointer (&default_monitor, totem_resources_monitor_free);
+}
@@ -7,8 +7,40 @@
 
 #include <glib.h>
 
+typedef enum {
+	TOTEM_RESOURCES_LIMIT_NONE,
+	TOTEM_RESOURCES_LIMIT_TIME,
+	TOTEM_RESOURCES_LIMIT_CPU,
+	TOTEM_RESOURCES_LIMIT_MEMORY
+} TotemResourcesLimit;
+
+typedef struct {
+	TotemResourcesLimit limit;	/* the limit that was hit, if any */
+	const char *backend;		/* "cgroup" or "rlimit" */
+	gint64 wall_clock_time;		/* in microseconds, for this file */
+	gint64 cpu_time;		/* in microseconds, for this file */
+	guint64 peak_memory;		/* in bytes, for the whole process */
+} TotemResourcesUsage;
+
+typedef struct _TotemResourcesMonitor TotemResourcesMonitor;
+typedef void (*TotemResourcesTimeoutFunc) (TotemResourcesLimit limit,
+					   gpointer user_data);
+
+GOptionGroup *totem_resources_get_option_group (void);
+
+TotemResourcesMonitor *totem_resources_monitor_new	(const char *input,
+							 gint wall_clock_time,
+							 gboolean verbose,
+							 TotemResourcesTimeoutFunc func,
+							 gpointer user_data);
+void totem_resources_monitor_get_usage	(TotemResourcesMonitor *monitor,
+					 TotemResourcesUsage *usage);
+void totem_resources_monitor_free	(TotemResourcesMonitor *monitor);
+
+char *totem_resources_usage_to_string	(const TotemResourcesUsage *usage);
+const char *totem_resources_limit_to_string	(TotemResourcesLimit limit);
+
 void totem_resources_monitor_start	(const char *input,
 					 gint wall_clock_time,
 					 gboolean verbose);
 void totem_resources_monitor_stop	(void);
-
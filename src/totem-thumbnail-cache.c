@@ -0,0 +1,201 @@
+/*
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "totem-thumbnail-cache.h"
+
+/* Same as the OpenSubtitles hash, see the opensubtitles plugin's hash.py */
+#define HASH_CHUNK_SIZE 65536
+
+#define CACHE_GROUP "Thumbnail"
+
+static gboolean
+sum_chunk (int      fd,
+	   goffset  offset,
+	   guint64 *hash)
+{
+	g_autofree guint64 *buffer = NULL;
+	gssize ret;
+	gsize done;
+	guint i;
+
+	buffer = g_malloc (HASH_CHUNK_SIZE);
+	done = 0;
+	while (done < HASH_CHUNK_SIZE) {
+		ret = pread (fd, (guint8 *) buffer + done, HASH_CHUNK_SIZE - done, offset + done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return FALSE;
+		done += ret;
+	}
+
+	for (i = 0; i < HASH_CHUNK_SIZE / sizeof (guint64); i++)
+		*hash += GUINT64_FROM_LE (buffer[i]);
+
+	return TRUE;
+}
+
+/* Returns the file's size plus the sum of the 64-bit little-endian words
+ * in its first and last 64 kB, as a hex string, or NULL if the file
+ * is too small to be hashed that way */
+char *
+totem_thumbnail_cache_hash_file (const char *path,
+				 guint64 *size)
+{
+	struct stat buf;
+	guint64 hash;
+	int fd;
+	gboolean ret;
+
+	fd = g_open (path, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat (fd, &buf) < 0 || !S_ISREG (buf.st_mode) ||
+	    buf.st_size < HASH_CHUNK_SIZE * 2) {
+		close (fd);
+		return NULL;
+	}
+
+	hash = buf.st_size;
+	ret = sum_chunk (fd, 0, &hash) &&
+		sum_chunk (fd, buf.st_size - HASH_CHUNK_SIZE, &hash);
+	close (fd);
+
+	if (ret == FALSE)
+		return NULL;
+
+	if (size != NULL)
+		*size = buf.st_size;
+	return g_strdup_printf ("%016" G_GINT64_MODIFIER "x", hash);
+}
+
+/* The key identifies the contents of @input, wherever it's stored. Only
+ * local files can be fingerprinted without reading them through. */
+char *
+totem_thumbnail_cache_get_key (const char *input)
+{
+	g_autoptr(GFile) file = NULL;
+	g_autofree char *path = NULL;
+	g_autofree char *hash = NULL;
+	guint64 size;
+
+	file = g_file_new_for_commandline_arg (input);
+	path = g_file_get_path (file);
+	if (path == NULL)
+		return NULL;
+
+	hash = totem_thumbnail_cache_hash_file (path, &size);
+	if (hash == NULL)
+		return NULL;
+
+	return g_strdup_printf ("%s-%" G_GUINT64_FORMAT, hash, size);
+}
+
+static char *
+get_image_path (const char *cache_dir,
+		const char *key,
+		const char *variant)
+{
+	g_autofree char *name = NULL;
+
+	name = g_strdup_printf ("%s-%s.png", key, variant);
+	return g_build_filename (cache_dir, name, NULL);
+}
+
+static char *
+get_info_path (const char *cache_dir,
+	       const char *key)
+{
+	g_autofree char *name = NULL;
+
+	name = g_strdup_printf ("%s.ini", key);
+	return g_build_filename (cache_dir, name, NULL);
+}
+
+/* Copies the thumbnail cached for @key, rendered with the @variant options,
+ * to @output. If there's no such thumbnail, @position is set to the position
+ * of the frame picked for the same contents before, or -1. */
+gboolean
+totem_thumbnail_cache_lookup (const char *cache_dir,
+			      const char *key,
+			      const char *variant,
+			      const char *output,
+			      gint64 *position)
+{
+	g_autoptr(GKeyFile) info = NULL;
+	g_autoptr(GFile) source = NULL;
+	g_autoptr(GFile) destination = NULL;
+	g_autofree char *info_path = NULL;
+	g_autofree char *image_path = NULL;
+
+	*position = -1;
+
+	info = g_key_file_new ();
+	info_path = get_info_path (cache_dir, key);
+	if (g_key_file_load_from_file (info, info_path, G_KEY_FILE_NONE, NULL) == FALSE)
+		return FALSE;
+
+	if (g_key_file_has_key (info, CACHE_GROUP, "Position", NULL))
+		*position = g_key_file_get_int64 (info, CACHE_GROUP, "Position", NULL);
+
+	image_path = get_image_path (cache_dir, key, variant);
+	source = g_file_new_for_path (image_path);
+	destination = g_file_new_for_path (output);
+
+	return g_file_copy (source, destination, G_FILE_COPY_OVERWRITE,
+			    NULL, NULL, NULL, NULL);
+}
+
+/* Keeps a copy of @output for @key, along with the @position of the
+ * frame it shows, or -1 for embedded covers. Files only ever appear
+ * complete in the cache, so concurrent thumbnailers can share it. */
+void
+totem_thumbnail_cache_store (const char *cache_dir,
+			     const char *key,
+			     const char *variant,
+			     const char *output,
+			     gint64 position)
+{
+	g_autoptr(GKeyFile) info = NULL;
+	g_autofree char *info_path = NULL;
+	g_autofree char *image_path = NULL;
+	g_autofree char *contents = NULL;
+	gsize length;
+	GError *err = NULL;
+
+	if (g_mkdir_with_parents (cache_dir, 0700) < 0)
+		return;
+
+	if (g_file_get_contents (output, &contents, &length, NULL) == FALSE)
+		return;
+
+	image_path = get_image_path (cache_dir, key, variant);
+	if (g_file_set_contents (image_path, contents, length, &err) == FALSE) {
+		g_debug ("Couldn't add '%s' to the thumbnail cache: %s", output, err->message);
+		g_error_free (err);
+		return;
+	}
+
+	info = g_key_file_new ();
+	if (position >= 0)
+		g_key_file_set_int64 (info, CACHE_GROUP, "Position", position);
+	else
+		g_key_file_set_boolean (info, CACHE_GROUP, "Cover", TRUE);
+
+	info_path = get_info_path (cache_dir, key);
+	g_key_file_save_to_file (info, info_path, NULL);
+}
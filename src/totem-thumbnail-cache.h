@@ -0,0 +1,23 @@
+/*
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+
+char *totem_thumbnail_cache_hash_file	(const char *path,
+					 guint64 *size);
+
+char *totem_thumbnail_cache_get_key	(const char *input);
+gboolean totem_thumbnail_cache_lookup	(const char *cache_dir,
+					 const char *key,
+					 const char *variant,
+					 const char *output,
+					 gint64 *position);
+void totem_thumbnail_cache_store	(const char *cache_dir,
+					 const char *key,
+					 const char *variant,
+					 const char *output,
+					 gint64 position);
@@ -0,0 +1,390 @@
+/*
+ * In-process video thumbnailing, for the files in the browser that
+ * don't have a thumbnail yet. Those thumbnails aren't made under the
+ * resource limits of the external thumbnailers, so they're only meant
+ * for display, not for the shared thumbnail cache.
+ *
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+#include "config.h"
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "totem-gst-helpers.h"
+#include "totem-gst-pixbuf-helpers.h"
+#include "totem-thumbnail-generator.h"
+
+/* Pipelines left over by finished thumbnails are kept for the next ones,
+ * which saves setting up playbin and its sinks again. The source, demuxers
+ * and decoders go away with each file though. */
+#define MAX_WARM_PIPELINES 4
+/* Pipelines that timed out are shut down in threads of their own, no
+ * more thumbnails are made in-process while that many are stuck */
+#define MAX_DROPPING_PIPELINES 2
+#define PREROLL_TIMEOUT (10 * GST_SECOND)
+/* How long totem_thumbnail_generator_clear() waits for the above */
+#define CLEAR_TIMEOUT (2 * G_USEC_PER_SEC)
+/* Same as totem-video-thumbnailer, without looking for interesting frames */
+#define FRAME_POSITION (1.0 / 3.0)
+
+typedef struct {
+	GstElement *play;
+	GThread    *thread;
+	gboolean    done;
+} DroppingPipeline;
+
+/* Protects all the below */
+static GMutex pipelines_lock;
+static GCond dropping_cond;
+static GQueue warm_pipelines = G_QUEUE_INIT;
+static GList *dropping_pipelines = NULL;
+
+static GstElement *
+create_pipeline (int size)
+{
+	GstElement *play, *bin, *capsfilter, *sink;
+	GstCaps *caps;
+	GstPad *pad;
+
+	play = gst_element_factory_make ("playbin", NULL);
+	if (play == NULL)
+		return NULL;
+
+	sink = gst_element_factory_make ("fakesink", NULL);
+	g_object_set (sink, "sync", TRUE, NULL);
+
+	/* Have playbin scale the frames down to the thumbnail's size,
+	 * in their native format, before they get converted to RGB */
+	caps = gst_caps_new_simple ("video/x-raw",
+				    "width", GST_TYPE_INT_RANGE, 1, size,
+				    "height", GST_TYPE_INT_RANGE, 1, size,
+				    "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+				    NULL);
+	capsfilter = gst_element_factory_make ("capsfilter", NULL);
+	g_object_set (capsfilter, "caps", caps, NULL);
+	gst_caps_unref (caps);
+
+	bin = gst_bin_new (NULL);
+	gst_bin_add_many (GST_BIN (bin), capsfilter, sink, NULL);
+	gst_element_link (capsfilter, sink);
+	pad = gst_element_get_static_pad (capsfilter, "sink");
+	gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+	gst_object_unref (pad);
+
+	g_object_set (play,
+		      "audio-sink", gst_element_factory_make ("fakesink", NULL),
+		      "video-sink", bin,
+		      "flags", GST_PLAY_FLAG_VIDEO,
+		      NULL);
+	g_object_set_data (G_OBJECT (play), "size", GINT_TO_POINTER (size));
+
+	return play;
+}
+
+static GstElement *
+acquire_pipeline (int       size,
+		  GError  **error)
+{
+	GstElement *play = NULL;
+	GList *l;
+
+	g_mutex_lock (&pipelines_lock);
+	if (join_dropped_pipelines () >= MAX_DROPPING_PIPELINES) {
+		g_mutex_unlock (&pipelines_lock);
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_BUSY,
+				     "Too many thumbnailing pipelines are stuck");
+		return NULL;
+	}
+	for (l = warm_pipelines.head; l != NULL; l = l->next) {
+		if (GPOINTER_TO_INT (g_object_get_data (l->data, "size")) == size) {
+			play = l->data;
+			g_queue_delete_link (&warm_pipelines, l);
+			break;
+		}
+	}
+	g_mutex_unlock (&pipelines_lock);
+
+	if (play != NULL)
+		return play;
+
+	play = create_pipeline (size);
+	if (play == NULL)
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+				     "Couldn't create a playbin");
+	return play;
+}
+
+static gpointer
+drop_pipeline_thread (gpointer data)
+{
+	DroppingPipeline *dropping = data;
+
+	gst_element_set_state (dropping->play, GST_STATE_NULL);
+	gst_object_unref (dropping->play);
+
+	g_mutex_lock (&pipelines_lock);
+	dropping->done = TRUE;
+	g_cond_broadcast (&dropping_cond);
+	g_mutex_unlock (&pipelines_lock);
+
+	return NULL;
+}
+
+/* Joins the threads of the pipelines that are gone, and returns how
+ * many are still being shut down. Called with the pipelines lock held. */
+static guint
+join_dropped_pipelines (void)
+{
+	GList *l, *next;
+	guint n_left = 0;
+
+	for (l = dropping_pipelines; l != NULL; l = next) {
+		DroppingPipeline *dropping = l->data;
+
+		next = l->next;
+		if (!dropping->done) {
+			n_left++;
+			continue;
+		}
+		g_thread_join (dropping->thread);
+		g_free (dropping);
+		dropping_pipelines = g_list_delete_link (dropping_pipelines, l);
+	}
+
+	return n_left;
+}
+
+/* A pipeline that timed out might have a streaming thread stuck
+ * somewhere, which would block the state change, so it's left to
+ * shut down on its own */
+static void
+drop_pipeline (GstElement *play)
+{
+	DroppingPipeline *dropping;
+
+	dropping = g_new0 (DroppingPipeline, 1);
+	dropping->play = play;
+
+	g_mutex_lock (&pipelines_lock);
+	dropping->thread = g_thread_new ("thumbnail-pipeline-drop", drop_pipeline_thread, dropping);
+	dropping_pipelines = g_list_prepend (dropping_pipelines, dropping);
+	g_mutex_unlock (&pipelines_lock);
+}
+
+static void
+release_pipeline (GstElement *play)
+{
+	GstBus *bus;
+
+	/* READY keeps the sinks, but lets go of the file, and of
+	 * the elements that were plugged in to read it */
+	if (gst_element_set_state (play, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+		gst_element_set_state (play, GST_STATE_NULL);
+		gst_object_unref (play);
+		return;
+	}
+
+	bus = gst_element_get_bus (play);
+	gst_bus_set_flushing (bus, TRUE);
+	gst_bus_set_flushing (bus, FALSE);
+	gst_object_unref (bus);
+
+	g_mutex_lock (&pipelines_lock);
+	if (warm_pipelines.length < MAX_WARM_PIPELINES) {
+		g_queue_push_head (&warm_pipelines, play);
+		play = NULL;
+	}
+	g_mutex_unlock (&pipelines_lock);
+
+	if (play != NULL) {
+		gst_element_set_state (play, GST_STATE_NULL);
+		gst_object_unref (play);
+	}
+}
+
+/* The size of the video as it would be displayed, for the
+ * thumbnail's metadata */
+static void
+set_video_size_options (GstElement *play,
+			GdkPixbuf  *pixbuf)
+{
+	g_autofree char *width = NULL;
+	g_autofree char *height = NULL;
+	GstPad *pad = NULL;
+	GstCaps *caps;
+	GstVideoInfo info;
+
+	g_signal_emit_by_name (play, "get-video-pad", 0, &pad);
+	if (pad == NULL)
+		return;
+
+	caps = gst_pad_get_current_caps (pad);
+	if (caps != NULL && gst_video_info_from_caps (&info, caps)) {
+		int video_width = GST_VIDEO_INFO_WIDTH (&info);
+
+		if (GST_VIDEO_INFO_PAR_D (&info) > 0)
+			video_width = gst_util_uint64_scale_int (video_width,
+								 GST_VIDEO_INFO_PAR_N (&info),
+								 GST_VIDEO_INFO_PAR_D (&info));
+		width = g_strdup_printf ("%d", video_width);
+		height = g_strdup_printf ("%d", GST_VIDEO_INFO_HEIGHT (&info));
+		gdk_pixbuf_set_option (pixbuf, "tEXt::Thumb::Image::Width", width);
+		gdk_pixbuf_set_option (pixbuf, "tEXt::Thumb::Image::Height", height);
+	}
+	g_clear_pointer (&caps, gst_caps_unref);
+	gst_object_unref (pad);
+}
+
+/* Waits for the pipeline to preroll, or for a seek to complete */
+static gboolean
+wait_for_async_done (GstElement  *play,
+		     GError     **error)
+{
+	GstBus *bus;
+	GstMessage *message;
+	gboolean ret = FALSE;
+
+	bus = gst_element_get_bus (play);
+	message = gst_bus_timed_pop_filtered (bus, PREROLL_TIMEOUT,
+					      GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR);
+	gst_object_unref (bus);
+
+	if (message == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+				     "Took too much time to process");
+	} else if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR) {
+		gst_message_parse_error (message, error, NULL);
+	} else {
+		ret = TRUE;
+	}
+	g_clear_pointer (&message, gst_message_unref);
+
+	return ret;
+}
+
+static GdkPixbuf *
+capture_frame (GstElement    *play,
+	       const char    *uri,
+	       GCancellable  *cancellable,
+	       GError       **error)
+{
+	GstStateChangeReturn ret;
+	GdkPixbuf *pixbuf;
+	gint64 duration;
+	guint n_video;
+
+	g_object_set (play, "uri", uri, NULL);
+	ret = gst_element_set_state (play, GST_STATE_PAUSED);
+	if (ret == GST_STATE_CHANGE_FAILURE) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			     "Couldn't open '%s'", uri);
+		return NULL;
+	}
+	if (ret == GST_STATE_CHANGE_ASYNC && !wait_for_async_done (play, error))
+		return NULL;
+
+	g_object_get (play, "n-video", &n_video, NULL);
+	if (n_video == 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+			     "No video track in '%s'", uri);
+		return NULL;
+	}
+
+	if (g_cancellable_set_error_if_cancelled (cancellable, error))
+		return NULL;
+
+	if (gst_element_query_duration (play, GST_FORMAT_TIME, &duration) && duration > 0) {
+		gst_element_seek (play, 1.0,
+				  GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT,
+				  GST_SEEK_TYPE_SET, duration * FRAME_POSITION,
+				  GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+		if (!wait_for_async_done (play, error))
+			return NULL;
+	}
+
+	pixbuf = totem_gst_playbin_get_frame (play, error);
+	if (pixbuf != NULL)
+		set_video_size_options (play, pixbuf);
+
+	return pixbuf;
+}
+
+/**
+ * totem_thumbnail_generator_generate:
+ * @uri: the URI of a video
+ * @size: the maximum width and height of the thumbnail
+ * @cancellable: (nullable): a #GCancellable
+ * @error: return location for a #GError
+ *
+ * Captures a frame from @uri, scaled down to fit in @size, using one of
+ * the playbins left over by previous calls if possible. Blocks, so needs
+ * to be called from a thread. Files without a video track, which might
+ * have a cover instead, are left to the external thumbnailers.
+ *
+ * The frame is captured without the external thumbnailers' resource
+ * limits, so it shouldn't be saved to the shared thumbnail cache, where
+ * it would stop the external thumbnailers from ever replacing it.
+ *
+ * Returns: (transfer full): the frame, or %NULL on error
+ **/
+GdkPixbuf *
+totem_thumbnail_generator_generate (const char    *uri,
+				    int            size,
+				    GCancellable  *cancellable,
+				    GError       **error)
+{
+	GstElement *play;
+	GdkPixbuf *pixbuf;
+	GError *local_error = NULL;
+
+	if (!gst_is_initialized ()) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED,
+				     "GStreamer isn't initialised");
+		return NULL;
+	}
+
+	play = acquire_pipeline (size, error);
+	if (play == NULL)
+		return NULL;
+
+	pixbuf = capture_frame (play, uri, cancellable, &local_error);
+	if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT))
+		drop_pipeline (play);
+	else
+		release_pipeline (play);
+
+	if (local_error != NULL)
+		g_propagate_error (error, local_error);
+
+	return pixbuf;
+}
+
+/**
+ * totem_thumbnail_generator_clear:
+ *
+ * Frees the pipelines kept around for the next thumbnails, and waits
+ * a little for the ones that timed out to be shut down. Pipelines that
+ * are still stuck after that are left alone.
+ **/
+void
+totem_thumbnail_generator_clear (void)
+{
+	GstElement *play;
+	gint64 end_time;
+
+	g_mutex_lock (&pipelines_lock);
+	while ((play = g_queue_pop_head (&warm_pipelines)) != NULL) {
+		gst_element_set_state (play, GST_STATE_NULL);
+		gst_object_unref (play);
+	}
+
+	end_time = g_get_monotonic_time () + CLEAR_TIMEOUT;
+	while (join_dropped_pipelines () > 0) {
+		if (!g_cond_wait_until (&dropping_cond, &pipelines_lock, end_time))
+			break;
+	}
+	g_mutex_unlock (&pipelines_lock);
+}
@@ -0,0 +1,15 @@
+/*
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+#pragma once
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gio/gio.h>
+
+GdkPixbuf *totem_thumbnail_generator_generate	(const char    *uri,
+						 int            size,
+						 GCancellable  *cancellable,
+						 GError       **error);
+void totem_thumbnail_generator_clear		(void);
@@ -11,7 +11,12 @@
 
 #include <glib/gstdio.h>
 #include <glib/gi18n.h>
+#include <gio/gunixinputstream.h>
+#include <gio/gunixoutputstream.h>
+#include <gio/gunixsocketaddress.h>
 #include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/pbutils/pbutils.h>
 #include <totem-pl-parser.h>
 
 #include <locale.h>
@@ -23,10 +28,13 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 
 #include "gst/totem-gst-helpers.h"
 #include "gst/totem-gst-pixbuf-helpers.h"
+#include "gst/totem-progress-helpers.h"
 #include "totem-resources.h"
+#include "totem-thumbnail-cache.h"
 
 #ifdef G_HAVE_ISO_VARARGS
 #define PROGRESS_DEBUG(...) { if (verbose != FALSE) g_message (__VA_ARGS__); }
@@ -35,30 +43,86 @@
 #endif
 
 /* The main() function controls progress in the first and last 10% */
-#define PRINT_PROGRESS(p) { if (print_progress) g_printf ("%f%% complete\n", p); }
+#define PRINT_PROGRESS(p) report_progress (p)
 #define MIN_PROGRESS 10.0
 #define MAX_PROGRESS 90.0
 
 #define BORING_IMAGE_VARIANCE 256.0		/* Tweak this if necessary */
+#define MIN_INTERESTING_BRIGHTNESS 24		/* Fades to black, night skies */
+#define MAX_INTERESTING_BRIGHTNESS 232		/* Fades to white, flashes */
+#define SAME_SCENE_DISTANCE 6			/* Average luma difference */
 #define DEFAULT_OUTPUT_SIZE 256
+#define COVER_PROBE_TIMEOUT (10 * GST_SECOND)
 
 static gboolean raw_output = FALSE;
 static int output_size = -1;
 static gboolean time_limit = TRUE;
 static gboolean verbose = FALSE;
+static gboolean report_resources = FALSE;
 static gboolean print_progress = FALSE;
+static int progress_fd = -1;
+static gint64 start_time = 0;
 static gint64 second_index = -1;
+static char *batch_manifest = NULL;
+static char *socket_path = NULL;
+static char *cache_dir = NULL;
+static int n_jobs = 1;
 static char **filenames = NULL;
 
 typedef struct {
 	const char *output;
 	const char *input;
 	GstElement *play;
+	GstDiscoverer *discoverer;
 	gint64      duration;
+	int         video_width;
+	int         video_height;
+	/* Position of the captured frame, or -1 for covers */
+	gint64      position;
+	/* Position picked for the same contents before, or -1 */
+	gint64      cached_position;
+	/* Set from the streaming threads */
+	gint        capturing;
+	gint        failed;
+	gint        eos;
+	/* The TotemResourcesLimit that was hit, if any */
+	gint        timed_out;
 } ThumbApp;
 
-static void save_pixbuf (GdkPixbuf *pixbuf, const char *path,
-			 const char *video_path, int size, gboolean is_still);
+/* Progress goes to --progress-fd as structured messages if it was
+ * passed, or to stdout as text with --print-progress */
+static void
+report_progress (gdouble percent)
+{
+	TotemProgressMessage msg = { TOTEM_PROGRESS_MESSAGE_PROGRESS, };
+
+	if (progress_fd < 0) {
+		if (print_progress)
+			g_printf ("%f%% complete\n", percent);
+		return;
+	}
+
+	msg.fraction = percent / 100.0;
+	msg.elapsed = g_get_monotonic_time () - start_time;
+	totem_progress_message_write (progress_fd, &msg);
+}
+
+static void
+report_result (const char   *output,
+	       const GError *error)
+{
+	TotemProgressMessage msg = { 0, };
+
+	if (progress_fd < 0)
+		return;
+
+	msg.type = error ? TOTEM_PROGRESS_MESSAGE_ERROR : TOTEM_PROGRESS_MESSAGE_DONE;
+	msg.fraction = 1.0;
+	msg.elapsed = g_get_monotonic_time () - start_time;
+	msg.output = (char *) output;
+	msg.message = error ? error->message : NULL;
+	totem_progress_message_write (progress_fd, &msg);
+}
 
 static void
 entry_parsed_cb (TotemPlParser *parser,
@@ -116,16 +180,14 @@ is_special_uri (const char *uri)
 	return FALSE;
 }
 
-static void
-thumb_app_set_filename (ThumbApp *app)
+static char *
+thumb_app_get_uri (ThumbApp *app)
 {
 	GFile *file;
 	char *uri;
 
-	if (is_special_uri (app->input)) {
-		g_object_set (app->play, "uri", app->input, NULL);
-		return;
-	}
+	if (is_special_uri (app->input))
+		return g_strdup (app->input);
 
 	file = g_file_new_for_commandline_arg (app->input);
 	uri = get_special_url (file);
@@ -133,6 +195,16 @@ thumb_app_set_filename (ThumbApp *app)
 		uri = g_file_get_uri (file);
 	g_object_unref (file);
 
+	return uri;
+}
+
+static void
+thumb_app_set_filename (ThumbApp *app)
+{
+	char *uri;
+
+	uri = thumb_app_get_uri (app);
+
 	PROGRESS_DEBUG("setting URI %s", uri);
 
 	g_object_set (app->play, "uri", uri, NULL);
@@ -142,17 +214,23 @@ thumb_app_set_filename (ThumbApp *app)
 static GstBusSyncReply
 error_handler (GstBus *bus,
 	       GstMessage *message,
-	       GstElement *play)
+	       ThumbApp *app)
 {
 	GstMessageType msg_type;
 
+	/* Errors while opening the file are handled in thumb_app_start() */
+	if (g_atomic_int_get (&app->capturing) == FALSE)
+		return GST_BUS_PASS;
+
 	msg_type = GST_MESSAGE_TYPE (message);
 	switch (msg_type) {
 	case GST_MESSAGE_ERROR:
-		totem_gst_message_print (message, play, "totem-video-thumbnailer-error");
-		exit (1);
+		totem_gst_message_print (message, app->play, "totem-video-thumbnailer-error");
+		g_atomic_int_set (&app->failed, TRUE);
+		break;
 	case GST_MESSAGE_EOS:
-		exit (0);
+		g_atomic_int_set (&app->eos, TRUE);
+		break;
 
 	case GST_MESSAGE_ASYNC_DONE:
 	case GST_MESSAGE_UNKNOWN:
@@ -193,11 +271,79 @@ error_handler (GstBus *bus,
 	return GST_BUS_PASS;
 }
 
+static gboolean
+thumb_app_is_stopped (ThumbApp *app)
+{
+	return g_atomic_int_get (&app->failed) || g_atomic_int_get (&app->eos);
+}
+
+/* Get the pipeline ready for the next file, without tearing
+ * down the elements that can be reused */
+static void
+thumb_app_reset (ThumbApp *app)
+{
+	GstBus *bus;
+
+	g_atomic_int_set (&app->capturing, FALSE);
+	gst_element_set_state (app->play, GST_STATE_READY);
+
+	/* Drop whatever the previous file left on the bus */
+	bus = gst_element_get_bus (app->play);
+	gst_bus_set_flushing (bus, TRUE);
+	gst_bus_set_flushing (bus, FALSE);
+	g_object_unref (bus);
+
+	g_atomic_int_set (&app->failed, FALSE);
+	g_atomic_int_set (&app->eos, FALSE);
+	g_atomic_int_set (&app->timed_out, TOTEM_RESOURCES_LIMIT_NONE);
+	app->duration = -1;
+	app->video_width = app->video_height = -1;
+	app->position = app->cached_position = -1;
+}
+
 static void
 thumb_app_cleanup (ThumbApp *app)
 {
 	gst_element_set_state (app->play, GST_STATE_NULL);
 	g_clear_object (&app->play);
+	g_clear_object (&app->discoverer);
+}
+
+static void
+thumb_app_free (ThumbApp *app)
+{
+	thumb_app_cleanup (app);
+	g_free (app);
+}
+
+static const char *
+get_limit_message (TotemResourcesLimit limit)
+{
+	switch (limit) {
+	case TOTEM_RESOURCES_LIMIT_CPU:
+		return "Used too much CPU time";
+	case TOTEM_RESOURCES_LIMIT_MEMORY:
+		return "Used too much memory";
+	case TOTEM_RESOURCES_LIMIT_TIME:
+	default:
+		return "Took too much time to process";
+	}
+}
+
+/* Called from the time monitor thread, makes the pipeline give up
+ * on the current file so that the other files can carry on */
+static void
+thumb_app_timeout (TotemResourcesLimit  limit,
+		   ThumbApp            *app)
+{
+	GError *err;
+
+	g_atomic_int_set (&app->timed_out, limit);
+	err = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+				   get_limit_message (limit));
+	gst_element_post_message (app->play,
+				  gst_message_new_error (GST_OBJECT (app->play), err, NULL));
+	g_error_free (err);
 }
 
 static void
@@ -206,11 +352,11 @@ thumb_app_set_error_handler (ThumbApp *app)
 	GstBus *bus;
 
 	bus = gst_element_get_bus (app->play);
-	gst_bus_set_sync_handler (bus, (GstBusSyncHandler) error_handler, app->play, NULL);
+	gst_bus_set_sync_handler (bus, (GstBusSyncHandler) error_handler, app, NULL);
 	g_object_unref (bus);
 }
 
-static void
+static GdkPixbuf *
 check_cover_for_stream (ThumbApp   *app,
 			const char *signal_name)
 {
@@ -220,28 +366,86 @@ check_cover_for_stream (ThumbApp   *app,
 	g_signal_emit_by_name (G_OBJECT (app->play), signal_name, 0, &tags);
 
 	if (!tags)
-		return;
+		return NULL;
 
 	pixbuf = totem_gst_tag_list_get_cover (tags);
-	if (!pixbuf) {
-		gst_tag_list_unref (tags);
-		return;
-	}
-
-	PROGRESS_DEBUG("Saving cover image to %s", app->output);
-	thumb_app_cleanup (app);
-	save_pixbuf (pixbuf, app->output, app->input, output_size, TRUE);
-	g_object_unref (pixbuf);
+	gst_tag_list_unref (tags);
 
-	exit (0);
+	return pixbuf;
 }
 
-static void
-thumb_app_check_for_cover (ThumbApp *app)
+static GdkPixbuf *
+thumb_app_get_cover (ThumbApp *app)
 {
+	GdkPixbuf *pixbuf;
+
 	PROGRESS_DEBUG ("Checking whether file has cover");
-	check_cover_for_stream (app, "get-audio-tags");
-	check_cover_for_stream (app, "get-video-tags");
+	pixbuf = check_cover_for_stream (app, "get-audio-tags");
+	if (pixbuf == NULL)
+		pixbuf = check_cover_for_stream (app, "get-video-tags");
+
+	return pixbuf;
+}
+
+/* Files that commonly carry cover art, which we can get at
+ * without prerolling, or decoding any video */
+static gboolean
+is_cover_probe_candidate (const char *input)
+{
+	g_autofree char *content_type = NULL;
+
+	content_type = g_content_type_guess (input, NULL, 0, NULL);
+	return g_str_has_prefix (content_type, "audio/") ||
+		g_content_type_is_a (content_type, "video/x-matroska") ||
+		g_content_type_is_a (content_type, "video/mp4");
+}
+
+/* Looks for a cover in the tags found by demuxing and parsing the
+ * file, which doesn't create decoders or sinks */
+static GdkPixbuf *
+thumb_app_probe_cover (ThumbApp *app)
+{
+	g_autoptr(GstDiscovererInfo) info = NULL;
+	g_autofree char *uri = NULL;
+	GdkPixbuf *pixbuf = NULL;
+	GError *err = NULL;
+	GList *streams, *l;
+	int size;
+
+	if (app->discoverer == NULL) {
+		app->discoverer = gst_discoverer_new (COVER_PROBE_TIMEOUT, &err);
+		if (app->discoverer == NULL) {
+			PROGRESS_DEBUG("Couldn't create discoverer: %s", err->message);
+			g_error_free (err);
+			return NULL;
+		}
+	}
+
+	uri = thumb_app_get_uri (app);
+	PROGRESS_DEBUG("Probing %s for a cover", uri);
+	info = gst_discoverer_discover_uri (app->discoverer, uri, &err);
+	if (err != NULL) {
+		PROGRESS_DEBUG("Couldn't probe %s: %s", uri, err->message);
+		g_error_free (err);
+	}
+	if (info == NULL)
+		return NULL;
+
+	/* Scale while decoding, unless we want the full-size picture */
+	size = (raw_output != FALSE && output_size == -1) ? -1 : output_size;
+
+	streams = gst_discoverer_info_get_stream_list (info);
+	for (l = streams; l != NULL && pixbuf == NULL; l = l->next) {
+		const GstTagList *tags;
+
+		tags = gst_discoverer_stream_info_get_tags (l->data);
+		if (tags != NULL)
+			pixbuf = totem_gst_tag_list_get_cover_at_size ((GstTagList *) tags, size,
+									&app->video_width, &app->video_height);
+	}
+	gst_discoverer_stream_info_list_free (streams);
+
+	return pixbuf;
 }
 
 static gboolean
@@ -257,13 +461,32 @@ thumb_app_set_duration (ThumbApp *app)
 	return FALSE;
 }
 
+/* The size of the video as it would be displayed, which is what the
+ * thumbnail metadata refers to, whatever size the frames get captured at */
 static void
-assert_duration (ThumbApp *app)
+thumb_app_set_video_size (ThumbApp *app)
 {
-	if (app->duration != -1)
+	GstPad *pad = NULL;
+	GstCaps *caps;
+	GstVideoInfo info;
+
+	app->video_width = app->video_height = -1;
+
+	g_signal_emit_by_name (app->play, "get-video-pad", 0, &pad);
+	if (pad == NULL)
 		return;
-	g_print ("totem-video-thumbnailer couldn't get the duration of file '%s'\n", app->input);
-	exit (1);
+
+	caps = gst_pad_get_current_caps (pad);
+	if (caps != NULL && gst_video_info_from_caps (&info, caps)) {
+		app->video_width = GST_VIDEO_INFO_WIDTH (&info);
+		app->video_height = GST_VIDEO_INFO_HEIGHT (&info);
+		if (GST_VIDEO_INFO_PAR_D (&info) > 0)
+			app->video_width = gst_util_uint64_scale_int (app->video_width,
+								      GST_VIDEO_INFO_PAR_N (&info),
+								      GST_VIDEO_INFO_PAR_D (&info));
+	}
+	g_clear_pointer (&caps, gst_caps_unref);
+	gst_object_unref (pad);
 }
 
 static gboolean
@@ -389,6 +612,42 @@ element_setup_cb (GstElement * playbin, GstElement * element, gpointer udata)
 	g_free (name);
 }
 
+static GstElement *
+create_video_sink (void)
+{
+	GstElement *bin, *capsfilter, *sink;
+	GstCaps *caps;
+	GstPad *pad;
+
+	sink = gst_element_factory_make ("fakesink", "video-fake-sink");
+	g_object_set (sink, "sync", TRUE, NULL);
+
+	/* Without a size, we were asked for the full-size frame */
+	if (output_size <= 0)
+		return sink;
+
+	/* Otherwise have playbin scale the frames down to fit the thumbnail,
+	 * in their native format, before they ever get converted to RGB */
+	caps = gst_caps_new_simple ("video/x-raw",
+				    "width", GST_TYPE_INT_RANGE, 1, output_size,
+				    "height", GST_TYPE_INT_RANGE, 1, output_size,
+				    "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+				    NULL);
+	capsfilter = gst_element_factory_make ("capsfilter", "video-scale-caps");
+	g_object_set (capsfilter, "caps", caps, NULL);
+	gst_caps_unref (caps);
+
+	bin = gst_bin_new ("video-sink-bin");
+	gst_bin_add_many (GST_BIN (bin), capsfilter, sink, NULL);
+	gst_element_link (capsfilter, sink);
+
+	pad = gst_element_get_static_pad (capsfilter, "sink");
+	gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+	gst_object_unref (pad);
+
+	return bin;
+}
+
 static void
 thumb_app_setup_play (ThumbApp *app)
 {
@@ -397,8 +656,7 @@ thumb_app_setup_play (ThumbApp *app)
 
 	play = gst_element_factory_make ("playbin", "play");
 	audio_sink = gst_element_factory_make ("fakesink", "audio-fake-sink");
-	video_sink = gst_element_factory_make ("fakesink", "video-fake-sink");
-	g_object_set (video_sink, "sync", TRUE, NULL);
+	video_sink = create_video_sink ();
 
 	g_object_set (play,
 		      "audio-sink", audio_sink,
@@ -409,8 +667,14 @@ thumb_app_setup_play (ThumbApp *app)
 	g_signal_connect (play, "element-setup", G_CALLBACK (element_setup_cb), NULL);
 
 	app->play = play;
-
-	totem_gst_disable_hardware_decoders ();
+	app->discoverer = NULL;
+	app->duration = -1;
+	app->video_width = app->video_height = -1;
+	app->capturing = FALSE;
+	app->failed = FALSE;
+	app->eos = FALSE;
+	app->timed_out = TOTEM_RESOURCES_LIMIT_NONE;
+	thumb_app_set_error_handler (app);
 }
 
 static void
@@ -421,8 +685,11 @@ thumb_app_seek (ThumbApp *app,
 			  GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT,
 			  GST_SEEK_TYPE_SET, _time * GST_MSECOND,
 			  GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
-	/* And wait for this seek to complete */
-	gst_element_get_state (app->play, NULL, NULL, GST_CLOCK_TIME_NONE);
+	/* And wait for this seek to complete, unless the pipeline
+	 * errored out in the meantime */
+	while (gst_element_get_state (app->play, NULL, NULL, 100 * GST_MSECOND) == GST_STATE_CHANGE_ASYNC &&
+	       thumb_app_is_stopped (app) == FALSE)
+		;
 }
 
 /* This function attempts to detect images that are mostly solid images
@@ -498,18 +765,28 @@ scale_pixbuf (GdkPixbuf *pixbuf, int size, gboolean is_still)
 	return result;
 }
 
-static void
+static gboolean
 save_pixbuf (GdkPixbuf *pixbuf, const char *path,
-	     const char *video_path, int size, gboolean is_still)
+	     const char *video_path, int size, gboolean is_still,
+	     int width, int height, GError **error)
 {
-	int width, height;
 	char *a_width, *a_height;
 	GdkPixbuf *with_holes;
 	GError *err = NULL;
 	gboolean ret;
 
-	height = gdk_pixbuf_get_height (pixbuf);
-	width = gdk_pixbuf_get_width (pixbuf);
+	/* The frame might have been captured smaller than the video */
+	if (width <= 0 || height <= 0) {
+		height = gdk_pixbuf_get_height (pixbuf);
+		width = gdk_pixbuf_get_width (pixbuf);
+	} else if ((width > height) != (gdk_pixbuf_get_width (pixbuf) > gdk_pixbuf_get_height (pixbuf))) {
+		int tmp;
+
+		/* Rotated */
+		tmp = width;
+		width = height;
+		height = tmp;
+	}
 
 	/* If we're outputting a raw image without a size,
 	 * don't scale the pixbuf or add borders */
@@ -527,20 +804,23 @@ save_pixbuf (GdkPixbuf *pixbuf, const char *path,
 			       "tEXt::Thumb::Image::Width", a_width,
 			       "tEXt::Thumb::Image::Height", a_height,
 			       NULL);
+	g_free (a_width);
+	g_free (a_height);
+	g_object_unref (with_holes);
 
 	if (ret == FALSE) {
 		if (err != NULL) {
-			g_print ("totem-video-thumbnailer couldn't write the thumbnail '%s' for video '%s': %s\n", path, video_path, err->message);
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+				     "totem-video-thumbnailer couldn't write the thumbnail '%s' for video '%s': %s", path, video_path, err->message);
 			g_error_free (err);
 		} else {
-			g_print ("totem-video-thumbnailer couldn't write the thumbnail '%s' for video '%s'\n", path, video_path);
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+				     "totem-video-thumbnailer couldn't write the thumbnail '%s' for video '%s'", path, video_path);
 		}
-
-		g_object_unref (with_holes);
-		return;
+		return FALSE;
 	}
 
-	g_object_unref (with_holes);
+	return TRUE;
 }
 
 static GdkPixbuf *
@@ -550,13 +830,35 @@ capture_frame_at_time (ThumbApp   *app,
 	if (milliseconds != 0)
 		thumb_app_seek (app, milliseconds);
 
+	app->position = milliseconds;
 	return totem_gst_playbin_get_frame (app->play, NULL);
 }
 
+static gboolean
+is_frame_well_lit (const TotemGstFrameStats *stats)
+{
+	return stats->brightness >= MIN_INTERESTING_BRIGHTNESS &&
+		stats->brightness <= MAX_INTERESTING_BRIGHTNESS;
+}
+
+/* Contrast is what makes a frame interesting, dark or washed
+ * out frames come second to all others */
+static guint
+score_frame (const TotemGstFrameStats *stats)
+{
+	if (is_frame_well_lit (stats) == FALSE)
+		return stats->variance / 4;
+	return stats->variance;
+}
+
 static GdkPixbuf *
 capture_interesting_frame (ThumbApp *app)
 {
-	GdkPixbuf* pixbuf;
+	g_autoptr(GstSample) best = NULL;
+	GdkPixbuf* pixbuf = NULL;
+	TotemGstFrameStats previous;
+	gboolean has_previous = FALSE;
+	guint best_score = 0;
 	guint current;
 	const double frame_locations[] = {
 		1.0 / 3.0,
@@ -572,48 +874,539 @@ capture_interesting_frame (ThumbApp *app)
 	}
 
 	/* Test at multiple points in the file to see if we can get an
-	 * interesting frame */
+	 * interesting frame. Frames are scored straight from the decoder's
+	 * output, and only the one we keep gets converted to RGB */
 	for (current = 0; current < G_N_ELEMENTS(frame_locations); current++)
 	{
+		g_autoptr(GstSample) sample = NULL;
+		TotemGstFrameStats stats;
+		guint score;
+
+		/* We print progress in the range 10% (MIN_PROGRESS) to 90% (MAX_PROGRESS) */
+		PRINT_PROGRESS (MIN_PROGRESS + current * ((MAX_PROGRESS - MIN_PROGRESS) / G_N_ELEMENTS (frame_locations)));
+
 		PROGRESS_DEBUG("About to seek to %f", frame_locations[current]);
 		thumb_app_seek (app, frame_locations[current] * app->duration);
+		if (thumb_app_is_stopped (app)) {
+			PROGRESS_DEBUG("Pipeline stopped while seeking");
+			break;
+		}
 
-		/* Pull the frame, if it's interesting we bail early */
 		PROGRESS_DEBUG("About to get frame for iter %d", current);
-		pixbuf = totem_gst_playbin_get_frame (app->play, NULL);
-		if (pixbuf != NULL && is_image_interesting (pixbuf) != FALSE) {
+		sample = totem_gst_playbin_get_sample (app->play, NULL);
+		if (sample == NULL)
+			continue;
+
+		if (totem_gst_sample_get_frame_stats (sample, &stats) == FALSE) {
+			/* Not a format we can score directly, so convert
+			 * every frame. If we get to the end of this loop,
+			 * we'll end up using the last image we pulled */
+			g_clear_object (&pixbuf);
+			pixbuf = totem_gst_sample_to_pixbuf (sample, NULL);
+			app->position = frame_locations[current] * app->duration;
+			if (pixbuf != NULL && is_image_interesting (pixbuf) != FALSE) {
+				PROGRESS_DEBUG("Frame for iter %d is interesting", current);
+				break;
+			}
+			PROGRESS_DEBUG("Frame for iter %d was not interesting", current);
+			continue;
+		}
+
+		score = score_frame (&stats);
+		PROGRESS_DEBUG("Frame for iter %d has brightness %u, variance %u",
+			       current, stats.brightness, stats.variance);
+		if (best == NULL || score > best_score) {
+			g_clear_pointer (&best, gst_sample_unref);
+			best = gst_sample_ref (sample);
+			best_score = score;
+			app->position = frame_locations[current] * app->duration;
+		}
+
+		/* If it's interesting we bail early */
+		if (stats.variance > BORING_IMAGE_VARIANCE && is_frame_well_lit (&stats)) {
 			PROGRESS_DEBUG("Frame for iter %d is interesting", current);
 			break;
 		}
 
-		/* If we get to the end of this loop, we'll end up using
-		 * the last image we pulled */
-		if (current + 1 < G_N_ELEMENTS(frame_locations))
-			g_clear_object (&pixbuf);
+		/* The same picture twice in different places, and it's not
+		 * a fade: this is a still or a slideshow, and seeking some
+		 * more won't find anything better */
+		if (has_previous &&
+		    is_frame_well_lit (&stats) &&
+		    totem_gst_frame_stats_distance (&stats, &previous) < SAME_SCENE_DISTANCE) {
+			PROGRESS_DEBUG("Frame for iter %d is the same scene as before", current);
+			break;
+		}
+
+		previous = stats;
+		has_previous = TRUE;
 		PROGRESS_DEBUG("Frame for iter %d was not interesting", current);
 	}
+
+	if (best != NULL) {
+		g_clear_object (&pixbuf);
+		pixbuf = totem_gst_sample_to_pixbuf (best, NULL);
+	}
+
+	return pixbuf;
+}
+
+static GdkPixbuf *
+thumb_app_capture (ThumbApp  *app,
+		   gboolean  *is_still,
+		   GError   **error)
+{
+	GdkPixbuf *pixbuf;
+
+	app->position = -1;
+
+	if (is_cover_probe_candidate (app->input)) {
+		pixbuf = thumb_app_probe_cover (app);
+		if (pixbuf != NULL) {
+			PROGRESS_DEBUG("Using cover image from '%s' without prerolling", app->input);
+			*is_still = TRUE;
+			return pixbuf;
+		}
+	}
+
+	thumb_app_set_filename (app);
+
+	PROGRESS_DEBUG("About to open video file");
+
+	if (thumb_app_start (app) == FALSE) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			     "totem-video-thumbnailer couldn't open file '%s'", app->input);
+		return NULL;
+	}
+	g_atomic_int_set (&app->capturing, TRUE);
+
+	pixbuf = thumb_app_get_cover (app);
+	if (pixbuf != NULL) {
+		PROGRESS_DEBUG("Using cover image from '%s'", app->input);
+		*is_still = TRUE;
+		return pixbuf;
+	}
+
+	if (thumb_app_get_has_video (app) == FALSE) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+			     "totem-video-thumbnailer couldn't find a video track in '%s'", app->input);
+		return NULL;
+	}
+	thumb_app_set_duration (app);
+	thumb_app_set_video_size (app);
+
+	PROGRESS_DEBUG("Opened video file: '%s'", app->input);
+	PRINT_PROGRESS (10.0);
+
+	/* If the user has told us to use a frame at a specific second
+	 * into the video, just use that frame no matter how boring it
+	 * is */
+	if (second_index != -1) {
+		if (app->duration == -1) {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+				     "totem-video-thumbnailer couldn't get the duration of file '%s'", app->input);
+			return NULL;
+		}
+		pixbuf = capture_frame_at_time (app, second_index * 1000);
+	} else if (app->cached_position >= 0 &&
+		   (app->duration == -1 || app->cached_position < app->duration)) {
+		/* We already looked for an interesting frame in the same contents */
+		PROGRESS_DEBUG("Using the frame at %" G_GINT64_FORMAT " ms picked before", app->cached_position);
+		pixbuf = capture_frame_at_time (app, app->cached_position);
+	} else {
+		pixbuf = capture_interesting_frame (app);
+	}
+
+	/* Keep the best frame found before hitting a limit */
+	if (g_atomic_int_get (&app->failed) && !g_atomic_int_get (&app->timed_out))
+		g_clear_object (&pixbuf);
+
+	if (pixbuf == NULL) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			     "totem-video-thumbnailer couldn't get a picture from '%s'", app->input);
+	}
+
 	return pixbuf;
 }
 
+/* Thumbnails a single file, leaving the pipeline ready for the
+ * next one. The resource limits apply to each file separately. */
+static gboolean
+thumb_app_process (ThumbApp   *app,
+		   const char *input,
+		   const char *output,
+		   GError    **error)
+{
+	TotemResourcesMonitor *monitor = NULL;
+	TotemResourcesLimit limit;
+	g_autofree char *cache_key = NULL;
+	g_autofree char *cache_variant = NULL;
+	GdkPixbuf *pixbuf;
+	gboolean is_still = FALSE;
+	gboolean ret;
+	int width, height;
+	gint64 position;
+
+	app->input = input;
+	app->output = output;
+	app->cached_position = -1;
+
+	/* The same contents might have been thumbnailed under another name */
+	if (cache_dir != NULL)
+		cache_key = totem_thumbnail_cache_get_key (input);
+	if (cache_key != NULL) {
+		cache_variant = g_strdup_printf ("%d%s", output_size, raw_output ? "-raw" : "");
+		if (second_index != -1) {
+			g_autofree char *variant = cache_variant;
+
+			cache_variant = g_strdup_printf ("%s-t%" G_GINT64_FORMAT, variant, second_index);
+		}
+
+		if (totem_thumbnail_cache_lookup (cache_dir, cache_key, cache_variant,
+						  output, &app->cached_position)) {
+			PROGRESS_DEBUG("Using cached thumbnail %s for '%s'", cache_key, input);
+			return TRUE;
+		}
+	}
+
+	if (time_limit != FALSE)
+		monitor = totem_resources_monitor_new (input, 0, verbose,
+						       (TotemResourcesTimeoutFunc) thumb_app_timeout, app);
+
+	pixbuf = thumb_app_capture (app, &is_still, error);
+	PRINT_PROGRESS (90.0);
+
+	if (monitor != NULL && report_resources) {
+		TotemResourcesUsage usage;
+		g_autofree char *usage_str = NULL;
+
+		totem_resources_monitor_get_usage (monitor, &usage);
+		usage_str = totem_resources_usage_to_string (&usage);
+		g_printerr ("RESOURCES\t%s\t%s\n", input, usage_str);
+	}
+	g_clear_pointer (&monitor, totem_resources_monitor_free);
+
+	limit = g_atomic_int_get (&app->timed_out);
+	if (limit != TOTEM_RESOURCES_LIMIT_NONE && pixbuf != NULL) {
+		/* The search for an interesting frame was cut short */
+		PROGRESS_DEBUG("%s, using the best frame found so far", get_limit_message (limit));
+		g_clear_error (error);
+	} else if (limit != TOTEM_RESOURCES_LIMIT_NONE) {
+		g_clear_error (error);
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+			     "totem-video-thumbnailer couldn't process file '%s': %s",
+			     input, get_limit_message (limit));
+	}
+	/* Covers probed without prerolling know their original size */
+	width = app->video_width;
+	height = app->video_height;
+	position = app->position;
+	thumb_app_reset (app);
+	PRINT_PROGRESS (92.0);
+
+	if (pixbuf == NULL)
+		return FALSE;
+
+	PROGRESS_DEBUG("Saving captured screenshot to %s", output);
+	ret = save_pixbuf (pixbuf, output, input, output_size, is_still, width, height, error);
+	g_object_unref (pixbuf);
+
+	/* Don't let a rushed choice of frame stick */
+	if (ret != FALSE && cache_key != NULL && limit == TOTEM_RESOURCES_LIMIT_NONE)
+		totem_thumbnail_cache_store (cache_dir, cache_key, cache_variant, output, position);
+
+	return ret;
+}
+
+/* Requests are one "INPUT<tab>OUTPUT" pair per line, and each gets
+ * an "OK<tab>OUTPUT" or "ERROR<tab>OUTPUT<tab>MESSAGE" reply */
+static gboolean
+parse_request (char        *line,
+	       const char **input,
+	       const char **output)
+{
+	char *sep;
+
+	sep = strchr (line, '\t');
+	if (sep == NULL)
+		return FALSE;
+	*sep = '\0';
+	*input = line;
+	*output = sep + 1;
+
+	return **input != '\0' && **output != '\0';
+}
+
+static gboolean
+write_reply (GOutputStream *out,
+	     const char    *output,
+	     const GError  *error)
+{
+	g_autofree char *reply = NULL;
+
+	if (error == NULL) {
+		reply = g_strdup_printf ("OK\t%s\n", output);
+	} else {
+		g_autofree char *message = NULL;
+
+		message = g_strdelimit (g_strdup (error->message), "\t\r\n", ' ');
+		reply = g_strdup_printf ("ERROR\t%s\t%s\n", output ? output : "", message);
+	}
+
+	return g_output_stream_write_all (out, reply, strlen (reply), NULL, NULL, NULL) &&
+		g_output_stream_flush (out, NULL, NULL);
+}
+
+typedef struct {
+	GMutex         lock;
+	GCond          cond;
+	GOutputStream *out;
+	guint          pending;
+	gboolean       failed;
+} BatchReplies;
+
+typedef struct {
+	BatchReplies *replies;
+	char         *input;
+	char         *output;
+} BatchRequest;
+
+/* Every worker thread has its own pipeline */
+static GPrivate worker_app = G_PRIVATE_INIT ((GDestroyNotify) thumb_app_free);
+
+static void
+batch_replies_push (BatchReplies *replies,
+		    const char   *output,
+		    const GError *error)
+{
+	g_mutex_lock (&replies->lock);
+	if (replies->failed == FALSE &&
+	    write_reply (replies->out, output, error) == FALSE)
+		replies->failed = TRUE;
+	replies->pending--;
+	g_cond_broadcast (&replies->cond);
+	g_mutex_unlock (&replies->lock);
+}
+
+static void
+batch_worker (BatchRequest *request,
+	      gpointer      user_data)
+{
+	ThumbApp *app;
+	GError *err = NULL;
+
+	app = g_private_get (&worker_app);
+	if (app == NULL) {
+		app = g_new0 (ThumbApp, 1);
+		thumb_app_setup_play (app);
+		g_private_set (&worker_app, app);
+	}
+
+	PROGRESS_DEBUG("Processing '%s' into '%s'", request->input, request->output);
+	thumb_app_process (app, request->input, request->output, &err);
+	batch_replies_push (request->replies, request->output, err);
+
+	g_clear_error (&err);
+	g_free (request->input);
+	g_free (request->output);
+	g_free (request);
+}
+
+/* Reads all the requests from @in, hands them over to the workers,
+ * and waits for all of them to be replied to */
+static gboolean
+thumb_app_run_batch (GThreadPool   *pool,
+		     GInputStream  *in,
+		     GOutputStream *out)
+{
+	g_autoptr(GDataInputStream) data = NULL;
+	BatchReplies replies = { 0, };
+	GError *err = NULL;
+	gboolean ret;
+	char *line;
+
+	g_mutex_init (&replies.lock);
+	g_cond_init (&replies.cond);
+	replies.out = out;
+
+	data = g_data_input_stream_new (in);
+	g_data_input_stream_set_newline_type (data, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+
+	while ((line = g_data_input_stream_read_line (data, NULL, NULL, &err)) != NULL) {
+		const char *input, *output;
+
+		if (*line == '\0') {
+			g_free (line);
+			continue;
+		}
+
+		g_mutex_lock (&replies.lock);
+		replies.pending++;
+		ret = !replies.failed;
+		g_mutex_unlock (&replies.lock);
+
+		if (parse_request (line, &input, &output) == FALSE) {
+			GError *parse_err;
+
+			parse_err = g_error_new (G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+						 "totem-video-thumbnailer couldn't parse request '%s'", line);
+			batch_replies_push (&replies, NULL, parse_err);
+			g_error_free (parse_err);
+		} else {
+			BatchRequest *request;
+
+			request = g_new0 (BatchRequest, 1);
+			request->replies = &replies;
+			request->input = g_strdup (input);
+			request->output = g_strdup (output);
+			g_thread_pool_push (pool, request, NULL);
+		}
+
+		g_free (line);
+
+		/* Stop reading once nobody is listening to the replies */
+		if (ret == FALSE)
+			break;
+	}
+
+	if (err != NULL) {
+		g_printerr ("totem-video-thumbnailer couldn't read requests: %s\n", err->message);
+		g_error_free (err);
+	}
+
+	g_mutex_lock (&replies.lock);
+	while (replies.pending > 0)
+		g_cond_wait (&replies.cond, &replies.lock);
+	ret = !replies.failed && err == NULL;
+	g_mutex_unlock (&replies.lock);
+
+	g_mutex_clear (&replies.lock);
+	g_cond_clear (&replies.cond);
+
+	return ret;
+}
+
+static gboolean
+thumb_app_run_manifest (GThreadPool *pool,
+			const char  *manifest)
+{
+	g_autoptr(GInputStream) in = NULL;
+	g_autoptr(GOutputStream) out = NULL;
+
+	if (g_strcmp0 (manifest, "-") == 0) {
+		in = g_unix_input_stream_new (STDIN_FILENO, FALSE);
+	} else {
+		g_autoptr(GFile) file = NULL;
+		GError *err = NULL;
+
+		file = g_file_new_for_commandline_arg (manifest);
+		in = G_INPUT_STREAM (g_file_read (file, NULL, &err));
+		if (in == NULL) {
+			g_printerr ("totem-video-thumbnailer couldn't open manifest '%s': %s\n", manifest, err->message);
+			g_error_free (err);
+			return FALSE;
+		}
+	}
+	out = g_unix_output_stream_new (STDOUT_FILENO, FALSE);
+
+	return thumb_app_run_batch (pool, in, out);
+}
+
+/* Serves one client connection at a time, with all the workers
+ * available to that client */
+static gboolean
+thumb_app_run_socket (GThreadPool *pool,
+		      const char  *path)
+{
+	g_autoptr(GSocketListener) listener = NULL;
+	g_autoptr(GSocketAddress) address = NULL;
+	GStatBuf buf;
+	GError *err = NULL;
+
+	/* Only replace sockets left over by previous runs */
+	if (g_lstat (path, &buf) == 0) {
+		if (!S_ISSOCK (buf.st_mode)) {
+			g_printerr ("totem-video-thumbnailer couldn't listen on '%s': File exists and isn't a socket\n", path);
+			return FALSE;
+		}
+		g_unlink (path);
+	}
+
+	listener = g_socket_listener_new ();
+	address = g_unix_socket_address_new (path);
+	if (!g_socket_listener_add_address (listener, address,
+					    G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+					    NULL, NULL, &err)) {
+		g_printerr ("totem-video-thumbnailer couldn't listen on '%s': %s\n", path, err->message);
+		g_error_free (err);
+		return FALSE;
+	}
+
+	PROGRESS_DEBUG("Listening on '%s'", path);
+
+	while (TRUE) {
+		g_autoptr(GSocketConnection) connection = NULL;
+
+		connection = g_socket_listener_accept (listener, NULL, NULL, &err);
+		if (connection == NULL) {
+			g_printerr ("totem-video-thumbnailer couldn't accept connection: %s\n", err->message);
+			g_error_free (err);
+			break;
+		}
+
+		thumb_app_run_batch (pool,
+				     g_io_stream_get_input_stream (G_IO_STREAM (connection)),
+				     g_io_stream_get_output_stream (G_IO_STREAM (connection)));
+		g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
+	}
+
+	g_unlink (path);
+
+	return FALSE;
+}
+
+static void
+print_peak_memory (void)
+{
+	struct rusage usage;
+
+	if (verbose == FALSE || getrusage (RUSAGE_SELF, &usage) < 0)
+		return;
+	PROGRESS_DEBUG("Peak memory usage: %ld kB", usage.ru_maxrss);
+}
+
+static void
+print_to_stderr (const char *string)
+{
+	fputs (string, stderr);
+}
+
 static const GOptionEntry entries[] = {
 	{ "size", 's', 0, G_OPTION_ARG_INT, &output_size, "Size of the thumbnail in pixels", NULL },
 	{ "raw", 'r', 0, G_OPTION_ARG_NONE, &raw_output, "Output the raw picture of the video without scaling or adding borders", NULL },
 	{ "no-limit", 'l', G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &time_limit, "Don't limit the thumbnailing time to 30 seconds", NULL },
 	{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "Output debug information", NULL },
+	{ "report-resources", '\0', 0, G_OPTION_ARG_NONE, &report_resources, "Print the resources used for each file, and the limit hit, to the standard error", NULL },
 	{ "time", 't', 0, G_OPTION_ARG_INT64, &second_index, "Choose this time (in seconds) as the thumbnail", NULL },
 	{ "print-progress", 'p', 0, G_OPTION_ARG_NONE, &print_progress, "Only print progress updates (can't be used with --verbose)", NULL },
+	{ "progress-fd", '\0', 0, G_OPTION_ARG_INT, &progress_fd, "Write progress messages to the given file descriptor", "FD" },
+	{ "batch", 'b', 0, G_OPTION_ARG_FILENAME, &batch_manifest, "Thumbnail the input and output pairs listed in this file, or \"-\" for the standard input", "MANIFEST" },
+	{ "socket", 'S', 0, G_OPTION_ARG_FILENAME, &socket_path, "Thumbnail the input and output pairs sent to this UNIX socket", "PATH" },
+	{ "cache", 'c', 0, G_OPTION_ARG_FILENAME, &cache_dir, "Reuse thumbnails of files with the same contents, kept in this directory", "DIR" },
+	{ "jobs", '\0', 0, G_OPTION_ARG_INT, &n_jobs, "Number of files to thumbnail in parallel with --batch or --socket", "N" },
 	{ G_OPTION_REMAINING, '\0', 0, G_OPTION_ARG_FILENAME_ARRAY, &filenames, NULL, "[INPUT FILE] [OUTPUT FILE]" },
 	{ NULL }
 };
 
 int main (int argc, char *argv[])
 {
-	GOptionGroup *options;
+	GOptionGroup *options, *resources;
 	GOptionContext *context;
 	GError *err = NULL;
-	GdkPixbuf *pixbuf;
 	const char *input, *output;
-	ThumbApp app;
+	gboolean batch;
+	gboolean ret;
+	ThumbApp app = { 0, };
 
 	setlocale (LC_ALL, "");
 	bindtextdomain (GETTEXT_PACKAGE, GNOMELOCALEDIR);
@@ -624,14 +1417,13 @@ int main (int argc, char *argv[])
 	 * address space max size safeguard for the thumbnailer. */
 	g_setenv("OMP_NUM_THREADS", "1", TRUE);
 
-	/* Call before the global thread pool is setup */
-	errno = 0;
-	if (nice (20) != 20 && errno != 0)
-		g_warning ("Couldn't change nice value of process.");
-
 	context = g_option_context_new ("Thumbnail movies");
+	/* Parsed first, as it changes the nice value, which needs
+	 * to be done before the global thread pool is setup */
+	resources = totem_resources_get_option_group ();
 	options = gst_init_get_option_group ();
 	g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+	g_option_context_add_group (context, resources);
 	g_option_context_add_group (context, options);
 
 	if (g_option_context_parse (context, &argc, &argv, &err) == FALSE) {
@@ -640,6 +1432,9 @@ int main (int argc, char *argv[])
 		return 1;
 	}
 
+	batch = (batch_manifest != NULL || socket_path != NULL);
+	start_time = g_get_monotonic_time ();
+
 	if (print_progress) {
 		fcntl (fileno (stdout), F_SETFL, O_NONBLOCK);
 		setbuf (stdout, NULL);
@@ -648,7 +1443,10 @@ int main (int argc, char *argv[])
 	if (raw_output == FALSE && output_size == -1)
 		output_size = DEFAULT_OUTPUT_SIZE;
 
-	if (filenames == NULL || g_strv_length (filenames) != 2 ||
+	if ((batch == FALSE && (filenames == NULL || g_strv_length (filenames) != 2)) ||
+	    (batch != FALSE && (filenames != NULL || print_progress == TRUE || progress_fd >= 0)) ||
+	    n_jobs < 1 || (batch == FALSE && n_jobs != 1) ||
+	    (batch_manifest != NULL && socket_path != NULL) ||
 	    (print_progress == TRUE && verbose == TRUE)) {
 		char *help;
 		help = g_option_context_get_help (context, FALSE, NULL);
@@ -656,68 +1454,52 @@ int main (int argc, char *argv[])
 		g_free (help);
 		return 1;
 	}
-	input = filenames[0];
-	output = filenames[1];
-
-	PROGRESS_DEBUG("Initialized libraries, about to create video widget");
-	PRINT_PROGRESS (2.0);
 
-	app.input = input;
-	app.output = output;
+	totem_gst_disable_hardware_decoders ();
 
-	thumb_app_setup_play (&app);
-	thumb_app_set_filename (&app);
+	if (batch != FALSE) {
+		GThreadPool *pool;
 
-	PROGRESS_DEBUG("Video widget created");
-	PRINT_PROGRESS (6.0);
+		/* Keep the standard output for the replies */
+		if (batch_manifest != NULL)
+			g_set_print_handler (print_to_stderr);
 
-	if (time_limit != FALSE)
-		totem_resources_monitor_start (input, 0, verbose);
+		PROGRESS_DEBUG("Starting %d workers", n_jobs);
+		pool = g_thread_pool_new ((GFunc) batch_worker, NULL, n_jobs, TRUE, NULL);
 
-	PROGRESS_DEBUG("About to open video file");
+		if (batch_manifest != NULL)
+			ret = thumb_app_run_manifest (pool, batch_manifest);
+		else
+			ret = thumb_app_run_socket (pool, socket_path);
+		g_thread_pool_free (pool, FALSE, TRUE);
+		print_peak_memory ();
 
-	if (thumb_app_start (&app) == FALSE) {
-		g_print ("totem-video-thumbnailer couldn't open file '%s'\n", input);
-		exit (1);
+		return ret ? 0 : 1;
 	}
-	thumb_app_set_error_handler (&app);
 
-	thumb_app_check_for_cover (&app);
-	if (thumb_app_get_has_video (&app) == FALSE) {
-		PROGRESS_DEBUG ("totem-video-thumbnailer couldn't find a video track in '%s'\n", input);
-		exit (1);
-	}
-	thumb_app_set_duration (&app);
+	PROGRESS_DEBUG("Initialized libraries, about to create video widget");
+	PRINT_PROGRESS (2.0);
 
-	PROGRESS_DEBUG("Opened video file: '%s'", input);
-	PRINT_PROGRESS (10.0);
+	thumb_app_setup_play (&app);
 
-	/* If the user has told us to use a frame at a specific second
-	 * into the video, just use that frame no matter how boring it
-	 * is */
-	if (second_index != -1) {
-		assert_duration (&app);
-		pixbuf = capture_frame_at_time (&app, second_index * 1000);
-	} else {
-		pixbuf = capture_interesting_frame (&app);
-	}
-	PRINT_PROGRESS (90.0);
+	PROGRESS_DEBUG("Video widget created");
+	PRINT_PROGRESS (6.0);
+
+	input = filenames[0];
+	output = filenames[1];
 
-	/* Cleanup */
-	totem_resources_monitor_stop ();
+	ret = thumb_app_process (&app, input, output, &err);
 	thumb_app_cleanup (&app);
-	PRINT_PROGRESS (92.0);
+	print_peak_memory ();
 
-	if (pixbuf == NULL) {
-		g_print ("totem-video-thumbnailer couldn't get a picture from '%s'\n", input);
-		exit (1);
+	if (ret == FALSE) {
+		g_print ("%s\n", err->message);
+		report_result (NULL, err);
+		g_error_free (err);
+		return 1;
 	}
-
-	PROGRESS_DEBUG("Saving captured screenshot to %s", output);
-	save_pixbuf (pixbuf, output, input, output_size, FALSE);
-	g_object_unref (pixbuf);
 	PRINT_PROGRESS (100.0);
+	report_result (output, NULL);
 
 	return 0;
 }
-